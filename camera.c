@@ -0,0 +1,126 @@
+//
+// Camera poses for rendering the scene from other viewpoints
+//
+
+#include "camera.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Axes of the camera in world space: right, down (y points down on the
+ * screen) and forward
+ *
+ *  @return void
+ */
+static void cameraAxes(const CameraPose* pose, Vector* right, Vector* down, Vector* forward)
+{
+    const float yaw = TO_RAD(pose->yaw), pitch = TO_RAD(pose->pitch);
+    *forward = (Vector){sinf(yaw) * cosf(pitch), -sinf(pitch), cosf(yaw) * cosf(pitch)};
+    *right = (Vector){cosf(yaw), 0.0f, -sinf(yaw)};
+    *down = crossProduct(forward, right);
+}
+
+/**
+ * Transformation from the camera's view space to world space
+ *
+ *  @param pose Camera pose
+ *
+ *  @return The matrix
+ */
+Matrix4x4 cameraToWorld(const CameraPose* pose)
+{
+    Vector right, down, forward;
+    cameraAxes(pose, &right, &down, &forward);
+    const Matrix4x4 m =
+    {
+        {
+            {right.x, right.y, right.z, 0.0f},
+            {down.x, down.y, down.z, 0.0f},
+            {forward.x, forward.y, forward.z, 0.0f},
+            {pose->position.x, pose->position.y, pose->position.z, 1.0f}
+        }
+    };
+    return m;
+}
+
+/**
+ * Transformation from world space to the camera's view space, where the
+ * camera sits at the origin looking down +z. Appending it to a world matrix
+ * lets the rest of the engine draw from the pose unchanged
+ *
+ *  @param pose Camera pose
+ *
+ *  @return The matrix
+ */
+Matrix4x4 viewMatrix(const CameraPose* pose)
+{
+    Vector right, down, forward;
+    cameraAxes(pose, &right, &down, &forward);
+    const Matrix4x4 m =
+    {
+        {
+            {right.x, down.x, forward.x, 0.0f},
+            {right.y, down.y, forward.y, 0.0f},
+            {right.z, down.z, forward.z, 0.0f},
+            {
+                -dotProduct(&pose->position, &right), -dotProduct(&pose->position, &down),
+                -dotProduct(&pose->position, &forward), 1.0f
+            }
+        }
+    };
+    return m;
+}
+
+/**
+ * Reads camera poses, one per line as "x y z yaw pitch". Empty lines and
+ * lines starting with # are skipped
+ *
+ *  @param path File to read, "-" for stdin
+ *  @param poses Output, array with the poses that has to be freed
+ *
+ *  @return Number of poses, -1 on failure
+ */
+int loadCameraPoses(const char* path, CameraPose** poses)
+{
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT OPEN THE CAMERA POSES %s!\n", path);
+        return -1;
+    }
+
+    int count = 0, capacity = 64;
+    ALLOCATE(*poses, capacity * sizeof(CameraPose));
+    char line[256];
+    int number = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        number++;
+        char first;
+        if (sscanf(line, " %c", &first) != 1 || first == '#')
+            continue;
+        CameraPose pose;
+        if (sscanf(line, "%f %f %f %f %f", &pose.position.x, &pose.position.y, &pose.position.z, &pose.yaw,
+                   &pose.pitch) != 5)
+        {
+            fprintf(stderr, "[ERROR] BAD CAMERA POSE AT LINE %d OF %s!\n", number, path);
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity *= 2;
+            CameraPose* grown = realloc(*poses, capacity * sizeof(CameraPose));
+            if (grown == NULL)
+            {
+                perror("[ERROR] ALLOCATING MEMORY FAILED!");
+                break;
+            }
+            *poses = grown;
+        }
+        (*poses)[count++] = pose;
+    }
+    if (file != stdin)
+        fclose(file);
+    return count;
+}
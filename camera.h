@@ -0,0 +1,22 @@
+//
+// Camera poses for rendering the scene from other viewpoints
+//
+
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "engine.h"
+
+typedef struct
+{
+    Vector position;
+    // Degrees, yaw turns right around y and pitch looks up. 0, 0 looks down +z like the default camera
+    float yaw, pitch;
+} CameraPose;
+
+/*Function prototypes*/
+Matrix4x4 cameraToWorld(const CameraPose* pose);
+Matrix4x4 viewMatrix(const CameraPose* pose);
+int loadCameraPoses(const char* path, CameraPose** poses);
+
+#endif //CAMERA_H
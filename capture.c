@@ -0,0 +1,479 @@
+//
+// Frame capture to image sequences or a video stream, written on its own thread
+//
+// Rendering only copies the finished frame into a queue slot. Converting it
+// and writing it out happens on the writer thread, so the next frame can be
+// drawn at the same time. When the writer falls CAPTURE_QUEUE_SIZE frames
+// behind, rendering waits for it instead of dropping frames
+//
+
+#include "capture.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+static Uint32 crcTable[256];
+static SDL_SpinLock crcLock;
+static int crcReady;
+
+/**
+ * Fills the CRC-32 table used by the PNG chunks the first time it is needed.
+ * Batch workers write PNGs concurrently, so the fill is behind a spin lock
+ *
+ *  @return void
+ */
+static void buildCrcTable(void)
+{
+    SDL_AtomicLock(&crcLock);
+    if (!crcReady)
+    {
+        for (Uint32 n = 0; n < 256; n++)
+        {
+            Uint32 c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+        crcReady = 1;
+    }
+    SDL_AtomicUnlock(&crcLock);
+}
+
+/**
+ * Writes a 32 bit number most significant byte first
+ *
+ *  @return void
+ */
+static void putBigEndian(Uint8* o, Uint32 value)
+{
+    o[0] = value >> 24;
+    o[1] = value >> 16;
+    o[2] = value >> 8;
+    o[3] = value;
+}
+
+/**
+ * Writes one PNG chunk: length, type, data and the CRC of type and data
+ *
+ *  @return void
+ */
+static void writePngChunk(FILE* file, const char* type, const Uint8* data, Uint32 size)
+{
+    Uint8 header[8];
+    putBigEndian(header, size);
+    memcpy(header + 4, type, 4);
+    Uint32 crc = 0xFFFFFFFFu;
+    for (int i = 4; i < 8; i++)
+        crc = crcTable[(crc ^ header[i]) & 0xFF] ^ (crc >> 8);
+    for (Uint32 i = 0; i < size; i++)
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    Uint8 footer[4];
+    putBigEndian(footer, crc ^ 0xFFFFFFFFu);
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, size, file);
+    fwrite(footer, 1, 4, file);
+}
+
+/**
+ * Writes a frame as a PNG. The pixels go into stored (uncompressed) deflate
+ * blocks: compressing them is the job of whatever consumes the frames, and
+ * it keeps the writer fast and without dependencies
+ *
+ *  @return 1 on success, 0 on failure
+ */
+static int writePng(FILE* file, const Uint32* pixels, int width, int height)
+{
+    static const Uint8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    buildCrcTable();
+    Uint8 ihdr[13];
+    putBigEndian(ihdr, width);
+    putBigEndian(ihdr + 4, height);
+    // 8 bit RGB, default compression and filtering, no interlacing
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    // Every row starts with its filter type (none)
+    const size_t raw = (size_t)height * (1 + 3 * width);
+    const size_t blocks = (raw + 65534) / 65535;
+    const size_t size = 2 + raw + 5 * blocks + 4;
+    Uint8* idat = malloc(size);
+    if (idat == NULL)
+        return 0;
+
+    Uint8* o = idat;
+    *o++ = 0x78;
+    *o++ = 0x01;
+    Uint32 a = 1, b = 0;
+    size_t left = raw, column = 0;
+    int row = 0;
+    while (left > 0)
+    {
+        const Uint16 length = left < 65535 ? (Uint16)left : 65535;
+        left -= length;
+        *o++ = left == 0;
+        *o++ = length & 0xFF;
+        *o++ = length >> 8;
+        *o++ = ~length & 0xFF;
+        *o++ = (Uint16)~length >> 8;
+        for (int i = 0; i < length; i++)
+        {
+            Uint8 byte;
+            if (column == 0)
+                byte = 0;
+            else
+            {
+                const Uint32 pixel = pixels[row * width + (column - 1) / 3];
+                byte = pixel >> (16 - 8 * ((column - 1) % 3));
+            }
+            if (++column == 1 + 3 * (size_t)width)
+            {
+                column = 0;
+                row++;
+            }
+            *o++ = byte;
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    putBigEndian(o, b << 16 | a);
+
+    fwrite(signature, 1, 8, file);
+    writePngChunk(file, "IHDR", ihdr, sizeof(ihdr));
+    writePngChunk(file, "IDAT", idat, size);
+    writePngChunk(file, "IEND", NULL, 0);
+    free(idat);
+    return !ferror(file);
+}
+
+/**
+ * Writes a frame as a binary PPM
+ *
+ *  @return 1 on success, 0 on failure
+ */
+static int writePpm(FILE* file, const Uint32* pixels, int width, int height)
+{
+    Uint8* row = malloc(width * 3);
+    if (row == NULL)
+        return 0;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const Uint32 pixel = pixels[y * width + x];
+            row[x * 3 + 0] = pixel >> 16;
+            row[x * 3 + 1] = pixel >> 8;
+            row[x * 3 + 2] = pixel;
+        }
+        fwrite(row, 1, width * 3, file);
+    }
+    free(row);
+    return !ferror(file);
+}
+
+/**
+ * Writes a frame to the Y4M stream, as full range YCbCr with the chroma
+ * averaged over 2x2 pixels (4:2:0), which is what most encoders expect
+ *
+ *  @return 1 on success, 0 on failure
+ */
+static int writeY4mFrame(FILE* file, const Uint32* pixels, int width, int height)
+{
+    const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    Uint8* planes = malloc(width * height + 2 * chromaWidth * chromaHeight);
+    if (planes == NULL)
+        return 0;
+    Uint8* luma = planes;
+    Uint8* cb = planes + width * height;
+    Uint8* cr = cb + chromaWidth * chromaHeight;
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const Uint32 pixel = pixels[y * width + x];
+            const int r = pixel >> 16 & 0xFF, g = pixel >> 8 & 0xFF, b = pixel & 0xFF;
+            luma[y * width + x] = (Uint8)((77 * r + 150 * g + 29 * b + 128) >> 8);
+        }
+    }
+    for (int cy = 0; cy < chromaHeight; cy++)
+    {
+        for (int cx = 0; cx < chromaWidth; cx++)
+        {
+            int r = 0, g = 0, b = 0, n = 0;
+            for (int y = cy * 2; y < cy * 2 + 2 && y < height; y++)
+            {
+                for (int x = cx * 2; x < cx * 2 + 2 && x < width; x++)
+                {
+                    const Uint32 pixel = pixels[y * width + x];
+                    r += pixel >> 16 & 0xFF;
+                    g += pixel >> 8 & 0xFF;
+                    b += pixel & 0xFF;
+                    n++;
+                }
+            }
+            r /= n;
+            g /= n;
+            b /= n;
+            cb[cy * chromaWidth + cx] = (Uint8)SDL_min(255, (-43 * r - 85 * g + 128 * b + 32768 + 128) >> 8);
+            cr[cy * chromaWidth + cx] = (Uint8)SDL_min(255, (128 * r - 107 * g - 21 * b + 32768 + 128) >> 8);
+        }
+    }
+
+    fputs("FRAME\n", file);
+    fwrite(planes, 1, width * height + 2 * chromaWidth * chromaHeight, file);
+    free(planes);
+    fflush(file);
+    return !ferror(file);
+}
+
+/**
+ * Writes an image file, PNG or PPM depending on the extension of the path.
+ * Safe to call from many threads at once
+ *
+ *  @param path File to write
+ *  @param pixels ARGB pixels
+ *  @param width Width of the image
+ *  @param height Height of the image
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int writeImage(const char* path, const Uint32* pixels, int width, int height)
+{
+    const char* extension = strrchr(path, '.');
+    const int png = extension != NULL && strcmp(extension, ".png") == 0;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CREATE THE IMAGE FILE %s!\n", path);
+        return 0;
+    }
+    const int ok = png ? writePng(file, pixels, width, height) : writePpm(file, pixels, width, height);
+    return fclose(file) == 0 && ok;
+}
+
+/**
+ * Converts and writes one frame in the format of the capture
+ *
+ *  @return void
+ */
+static void writeFrame(FrameCapture* capture, const Uint32* pixels, int number)
+{
+    int ok;
+    if (capture->format == CAPTURE_Y4M)
+        ok = writeY4mFrame(capture->stream, pixels, capture->width, capture->height);
+    else
+    {
+        char name[CAPTURE_PATH_LENGTH + 16];
+        snprintf(name, sizeof(name), capture->path, number);
+        ok = writeImage(name, pixels, capture->width, capture->height);
+    }
+    if (!ok)
+        fprintf(stderr, "[ERROR] COULD NOT WRITE FRAME %d!\n", number);
+}
+
+/**
+ * Writer thread: takes frames from the head of the queue until the capture
+ * is stopped and every frame is written
+ *
+ *  @param data The FrameCapture
+ *
+ *  @return 0
+ */
+static int writerThread(void* data)
+{
+    FrameCapture* capture = data;
+    SDL_LockMutex(capture->mutex);
+    while (1)
+    {
+        while (capture->count == 0 && capture->running)
+            SDL_CondWait(capture->added, capture->mutex);
+        if (capture->count == 0)
+            break;
+
+        const Uint32* pixels = capture->frames[capture->head];
+        const int number = capture->written;
+        SDL_UnlockMutex(capture->mutex);
+        writeFrame(capture, pixels, number);
+        SDL_LockMutex(capture->mutex);
+
+        capture->head = (capture->head + 1) % CAPTURE_QUEUE_SIZE;
+        capture->count--;
+        capture->written++;
+        SDL_CondSignal(capture->freed);
+    }
+    SDL_UnlockMutex(capture->mutex);
+    return 0;
+}
+
+/**
+ * Checks that a path can be given to snprintf with a frame number: it needs
+ * exactly one integer conversion (like %04d) and no other %
+ *
+ *  @param pattern Path to check
+ *
+ *  @return 1 if it can, 0 otherwise
+ */
+int isFramePattern(const char* pattern)
+{
+    int conversions = 0;
+    for (const char* c = strchr(pattern, '%'); c != NULL; c = strchr(c, '%'))
+    {
+        // Flags and a width are fine, anything else could read arguments that are not there
+        c++;
+        c += strspn(c, "-+ #0");
+        c += strspn(c, "0123456789");
+        if (*c != 'd' && *c != 'i')
+            return 0;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+/**
+ * Starts capturing frames. The format comes from the path: "-" or a .y4m
+ * file for a Y4M stream, or a .ppm / .png pattern with the frame number in
+ * it (like "frames/%04d.png") for an image sequence. When the stream goes to
+ * stdout, whatever the engine prints is sent to stderr instead
+ *
+ *  @param capture Capture to start
+ *  @param path Where the frames go
+ *  @param width Width of the frames
+ *  @param height Height of the frames
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int createCapture(FrameCapture* capture, const char* path, int width, int height)
+{
+    memset(capture, 0, sizeof(*capture));
+    const char* extension = strrchr(path, '.');
+    if (strcmp(path, "-") == 0 || (extension != NULL && strcmp(extension, ".y4m") == 0))
+        capture->format = CAPTURE_Y4M;
+    else if (extension != NULL && strcmp(extension, ".png") == 0)
+        capture->format = CAPTURE_PNG;
+    else if (extension != NULL && strcmp(extension, ".ppm") == 0)
+        capture->format = CAPTURE_PPM;
+    else
+    {
+        fprintf(stderr, "[ERROR] CAPTURES HAVE TO BE .ppm, .png, .y4m OR - (Y4M ON STDOUT)!\n");
+        return 0;
+    }
+    if (capture->format != CAPTURE_Y4M && !isFramePattern(path))
+    {
+        fprintf(stderr, "[ERROR] IMAGE SEQUENCES NEED THE FRAME NUMBER IN THE PATH, AND NO OTHER %% (like "
+                        "frames/%%04d.png)!\n");
+        return 0;
+    }
+    if (strlen(path) >= CAPTURE_PATH_LENGTH)
+    {
+        fprintf(stderr, "[ERROR] THE PATH %s IS TOO LONG!\n", path);
+        return 0;
+    }
+    strcpy(capture->path, path);
+    capture->width = width;
+    capture->height = height;
+
+    if (capture->format == CAPTURE_Y4M)
+    {
+        if (strcmp(path, "-") == 0)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            // Keep stdout for the stream alone
+            fflush(stdout);
+            capture->stream = fdopen(dup(STDOUT_FILENO), "wb");
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+#else
+            capture->stream = stdout;
+#endif
+        }
+        else
+            capture->stream = fopen(path, "wb");
+        if (capture->stream == NULL)
+        {
+            fprintf(stderr, "[ERROR] COULD NOT OPEN %s FOR THE CAPTURE!\n", path);
+            return 0;
+        }
+        fprintf(capture->stream, "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C420jpeg\n", width, height);
+    }
+
+    for (int i = 0; i < CAPTURE_QUEUE_SIZE; i++)
+        ALLOCATE(capture->frames[i], width * height * sizeof(Uint32));
+    capture->running = 1;
+    capture->mutex = SDL_CreateMutex();
+    capture->added = SDL_CreateCond();
+    capture->freed = SDL_CreateCond();
+    capture->thread = SDL_CreateThread(writerThread, "capture", capture);
+    if (capture->mutex == NULL || capture->added == NULL || capture->freed == NULL || capture->thread == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT START THE CAPTURE THREAD!\n[SDL] %s\n", SDL_GetError());
+        destroyCapture(capture);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Queues a copy of the framebuffer to be written. Only waits when the
+ * writer is CAPTURE_QUEUE_SIZE frames behind
+ *
+ *  @param capture Capture
+ *  @param fb Framebuffer with the finished frame, the same size as the capture
+ *
+ *  @return void
+ */
+void captureFrame(FrameCapture* capture, const Framebuffer* fb)
+{
+    SDL_LockMutex(capture->mutex);
+    while (capture->count == CAPTURE_QUEUE_SIZE)
+        SDL_CondWait(capture->freed, capture->mutex);
+    Uint32* slot = capture->frames[(capture->head + capture->count) % CAPTURE_QUEUE_SIZE];
+    SDL_UnlockMutex(capture->mutex);
+
+    // The writer never looks past the frames already queued, so the copy needs no lock
+    for (int y = 0; y < capture->height; y++)
+        memcpy(&slot[y * capture->width], &fb->color[y * fb->width], capture->width * sizeof(Uint32));
+
+    SDL_LockMutex(capture->mutex);
+    capture->count++;
+    capture->captured++;
+    SDL_CondSignal(capture->added);
+    SDL_UnlockMutex(capture->mutex);
+}
+
+/**
+ * Writes the frames still in the queue, stops the writer and closes the
+ * stream
+ *
+ *  @param capture Capture to stop
+ *
+ *  @return void
+ */
+void destroyCapture(FrameCapture* capture)
+{
+    if (capture->thread != NULL)
+    {
+        SDL_LockMutex(capture->mutex);
+        capture->running = 0;
+        SDL_CondSignal(capture->added);
+        SDL_UnlockMutex(capture->mutex);
+        SDL_WaitThread(capture->thread, NULL);
+        capture->thread = NULL;
+    }
+    if (capture->stream != NULL)
+        fclose(capture->stream);
+    capture->stream = NULL;
+    for (int i = 0; i < CAPTURE_QUEUE_SIZE; i++)
+    {
+        free(capture->frames[i]);
+        capture->frames[i] = NULL;
+    }
+    SDL_DestroyCond(capture->added);
+    SDL_DestroyCond(capture->freed);
+    SDL_DestroyMutex(capture->mutex);
+    capture->added = capture->freed = NULL;
+    capture->mutex = NULL;
+}
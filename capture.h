@@ -0,0 +1,50 @@
+//
+// Frame capture to image sequences or a video stream, written on its own thread
+//
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "engine.h"
+
+// Frames waiting to be written before rendering has to wait for the writer
+#define CAPTURE_QUEUE_SIZE 8
+#define CAPTURE_PATH_LENGTH 256
+
+typedef enum
+{
+    CAPTURE_PPM,
+    CAPTURE_PNG,
+    CAPTURE_Y4M
+} CaptureFormat;
+
+typedef struct
+{
+    CaptureFormat format;
+    // printf pattern with the frame number for image sequences, a file or "-" (stdout) for Y4M
+    char path[CAPTURE_PATH_LENGTH];
+    int width, height;
+    // Y4M stream, NULL for image sequences
+    FILE* stream;
+
+    SDL_Thread* thread;
+    // Guards the queue, the conditions signal frames added and slots freed
+    SDL_mutex* mutex;
+    SDL_cond* added;
+    SDL_cond* freed;
+    int running;
+    // Ring of CAPTURE_QUEUE_SIZE frames, count of them starting at head are waiting
+    Uint32* frames[CAPTURE_QUEUE_SIZE];
+    int head, count;
+    // Frames captured and frames written so far
+    int captured, written;
+} FrameCapture;
+
+/*Function prototypes*/
+int isFramePattern(const char* pattern);
+int createCapture(FrameCapture* capture, const char* path, int width, int height);
+void captureFrame(FrameCapture* capture, const Framebuffer* fb);
+void destroyCapture(FrameCapture* capture);
+int writeImage(const char* path, const Uint32* pixels, int width, int height);
+
+#endif //CAPTURE_H
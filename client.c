@@ -0,0 +1,171 @@
+//
+// Test client of the render server: asks for frames and times them
+//
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "protocol.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Connects to a render server
+ *
+ *  @param path Path of the socket of the server
+ *
+ *  @return The connected socket, -1 on failure
+ */
+static int connectToServer(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "[ERROR] THE SOCKET PATH %s IS TOO LONG!\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        perror("[ERROR] COULD NOT CONNECT TO THE RENDER SERVER");
+        if (connection >= 0)
+            close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+/**
+ * MAIN
+ *
+ * @param argc
+ * @param argv Socket of the server, then the options: --pose <x y z yaw pitch> camera pose,
+ *             --size <width height> resolution, --msaa <4 or 8> anti-aliasing, --mesh <index> draws only the given meshes (repeatable),
+ *             --repeat <n> asks for the frame n times, --output <file> writes the last frame (.png or .ppm),
+ *             --shutdown stops the server afterwards
+ * @return
+ */
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <socket> [--pose x y z yaw pitch] [--size w h] [--msaa n] [--mesh i]... "
+                        "[--repeat n] [--output file] [--shutdown]\n", argv[0]);
+        return 1;
+    }
+
+    RenderRequest request;
+    memset(&request, 0, sizeof(request));
+    request.magic = RENDER_MAGIC;
+    request.command = RENDER_FRAME;
+    request.width = 800;
+    request.height = 800;
+    const char* output = NULL;
+    int repeat = 1, stop = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--pose") == 0 && i + 5 < argc)
+        {
+            request.pose.position.x = (float)atof(argv[++i]);
+            request.pose.position.y = (float)atof(argv[++i]);
+            request.pose.position.z = (float)atof(argv[++i]);
+            request.pose.yaw = (float)atof(argv[++i]);
+            request.pose.pitch = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc)
+        {
+            request.width = atoi(argv[++i]);
+            request.height = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--msaa") == 0 && i + 1 < argc)
+            request.samples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc && request.nMeshes < RENDER_MAX_MESHES)
+            request.meshes[request.nMeshes++] = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--shutdown") == 0)
+            stop = 1;
+        else
+        {
+            fprintf(stderr, "[ERROR] UNKNOWN OPTION %s!\n", argv[i]);
+            return 1;
+        }
+    }
+
+    repeat = SDL_max(1, repeat);
+    const int connection = connectToServer(argv[1]);
+    if (connection < 0)
+        return 1;
+
+    // The frame is mapped once and read in place, it is only mapped again when the server renames it
+    RenderResponse response;
+    char mapped[RENDER_SHM_NAME_LENGTH] = "";
+    Uint32* pixels = NULL;
+    size_t size = 0;
+    int status = 0;
+    for (int i = 0; i < repeat && status == 0; i++)
+    {
+        const Uint64 begin = SDL_GetPerformanceCounter();
+        if (!sendMessage(connection, &request, sizeof(request)) ||
+            receiveMessage(connection, &response, sizeof(response)) <= 0)
+        {
+            fprintf(stderr, "[ERROR] THE RENDER SERVER WENT AWAY!\n");
+            status = 1;
+            break;
+        }
+        const double ms = (double)(SDL_GetPerformanceCounter() - begin) * 1000.0 /
+                          (double)SDL_GetPerformanceFrequency();
+        if (response.status != RENDER_OK)
+        {
+            fprintf(stderr, "[ERROR] THE RENDER SERVER REFUSED THE REQUEST (%d)!\n", response.status);
+            status = 1;
+            break;
+        }
+        if (strcmp(mapped, response.shm) != 0)
+        {
+            unmapSharedFrame(pixels, size);
+            size = (size_t)response.width * response.height * sizeof(Uint32);
+            pixels = mapSharedFrame(response.shm, size, 0);
+            memcpy(mapped, response.shm, sizeof(mapped));
+            if (pixels == NULL)
+                status = 1;
+        }
+        printf("[CLIENT] Frame %u, %dx%d, %d meshes in the scene, drawn in %.2f ms, %.2f ms round trip\n",
+               response.frame, response.width, response.height, response.nMeshes, response.milliseconds, ms);
+    }
+
+    if (status == 0 && output != NULL && !writeImage(output, pixels, response.width, response.height))
+        status = 1;
+    if (stop)
+    {
+        request.command = RENDER_SHUTDOWN;
+        if (!sendMessage(connection, &request, sizeof(request)) ||
+            receiveMessage(connection, &response, sizeof(response)) <= 0)
+            status = 1;
+    }
+    unmapSharedFrame(pixels, size);
+    close(connection);
+    return status;
+}
+
+#else
+
+int main(int argc, char* argv[])
+{
+    fprintf(stderr, "[ERROR] THE RENDER CLIENT NEEDS A UNIX SYSTEM!\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,260 @@
+//
+// Compact mesh storage: quantized positions, octahedral normals and delta +
+// varint encoded indices
+//
+
+#include "compact.h"
+#include <math.h>
+#include <stdio.h>
+
+/**
+ * Writes the difference between an index and the previous one as a zigzag
+ * varint: 7 bits per byte, the high bit set when more bytes follow. Indices of
+ * optimized meshes are close to each other, so most of them take one byte
+ *
+ *  @param stream Where to write, advanced past the written bytes
+ *  @param index Index to write
+ *  @param previous Last index written to the stream, updated to _index_
+ *
+ *  @return void
+ */
+static void writePackedIndex(Uint8** stream, int index, int* previous)
+{
+    const int delta = index - *previous;
+    Uint32 value = ((Uint32)delta << 1) ^ (Uint32)(delta >> 31);
+    *previous = index;
+    while (value >= 0x80)
+    {
+        *(*stream)++ = (Uint8)(value | 0x80);
+        value >>= 7;
+    }
+    *(*stream)++ = (Uint8)value;
+}
+
+/**
+ * Reads an index written by writePackedIndex
+ *
+ *  @param stream Where to read from, advanced past the read bytes
+ *  @param previous Last index read from the stream, updated to the new one
+ *
+ *  @return The index
+ */
+int readPackedIndex(const Uint8** stream, int* previous)
+{
+    Uint32 value = 0;
+    int shift = 0;
+    Uint8 byte;
+    do
+    {
+        byte = *(*stream)++;
+        value |= (Uint32)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    *previous += (int)(value >> 1) ^ -(int)(value & 1);
+    return *previous;
+}
+
+/**
+ * Packs a unit normal in 16 bits: the normal is projected on an octahedron,
+ * the octahedron is unfolded into a square and each coordinate of the square
+ * is stored in 8 bits. The error stays below a couple of degrees
+ *
+ *  @param n Unit normal
+ *
+ *  @return Packed normal, x in the low byte and y in the high byte
+ */
+Uint16 encodeOctahedral(const Vector* n)
+{
+    const float l1 = fabsf(n->x) + fabsf(n->y) + fabsf(n->z);
+    float x = l1 > 0.0f ? n->x / l1 : 0.0f, y = l1 > 0.0f ? n->y / l1 : 0.0f;
+    // The lower half folds over the diagonals
+    if (n->z < 0.0f)
+    {
+        const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    const Sint8 qx = (Sint8)lrintf(fmaxf(-1.0f, fminf(1.0f, x)) * 127.0f);
+    const Sint8 qy = (Sint8)lrintf(fmaxf(-1.0f, fminf(1.0f, y)) * 127.0f);
+    return (Uint16)((Uint8)qx | (Uint8)qy << 8);
+}
+
+/**
+ * Unpacks a normal written by encodeOctahedral
+ *
+ *  @param packed Packed normal
+ *
+ *  @return Unit normal
+ */
+Vector decodeOctahedral(Uint16 packed)
+{
+    Vector n = {(Sint8)(packed & 0xFF) / 127.0f, (Sint8)(packed >> 8) / 127.0f, 0.0f};
+    n.z = 1.0f - fabsf(n.x) - fabsf(n.y);
+    const float t = fmaxf(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    normalizeVector(&n);
+    return n;
+}
+
+/**
+ * Switches an indexed mesh with meshlets to the compact storage: positions
+ * become 16 bit integers inside the bounding box of the mesh, normals are
+ * octahedral encoded, and the index buffer and the vertices of every meshlet
+ * are delta + varint encoded. The full size arrays are freed
+ *
+ *  @param mesh Prepared mesh to compress
+ *
+ *  @return void
+ */
+void compressMesh(Mesh* mesh)
+{
+    // Quantize positions to the bounding box
+    const Vector extent = {
+        mesh->boundsMax.x - mesh->boundsMin.x,
+        mesh->boundsMax.y - mesh->boundsMin.y,
+        mesh->boundsMax.z - mesh->boundsMin.z
+    };
+    ALLOCATE(mesh->qverts, (mesh->nVerts * 3 + 1) * sizeof(Uint16));
+    for (int v = 0; v < mesh->nVerts; v++)
+    {
+        const Vector* p = &mesh->verts[v];
+        mesh->qverts[v * 3 + 0] = extent.x > 0.0f ? (Uint16)lrintf((p->x - mesh->boundsMin.x) / extent.x * 65535.0f) : 0;
+        mesh->qverts[v * 3 + 1] = extent.y > 0.0f ? (Uint16)lrintf((p->y - mesh->boundsMin.y) / extent.y * 65535.0f) : 0;
+        mesh->qverts[v * 3 + 2] = extent.z > 0.0f ? (Uint16)lrintf((p->z - mesh->boundsMin.z) / extent.z * 65535.0f) : 0;
+    }
+
+    if (mesh->normals != NULL)
+    {
+        ALLOCATE(mesh->octNormals, (mesh->nVerts + 1) * sizeof(Uint16));
+        for (int v = 0; v < mesh->nVerts; v++)
+            mesh->octNormals[v] = encodeOctahedral(&mesh->normals[v]);
+    }
+
+    // A varint never takes more than 5 bytes
+    Uint8* stream;
+    ALLOCATE(mesh->packedIndices, mesh->nTris * 3 * 5 + 1);
+    stream = mesh->packedIndices;
+    int previous = 0;
+    for (int i = 0; i < mesh->nTris * 3; i++)
+        writePackedIndex(&stream, mesh->indices[i], &previous);
+    mesh->packedIndicesSize = (int)(stream - mesh->packedIndices);
+
+    // Every meshlet starts a new delta chain so they can be decoded on their own
+    int nMeshletVerts = 0;
+    for (int m = 0; m < mesh->nMeshlets; m++)
+        nMeshletVerts += mesh->meshlets[m].nVerts;
+    ALLOCATE(mesh->packedMeshletVerts, nMeshletVerts * 5 + 1);
+    stream = mesh->packedMeshletVerts;
+    for (int m = 0; m < mesh->nMeshlets; m++)
+    {
+        Meshlet* meshlet = &mesh->meshlets[m];
+        const int* verts = &mesh->meshletVerts[meshlet->vertOffset];
+        meshlet->vertOffset = (int)(stream - mesh->packedMeshletVerts);
+        previous = 0;
+        for (int v = 0; v < meshlet->nVerts; v++)
+            writePackedIndex(&stream, verts[v], &previous);
+    }
+    mesh->packedMeshletVertsSize = (int)(stream - mesh->packedMeshletVerts);
+
+    // Shrink the streams to what was used
+    Uint8* shrunk = realloc(mesh->packedIndices, mesh->packedIndicesSize + 1);
+    if (shrunk != NULL)
+        mesh->packedIndices = shrunk;
+    shrunk = realloc(mesh->packedMeshletVerts, mesh->packedMeshletVertsSize + 1);
+    if (shrunk != NULL)
+        mesh->packedMeshletVerts = shrunk;
+
+    free(mesh->verts);
+    free(mesh->normals);
+    free(mesh->indices);
+    free(mesh->meshletVerts);
+    mesh->verts = NULL;
+    mesh->normals = NULL;
+    mesh->indices = NULL;
+    mesh->meshletVerts = NULL;
+    mesh->compact = 1;
+}
+
+/**
+ * Gets the position of a vertex of the mesh, whatever storage it uses
+ *
+ *  @param mesh Mesh the vertex belongs to
+ *  @param v Index of the vertex
+ *
+ *  @return Model space position
+ */
+Vector getMeshVertex(const Mesh* mesh, int v)
+{
+    if (!mesh->compact)
+        return mesh->verts[v];
+
+    const float s = 1.0f / 65535.0f;
+    return (Vector){
+        mesh->boundsMin.x + mesh->qverts[v * 3 + 0] * s * (mesh->boundsMax.x - mesh->boundsMin.x),
+        mesh->boundsMin.y + mesh->qverts[v * 3 + 1] * s * (mesh->boundsMax.y - mesh->boundsMin.y),
+        mesh->boundsMin.z + mesh->qverts[v * 3 + 2] * s * (mesh->boundsMax.z - mesh->boundsMin.z)
+    };
+}
+
+/**
+ * Gets the normal of a vertex of the mesh, whatever storage it uses
+ *
+ *  @param mesh Mesh the vertex belongs to
+ *  @param v Index of the vertex
+ *
+ *  @return Model space unit normal
+ */
+Vector getMeshNormal(const Mesh* mesh, int v)
+{
+    return mesh->compact ? decodeOctahedral(mesh->octNormals[v]) : mesh->normals[v];
+}
+
+/**
+ * Folds the dequantization of a compact mesh into its world matrix, so the
+ * 16 bit positions can go through the transform without being decoded first
+ *
+ *  @param mesh Compact mesh
+ *  @param world Transformation from model to world space
+ *
+ *  @return Transformation from quantized positions to world space
+ */
+Matrix4x4 dequantizeMatrix(const Mesh* mesh, const Matrix4x4* world)
+{
+    const float s = 1.0f / 65535.0f;
+    const Matrix4x4 dequantize = {
+        .mat = {
+            {(mesh->boundsMax.x - mesh->boundsMin.x) * s, 0, 0, 0},
+            {0, (mesh->boundsMax.y - mesh->boundsMin.y) * s, 0, 0},
+            {0, 0, (mesh->boundsMax.z - mesh->boundsMin.z) * s, 0},
+            {mesh->boundsMin.x, mesh->boundsMin.y, mesh->boundsMin.z, 1}
+        }
+    };
+    return multMatMat(&dequantize, world);
+}
+
+/**
+ * Bytes a mesh keeps resident for its geometry
+ *
+ *  @param mesh Mesh to measure
+ *
+ *  @return Size in bytes
+ */
+size_t meshMemory(const Mesh* mesh)
+{
+    int nMeshletVerts = 0;
+    for (int m = 0; m < mesh->nMeshlets; m++)
+        nMeshletVerts += mesh->meshlets[m].nVerts;
+
+    size_t size = mesh->nMeshlets * sizeof(Meshlet) + (size_t)mesh->nTris * 3 * sizeof(Uint8);
+    if (mesh->compact)
+        size += mesh->nVerts * 4 * sizeof(Uint16) + mesh->packedIndicesSize + mesh->packedMeshletVertsSize;
+    else
+        size += mesh->nVerts * 2 * sizeof(Vector) + (size_t)mesh->nTris * 3 * sizeof(int) + nMeshletVerts * sizeof(int);
+    if (mesh->uvs != NULL)
+        size += mesh->nVerts * sizeof(TexCoord);
+    size += (size_t)mesh->nEdges * 2 * sizeof(int);
+    return size;
+}
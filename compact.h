@@ -0,0 +1,21 @@
+//
+// Compact mesh storage: quantized positions, octahedral normals and delta +
+// varint encoded indices
+//
+
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include "engine.h"
+
+/*Function prototypes*/
+void compressMesh(Mesh* mesh);
+int readPackedIndex(const Uint8** stream, int* previous);
+Vector getMeshVertex(const Mesh* mesh, int v);
+Uint16 encodeOctahedral(const Vector* n);
+Vector decodeOctahedral(Uint16 packed);
+Vector getMeshNormal(const Mesh* mesh, int v);
+Matrix4x4 dequantizeMatrix(const Mesh* mesh, const Matrix4x4* world);
+size_t meshMemory(const Mesh* mesh);
+
+#endif //COMPACT_H
@@ -3,7 +3,11 @@
 //
 
 #include "engine.h"
+#include "meshlet.h"
+#include "vcache.h"
+#include "wireframe.h"
 #include <math.h>
+#include <stdio.h>
 
 /**
  *  This function multiplies a 3x3 vector i by a 4x4 matrix m and outputs the
@@ -34,18 +38,33 @@ void multMatVec(const Vector* i, Vector* o, const Matrix4x4* m)
 }
 
 /**
- * Build the necessary 4x4 Matrix to **translate** a vector i by a
- * vector v, storing the result in vector o
+ *  Multiplies two 4x4 matrices. Since vectors are multiplied as rows
+ *  (see multMatVec), the result applies _a_ first and then _b_
+ *
+ *  @param a First transformation
+ *  @param b Second transformation
+ *
+ *  @return The combined transformation a * b
+ */
+Matrix4x4 multMatMat(const Matrix4x4* a, const Matrix4x4* b)
+{
+    Matrix4x4 o;
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+            o.mat[r][c] = a->mat[r][0] * b->mat[0][c] + a->mat[r][1] * b->mat[1][c] +
+                          a->mat[r][2] * b->mat[2][c] + a->mat[r][3] * b->mat[3][c];
+    return o;
+}
+
+/**
+ * Build the 4x4 Matrix that **translates** a vector by v
  *
- *  @param i Pointer to the Vector to perform the multiplication on
- *  @param o Pointer to the Vector to store the output
  *  @param v Pointer to the translation Vector
  *
- *  @return void
+ *  @return The translation matrix
  */
-void translate(const Vector* i, Vector* o, const Vector* v)
+Matrix4x4 translationMatrix(const Vector* v)
 {
-    // Create a 4x4 matrix that translates a vector i by v
     const Matrix4x4 aux = {
         .mat = {
             {   1,    0,    0, 0},
@@ -54,6 +73,43 @@ void translate(const Vector* i, Vector* o, const Vector* v)
             {v->x, v->y, v->z, 1}
         }
     };
+    return aux;
+}
+
+/**
+ * Build the projection matrix of an image (see the projection macros)
+ *
+ *  @param aspectRatio Height over width of the image, ASPECT_RATIO for the screen
+ *
+ *  @return The projection matrix
+ */
+Matrix4x4 projectionMatrix(float aspectRatio)
+{
+    const Matrix4x4 aux = {
+        .mat = {
+            {aspectRatio * FOV_TAN, 0.0f, 0.0f, 0.0f},
+            {0.0f, FOV_TAN, 0.0f, 0.0f},
+            {0.0f, 0.0f, Q, 1.0f},
+            {0.0f, 0.0f, -Z_NEAR * Q, 0.0f}
+        }
+    };
+    return aux;
+}
+
+/**
+ * Build the necessary 4x4 Matrix to **translate** a vector i by a
+ * vector v, storing the result in vector o
+ *
+ *  @param i Pointer to the Vector to perform the multiplication on
+ *  @param o Pointer to the Vector to store the output
+ *  @param v Pointer to the translation Vector
+ *
+ *  @return void
+ */
+void translate(const Vector* i, Vector* o, const Vector* v)
+{
+    // Create a 4x4 matrix that translates a vector i by v
+    const Matrix4x4 aux = translationMatrix(v);
 
     multMatVec(i, o, &aux);
 }
@@ -103,60 +159,444 @@ void normalizeVector(Vector* v)
 }
 
 /**
- * Draws a triangle. Useful for wireframe view.
+ * Scales a Vector to the screen
  *
- * @param t Triangle to draw
- * @param renderer Renderer to use to draw the triangle
+ *  @param v Vector to scale
  *
- * @return void
+ *  @return void
  */
-void drawTriangle(const Triangle* t, SDL_Renderer* renderer)
+void scale(Vector* v)
 {
-    // Draw the points
-    SDL_RenderDrawPoint(renderer, t->points[0].x, t->points[0].y);
-    SDL_RenderDrawPoint(renderer, t->points[1].x, t->points[1].y);
-    SDL_RenderDrawPoint(renderer, t->points[2].x, t->points[2].y);
-    // Draw the lines
-    SDL_RenderDrawLine(renderer, t->points[0].x, t->points[0].y, t->points[1].x, t->points[1].y);
-    SDL_RenderDrawLine(renderer, t->points[1].x, t->points[1].y, t->points[2].x, t->points[2].y);
-    SDL_RenderDrawLine(renderer, t->points[2].x, t->points[2].y, t->points[0].x, t->points[0].y);
+    v->x += 1.0f;
+    v->y += 1.0f;
+    v->x *= 0.5f * WIDTH;
+    v->y *= 0.5f * HEIGHT;
 }
 
 /**
- * Uses RenderGeometry to take a triangle and fill it in
+ * Hashes the position of a vertex, equal positions always give the same value
+ *
+ *  @param v Vertex to hash
  *
- * @param t Triangle to be filled
- * @param renderer Renderer to use to fill the triangle
+ *  @return Hash of the position
  */
-void fillTriangle(const Triangle* t, SDL_Renderer* renderer)
+Uint32 hashVector(const Vector* v)
 {
-    // Define triangle vertices
-    SDL_Vertex vertices[3];
-    for (int i = 0; i  < 3; i++) {
-        // Position
-        vertices[i].position.x = t->points[i].x;
-        vertices[i].position.y = t->points[i].y;
-        // RGB Values - Darkened by the quantity of light from the triangle
-        vertices[i].color.r = 255 * t->light;
-        vertices[i].color.g = 255 * t->light;
-        vertices[i].color.b = 255 * t->light;
-        vertices[i].color.a = 255;
+    Uint32 bits[3];
+    memcpy(bits, v, sizeof(bits));
+    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+}
+
+/**
+ * Builds the indexed form of a mesh out of its triangle soup, welding the
+ * vertices that share the same position (and texture coordinates, for
+ * textured meshes). The soup is freed afterwards
+ *
+ *  @param mesh Mesh to index
+ *
+ *  @return void
+ */
+void buildMeshIndex(Mesh* mesh)
+{
+    const int nPoints = mesh->nTris * 3;
+    // Open addressing table of vertex indices, at most half full
+    int capacity = 16;
+    while (capacity < nPoints * 2)
+        capacity *= 2;
+    int* table;
+    ALLOCATE(table, capacity * sizeof(int));
+    for (int i = 0; i < capacity; i++)
+        table[i] = -1;
+
+    ALLOCATE(mesh->verts, (nPoints > 0 ? nPoints : 1) * sizeof(Vector));
+    ALLOCATE(mesh->indices, (nPoints > 0 ? nPoints : 1) * sizeof(int));
+    if (mesh->texture != NULL)
+        ALLOCATE(mesh->uvs, (nPoints > 0 ? nPoints : 1) * sizeof(TexCoord));
+    mesh->nVerts = 0;
+
+    for (int i = 0; i < nPoints; i++)
+    {
+        const Vector* p = &mesh->tris[i / 3].points[i % 3];
+        const TexCoord* uv = &mesh->tris[i / 3].uv[i % 3];
+        Uint32 slot = hashVector(p) & (capacity - 1);
+        // Walk until we find the same vertex or an empty slot
+        while (table[slot] != -1 && (memcmp(&mesh->verts[table[slot]], p, sizeof(Vector)) != 0 ||
+               (mesh->uvs != NULL && memcmp(&mesh->uvs[table[slot]], uv, sizeof(TexCoord)) != 0)))
+            slot = (slot + 1) & (capacity - 1);
+
+        if (table[slot] == -1)
+        {
+            table[slot] = mesh->nVerts;
+            if (mesh->uvs != NULL)
+                mesh->uvs[mesh->nVerts] = *uv;
+            mesh->verts[mesh->nVerts++] = *p;
+        }
+        mesh->indices[i] = table[slot];
     }
-    // Render geometric Shape
-    SDL_RenderGeometry(renderer, NULL, vertices, 3, NULL, 0);
+    free(table);
+
+    free(mesh->tris);
+    mesh->tris = NULL;
 }
 
 /**
- * Scales a Vector to the screen
+ * Computes a normal for every vertex by averaging the normals of the faces
+ * around it, weighted by their area. Faces meeting at more than CREASE_ANGLE
+ * are not smoothed together, so those vertices are split and hard edges (the
+ * sides of a cube) stay sharp
  *
- *  @param v Vector to scale
+ *  @param mesh Indexed mesh, its vertices can be split
  *
  *  @return void
  */
-void scale(Vector* v)
+void computeVertexNormals(Mesh* mesh)
 {
-    v->x += 1.0f;
-    v->y += 1.0f;
-    v->x *= 0.5f * WIDTH;
-    v->y *= 0.5f * HEIGHT;
+    const int nVerts = mesh->nVerts, nCorners = mesh->nTris * 3;
+    const float crease = cosf(TO_RAD(CREASE_ANGLE));
+
+    // Face normals, scaled by twice the area, and their unit version for the crease test
+    Vector *faces, *units;
+    ALLOCATE(faces, (mesh->nTris + 1) * sizeof(Vector));
+    ALLOCATE(units, (mesh->nTris + 1) * sizeof(Vector));
+    for (int t = 0; t < mesh->nTris; t++)
+    {
+        const Vector* p0 = &mesh->verts[mesh->indices[t * 3 + 0]];
+        const Vector* p1 = &mesh->verts[mesh->indices[t * 3 + 1]];
+        const Vector* p2 = &mesh->verts[mesh->indices[t * 3 + 2]];
+        const Vector l1 = {p1->x - p0->x, p1->y - p0->y, p1->z - p0->z};
+        const Vector l2 = {p2->x - p0->x, p2->y - p0->y, p2->z - p0->z};
+        faces[t] = units[t] = crossProduct(&l1, &l2);
+        if (dotProduct(&units[t], &units[t]) > 0.0f)
+            normalizeVector(&units[t]);
+    }
+
+    // Triangles around every vertex, as offsets into one flat array
+    int *offsets, *adjacency, *fill;
+    ALLOCATE(offsets, (nVerts + 1) * sizeof(int));
+    ALLOCATE(adjacency, (nCorners + 1) * sizeof(int));
+    ALLOCATE(fill, (nVerts + 1) * sizeof(int));
+    memset(fill, 0, nVerts * sizeof(int));
+    for (int i = 0; i < nCorners; i++)
+        fill[mesh->indices[i]]++;
+    offsets[0] = 0;
+    for (int v = 0; v < nVerts; v++)
+    {
+        offsets[v + 1] = offsets[v] + fill[v];
+        fill[v] = 0;
+    }
+    for (int i = 0; i < nCorners; i++)
+    {
+        const int v = mesh->indices[i];
+        adjacency[offsets[v] + fill[v]++] = i / 3;
+    }
+
+    // Every corner gets the normal of the faces on its side of the creases, and
+    // corners of the same vertex with the same normal share one output vertex
+    Vector *verts, *normals;
+    TexCoord* uvs = NULL;
+    int *firstCopy, *nextCopy;
+    ALLOCATE(verts, (nCorners + 1) * sizeof(Vector));
+    ALLOCATE(normals, (nCorners + 1) * sizeof(Vector));
+    if (mesh->uvs != NULL)
+        ALLOCATE(uvs, (nCorners + 1) * sizeof(TexCoord));
+    ALLOCATE(firstCopy, (nVerts + 1) * sizeof(int));
+    ALLOCATE(nextCopy, (nCorners + 1) * sizeof(int));
+    for (int v = 0; v < nVerts; v++)
+        firstCopy[v] = -1;
+
+    int nOut = 0;
+    for (int i = 0; i < nCorners; i++)
+    {
+        const int v = mesh->indices[i], t = i / 3;
+        Vector n = {0.0f, 0.0f, 0.0f};
+        for (int a = offsets[v]; a < offsets[v + 1]; a++)
+        {
+            const int other = adjacency[a];
+            if (dotProduct(&units[t], &units[other]) >= crease)
+            {
+                n.x += faces[other].x; n.y += faces[other].y; n.z += faces[other].z;
+            }
+        }
+        if (dotProduct(&n, &n) > 0.0f)
+            normalizeVector(&n);
+
+        int copy = firstCopy[v];
+        while (copy != -1 && memcmp(&normals[copy], &n, sizeof(Vector)) != 0)
+            copy = nextCopy[copy];
+        if (copy == -1)
+        {
+            copy = nOut++;
+            verts[copy] = mesh->verts[v];
+            normals[copy] = n;
+            if (uvs != NULL)
+                uvs[copy] = mesh->uvs[v];
+            nextCopy[copy] = firstCopy[v];
+            firstCopy[v] = copy;
+        }
+        mesh->indices[i] = copy;
+    }
+
+    free(mesh->verts);
+    free(mesh->uvs);
+    free(mesh->normals);
+    mesh->verts = verts;
+    mesh->uvs = uvs;
+    mesh->normals = normals;
+    mesh->nVerts = nOut;
+
+    free(faces);
+    free(units);
+    free(offsets);
+    free(adjacency);
+    free(fill);
+    free(firstCopy);
+    free(nextCopy);
+}
+
+/**
+ * Gets a freshly loaded mesh ready to be drawn: indexes it, computes its
+ * normals, reorders it for vertex reuse, computes its bounds and splits it
+ * into meshlets
+ *
+ *  @param mesh Mesh with its triangle soup filled in
+ *
+ *  @return void
+ */
+void prepareMesh(Mesh* mesh)
+{
+    buildMeshIndex(mesh);
+    computeVertexNormals(mesh);
+
+    optimizeVertexCache(mesh);
+    optimizeVertexFetch(mesh);
+
+    computeMeshBounds(mesh);
+    buildMeshlets(mesh);
+    buildMeshEdges(mesh);
+}
+
+/**
+ * Copies an array into memory of its own
+ *
+ *  @return The copy, NULL for an empty or missing array
+ */
+static void* duplicateArray(const void* array, size_t size)
+{
+    if (array == NULL || size == 0)
+        return NULL;
+    void* copy;
+    ALLOCATE(copy, size);
+    memcpy(copy, array, size);
+    return copy;
+}
+
+/**
+ * Copies a prepared mesh, so many instances can be posed or reloaded on their
+ * own without preparing the same triangles again. The texture is shared,
+ * the skin is not copied
+ *
+ *  @param mesh Prepared mesh, not compact
+ *  @param copy Mesh to fill with the copy
+ *
+ *  @return void
+ */
+void copyMesh(const Mesh* mesh, Mesh* copy)
+{
+    *copy = *mesh;
+    copy->tris = duplicateArray(mesh->tris, (size_t)mesh->nTris * sizeof(Triangle));
+    copy->verts = duplicateArray(mesh->verts, (size_t)mesh->nVerts * sizeof(Vector));
+    copy->indices = duplicateArray(mesh->indices, (size_t)mesh->nTris * 3 * sizeof(int));
+    copy->uvs = duplicateArray(mesh->uvs, (size_t)mesh->nVerts * sizeof(TexCoord));
+    copy->normals = duplicateArray(mesh->normals, (size_t)mesh->nVerts * sizeof(Vector));
+    copy->edges = duplicateArray(mesh->edges, (size_t)mesh->nEdges * 2 * sizeof(int));
+    copy->meshlets = duplicateArray(mesh->meshlets, (size_t)mesh->nMeshlets * sizeof(Meshlet));
+    int nMeshletVerts = 0;
+    for (int m = 0; m < mesh->nMeshlets; m++)
+        nMeshletVerts = SDL_max(nMeshletVerts, mesh->meshlets[m].vertOffset + mesh->meshlets[m].nVerts);
+    copy->meshletVerts = duplicateArray(mesh->meshletVerts, (size_t)nMeshletVerts * sizeof(int));
+    copy->meshletTris = duplicateArray(mesh->meshletTris, (size_t)mesh->nTris * 3);
+    copy->skin = NULL;
+}
+
+/**
+ * Frees everything a mesh allocated, the mesh itself is not freed
+ *
+ *  @param mesh Mesh to free
+ *
+ *  @return void
+ */
+void freeMesh(Mesh* mesh)
+{
+    free(mesh->tris);
+    free(mesh->verts);
+    free(mesh->indices);
+    free(mesh->uvs);
+    free(mesh->normals);
+    free(mesh->meshlets);
+    free(mesh->meshletVerts);
+    free(mesh->meshletTris);
+    free(mesh->edges);
+    free(mesh->qverts);
+    free(mesh->octNormals);
+    free(mesh->packedIndices);
+    free(mesh->packedMeshletVerts);
+    if (mesh->skin != NULL)
+    {
+        free(mesh->skin->bones);
+        free(mesh->skin->weights);
+        free(mesh->skin->restVerts);
+        free(mesh->skin->restNormals);
+        free(mesh->skin->palette);
+        free(mesh->skin);
+    }
+    mesh->tris = NULL;
+    mesh->verts = NULL;
+    mesh->indices = NULL;
+    mesh->uvs = NULL;
+    mesh->normals = NULL;
+    mesh->meshlets = NULL;
+    mesh->meshletVerts = NULL;
+    mesh->meshletTris = NULL;
+    mesh->edges = NULL;
+    mesh->qverts = NULL;
+    mesh->octNormals = NULL;
+    mesh->packedIndices = NULL;
+    mesh->packedMeshletVerts = NULL;
+    mesh->skin = NULL;
+}
+
+/**
+ * Computes the model space bounding box of a mesh. Needs to be called
+ * again whenever the vertices of the mesh change
+ *
+ *  @param mesh Indexed mesh to compute the bounds of
+ *
+ *  @return void
+ */
+void computeMeshBounds(Mesh* mesh)
+{
+    if (mesh->nVerts == 0)
+    {
+        mesh->boundsMin = mesh->boundsMax = (Vector){0.0f, 0.0f, 0.0f};
+        return;
+    }
+
+    mesh->boundsMin = mesh->boundsMax = mesh->verts[0];
+    for (int i = 1; i < mesh->nVerts; i++)
+    {
+        const Vector* p = &mesh->verts[i];
+        mesh->boundsMin.x = fminf(mesh->boundsMin.x, p->x);
+        mesh->boundsMin.y = fminf(mesh->boundsMin.y, p->y);
+        mesh->boundsMin.z = fminf(mesh->boundsMin.z, p->z);
+        mesh->boundsMax.x = fmaxf(mesh->boundsMax.x, p->x);
+        mesh->boundsMax.y = fmaxf(mesh->boundsMax.y, p->y);
+        mesh->boundsMax.z = fmaxf(mesh->boundsMax.z, p->z);
+    }
+}
+
+/**
+ * Finds the screen area a bounding box covers by projecting its corners. If
+ * part of the box is behind the near plane we can not trust the projection,
+ * so the whole screen is returned, and nothing when all of it is
+ *
+ *  @param boundsMin Model space corner of the box with the smallest coordinates
+ *  @param boundsMax Model space corner of the box with the biggest coordinates
+ *  @param world Transformation from model to world space
+ *  @param proj Projection matrix
+ *
+ *  @return Rectangle (clamped to the screen) covering the box, empty if offscreen
+ */
+SDL_Rect boundsScreenRect(const Vector* boundsMin, const Vector* boundsMax, const Matrix4x4* world,
+                          const Matrix4x4* proj)
+{
+    const SDL_Rect screen = {0, 0, WIDTH, HEIGHT};
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+    int behind = 0;
+
+    for (int c = 0; c < 8; c++)
+    {
+        const Vector corner = {
+            c & 1 ? boundsMax->x : boundsMin->x,
+            c & 2 ? boundsMax->y : boundsMin->y,
+            c & 4 ? boundsMax->z : boundsMin->z
+        };
+        Vector transformed, projected;
+        multMatVec(&corner, &transformed, world);
+        if (transformed.z < Z_NEAR)
+        {
+            behind++;
+            continue;
+        }
+
+        multMatVec(&transformed, &projected, proj);
+        scale(&projected);
+        minX = fminf(minX, projected.x); maxX = fmaxf(maxX, projected.x);
+        minY = fminf(minY, projected.y); maxY = fmaxf(maxY, projected.y);
+    }
+    if (behind == 8)
+        return (SDL_Rect){0, 0, 0, 0};
+    if (behind > 0)
+        return screen;
+
+    // Pad by a pixel so the rasterizer's rounding never leaves anything behind
+    SDL_Rect rect = {
+        (int)floorf(minX) - 1,
+        (int)floorf(minY) - 1,
+        (int)ceilf(maxX) - (int)floorf(minX) + 2,
+        (int)ceilf(maxY) - (int)floorf(minY) + 2
+    };
+    SDL_Rect clamped;
+    if (!SDL_IntersectRect(&rect, &screen, &clamped))
+        clamped = (SDL_Rect){0, 0, 0, 0};
+    return clamped;
+}
+
+/**
+ * Finds the screen area a mesh covers (see boundsScreenRect)
+ *
+ *  @param mesh Mesh to get the screen area of
+ *  @param world Transformation from model to world space
+ *  @param proj Projection matrix
+ *
+ *  @return Rectangle (clamped to the screen) covering the mesh, empty if offscreen
+ */
+SDL_Rect meshScreenRect(const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj)
+{
+    return boundsScreenRect(&mesh->boundsMin, &mesh->boundsMax, world, proj);
+}
+
+/**
+ * Marks a screen area to be redrawn this frame. Overlapping areas are merged
+ * and if there are too many of them everything collapses into one rectangle
+ *
+ *  @param engine Engine that holds the dirty rectangles
+ *  @param rect Screen area that changed
+ *
+ *  @return void
+ */
+void addDirtyRect(Engine* engine, const SDL_Rect* rect)
+{
+    if (rect->w <= 0 || rect->h <= 0)
+        return;
+
+    SDL_Rect merged = *rect;
+    // Absorb every rectangle touching the new one, this can make it grow into others
+    for (int i = 0; i < engine->nDirty; i++)
+    {
+        if (SDL_HasIntersection(&engine->dirty[i], &merged))
+        {
+            SDL_UnionRect(&engine->dirty[i], &merged, &merged);
+            engine->dirty[i] = engine->dirty[--engine->nDirty];
+            i = -1;
+        }
+    }
+
+    if (engine->nDirty == MAX_DIRTY_RECTS)
+    {
+        // Too many small areas, one big one is cheaper to handle
+        for (int i = 0; i < engine->nDirty; i++)
+            SDL_UnionRect(&engine->dirty[i], &merged, &merged);
+        engine->nDirty = 0;
+    }
+    engine->dirty[engine->nDirty++] = merged;
 }
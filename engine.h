@@ -18,9 +18,24 @@
 #define Z_FAR 1000.0f
 #define Q (Z_FAR / (Z_FAR - Z_NEAR))
 #define FOV 90.0f
-#define ASPECT_RATIO (WIDTH / HEIGHT)
+#define ASPECT_RATIO ((float)HEIGHT / WIDTH)
 #define FOV_TAN (1.0f / tanf(TO_RAD(FOV * 0.5f)))
 
+// Dirty rectangles kept per frame before they get merged into one
+#define MAX_DIRTY_RECTS 16
+
+// Lights the engine evaluates for every vertex
+#define MAX_LIGHTS 8
+// Faces meeting at a sharper angle than this get their own vertex normals
+#define CREASE_ANGLE 60.0f
+
+// Mip levels a texture can have, enough for 32768 x 32768
+#define TEXTURE_MAX_LEVELS 16
+
+// Meshlet limits, small enough to keep the transformed vertices of one on the stack
+#define MESHLET_MAX_VERTS 64
+#define MESHLET_MAX_TRIS 124
+
 // Macros for error treatment
 #define CHECK_INITIALIZATION(msg)                                                                                      \
     do                                                                                                                 \
@@ -52,6 +67,18 @@
         }                                                                                                              \
     }while(0)
 
+#define CHECK_TEXTURE_CREATION(window, renderer, x, msg)                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(x)) {                                                                                                    \
+            fprintf(stderr, "[ERROR] %s! \n[SDL] %s", msg, SDL_GetError());                                            \
+            SDL_DestroyRenderer(renderer);                                                                             \
+            SDL_DestroyWindow(window);                                                                                 \
+            SDL_Quit();                                                                                                \
+            return 0;                                                                                                  \
+        }                                                                                                              \
+    }while(0)
+
 #define ALLOCATE(x, size)                                                                                              \
 do                                                                                                                     \
 {                                                                                                                      \
@@ -68,45 +95,248 @@ typedef struct
     float x, y, z;
 } Vector;
 
+typedef struct
+{
+    float u, v;
+} TexCoord;
+
 typedef struct
 {
     Vector points[3];
     float light;
+    // Texture coordinates of every point, only used by textured meshes
+    TexCoord uv[3];
 } Triangle;
 
+typedef struct
+{
+    // Size of level 0, both powers of two
+    int width, height;
+    int nLevels;
+    // Every mip level is stored in tiles of 4x4 texels, one cache line each (see texture.h)
+    Uint32* levels[TEXTURE_MAX_LEVELS];
+} Texture;
+
+typedef struct
+{
+    int width, height;
+    // Samples per pixel: 1, or 4 or 8 for multisample anti-aliasing
+    int samples;
+    // ARGB8888 pixels, resolved from the samples when there is more than one (see resolveFramebuffer)
+    Uint32* color;
+    // ARGB8888 color of every sample when there is more than one, the samples of a pixel next to each other
+    Uint32* sampleColor;
+    // 1 / view depth of every sample, 0 is infinitely far away
+    float* depth;
+} Framebuffer;
+
+typedef struct
+{
+    // Screen position and view depth
+    float x, y, w;
+    TexCoord uv;
+    // Light reaching the vertex, 1 is full brightness
+    float r, g, b;
+    // Light from the shadow casting light, only reaches the pixels the shadow map says are lit
+    float sr, sg, sb;
+    // Position in the shadow map (see shadow.h)
+    Vector shadowPos;
+} RasterVertex;
+
+typedef enum
+{
+    LIGHT_AMBIENT,
+    LIGHT_DIRECTIONAL,
+    LIGHT_POINT
+} LightType;
+
+typedef struct
+{
+    LightType type;
+    // Direction the light travels in (directional lights)
+    Vector direction;
+    // Where the light is and how far it reaches (point lights)
+    Vector position;
+    float range;
+    // Color and intensity, 1 is full brightness
+    float r, g, b;
+    // Directional lights only, meshes flagged as shadow casters block it (see shadow.h)
+    int castsShadows;
+} Light;
+
+typedef struct
+{
+    // Hardcoded the size because it should not change
+    float mat[4][4];
+} Matrix4x4;
+
+typedef struct
+{
+    // Ranges in the meshletVerts and meshletTris arrays of the mesh. For compact
+    // meshes vertOffset is a byte offset in packedMeshletVerts instead
+    int vertOffset, nVerts;
+    int triOffset, nTris;
+    // Model space bounding sphere
+    Vector center;
+    float radius;
+    // Normal cone, every triangle faces away when the camera is outside of it
+    Vector coneAxis;
+    float coneCutoff;
+} Meshlet;
+
+typedef struct
+{
+    int nBones;
+    // SKIN_INFLUENCES bones per vertex, heaviest first, and their weights, which add up to 1
+    Uint8* bones;
+    float* weights;
+    // Vertices and normals at rest, the ones of the mesh are posed from them (see skin.h)
+    Vector* restVerts;
+    Vector* restNormals;
+    // Transformation of every bone from the rest pose to the current one, set by the animation
+    Matrix4x4* palette;
+    // The palette changed since the vertices were last posed
+    int dirty;
+} Skin;
+
 typedef struct
 {
     // Dynamically allocated for ease of expansion
     int nTris;
+    // Triangle soup as it is loaded, replaced by the indexed form in prepareMesh()
     Triangle* tris;
+    // Unique vertices and 3 indices per triangle
+    int nVerts;
+    Vector* verts;
+    int* indices;
+    // Set before prepareMesh() to keep the texture coordinates, one per vertex
+    Texture* texture;
+    TexCoord* uvs;
+    // Smooth normal of every vertex (see computeVertexNormals)
+    Vector* normals;
+    // Unique edges, 2 vertices each, for the wireframe view (see wireframe.h)
+    int nEdges;
+    int* edges;
+    // Clusters of triangles that are culled as a whole (see meshlet.h)
+    int nMeshlets;
+    Meshlet* meshlets;
+    // Mesh vertex of every meshlet vertex, and 3 meshlet vertices per meshlet triangle
+    int* meshletVerts;
+    Uint8* meshletTris;
+    // Compact storage (see compact.h), replaces verts, normals, indices and meshletVerts when set
+    int compact;
+    Uint16* qverts;
+    Uint16* octNormals;
+    Uint8* packedIndices;
+    int packedIndicesSize;
+    Uint8* packedMeshletVerts;
+    int packedMeshletVertsSize;
+    // Model space bounding box (see computeMeshBounds)
+    Vector boundsMin, boundsMax;
+    // Scene graph node that places the mesh in the world (see scene.h)
+    int node;
+    // Picked every frame among the meshes covering the most of the screen, occluders hide the ones behind them
+    // (see selectOccluders)
+    int occluder;
+    int visible;
+    // Shadow casters are drawn into the shadow map (see shadow.h)
+    int shadowCaster;
+    // Bones that pose the vertices every frame, NULL for rigid meshes
+    Skin* skin;
+    // Loader asset the mesh was loaded from, counting from 1, 0 for meshes built in code (see loader.h)
+    int asset;
+    // Transform and screen area of the last drawn frame
+    Matrix4x4 world;
+    SDL_Rect rect;
 } Mesh;
 
+typedef struct
+{
+    // Parent node, -1 for roots. Parents always come before their children
+    int parent;
+    // Number of nodes in the subtree of this one, itself included. The subtree follows the node in the array
+    int subtreeSize;
+    // Mesh drawn at this node, -1 for none
+    int mesh;
+    // Replaces the local transform with the scene rotation every frame
+    int spinning;
+    // Set when the local transform changed, cleared once the world matrix is updated
+    int dirty;
+    // Set when the world matrix changed in the last update
+    int changed;
+    // Transformation relative to the parent, and from model to world space
+    Matrix4x4 local;
+    Matrix4x4 world;
+} Node;
+
+// Meshes streamed from disk in chunks (see stream.h)
+typedef struct MeshStream MeshStream;
+// Clouds of points drawn without triangles (see pointcloud.h)
+typedef struct PointCloud PointCloud;
+
 typedef struct
 {
     SDL_Window* window;
     SDL_Renderer* renderer;
+    // The frame is rasterized into fb and the dirty parts of it are uploaded to canvas
+    Framebuffer fb;
+    SDL_Texture* canvas;
 
     int nMeshes;
     // Dynamically allocated for ease of expansion
     Mesh* meshes;
-} Engine;
 
-typedef struct
-{
-    // Hardcoded the size because it should not change
-    float mat[4][4];
-} Matrix4x4;
+    // Meshes too big to keep in memory, paged in as they are needed (see stream.h)
+    int nStreams;
+    MeshStream* streams;
+
+    // Point clouds, and the side of the square every point covers in pixels (see pointcloud.h)
+    int nClouds;
+    PointCloud* clouds;
+    int pointSize;
+
+    // Scene graph in depth first order (see scene.h)
+    int nNodes;
+    int nodesCapacity;
+    Node* nodes;
+
+    int nLights;
+    Light lights[MAX_LIGHTS];
+
+    // Draw the edges of the meshes instead of filling them (see wireframe.h)
+    int wireframe;
+
+    // Most meshes drawn into the occlusion buffer every frame, 0 turns occlusion culling off (see occlusion.h)
+    int nOccluders;
+
+    // Screen areas that need to be redrawn this frame
+    int nDirty;
+    SDL_Rect dirty[MAX_DIRTY_RECTS];
+} Engine;
 
 /*Function prototypes*/
 // Vector operations
 void multMatVec(const Vector* i, Vector* o, const Matrix4x4* m);
+Matrix4x4 multMatMat(const Matrix4x4* a, const Matrix4x4* b);
+Matrix4x4 translationMatrix(const Vector* v);
+Matrix4x4 projectionMatrix(float aspectRatio);
 void translate(const Vector* i, Vector* o, const Vector* v);
 float dotProduct(const Vector* a, const Vector* b);
 Vector crossProduct(const Vector* a, const Vector* b);
 void normalizeVector(Vector* v);
 void scale(Vector* v);
-// Draw and fill function -> TODO: Update this to more generic functions
-void drawTriangle(const Triangle* t, SDL_Renderer* renderer);
-void fillTriangle(const Triangle* t, SDL_Renderer* renderer);
+Uint32 hashVector(const Vector* v);
+// Mesh preparation
+void buildMeshIndex(Mesh* mesh);
+void computeVertexNormals(Mesh* mesh);
+void prepareMesh(Mesh* mesh);
+void copyMesh(const Mesh* mesh, Mesh* copy);
+void freeMesh(Mesh* mesh);
+// Bounds and dirty rectangles
+void computeMeshBounds(Mesh* mesh);
+SDL_Rect boundsScreenRect(const Vector* boundsMin, const Vector* boundsMax, const Matrix4x4* world,
+                          const Matrix4x4* proj);
+SDL_Rect meshScreenRect(const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj);
+void addDirtyRect(Engine* engine, const SDL_Rect* rect);
 
 #endif //ENGINE_H
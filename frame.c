@@ -0,0 +1,986 @@
+//
+// Frame loop of the renderer
+//
+// Every frame runs the same stages on the task graph (see taskgraph.h):
+// animating the scene, finding the dirty rectangles, paging in the streams,
+// the shadow map, the lights, occlusion culling and drawing. Only the dirty
+// rectangles are drawn again, and with a window they are drawn straight into
+// the locked canvas on a render thread while the calling thread handles the
+// events and owns the window
+//
+
+#include "frame.h"
+#include "light.h"
+#include "occlusion.h"
+#include "pointcloud.h"
+#include "pool.h"
+#include "raster.h"
+#include "render.h"
+#include "scene.h"
+#include "shadow.h"
+#include "skin.h"
+#include "stream.h"
+#include "wireframe.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// How fast the keys fly the camera, units and degrees per second
+#define CAMERA_SPEED 2.0f
+#define CAMERA_TURN_SPEED 90.0f
+
+// Requests of the render thread to the event thread, which owns the window. They are
+// registered SDL events counted from FrameLoop.firstEvent
+typedef enum
+{
+    // Lock FrameLoop.rect of the canvas and hand its pixels over
+    FRAME_LOCK,
+    // Upload the pixels drawn into the locked canvas
+    FRAME_UNLOCK,
+    // Upload the dirty rectangles from FrameLoop.firstUpload on from the framebuffer
+    FRAME_UPLOAD,
+    FRAME_PRESENT,
+    // The render thread has stopped
+    FRAME_STOPPED,
+    FRAME_EVENTS
+} FrameEvent;
+
+typedef struct
+{
+    Engine* engine;
+    MeshLoader* loader;
+    FrameCapture* capture;
+    int frames;
+    InputChannel input;
+    // Records the camera path of the session, NULL when not recording
+    PathRecorder* recorder;
+    // Path drawn instead of following the input, NULL when not replaying
+    const Replay* replay;
+    // Counters published after every frame, NULL for none
+    TelemetryBlock* telemetry;
+    // Gets the stages of every drawn frame, NULL for none
+    TaskTrace* trace;
+    // Poses the skinned meshes every frame, NULL leaves them as they are
+    PoseFunction pose;
+    // Draws straight into the locked canvas instead of uploading from the framebuffer, only
+    // changed by the render thread
+    int direct;
+    // Guards what is below, pending is set while the render thread waits for a request
+    SDL_mutex* mutex;
+    SDL_cond* done;
+    int pending;
+    SDL_Rect rect;
+    Uint32* pixels;
+    int firstUpload;
+    // Only used by the event thread: the canvas is locked and cannot be shown
+    int locked;
+    Uint32 firstEvent;
+} FrameLoop;
+
+/**
+ * Sends a request to the event thread without waiting for it
+ *
+ *  @return void
+ */
+static void sendFrameEvent(FrameLoop* loop, FrameEvent type)
+{
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = loop->firstEvent + type;
+    // The queue only refuses it when it is full, which lasts until the event thread catches up
+    while (SDL_PushEvent(&event) < 0)
+        SDL_Delay(1);
+}
+
+/**
+ * Sends a request to the event thread and waits until it is done, or until
+ * the window asks to quit
+ *
+ *  @return void
+ */
+static void waitForEventThread(FrameLoop* loop, FrameEvent type)
+{
+    SDL_LockMutex(loop->mutex);
+    loop->pending = 1;
+    sendFrameEvent(loop, type);
+    while (loop->pending && !isQuitRequested(&loop->input))
+        SDL_CondWait(loop->done, loop->mutex);
+    // A request the event thread did not get to yet is dropped
+    loop->pending = 0;
+    SDL_UnlockMutex(loop->mutex);
+}
+
+/**
+ * Points the framebuffer at the canvas, locked at the area of a dirty
+ * rectangle, so the rasterizer writes straight into the memory that gets
+ * uploaded. Locked pixels hold garbage, which is fine because the dirty
+ * rectangle is cleared before anything is drawn into it
+ *
+ *  @return 1 if the framebuffer points at the canvas, 0 if it has to be drawn and uploaded instead
+ */
+static int lockCanvas(FrameLoop* loop, const SDL_Rect* rect)
+{
+    SDL_LockMutex(loop->mutex);
+    loop->rect = *rect;
+    loop->pixels = NULL;
+    SDL_UnlockMutex(loop->mutex);
+    waitForEventThread(loop, FRAME_LOCK);
+    if (loop->pixels == NULL)
+    {
+        loop->direct = 0;
+        return 0;
+    }
+
+    // The canvas has the width of the framebuffer, so the rows of the rectangle are where the
+    // rasterizer expects them once the pointer is moved back to the corner of the canvas
+    Framebuffer* fb = &loop->engine->fb;
+    fb->color = loop->pixels - (rect->y * fb->width + rect->x);
+    return 1;
+}
+
+/**
+ * Flies the camera with the keys held down: forward, sideways and turning
+ * along the camera, up and down along the world
+ *
+ *  @param pose Camera pose to move
+ *  @param keys Camera keys held down (see CameraKey)
+ *  @param seconds How long they were held since the last frame
+ *
+ *  @return void
+ */
+static void moveCamera(CameraPose* pose, Uint32 keys, float seconds)
+{
+    const float turn = CAMERA_TURN_SPEED * seconds, step = CAMERA_SPEED * seconds;
+    pose->yaw += (!!(keys & KEY_TURN_RIGHT) - !!(keys & KEY_TURN_LEFT)) * turn;
+    pose->pitch += (!!(keys & KEY_LOOK_UP) - !!(keys & KEY_LOOK_DOWN)) * turn;
+    pose->pitch = fminf(fmaxf(pose->pitch, -89.0f), 89.0f);
+    // Rows of the matrix are the right, down and forward axes of the camera
+    const Matrix4x4 axes = cameraToWorld(pose);
+    const float forward = (!!(keys & KEY_FORWARD) - !!(keys & KEY_BACK)) * step;
+    const float right = (!!(keys & KEY_RIGHT) - !!(keys & KEY_LEFT)) * step;
+    pose->position.x += axes.mat[2][0] * forward + axes.mat[0][0] * right;
+    pose->position.y += axes.mat[2][1] * forward + axes.mat[0][1] * right;
+    pose->position.z += axes.mat[2][2] * forward + axes.mat[0][2] * right;
+    pose->position.y += (!!(keys & KEY_SINK) - !!(keys & KEY_RISE)) * step;
+}
+
+/**
+ * Compares two frame times
+ *
+ *  @return qsort order
+ */
+static int compareTimes(const void* a, const void* b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Prints how long the frames of a replay took
+ *
+ *  @param times Milliseconds of every frame, sorted in place
+ *  @param count Number of frames
+ *
+ *  @return void
+ */
+static void reportReplay(double* times, int count)
+{
+    double total = 0.0;
+    for (int i = 0; i < count; i++)
+        total += times[i];
+    qsort(times, count, sizeof(double), compareTimes);
+    fprintf(stderr, "[REPLAY] %d FRAMES, %.2f MS AVERAGE, %.2f MS MEDIAN, %.2f MS 99TH PERCENTILE, %.2f MS WORST\n",
+            count, total / count, times[count / 2], times[SDL_min(count - 1, count * 99 / 100)], times[count - 1]);
+}
+
+// Parts of a frame the stages read and write, one bit each (see taskgraph.h)
+typedef enum
+{
+    // Nodes and the world matrices and posed vertices of the meshes
+    FRAME_SCENE = 1 << 0,
+    // Dirty rectangles, and the screen areas they are made of
+    FRAME_DIRTY = 1 << 1,
+    FRAME_STREAMS = 1 << 2,
+    FRAME_SHADOW = 1 << 3,
+    FRAME_LIGHTS = 1 << 4,
+    // Occlusion buffer, and the occluder and visible flags of the meshes
+    FRAME_VISIBILITY = 1 << 5,
+    FRAME_PIXELS = 1 << 6,
+    // The worker pool runs one parallel loop at a time
+    FRAME_WORKERS = 1 << 7
+} FrameResource;
+
+// What the stages of a frame share. Set before the graph runs, the stages only write their own part
+typedef struct
+{
+    FrameLoop* loop;
+    Engine* engine;
+    // NULL without worker threads
+    WorkerPool* pool;
+    OcclusionBuffer* occlusion;
+    ShadowMap* shadow;
+    PointBuffer* points;
+    Matrix4x4 proj, view, toWorld, spin;
+    float theta;
+    int refresh;
+    // Written by the stages
+    Light lights[MAX_LIGHTS];
+    ShadowMap viewShadow;
+    int shadowChanged;
+    int offscreen, occluded;
+    // Nothing to draw, the canvas is still up to date
+    int idle;
+    int firstUpload;
+    // Pixels of the dirty rectangles, and meshes, triangles that went to the rasterizer and points drawn. What is
+    // drawn in several dirty rectangles counts once
+    int drawn;
+    long pixels, triangles, pointsDrawn;
+} FrameState;
+
+/**
+ * Stage: moves the nodes and poses the characters
+ *
+ *  @param data The FrameState
+ *
+ *  @return void
+ */
+static void animateStage(void* data)
+{
+    FrameState* frame = data;
+    Engine* engine = frame->engine;
+    for (int i = 0; i < engine->nNodes; i++)
+        if (engine->nodes[i].spinning)
+            setNodeLocal(engine, i, &frame->spin);
+    for (int i = 0; i < engine->nMeshes; i++)
+        if (engine->meshes[i].skin != NULL && frame->loop->pose != NULL)
+            frame->loop->pose(&engine->meshes[i], frame->theta, (float)i);
+    skinMeshes(engine, frame->pool);
+    updateSceneGraph(engine);
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        Mesh* mesh = &engine->meshes[i];
+        const Node* node = &engine->nodes[mesh->node];
+        if (frame->refresh || node->changed)
+            mesh->world = node->world;
+    }
+}
+
+/**
+ * Stage: marks the old and new screen areas of the meshes and clouds that moved
+ *
+ *  @param data The FrameState
+ *
+ *  @return void
+ */
+static void screenStage(void* data)
+{
+    FrameState* frame = data;
+    Engine* engine = frame->engine;
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        Mesh* mesh = &engine->meshes[i];
+        const Node* node = &engine->nodes[mesh->node];
+        if (frame->refresh || node->changed)
+        {
+            const Matrix4x4 modelView = multMatMat(&node->world, &frame->view);
+            const SDL_Rect rect = meshScreenRect(mesh, &modelView, &frame->proj);
+            addDirtyRect(engine, &mesh->rect);
+            addDirtyRect(engine, &rect);
+            mesh->rect = rect;
+        }
+    }
+    for (int i = 0; i < engine->nClouds; i++)
+    {
+        PointCloud* cloud = &engine->clouds[i];
+        const Node* node = &engine->nodes[cloud->node];
+        if (frame->refresh || node->changed)
+        {
+            const Matrix4x4 modelView = multMatMat(&node->world, &frame->view);
+            const SDL_Rect rect = boundsScreenRect(&cloud->boundsMin, &cloud->boundsMax, &modelView, &frame->proj);
+            addDirtyRect(engine, &cloud->rect);
+            addDirtyRect(engine, &rect);
+            cloud->world = node->world;
+            cloud->rect = rect;
+        }
+    }
+}
+
+/**
+ * Stage: asks for the chunks the streams need and marks the streams that
+ * moved or got new chunks. Captures and replays wait for the chunks, so
+ * their frames do not depend on how fast the disk is
+ *
+ *  @param data The FrameState
+ *
+ *  @return void
+ */
+static void streamStage(void* data)
+{
+    FrameState* frame = data;
+    Engine* engine = frame->engine;
+    for (int i = 0; i < engine->nStreams; i++)
+    {
+        MeshStream* stream = &engine->streams[i];
+        const Node* node = &engine->nodes[stream->node];
+        const Matrix4x4 modelView = multMatMat(&node->world, &frame->view);
+        const int arrived = frame->loop->capture != NULL || frame->loop->replay != NULL ?
+                            settleMeshStream(stream, &modelView, &frame->proj, HEIGHT) :
+                            updateMeshStream(stream, &modelView, &frame->proj, HEIGHT);
+        if (frame->refresh || node->changed || arrived)
+        {
+            const SDL_Rect rect = boundsScreenRect(&stream->boundsMin, &stream->boundsMax, &modelView,
+                                                   &frame->proj);
+            addDirtyRect(engine, &stream->rect);
+            addDirtyRect(engine, &rect);
+            stream->world = node->world;
+            stream->rect = rect;
+        }
+    }
+}
+
+/**
+ * Stage: draws the shadow map again when a caster moved. The map is in
+ * world space, the camera moving does not change it
+ *
+ *  @param data The FrameState
+ *
+ *  @return void
+ */
+static void shadowStage(void* data)
+{
+    FrameState* frame = data;
+    const Engine* engine = frame->engine;
+    for (int i = 0; i < engine->nMeshes; i++)
+        if (engine->meshes[i].shadowCaster && engine->nodes[engine->meshes[i].node].changed)
+            frame->shadow->dirty = 1;
+    frame->shadowChanged = updateShadowMap(frame->shadow, engine);
+    // Looked up in view space, like the meshes are drawn
+    frame->viewShadow = *frame->shadow;
+    frame->viewShadow.toMap = multMatMat(&frame->toWorld, &frame->shadow->toMap);
+}
+
+/**
+ * Stage: moves the lights to view space
+ *
+ *  @param data The FrameState
+ *
+ *  @return void
+ */
+static void lightStage(void* data)
+{
+    FrameState* frame = data;
+    transformLights(frame->engine->lights, frame->engine->nLights, &frame->view, frame->lights);
+}
+
+/**
+ * Stage: picks the occluders, draws them and hides every mesh that ends up
+ * completely behind them. Skipped when nothing is dirty: a new shadow map
+ * always comes with a caster that moved, so there is nothing to draw
+ *
+ *  @param data The FrameState
+ *
+ *  @return void
+ */
+static void occlusionStage(void* data)
+{
+    FrameState* frame = data;
+    Engine* engine = frame->engine;
+    frame->offscreen = frame->occluded = 0;
+    if (engine->nDirty == 0)
+        return;
+
+    // Wireframes show what is behind the occluders
+    const int culling = !engine->wireframe && selectOccluders(engine, engine->nOccluders) > 0;
+    if (culling)
+    {
+        clearOcclusionBuffer(frame->occlusion);
+        for (int i = 0; i < engine->nMeshes; i++)
+            if (engine->meshes[i].occluder)
+            {
+                const Matrix4x4 modelView = multMatMat(&engine->meshes[i].world, &frame->view);
+                rasterizeOccluder(frame->occlusion, &engine->meshes[i], &modelView, &frame->proj);
+            }
+        resolveOcclusionBuffer(frame->occlusion);
+    }
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        Mesh* mesh = &engine->meshes[i];
+        const Matrix4x4 modelView = multMatMat(&mesh->world, &frame->view);
+        mesh->visible = !culling || mesh->occluder || isMeshVisible(frame->occlusion, mesh, &modelView, &frame->proj);
+        if (mesh->rect.w <= 0 || mesh->rect.h <= 0)
+            frame->offscreen++;
+        else if (!mesh->visible)
+            frame->occluded++;
+    }
+}
+
+/**
+ * Finds the first dirty rectangle a screen area touches, where what is drawn
+ * in it gets counted
+ *
+ *  @param engine Engine with the dirty rectangles
+ *  @param rect Screen area
+ *
+ *  @return Index of the rectangle, -1 if it touches none
+ */
+static int firstDirtyRect(const Engine* engine, const SDL_Rect* rect)
+{
+    for (int d = 0; d < engine->nDirty; d++)
+        if (SDL_HasIntersection(rect, &engine->dirty[d]))
+            return d;
+    return -1;
+}
+
+/**
+ * Stage: redraws only what is inside the dirty rectangles, on black.
+ * Quitting does not wait for the frame
+ *
+ *  @param data The FrameState
+ *
+ *  @return void
+ */
+static void drawStage(void* data)
+{
+    FrameState* frame = data;
+    FrameLoop* loop = frame->loop;
+    Engine* engine = frame->engine;
+    // New shadows can fall on any mesh
+    if (frame->shadowChanged)
+    {
+        for (int i = 0; i < engine->nMeshes; i++)
+            addDirtyRect(engine, &engine->meshes[i].rect);
+        for (int i = 0; i < engine->nStreams; i++)
+            addDirtyRect(engine, &engine->streams[i].rect);
+    }
+    frame->firstUpload = frame->drawn = 0;
+    frame->pixels = frame->triangles = frame->pointsDrawn = 0;
+    // Nothing moved, the canvas is still up to date. Captures and replays still need the frame
+    frame->idle = engine->nDirty == 0 && loop->capture == NULL && loop->replay == NULL;
+    if (frame->idle)
+        return;
+
+    Uint32* color = engine->fb.color;
+    for (int d = 0; d < engine->nDirty && !isQuitRequested(&loop->input); d++)
+    {
+        const SDL_Rect* dirty = &engine->dirty[d];
+        // Once a rectangle has to be uploaded the rest of the frame is drawn into the framebuffer too
+        const int direct = frame->firstUpload == d && loop->direct && lockCanvas(loop, dirty);
+        if (direct)
+            frame->firstUpload = d + 1;
+        clearFramebuffer(&engine->fb, dirty);
+        frame->pixels += dirty->w * dirty->h;
+
+        for (int i = 0; i < engine->nMeshes; i++)
+        {
+            const Mesh* mesh = &engine->meshes[i];
+            if (!mesh->visible || !SDL_HasIntersection(&mesh->rect, dirty))
+                continue;
+            const Matrix4x4 modelView = multMatMat(&mesh->world, &frame->view);
+            // The culling does not depend on the rectangle, the other rectangles draw the same triangles
+            const int first = firstDirtyRect(engine, &mesh->rect) == d;
+            int triangles = 0;
+            if (engine->wireframe)
+                drawMeshEdges(mesh, &modelView, &frame->proj, &engine->fb, dirty);
+            else
+                triangles = drawMesh(mesh, &modelView, &frame->proj, frame->lights, engine->nLights,
+                                     &frame->viewShadow, &engine->fb, dirty);
+            if (first)
+            {
+                frame->drawn++;
+                frame->triangles += triangles;
+            }
+        }
+        for (int i = 0; i < engine->nStreams; i++)
+        {
+            const MeshStream* stream = &engine->streams[i];
+            const Matrix4x4 modelView = multMatMat(&stream->world, &frame->view);
+            if (!SDL_HasIntersection(&stream->rect, dirty))
+                continue;
+            const int triangles = drawMeshStream(stream, &modelView, &frame->proj, frame->lights, engine->nLights,
+                                                 &frame->viewShadow, engine->wireframe, &engine->fb, dirty);
+            if (firstDirtyRect(engine, &stream->rect) == d)
+                frame->triangles += triangles;
+        }
+        // Points are not lit, wireframes show them too
+        for (int i = 0; i < engine->nClouds; i++)
+        {
+            const PointCloud* cloud = &engine->clouds[i];
+            const Matrix4x4 modelView = multMatMat(&cloud->world, &frame->view);
+            if (!SDL_HasIntersection(&cloud->rect, dirty))
+                continue;
+            const int points = drawPointCloud(cloud, &modelView, &frame->proj, engine->pointSize, frame->points,
+                                              &engine->fb, dirty, frame->pool);
+            if (firstDirtyRect(engine, &cloud->rect) == d)
+                frame->pointsDrawn += points;
+        }
+        resolveFramebuffer(&engine->fb, dirty);
+
+        // Uploaded by the event thread while the next rectangle is drawn
+        if (direct)
+        {
+            engine->fb.color = color;
+            sendFrameEvent(loop, FRAME_UNLOCK);
+        }
+    }
+}
+
+/**
+ * Draws the frames (the scene, the shadows and the dirty rectangles) until
+ * the window asks to quit or the requested frames are done. Runs on its own
+ * thread when there is a window, and never touches it
+ *
+ *  @param data The FrameLoop
+ *
+ *  @return 0
+ */
+static int renderFrames(void* data)
+{
+    FrameLoop* loop = data;
+    Engine* engine = loop->engine;
+
+    // Defining the projection matrix
+    const Matrix4x4 proj_mat = projectionMatrix(ASPECT_RATIO);
+    const SDL_Rect screen = {0, 0, WIDTH, HEIGHT};
+
+    // Low resolution depth buffer where the occluders are drawn every frame
+    OcclusionBuffer occlusion;
+    ALLOCATE(occlusion.samples, OCCLUSION_SAMPLES_WIDTH * OCCLUSION_SAMPLES_HEIGHT * sizeof(float));
+    ALLOCATE(occlusion.depth, OCCLUSION_WIDTH * OCCLUSION_HEIGHT * sizeof(float));
+    // Depth from the shadow casting light, kept until a caster or the light moves
+    ShadowMap shadow;
+    createShadowMap(&shadow);
+    // Poses the animated meshes
+    WorkerPool pool;
+    const int pooled = createWorkerPool(&pool, 0);
+    // Points are splatted here before they are merged into the framebuffer
+    PointBuffer points = {0};
+    if (engine->nClouds > 0)
+        createPointBuffer(&points, WIDTH, HEIGHT);
+
+    // Every frame runs the same stages, in the order they are added here whenever they share something
+    FrameState state;
+    memset(&state, 0, sizeof(state));
+    state.loop = loop;
+    state.engine = engine;
+    state.pool = pooled ? &pool : NULL;
+    state.occlusion = &occlusion;
+    state.shadow = &shadow;
+    state.points = &points;
+    state.proj = proj_mat;
+    TaskGraph graph;
+    createTaskGraph(&graph);
+    addTask(&graph, "animate", animateStage, &state, 0, FRAME_SCENE | FRAME_WORKERS);
+    addTask(&graph, "screen areas", screenStage, &state, FRAME_SCENE, FRAME_DIRTY);
+    addTask(&graph, "streams", streamStage, &state, FRAME_SCENE, FRAME_STREAMS | FRAME_DIRTY);
+    addTask(&graph, "shadow map", shadowStage, &state, FRAME_SCENE, FRAME_SHADOW);
+    addTask(&graph, "lights", lightStage, &state, 0, FRAME_LIGHTS);
+    addTask(&graph, "occlusion", occlusionStage, &state, FRAME_SCENE | FRAME_DIRTY, FRAME_VISIBILITY);
+    addTask(&graph, "draw", drawStage, &state,
+            FRAME_SCENE | FRAME_STREAMS | FRAME_SHADOW | FRAME_LIGHTS | FRAME_VISIBILITY,
+            FRAME_DIRTY | FRAME_PIXELS | FRAME_WORKERS);
+    // Without its threads the graph runs on this one, in order
+    TaskScheduler scheduler;
+    createTaskScheduler(&scheduler, 0);
+
+    // Captures and replays are rendered offline, so they wait for every requested mesh to be in the scene
+    while ((loop->capture != NULL || loop->replay != NULL) && loop->loader != NULL && !isLoaderIdle(loop->loader))
+    {
+        publishLoadedMeshes(loop->loader, engine);
+        SDL_Delay(1);
+    }
+
+    float theta = 0.0f;
+    int firstFrame = 1;
+    int frame = 0;
+    // The camera starts at the origin looking down +z
+    CameraPose camera;
+    memset(&camera, 0, sizeof(camera));
+    Uint32 lastTicks = SDL_GetTicks();
+    const Uint32 recordStart = lastTicks;
+    // Time of every replayed frame
+    double* times = NULL;
+    int nTimes = 0;
+    if (loop->replay != NULL)
+    {
+        nTimes = (int)(loop->replay->keys[loop->replay->nKeys - 1].time / loop->replay->timestep) + 1;
+        ALLOCATE(times, nTimes * sizeof(double));
+        if (loop->replay->stats != NULL)
+            fprintf(loop->replay->stats,
+                    "frame,time,ms,dirty_rects,dirty_pixels,meshes_drawn,triangles_rasterized,points_drawn\n");
+    }
+    // Counters of the last frame, the totals carry on
+    TelemetryCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    addDirtyRect(engine, &screen);
+    // Main Loop
+    while (!isQuitRequested(&loop->input))
+    {
+        const Uint64 frameStart = SDL_GetPerformanceCounter();
+        Uint64 busyStart = 0;
+        for (int i = 0; pooled && i < pool.nWorkers; i++)
+            busyStart += pool.busy[i];
+        // Replays take everything that moves from the path, a fixed step of it every frame
+        PathKey key;
+        if (loop->replay != NULL)
+        {
+            if (frame >= nTimes)
+                break;
+            samplePath(loop->replay->keys, loop->replay->nKeys, frame * loop->replay->timestep, &key);
+            theta = key.theta;
+        }
+
+        // TODO: Make this Matrices better and use less space
+        Matrix4x4 rot_mat_x =
+        {
+            {
+                {1.0f, 0.0f, 0.0f, 0.0f},
+                {0.0f, cosf(TO_RAD(theta)), -sinf(TO_RAD(theta)), 0.0f},
+                {0.0f, sinf(TO_RAD(theta)), cosf(TO_RAD(theta)), 0.0f},
+                {0.0f, 0.0f, 0.0f, 1.0f}
+            }
+        };
+
+        Matrix4x4 rot_mat_y =
+        {
+            {
+                {cosf(TO_RAD(theta)), 0.0f, sinf(TO_RAD(theta)), 0.0f},
+                {0.0f, 1.0f, 0.0f, 0.0f},
+                {-sinf(TO_RAD(theta)), 0.0f, cosf(TO_RAD(theta)), 0.0f},
+                {0.0f, 0.0f, 0.0f, 1.0f}
+            }
+        };
+
+        Matrix4x4 rot_mat_z =
+        {
+            {
+                {cosf(TO_RAD(theta)), -sinf(TO_RAD(theta)), 0.0f, 0.0f},
+                {sinf(TO_RAD(theta)), cosf(TO_RAD(theta)), 0.0f, 0.0f},
+                {0.0f, 0.0f, 1.0f, 0.0f},
+                {0.0f, 0.0f, 0.0f, 1.0f}
+            }
+        };
+        const Matrix4x4 spin = multMatMat(&rot_mat_x, &rot_mat_z);
+
+        // The input as it is right now, whatever the event thread did during the last frame
+        const InputState* input = readInput(&loop->input);
+        const int wireframe = loop->replay != NULL ? (int)key.wireframe : input->wireframe;
+        if (wireframe != engine->wireframe)
+        {
+            engine->wireframe = wireframe;
+            addDirtyRect(engine, &screen);
+        }
+
+        // The camera flies with the keys held since the last frame, or follows the path. When it moves
+        // everything on the screen does
+        const Uint32 ticks = SDL_GetTicks();
+        const CameraPose lastCamera = camera;
+        if (loop->replay != NULL)
+            camera = key.pose;
+        else
+            moveCamera(&camera, input->keys, SDL_min(ticks - lastTicks, 100u) / 1000.0f);
+        lastTicks = ticks;
+        const int refresh = firstFrame || memcmp(&camera, &lastCamera, sizeof(camera)) != 0;
+        if (refresh)
+            addDirtyRect(engine, &screen);
+        const Matrix4x4 view = viewMatrix(&camera);
+
+        // Meshes loaded in the background join the scene between two frames
+        if (loop->loader != NULL)
+            publishLoadedMeshes(loop->loader, engine);
+
+        // The stages of the frame, at once where they can be
+        state.view = view;
+        state.toWorld = cameraToWorld(&camera);
+        state.spin = spin;
+        state.theta = theta;
+        state.refresh = refresh;
+        runTaskGraph(&scheduler, &graph);
+        if (state.idle)
+        {
+            SDL_Delay(1);
+            continue;
+        }
+        if (loop->trace != NULL)
+            traceTaskGraph(loop->trace, &graph, frame);
+        if (isQuitRequested(&loop->input))
+            break;
+
+        // The writer thread takes it from here
+        if (loop->capture != NULL)
+            captureFrame(loop->capture, &engine->fb);
+
+        // The event thread presents while the next frame starts
+        if (engine->window != NULL)
+        {
+            if (state.firstUpload < engine->nDirty)
+            {
+                loop->firstUpload = state.firstUpload;
+                waitForEventThread(loop, FRAME_UPLOAD);
+            }
+            sendFrameEvent(loop, FRAME_PRESENT);
+        }
+
+        // What this frame showed, and what it cost
+        const double frequency = (double)SDL_GetPerformanceFrequency();
+        const double frameMs = (double)(SDL_GetPerformanceCounter() - frameStart) * 1000.0 / frequency;
+        if (loop->recorder != NULL)
+        {
+            const PathKey recorded = {(ticks - recordStart) / 1000.0f, camera, theta, (Uint32)engine->wireframe};
+            recordPathKey(loop->recorder, &recorded);
+        }
+        if (loop->telemetry != NULL)
+        {
+            counters.frame = frame;
+            counters.ticks = SDL_GetTicks();
+            counters.frameMs = (float)frameMs;
+            Uint64 busy = 0;
+            for (int i = 0; pooled && i < pool.nWorkers; i++)
+                busy += pool.busy[i];
+            counters.workerMs = (float)((double)(busy - busyStart) * 1000.0 / frequency);
+            counters.nWorkers = pooled ? pool.nWorkers : 1;
+            counters.dirtyRects = engine->nDirty;
+            counters.meshes = engine->nMeshes;
+            counters.meshesOffscreen = state.offscreen;
+            counters.meshesOccluded = state.occluded;
+            counters.meshesDrawn = state.drawn;
+            counters.dirtyPixels = state.pixels;
+            counters.triangles = state.triangles;
+            counters.points = state.pointsDrawn;
+            counters.streamedBytes = counters.streamBudget = 0;
+            for (int i = 0; i < engine->nStreams; i++)
+            {
+                counters.streamedBytes += engine->streams[i].resident;
+                counters.streamBudget += engine->streams[i].budget;
+            }
+            counters.totalTriangles += state.triangles;
+            publishTelemetry(loop->telemetry, &counters);
+        }
+        if (loop->replay != NULL)
+        {
+            times[frame] = frameMs;
+            if (loop->replay->stats != NULL)
+                fprintf(loop->replay->stats, "%d,%.4f,%.3f,%d,%ld,%d,%ld,%ld\n", frame, key.time, times[frame],
+                        engine->nDirty, state.pixels, state.drawn, state.triangles, state.pointsDrawn);
+        }
+        engine->nDirty = 0;
+        firstFrame = 0;
+        theta += 0.1f;
+        frame++;
+        if (loop->frames > 0 && frame == loop->frames)
+            break;
+    }
+    if (loop->replay != NULL && frame > 0)
+        reportReplay(times, frame);
+    free(times);
+    free(occlusion.samples);
+    free(occlusion.depth);
+    freeShadowMap(&shadow);
+    if (engine->nClouds > 0)
+        freePointBuffer(&points);
+    destroyTaskScheduler(&scheduler);
+    if (pooled)
+        destroyWorkerPool(&pool);
+
+    // Wakes the event thread up so it stops waiting for events
+    if (engine->window != NULL)
+        sendFrameEvent(loop, FRAME_STOPPED);
+    return 0;
+}
+
+/**
+ * Does what the render thread asked for. Requests it waits for are dropped
+ * if it stopped waiting in the meantime
+ *
+ *  @return void
+ */
+static void answerFrameEvent(FrameLoop* loop, FrameEvent type)
+{
+    Engine* engine = loop->engine;
+    SDL_LockMutex(loop->mutex);
+    if (type == FRAME_LOCK && loop->pending)
+    {
+        void* pixels;
+        int pitch;
+        loop->locked = SDL_LockTexture(engine->canvas, &loop->rect, &pixels, &pitch) == 0;
+        // Rows padded by the driver do not line up with the framebuffer, those are uploaded instead
+        if (loop->locked && pitch == engine->fb.width * (int)sizeof(Uint32))
+            loop->pixels = pixels;
+        else
+        {
+            if (loop->locked)
+                SDL_UnlockTexture(engine->canvas);
+            loop->locked = 0;
+        }
+    }
+    else if (type == FRAME_UNLOCK && loop->locked)
+    {
+        SDL_UnlockTexture(engine->canvas);
+        loop->locked = 0;
+    }
+    // Upload just the pixels that changed
+    else if (type == FRAME_UPLOAD && loop->pending)
+        for (int d = loop->firstUpload; d < engine->nDirty; d++)
+        {
+            const SDL_Rect* dirty = &engine->dirty[d];
+            SDL_UpdateTexture(engine->canvas, dirty, &engine->fb.color[dirty->y * engine->fb.width + dirty->x],
+                              engine->fb.width * sizeof(Uint32));
+        }
+    if (type != FRAME_UNLOCK && loop->pending)
+    {
+        loop->pending = 0;
+        SDL_CondSignal(loop->done);
+    }
+    SDL_UnlockMutex(loop->mutex);
+}
+
+/**
+ * Presents the canvas, unless the render thread is drawing into it
+ *
+ *  @return void
+ */
+static void presentCanvas(FrameLoop* loop)
+{
+    if (loop->locked)
+        return;
+    SDL_RenderClear(loop->engine->renderer);
+    SDL_RenderCopy(loop->engine->renderer, loop->engine->canvas, NULL, NULL);
+    SDL_RenderPresent(loop->engine->renderer);
+}
+
+/**
+ * Tells which camera key a key of the keyboard is
+ *
+ *  @param key SDL key code
+ *
+ *  @return Its CameraKey, 0 if it does not move the camera
+ */
+static Uint32 cameraKey(SDL_Keycode key)
+{
+    const SDL_Keycode codes[] = {SDLK_UP, SDLK_DOWN, SDLK_a, SDLK_d, SDLK_SPACE, SDLK_LSHIFT, SDLK_LEFT, SDLK_RIGHT,
+                                 SDLK_PAGEUP, SDLK_PAGEDOWN};
+    const Uint32 keys[] = {KEY_FORWARD, KEY_BACK, KEY_LEFT, KEY_RIGHT, KEY_RISE, KEY_SINK, KEY_TURN_LEFT,
+                           KEY_TURN_RIGHT, KEY_LOOK_UP, KEY_LOOK_DOWN};
+    for (int i = 0; i < (int)(sizeof(codes) / sizeof(codes[0])); i++)
+        if (codes[i] == key)
+            return keys[i];
+    return 0;
+}
+
+/**
+ * Handles the events of the window while the render thread draws. Quitting
+ * and showing the window again never wait for a frame to be finished
+ *
+ *  @param loop Loop of the render thread, already running
+ *  @param initial State the input channel was created with. Only the render thread reads the channel
+ *
+ *  @return void
+ */
+static void handleEvents(FrameLoop* loop, const InputState* initial)
+{
+    Engine* engine = loop->engine;
+    InputState input = *initial;
+    SDL_Event event;
+    int rendering = 1;
+    while (rendering && SDL_WaitEvent(&event))
+    {
+        if (event.type == SDL_QUIT && !isQuitRequested(&loop->input))
+        {
+            // The window goes away now, the render thread stops at its next dirty rectangle
+            SDL_HideWindow(engine->window);
+            SDL_LockMutex(loop->mutex);
+            requestQuit(&loop->input);
+            SDL_CondSignal(loop->done);
+            SDL_UnlockMutex(loop->mutex);
+        }
+        // The canvas still holds the whole frame, it is only shown again
+        else if (event.type == SDL_WINDOWEVENT && (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                                                   event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED))
+            presentCanvas(loop);
+        // W switches between the filled and the wireframe view
+        // Camera keys are published when they go down or up, the renderer moves while they are held
+        else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && cameraKey(event.key.keysym.sym) != 0 &&
+                 !event.key.repeat)
+        {
+            const Uint32 key = cameraKey(event.key.keysym.sym);
+            input.keys = event.type == SDL_KEYDOWN ? input.keys | key : input.keys & ~key;
+            input.timestamp = event.key.timestamp;
+            publishInput(&loop->input, &input);
+        }
+        else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_w && !event.key.repeat)
+        {
+            input.wireframe = !input.wireframe;
+            input.timestamp = event.key.timestamp;
+            publishInput(&loop->input, &input);
+        }
+        else if (event.type == loop->firstEvent + FRAME_PRESENT)
+            presentCanvas(loop);
+        else if (event.type == loop->firstEvent + FRAME_STOPPED)
+            rendering = 0;
+        else if (event.type >= loop->firstEvent && event.type < loop->firstEvent + FRAME_EVENTS)
+            answerFrameEvent(loop, event.type - loop->firstEvent);
+    }
+    // A rectangle the render thread did not finish before quitting
+    if (loop->locked)
+        SDL_UnlockTexture(engine->canvas);
+}
+
+/**
+ * Enters the main loop of the renderer. With a window the frames are drawn on
+ * a thread of their own while this one handles the events, and the dirty
+ * rectangles are drawn straight into the canvas unless they are captured
+ *
+ *  @param engine Engine with the scene, and the window when there is one
+ *  @param loader Loader whose meshes are added as they finish, can be NULL
+ *  @param capture Capture that gets every frame, can be NULL
+ *  @param frames Frames to render before stopping, 0 to run until the window is closed
+ *  @param recorder Recorder of the camera path, can be NULL
+ *  @param replay Camera path to draw instead of following the input, can be NULL
+ *  @param telemetry Block that gets the counters of every frame, can be NULL
+ *  @param trace Trace that gets the stages of every frame, can be NULL
+ *  @param pose Poses the skinned meshes at the animation time of every frame, can be NULL
+ *
+ *  @return void
+ */
+void runFrameLoop(Engine* engine, MeshLoader* loader, FrameCapture* capture, int frames, PathRecorder* recorder,
+                  const Replay* replay, TelemetryBlock* telemetry, TaskTrace* trace, PoseFunction pose)
+{
+    FrameLoop loop;
+    memset(&loop, 0, sizeof(loop));
+    loop.engine = engine;
+    loop.loader = loader;
+    loop.capture = capture;
+    loop.frames = frames;
+    loop.recorder = recorder;
+    loop.replay = replay;
+    loop.telemetry = telemetry;
+    loop.trace = trace;
+    loop.pose = pose;
+    // Captures need the whole frame in the framebuffer, not only the parts that changed, and without
+    // a window there is no canvas
+    loop.direct = capture == NULL && engine->window != NULL;
+    const InputState initial = {engine->wireframe, 0, SDL_GetTicks()};
+    createInputChannel(&loop.input, &initial);
+
+    if (engine->window == NULL)
+        renderFrames(&loop);
+    else
+    {
+        loop.mutex = SDL_CreateMutex();
+        loop.done = SDL_CreateCond();
+        loop.firstEvent = SDL_RegisterEvents(FRAME_EVENTS);
+        SDL_Thread* thread = NULL;
+        if (loop.mutex != NULL && loop.done != NULL && loop.firstEvent != (Uint32)-1)
+            thread = SDL_CreateThread(renderFrames, "render", &loop);
+        if (thread == NULL)
+            fprintf(stderr, "[ERROR] COULD NOT START THE RENDER THREAD!\n[SDL] %s\n", SDL_GetError());
+        else
+        {
+            handleEvents(&loop, &initial);
+            SDL_WaitThread(thread, NULL);
+        }
+        if (loop.done != NULL)
+            SDL_DestroyCond(loop.done);
+        if (loop.mutex != NULL)
+            SDL_DestroyMutex(loop.mutex);
+    }
+}
@@ -0,0 +1,24 @@
+//
+// Frame loop of the renderer: the stages of every frame, drawing only the
+// dirty rectangles, straight into the canvas when there is a window
+//
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "engine.h"
+#include "capture.h"
+#include "input.h"
+#include "loader.h"
+#include "replay.h"
+#include "taskgraph.h"
+#include "telemetry.h"
+
+// Poses a skinned mesh at an animation time, phase tells the meshes apart (their index)
+typedef void (*PoseFunction)(Mesh* mesh, float time, float phase);
+
+/*Function prototypes*/
+void runFrameLoop(Engine* engine, MeshLoader* loader, FrameCapture* capture, int frames, PathRecorder* recorder,
+                  const Replay* replay, TelemetryBlock* telemetry, TaskTrace* trace, PoseFunction pose);
+
+#endif //FRAME_H
@@ -0,0 +1,79 @@
+//
+// Input published by the event thread and read by the render thread
+//
+// Events are handled on the main thread while the frames are drawn on another
+// one, so a slow frame never holds back the window. The input state goes
+// through a triple buffer: publishing and reading both swap one index
+// atomically, neither side ever waits for the other and the renderer always
+// gets the latest complete state
+//
+
+#include "input.h"
+
+/**
+ * Starts a channel with every slot holding the same state
+ *
+ *  @param channel Channel to start
+ *  @param initial State the renderer reads until something is published
+ *
+ *  @return void
+ */
+void createInputChannel(InputChannel* channel, const InputState* initial)
+{
+    for (int i = 0; i < 3; i++)
+        channel->slots[i] = *initial;
+    channel->back = 0;
+    channel->front = 1;
+    SDL_AtomicSet(&channel->latest, 2);
+    SDL_AtomicSet(&channel->quit, 0);
+}
+
+/**
+ * Publishes a new input state. Only the event thread calls this
+ *
+ *  @param channel Channel to publish to
+ *  @param state State copied into the channel
+ *
+ *  @return void
+ */
+void publishInput(InputChannel* channel, const InputState* state)
+{
+    channel->slots[channel->back] = *state;
+    // The slot published before, taken by the renderer or not, becomes the next one to write
+    channel->back = SDL_AtomicSet(&channel->latest, channel->back | INPUT_FRESH) & ~INPUT_FRESH;
+}
+
+/**
+ * Takes the latest input state. Only the render thread calls this, once at
+ * the start of every frame
+ *
+ *  @param channel Channel to read from
+ *
+ *  @return The state, valid until the next readInput
+ */
+const InputState* readInput(InputChannel* channel)
+{
+    if (SDL_AtomicGet(&channel->latest) & INPUT_FRESH)
+        channel->front = SDL_AtomicSet(&channel->latest, channel->front) & ~INPUT_FRESH;
+    return &channel->slots[channel->front];
+}
+
+/**
+ * Asks the renderer to stop as soon as it can
+ *
+ *  @return void
+ */
+void requestQuit(InputChannel* channel)
+{
+    SDL_AtomicSet(&channel->quit, 1);
+}
+
+/**
+ * Tells if the window asked to quit
+ *
+ *  @return 1 if it did, 0 otherwise
+ */
+int isQuitRequested(InputChannel* channel)
+{
+    return SDL_AtomicGet(&channel->quit);
+}
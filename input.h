@@ -0,0 +1,63 @@
+//
+// Input published by the event thread and read by the render thread
+//
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "engine.h"
+
+// Set in InputChannel.latest while the renderer has not taken the slot yet
+#define INPUT_FRESH 0x4
+
+// Keys that fly the camera, bits of InputState.keys
+typedef enum
+{
+    // Up and down arrows
+    KEY_FORWARD = 1 << 0,
+    KEY_BACK = 1 << 1,
+    // A and D
+    KEY_LEFT = 1 << 2,
+    KEY_RIGHT = 1 << 3,
+    // Space and left shift
+    KEY_RISE = 1 << 4,
+    KEY_SINK = 1 << 5,
+    // Left and right arrows
+    KEY_TURN_LEFT = 1 << 6,
+    KEY_TURN_RIGHT = 1 << 7,
+    // Page up and page down
+    KEY_LOOK_UP = 1 << 8,
+    KEY_LOOK_DOWN = 1 << 9
+} CameraKey;
+
+// Everything the renderer needs to know about the input, read once per frame
+typedef struct
+{
+    // Wireframe view toggled by W
+    int wireframe;
+    // Camera keys held down (see CameraKey), the renderer moves the camera while they are
+    Uint32 keys;
+    // SDL_GetTicks of the event that produced this state
+    Uint32 timestamp;
+} InputState;
+
+typedef struct
+{
+    // Triple buffer: the event thread writes slots[back], the renderer reads slots[front],
+    // latest is the one published last. The three indices always differ
+    InputState slots[3];
+    int back;
+    int front;
+    SDL_atomic_t latest;
+    // Checked by the renderer in the middle of a frame as well, it does not wait for the next one
+    SDL_atomic_t quit;
+} InputChannel;
+
+/*Function prototypes*/
+void createInputChannel(InputChannel* channel, const InputState* initial);
+void publishInput(InputChannel* channel, const InputState* state);
+const InputState* readInput(InputChannel* channel);
+void requestQuit(InputChannel* channel);
+int isQuitRequested(InputChannel* channel);
+
+#endif //INPUT_H
@@ -0,0 +1,201 @@
+//
+// Per vertex lighting
+//
+
+#include "light.h"
+#include <math.h>
+#include <stdio.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Adds a light to the engine. Directional lights get their direction
+ * normalized here so the shading does not have to
+ *
+ *  @param engine Engine to add the light to
+ *  @param light Light to add
+ *
+ *  @return 1 if the light was added, 0 if there are already MAX_LIGHTS
+ */
+int addLight(Engine* engine, const Light* light)
+{
+    if (engine->nLights == MAX_LIGHTS)
+    {
+        fprintf(stderr, "[ERROR] NO ROOM FOR MORE THAN %d LIGHTS!\n", MAX_LIGHTS);
+        return 0;
+    }
+    Light* added = &engine->lights[engine->nLights++];
+    *added = *light;
+    if (added->type == LIGHT_DIRECTIONAL)
+        normalizeVector(&added->direction);
+    return 1;
+}
+
+/**
+ * Moves lights to another space, like the view space of a camera. The
+ * transformation must not scale
+ *
+ *  @param lights Lights to move
+ *  @param nLights Number of lights
+ *  @param m Transformation
+ *  @param out nLights lights to store the moved lights
+ *
+ *  @return void
+ */
+void transformLights(const Light* lights, int nLights, const Matrix4x4* m, Light* out)
+{
+    for (int l = 0; l < nLights; l++)
+    {
+        out[l] = lights[l];
+        const Vector d = lights[l].direction;
+        out[l].direction.x = d.x * m->mat[0][0] + d.y * m->mat[1][0] + d.z * m->mat[2][0];
+        out[l].direction.y = d.x * m->mat[0][1] + d.y * m->mat[1][1] + d.z * m->mat[2][1];
+        out[l].direction.z = d.x * m->mat[0][2] + d.y * m->mat[1][2] + d.z * m->mat[2][2];
+        multMatVec(&lights[l].position, &out[l].position, m);
+    }
+}
+
+/**
+ * Light reaching one vertex (Lambert) from every light. Point lights fade out
+ * smoothly until they reach zero at their range
+ *
+ *  @return void
+ */
+static void shadeVertex(const Vector* p, const Vector* normal, const Light* lights, int nLights, int shadowed,
+                        float* rgb, float* shadowRgb)
+{
+    Vector n = *normal;
+    // Zero length normals stay zero instead of turning into NaN, the vertex only gets ambient light
+    if (dotProduct(&n, &n) > 0.0f)
+        normalizeVector(&n);
+    rgb[0] = rgb[1] = rgb[2] = 0.0f;
+    if (shadowed >= 0)
+        shadowRgb[0] = shadowRgb[1] = shadowRgb[2] = 0.0f;
+
+    for (int l = 0; l < nLights; l++)
+    {
+        const Light* light = &lights[l];
+        float amount = 1.0f;
+        if (light->type == LIGHT_DIRECTIONAL)
+            amount = -dotProduct(&n, &light->direction);
+        else if (light->type == LIGHT_POINT)
+        {
+            Vector d = {light->position.x - p->x, light->position.y - p->y, light->position.z - p->z};
+            const float distance2 = dotProduct(&d, &d);
+            const float fade = 1.0f - distance2 / (light->range * light->range);
+            amount = fade > 0.0f ? dotProduct(&n, &d) / sqrtf(distance2) * fade : 0.0f;
+        }
+        amount = fmaxf(amount, 0.0f);
+        float* out = l == shadowed ? shadowRgb : rgb;
+        out[0] += light->r * amount;
+        out[1] += light->g * amount;
+        out[2] += light->b * amount;
+    }
+}
+
+/**
+ * Lights a batch of vertices, which is done once per transformed vertex and
+ * not once per face. With SSE, 4 vertices are lit together
+ *
+ *  @param positions World space positions
+ *  @param normals World space normals, they do not need to be normalized
+ *  @param n Number of vertices
+ *  @param lights Lights to use
+ *  @param nLights Number of lights
+ *  @param shadowed Light whose shadows are looked up later, kept apart in shadowRgb. -1 for none
+ *  @param rgb 3 floats per vertex to store the light reaching it
+ *  @param shadowRgb 3 floats per vertex to store the light of the shadowed light, can be NULL without one
+ *
+ *  @return void
+ */
+void shadeVertices(const Vector* positions, const Vector* normals, int n, const Light* lights, int nLights,
+                   int shadowed, float* rgb, float* shadowRgb)
+{
+    int v = 0;
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    for (; v + 4 <= n; v += 4)
+    {
+        // Structure of arrays for the 4 vertices
+        __m128 nx = _mm_set_ps(normals[v + 3].x, normals[v + 2].x, normals[v + 1].x, normals[v].x);
+        __m128 ny = _mm_set_ps(normals[v + 3].y, normals[v + 2].y, normals[v + 1].y, normals[v].y);
+        __m128 nz = _mm_set_ps(normals[v + 3].z, normals[v + 2].z, normals[v + 1].z, normals[v].z);
+        const __m128 px = _mm_set_ps(positions[v + 3].x, positions[v + 2].x, positions[v + 1].x, positions[v].x);
+        const __m128 py = _mm_set_ps(positions[v + 3].y, positions[v + 2].y, positions[v + 1].y, positions[v].y);
+        const __m128 pz = _mm_set_ps(positions[v + 3].z, positions[v + 2].z, positions[v + 1].z, positions[v].z);
+
+        const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)),
+                                                     _mm_mul_ps(nz, nz)));
+        // Zero length normals stay zero instead of turning into NaN
+        const __m128 scale = _mm_and_ps(_mm_cmpgt_ps(length, zero), _mm_div_ps(one, length));
+        nx = _mm_mul_ps(nx, scale);
+        ny = _mm_mul_ps(ny, scale);
+        nz = _mm_mul_ps(nz, scale);
+
+        __m128 r = zero, g = zero, b = zero;
+        __m128 sr = zero, sg = zero, sb = zero;
+        for (int l = 0; l < nLights; l++)
+        {
+            const Light* light = &lights[l];
+            __m128 amount = one;
+            if (light->type == LIGHT_DIRECTIONAL)
+            {
+                amount = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(-light->direction.x)),
+                                               _mm_mul_ps(ny, _mm_set1_ps(-light->direction.y))),
+                                    _mm_mul_ps(nz, _mm_set1_ps(-light->direction.z)));
+            }
+            else if (light->type == LIGHT_POINT)
+            {
+                const __m128 dx = _mm_sub_ps(_mm_set1_ps(light->position.x), px);
+                const __m128 dy = _mm_sub_ps(_mm_set1_ps(light->position.y), py);
+                const __m128 dz = _mm_sub_ps(_mm_set1_ps(light->position.z), pz);
+                const __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                                    _mm_mul_ps(dz, dz));
+                const __m128 fade = _mm_max_ps(zero, _mm_sub_ps(one, _mm_div_ps(distance2,
+                                               _mm_set1_ps(light->range * light->range))));
+                const __m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)),
+                                                 _mm_mul_ps(nz, dz));
+                amount = _mm_mul_ps(_mm_div_ps(facing, _mm_sqrt_ps(distance2)), fade);
+            }
+            amount = _mm_max_ps(amount, zero);
+            const __m128 lr = _mm_mul_ps(amount, _mm_set1_ps(light->r));
+            const __m128 lg = _mm_mul_ps(amount, _mm_set1_ps(light->g));
+            const __m128 lb = _mm_mul_ps(amount, _mm_set1_ps(light->b));
+            if (l == shadowed)
+            {
+                sr = lr;
+                sg = lg;
+                sb = lb;
+                continue;
+            }
+            r = _mm_add_ps(r, lr);
+            g = _mm_add_ps(g, lg);
+            b = _mm_add_ps(b, lb);
+        }
+
+        float out[6][4];
+        _mm_storeu_ps(out[0], r);
+        _mm_storeu_ps(out[1], g);
+        _mm_storeu_ps(out[2], b);
+        _mm_storeu_ps(out[3], sr);
+        _mm_storeu_ps(out[4], sg);
+        _mm_storeu_ps(out[5], sb);
+        for (int i = 0; i < 4; i++)
+        {
+            rgb[(v + i) * 3 + 0] = out[0][i];
+            rgb[(v + i) * 3 + 1] = out[1][i];
+            rgb[(v + i) * 3 + 2] = out[2][i];
+            if (shadowed < 0)
+                continue;
+            shadowRgb[(v + i) * 3 + 0] = out[3][i];
+            shadowRgb[(v + i) * 3 + 1] = out[4][i];
+            shadowRgb[(v + i) * 3 + 2] = out[5][i];
+        }
+    }
+#endif
+    for (; v < n; v++)
+        shadeVertex(&positions[v], &normals[v], lights, nLights, shadowed, &rgb[v * 3],
+                    shadowed >= 0 ? &shadowRgb[v * 3] : NULL);
+}
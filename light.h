@@ -0,0 +1,16 @@
+//
+// Per vertex lighting
+//
+
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "engine.h"
+
+/*Function prototypes*/
+int addLight(Engine* engine, const Light* light);
+void transformLights(const Light* lights, int nLights, const Matrix4x4* m, Light* out);
+void shadeVertices(const Vector* positions, const Vector* normals, int n, const Light* lights, int nLights,
+                   int shadowed, float* rgb, float* shadowRgb);
+
+#endif //LIGHT_H
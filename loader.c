@@ -0,0 +1,474 @@
+//
+// Background mesh loading and hot reloading of changed mesh files
+//
+
+#include "loader.h"
+#include "compact.h"
+#include "scene.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Grows an array loaded from a file, doubling its capacity when it is full
+ *
+ *  @return 1 on success, 0 if there is no memory left
+ */
+static int reserve(void** array, int* capacity, int count, size_t size)
+{
+    if (count < *capacity)
+        return 1;
+    const int grown = *capacity ? *capacity * 2 : 256;
+    void* memory = realloc(*array, grown * size);
+    if (memory == NULL)
+    {
+        perror("[ERROR] ALLOCATING MEMORY FAILED!");
+        return 0;
+    }
+    *array = memory;
+    *capacity = grown;
+    return 1;
+}
+
+/**
+ * Turns a 1 based (or negative, counting from the end) OBJ index into a 0 based one
+ *
+ *  @return The index, -1 if it is out of range
+ */
+static int objIndex(int index, int count)
+{
+    index = index < 0 ? count + index : index - 1;
+    return index >= 0 && index < count ? index : -1;
+}
+
+/**
+ * Reads the triangles of a Wavefront OBJ file (positions, texture coordinates
+ * and polygonal faces). OBJ is y up while our y points down, so y is flipped
+ * and the faces turned around to keep them facing out
+ *
+ *  @param path File to read
+ *  @param tris Set to the triangle soup, freed by the caller
+ *
+ *  @return Number of triangles, 0 on failure
+ */
+int loadObjTriangles(const char* path, Triangle** tris)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT OPEN THE MESH FILE %s!\n", path);
+        return 0;
+    }
+
+    Vector* positions = NULL;
+    TexCoord* uvs = NULL;
+    *tris = NULL;
+    int nPositions = 0, nUvs = 0, nTris = 0;
+    int positionsCapacity = 0, uvsCapacity = 0, trisCapacity = 0;
+    int ok = 1;
+    char line[512];
+
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == 'v' && line[1] == ' ')
+        {
+            Vector p = {0.0f, 0.0f, 0.0f};
+            sscanf(line + 2, "%f %f %f", &p.x, &p.y, &p.z);
+            p.y = -p.y;
+            ok = reserve((void**)&positions, &positionsCapacity, nPositions, sizeof(Vector));
+            if (ok)
+                positions[nPositions++] = p;
+        }
+        else if (line[0] == 'v' && line[1] == 't' && line[2] == ' ')
+        {
+            TexCoord uv = {0.0f, 0.0f};
+            sscanf(line + 3, "%f %f", &uv.u, &uv.v);
+            // OBJ puts v = 0 at the bottom of the image
+            uv.v = 1.0f - uv.v;
+            ok = reserve((void**)&uvs, &uvsCapacity, nUvs, sizeof(TexCoord));
+            if (ok)
+                uvs[nUvs++] = uv;
+        }
+        else if (line[0] == 'f' && line[1] == ' ')
+        {
+            // Polygons are split into a fan of triangles around their first corner
+            Vector corners[3];
+            TexCoord cornerUvs[3];
+            int nCorners = 0;
+            char token[64];
+            int used;
+            for (const char* at = line + 2; sscanf(at, "%63s%n", token, &used) == 1; at += used)
+            {
+                int p = 0, t = 0;
+                if (sscanf(token, "%d/%d", &p, &t) < 1 || objIndex(p, nPositions) < 0)
+                {
+                    fprintf(stderr, "[ERROR] BAD FACE IN THE MESH FILE %s!\n", path);
+                    ok = 0;
+                    break;
+                }
+                const int slot = nCorners < 3 ? nCorners : 2;
+                if (nCorners >= 3)
+                {
+                    corners[1] = corners[2];
+                    cornerUvs[1] = cornerUvs[2];
+                }
+                corners[slot] = positions[objIndex(p, nPositions)];
+                cornerUvs[slot] = objIndex(t, nUvs) >= 0 ? uvs[objIndex(t, nUvs)] : (TexCoord){0.0f, 0.0f};
+                if (++nCorners < 3)
+                    continue;
+
+                ok = reserve((void**)tris, &trisCapacity, nTris, sizeof(Triangle));
+                if (!ok)
+                    break;
+                Triangle* tri = &(*tris)[nTris++];
+                // Flipping y mirrored the faces, so the winding is flipped too
+                tri->points[0] = corners[0];
+                tri->points[1] = corners[2];
+                tri->points[2] = corners[1];
+                tri->uv[0] = cornerUvs[0];
+                tri->uv[1] = cornerUvs[2];
+                tri->uv[2] = cornerUvs[1];
+                tri->light = 0.0f;
+            }
+        }
+    }
+    fclose(file);
+    free(positions);
+    free(uvs);
+
+    if (ok && nTris == 0)
+    {
+        fprintf(stderr, "[ERROR] THE MESH FILE %s HAS NO FACES!\n", path);
+        ok = 0;
+    }
+    if (!ok)
+    {
+        free(*tris);
+        *tris = NULL;
+        return 0;
+    }
+    return nTris;
+}
+
+/**
+ * Loads a Wavefront OBJ file (see loadObjTriangles) and prepares it for drawing
+ *
+ *  @param path File to load
+ *  @param mesh Mesh to fill, ready to draw on success
+ *  @param compact Switch the mesh to the compact storage (see compressMesh)
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int loadMeshFile(const char* path, Mesh* mesh, int compact)
+{
+    Triangle* tris;
+    const int nTris = loadObjTriangles(path, &tris);
+    if (nTris == 0)
+        return 0;
+
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->nTris = nTris;
+    mesh->tris = tris;
+    prepareMesh(mesh);
+    if (compact)
+        compressMesh(mesh);
+    return 1;
+}
+
+#ifdef __linux__
+/**
+ * Marks the assets whose files were written or replaced since the last call
+ * as pending. Editors often save by renaming a new file over the old one, so
+ * the folder is watched and not the file itself
+ *
+ *  @param loader Loader, the mutex has to be held
+ *
+ *  @return void
+ */
+static void checkChangedFiles(MeshLoader* loader)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(loader->notify, buffer, sizeof(buffer))) > 0)
+    {
+        for (char* at = buffer; at < buffer + length;)
+        {
+            const struct inotify_event* event = (const struct inotify_event*)at;
+            at += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0)
+                continue;
+            for (int a = 0; a < loader->nAssets; a++)
+            {
+                Asset* asset = &loader->assets[a];
+                const char* name = strrchr(asset->path, '/');
+                name = name != NULL ? name + 1 : asset->path;
+                if (asset->watch == event->wd && strcmp(name, event->name) == 0)
+                    asset->pending = 1;
+            }
+        }
+    }
+}
+#endif
+
+/**
+ * Loader thread: loads pending assets one at a time without holding the
+ * mutex, and looks for changed files while there is nothing to do
+ *
+ *  @param data The MeshLoader
+ *
+ *  @return 0
+ */
+static int loaderThread(void* data)
+{
+    MeshLoader* loader = data;
+    SDL_LockMutex(loader->mutex);
+    while (loader->running)
+    {
+        int next = -1;
+        for (int a = 0; a < loader->nAssets && next < 0; a++)
+            if (loader->assets[a].pending)
+                next = a;
+        if (next < 0)
+        {
+            SDL_CondWaitTimeout(loader->wake, loader->mutex, LOADER_POLL_MS);
+#ifdef __linux__
+            if (loader->notify >= 0)
+                checkChangedFiles(loader);
+#endif
+            continue;
+        }
+
+        Asset* asset = &loader->assets[next];
+        asset->pending = 0;
+        char path[ASSET_PATH_LENGTH];
+        memcpy(path, asset->path, sizeof(path));
+        loader->loading = 1;
+        SDL_UnlockMutex(loader->mutex);
+
+        Mesh mesh;
+        const int loaded = loadMeshFile(path, &mesh, loader->compact);
+
+        SDL_LockMutex(loader->mutex);
+        loader->loading = 0;
+        if (loaded)
+        {
+            // A newer version replaces one that was never published
+            if (asset->ready)
+                freeMesh(&asset->mesh);
+            mesh.asset = next + 1;
+            mesh.shadowCaster = 1;
+            asset->mesh = mesh;
+            asset->ready = 1;
+        }
+    }
+    SDL_UnlockMutex(loader->mutex);
+    return 0;
+}
+
+/**
+ * Starts the loader thread. Hot reloading is only available on Linux (inotify)
+ *
+ *  @param loader Loader to start
+ *  @param compact Switch every loaded mesh to the compact storage (see compressMesh)
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int createLoader(MeshLoader* loader, int compact)
+{
+    memset(loader, 0, sizeof(*loader));
+    loader->notify = -1;
+    loader->compact = compact;
+#ifdef __linux__
+    loader->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (loader->notify < 0)
+        perror("[ERROR] HOT RELOADING IS NOT AVAILABLE");
+#endif
+    loader->running = 1;
+    loader->mutex = SDL_CreateMutex();
+    loader->wake = SDL_CreateCond();
+    if (loader->mutex == NULL || loader->wake == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CREATE THE LOADER LOCKS!\n[SDL] %s\n", SDL_GetError());
+        destroyLoader(loader);
+        return 0;
+    }
+    loader->thread = SDL_CreateThread(loaderThread, "loader", loader);
+    if (loader->thread == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT START THE LOADER THREAD!\n[SDL] %s\n", SDL_GetError());
+        destroyLoader(loader);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Stops the loader thread and frees the meshes that were never published
+ *
+ *  @param loader Loader to stop
+ *
+ *  @return void
+ */
+void destroyLoader(MeshLoader* loader)
+{
+    if (loader->thread != NULL)
+    {
+        SDL_LockMutex(loader->mutex);
+        loader->running = 0;
+        SDL_CondSignal(loader->wake);
+        SDL_UnlockMutex(loader->mutex);
+        SDL_WaitThread(loader->thread, NULL);
+        loader->thread = NULL;
+    }
+    for (int a = 0; a < loader->nAssets; a++)
+    {
+        if (loader->assets[a].ready)
+            freeMesh(&loader->assets[a].mesh);
+        loader->assets[a].ready = 0;
+    }
+#ifdef __linux__
+    if (loader->notify >= 0)
+        close(loader->notify);
+    loader->notify = -1;
+#endif
+    SDL_DestroyCond(loader->wake);
+    SDL_DestroyMutex(loader->mutex);
+    loader->wake = NULL;
+    loader->mutex = NULL;
+}
+
+/**
+ * Asks the loader thread to load a mesh file. The mesh shows up in the
+ * engine at the first frame boundary after it is ready (see
+ * publishLoadedMeshes), and again every time the file changes
+ *
+ *  @param loader Loader
+ *  @param path Mesh file to load
+ *  @param position Where to place the mesh
+ *
+ *  @return 1 if the request was queued, 0 if there is no room for more assets
+ */
+int requestMesh(MeshLoader* loader, const char* path, const Vector* position)
+{
+    if (strlen(path) >= ASSET_PATH_LENGTH)
+    {
+        fprintf(stderr, "[ERROR] THE PATH %s IS TOO LONG!\n", path);
+        return 0;
+    }
+
+    SDL_LockMutex(loader->mutex);
+    if (loader->nAssets == MAX_ASSETS)
+    {
+        SDL_UnlockMutex(loader->mutex);
+        fprintf(stderr, "[ERROR] NO ROOM FOR MORE THAN %d ASSETS!\n", MAX_ASSETS);
+        return 0;
+    }
+    Asset* asset = &loader->assets[loader->nAssets++];
+    memset(asset, 0, sizeof(*asset));
+    strcpy(asset->path, path);
+    asset->position = *position;
+    asset->pending = 1;
+    asset->watch = -1;
+#ifdef __linux__
+    if (loader->notify >= 0)
+    {
+        char folder[ASSET_PATH_LENGTH];
+        strcpy(folder, path);
+        char* slash = strrchr(folder, '/');
+        if (slash == NULL)
+            strcpy(folder, ".");
+        else if (slash == folder)
+            slash[1] = '\0';
+        else
+            *slash = '\0';
+        asset->watch = inotify_add_watch(loader->notify, folder, IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+#endif
+    SDL_CondSignal(loader->wake);
+    SDL_UnlockMutex(loader->mutex);
+    return 1;
+}
+
+/**
+ * Moves the meshes the loader finished into the engine. Called once per
+ * frame before anything is drawn, so a frame never sees half of a change.
+ * New meshes get a root node at the asset position, reloaded ones take the
+ * place of their old version and keep its node
+ *
+ *  @param loader Loader
+ *  @param engine Engine to add the meshes to
+ *
+ *  @return Number of meshes published
+ */
+int publishLoadedMeshes(MeshLoader* loader, Engine* engine)
+{
+    // Never wait for the loader, it may be in the middle of a big file
+    if (SDL_TryLockMutex(loader->mutex) != 0)
+        return 0;
+
+    int published = 0;
+    for (int a = 0; a < loader->nAssets; a++)
+    {
+        Asset* asset = &loader->assets[a];
+        if (!asset->ready)
+            continue;
+
+        Mesh* target = NULL;
+        for (int i = 0; i < engine->nMeshes && target == NULL; i++)
+            if (engine->meshes[i].asset == a + 1)
+                target = &engine->meshes[i];
+
+        if (target != NULL)
+        {
+            // Keep the node and the old screen area so it gets cleared, the dirty node forces a redraw
+            const SDL_Rect rect = target->rect;
+            const int node = target->node;
+            freeMesh(target);
+            *target = asset->mesh;
+            target->rect = rect;
+            target->node = node;
+            engine->nodes[node].dirty = 1;
+        }
+        else
+        {
+            Mesh* meshes = realloc(engine->meshes, (engine->nMeshes + 1) * sizeof(Mesh));
+            if (meshes == NULL)
+            {
+                perror("[ERROR] ALLOCATING MEMORY FAILED!");
+                continue;
+            }
+            engine->meshes = meshes;
+            engine->meshes[engine->nMeshes++] = asset->mesh;
+            const Matrix4x4 place = translationMatrix(&asset->position);
+            addNode(engine, -1, &place, engine->nMeshes - 1);
+        }
+        asset->ready = 0;
+        published++;
+    }
+    SDL_UnlockMutex(loader->mutex);
+    return published;
+}
+
+/**
+ * Tells if the loader has nothing left to do: no file waiting or being
+ * loaded, and every loaded mesh published
+ *
+ *  @param loader Loader
+ *
+ *  @return 1 when idle, 0 otherwise
+ */
+int isLoaderIdle(MeshLoader* loader)
+{
+    SDL_LockMutex(loader->mutex);
+    int idle = !loader->loading;
+    for (int a = 0; a < loader->nAssets && idle; a++)
+        idle = !loader->assets[a].pending && !loader->assets[a].ready;
+    SDL_UnlockMutex(loader->mutex);
+    return idle;
+}
@@ -0,0 +1,56 @@
+//
+// Background mesh loading and hot reloading of changed mesh files
+//
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "engine.h"
+
+// Mesh files the loader can keep track of
+#define MAX_ASSETS 64
+#define ASSET_PATH_LENGTH 256
+// How often the loader looks for changed files while it has nothing to load
+#define LOADER_POLL_MS 100
+
+typedef struct
+{
+    char path[ASSET_PATH_LENGTH];
+    // Placement of the mesh once it is published
+    Vector position;
+    // Set when the file has to be (re)loaded
+    int pending;
+    // A loaded mesh waiting for the next frame boundary
+    int ready;
+    Mesh mesh;
+    // inotify watch of the folder the file is in
+    int watch;
+} Asset;
+
+typedef struct
+{
+    SDL_Thread* thread;
+    // Guards everything below, the condition wakes the thread up for new requests
+    SDL_mutex* mutex;
+    SDL_cond* wake;
+    int running;
+    int nAssets;
+    Asset assets[MAX_ASSETS];
+    // Set while the thread is reading a file
+    int loading;
+    // inotify descriptor, -1 when hot reloading is not available
+    int notify;
+    // Loaded meshes are switched to the compact storage (see compact.h)
+    int compact;
+} MeshLoader;
+
+/*Function prototypes*/
+int loadObjTriangles(const char* path, Triangle** tris);
+int loadMeshFile(const char* path, Mesh* mesh, int compact);
+int createLoader(MeshLoader* loader, int compact);
+void destroyLoader(MeshLoader* loader);
+int requestMesh(MeshLoader* loader, const char* path, const Vector* position);
+int publishLoadedMeshes(MeshLoader* loader, Engine* engine);
+int isLoaderIdle(MeshLoader* loader);
+
+#endif //LOADER_H
@@ -5,175 +5,382 @@
 #include <SDL.h>
 #include <stdio.h>
 
+#include "camera.h"
+#include "capture.h"
+#include "compact.h"
 #include "engine.h"
+#include "frame.h"
+#include "light.h"
+#include "loader.h"
+#include "occlusion.h"
+#include "pointcloud.h"
+#include "pool.h"
+#include "raster.h"
+#include "render.h"
+#include "replay.h"
+#include "scene.h"
+#include "server.h"
+#include "shadow.h"
+#include "skin.h"
+#include "stream.h"
+#include "taskgraph.h"
+#include "telemetry.h"
+#include "texture.h"
 
-Vector camera = {0.0f, 0.0f, 0.0f};
+// Animated characters: tubes standing on the floor, bent by a chain of bones like grass in the wind
+#define CHARACTER_BONES 4
+#define CHARACTER_RINGS 8
+#define CHARACTER_SIDES 10
+#define CHARACTER_HEIGHT 1.0f
+#define CHARACTER_RADIUS 0.1f
+// Side of the box point clouds are scaled to
+#define CLOUD_SIZE 3.0f
+
+/**
+ * Builds the mesh of a character at rest, a closed tube going up from the
+ * origin (y points down)
+ *
+ *  @param mesh Mesh to fill, prepared for drawing
+ *
+ *  @return void
+ */
+static void buildCharacter(Mesh* mesh)
+{
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->nTris = CHARACTER_RINGS * CHARACTER_SIDES * 2 + CHARACTER_SIDES * 2;
+    ALLOCATE(mesh->tris, mesh->nTris * sizeof(Triangle));
+    Triangle* tri = mesh->tris;
+    for (int r = 0; r < CHARACTER_RINGS; r++)
+        for (int s = 0; s < CHARACTER_SIDES; s++)
+        {
+            const float a0 = 2.0f * (float)M_PI * s / CHARACTER_SIDES;
+            const float a1 = 2.0f * (float)M_PI * (s + 1) / CHARACTER_SIDES;
+            const float y0 = -CHARACTER_HEIGHT * r / CHARACTER_RINGS;
+            const float y1 = -CHARACTER_HEIGHT * (r + 1) / CHARACTER_RINGS;
+            const Vector p00 = {CHARACTER_RADIUS * cosf(a0), y0, CHARACTER_RADIUS * sinf(a0)};
+            const Vector p01 = {CHARACTER_RADIUS * cosf(a1), y0, CHARACTER_RADIUS * sinf(a1)};
+            const Vector p10 = {CHARACTER_RADIUS * cosf(a0), y1, CHARACTER_RADIUS * sinf(a0)};
+            const Vector p11 = {CHARACTER_RADIUS * cosf(a1), y1, CHARACTER_RADIUS * sinf(a1)};
+            *tri++ = (Triangle){{p00, p11, p10}};
+            *tri++ = (Triangle){{p00, p01, p11}};
+            // Caps on both ends
+            if (r == 0)
+                *tri++ = (Triangle){{{0.0f, y0, 0.0f}, p01, p00}};
+            if (r == CHARACTER_RINGS - 1)
+                *tri++ = (Triangle){{{0.0f, y1, 0.0f}, p10, p11}};
+        }
+    prepareMesh(mesh);
+}
+
+/**
+ * Bends a character: every bone turns around its joint, carrying the bones
+ * above it along
+ *
+ *  @param mesh Character to pose
+ *  @param time Animation time
+ *  @param phase Offset of the animation of this character
+ *
+ *  @return void
+ */
+static void poseCharacter(Mesh* mesh, float time, float phase)
+{
+    Skin* skin = mesh->skin;
+    const float length = CHARACTER_HEIGHT / CHARACTER_BONES;
+    for (int b = 0; b < skin->nBones; b++)
+    {
+        const float angle = 0.25f * sinf(time + phase + 0.8f * b);
+        const float c = cosf(angle), s = sinf(angle);
+        const Matrix4x4 bend = {{{c, -s, 0.0f, 0.0f}, {s, c, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f},
+                                 {0.0f, 0.0f, 0.0f, 1.0f}}};
+        // Around the joint at the bottom of the bone
+        const Vector down = {0.0f, b * length, 0.0f};
+        const Vector up = {0.0f, -b * length, 0.0f};
+        const Matrix4x4 toJoint = translationMatrix(&down);
+        const Matrix4x4 fromJoint = translationMatrix(&up);
+        const Matrix4x4 turned = multMatMat(&toJoint, &bend);
+        const Matrix4x4 local = multMatMat(&turned, &fromJoint);
+        skin->palette[b] = b == 0 ? local : multMatMat(&local, &skin->palette[b - 1]);
+    }
+    skin->dirty = 1;
+}
+
+/**
+ * Adds animated characters in rows on the floor, all copies of the same
+ * mesh with a skin of their own
+ *
+ *  @param engine Engine to add them to
+ *  @param count Number of characters
+ *
+ *  @return void
+ */
+static void addCharacters(Engine* engine, int count)
+{
+    Mesh character;
+    buildCharacter(&character);
+    // Every vertex hangs from the two bones closest to its height
+    Uint8* bones;
+    float* weights;
+    ALLOCATE(bones, character.nVerts * SKIN_INFLUENCES * sizeof(Uint8));
+    ALLOCATE(weights, character.nVerts * SKIN_INFLUENCES * sizeof(float));
+    memset(bones, 0, character.nVerts * SKIN_INFLUENCES * sizeof(Uint8));
+    memset(weights, 0, character.nVerts * SKIN_INFLUENCES * sizeof(float));
+    for (int v = 0; v < character.nVerts; v++)
+    {
+        const float t = SDL_max(0.0f, -character.verts[v].y / (CHARACTER_HEIGHT / CHARACTER_BONES) - 0.5f);
+        const int bone = SDL_min((int)t, CHARACTER_BONES - 1);
+        const float blend = bone + 1 < CHARACTER_BONES ? t - (float)bone : 0.0f;
+        bones[v * SKIN_INFLUENCES] = (Uint8)bone;
+        weights[v * SKIN_INFLUENCES] = 1.0f - blend;
+        bones[v * SKIN_INFLUENCES + 1] = (Uint8)SDL_min(bone + 1, CHARACTER_BONES - 1);
+        weights[v * SKIN_INFLUENCES + 1] = blend;
+    }
+
+    Mesh* meshes = realloc(engine->meshes, (engine->nMeshes + count) * sizeof(Mesh));
+    if (meshes == NULL)
+        perror("[ERROR] ALLOCATING MEMORY FAILED!");
+    const int columns = (int)ceilf(sqrtf((float)count));
+    for (int i = 0; i < count && meshes != NULL; i++)
+    {
+        engine->meshes = meshes;
+        Mesh* mesh = &engine->meshes[engine->nMeshes++];
+        copyMesh(&character, mesh);
+        createSkin(mesh, CHARACTER_BONES, bones, weights);
+        poseCharacter(mesh, 0.0f, (float)i);
+        const Vector position = {-2.5f + 5.0f * (i % columns + 0.5f) / columns, 2.0f,
+                                 4.0f + 4.0f * (i / columns + 0.5f) / columns};
+        const Matrix4x4 place = translationMatrix(&position);
+        addNode(engine, -1, &place, engine->nMeshes - 1);
+    }
+    free(bones);
+    free(weights);
+    freeMesh(&character);
+}
 
 /**
  * Construct the engine (initialize the window, renderer, meshes, ...)
  *
  * @param engine Engine to be initialized
+ * @param headless Render without a window, only into the framebuffer
+ * @param samples Samples per pixel of the framebuffer, 4 or 8 for anti-aliasing
  *
  * @return status
  */
-int constructEngine(Engine* engine)
+int constructEngine(Engine* engine, int headless, int samples)
 {
+    engine->window = NULL;
+    engine->renderer = NULL;
+    engine->canvas = NULL;
+    engine->nDirty = 0;
+    engine->nLights = 0;
+    engine->nStreams = 0;
+    engine->streams = NULL;
+    engine->nClouds = 0;
+    engine->clouds = NULL;
+    engine->pointSize = 1;
+    engine->nNodes = 0;
+    engine->nodesCapacity = 0;
+    engine->wireframe = 0;
+    engine->nodes = NULL;
+    // The framebuffer keeps the last frame around so only what changed has to be redrawn
+    createFramebuffer(&engine->fb, WIDTH, HEIGHT, samples);
+    // The cube and the floor
+    ALLOCATE(engine->meshes, 2 * sizeof(Mesh));
+    if (headless)
+        return 1;
+
     // Initialize SDL
     CHECK_INITIALIZATION("SOMETHING WENT WRONG WHILE INITIALIZING SDL");
     // Create a window
     SDL_Window* window = SDL_CreateWindow("RENDERER",SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                          WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
+                                          WIDTH, HEIGHT, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
     CHECK_WINDOW_CREATION(window, "SOMETHING WENT WRONG WHEN CREATING THE WINDOW");
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     CHECK_RENDERER_CREATION(window, renderer, "SOMETHING WENT WRONG WHILE CREATING THE RENDERER");
+    // The frame keeps its size and proportions however the window is resized
+    SDL_RenderSetLogicalSize(renderer, WIDTH, HEIGHT);
+    // The canvas shows the framebuffer, only the parts of it that changed are uploaded
+    SDL_Texture* canvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                            WIDTH, HEIGHT);
+    CHECK_TEXTURE_CREATION(window, renderer, canvas, "SOMETHING WENT WRONG WHILE CREATING THE CANVAS");
 
     engine->window = window;
     engine->renderer = renderer;
+    engine->canvas = canvas;
     // Set Background color to white
     SDL_SetRenderDrawColor(engine->renderer, 255, 255, 255, 255);
-    ALLOCATE(engine->meshes, sizeof(Mesh));
 
     return 1;
 }
 
+/**
+ * Frees the meshes, the streams, the point clouds, the scene graph and the framebuffer of the engine
+ *
+ * @param engine Engine to be destroyed
+ *
+ * @return void
+ */
+void destroyEngine(Engine* engine)
+{
+    // Free Meshes data
+    for (int i = 0; i < engine->nMeshes; i++)
+        freeMesh(&engine->meshes[i]);
+
+    // Free the array of Meshes
+    free(engine->meshes);
+    for (int i = 0; i < engine->nStreams; i++)
+        destroyMeshStream(&engine->streams[i]);
+    free(engine->streams);
+    for (int i = 0; i < engine->nClouds; i++)
+        freePointCloud(&engine->clouds[i]);
+    free(engine->clouds);
+    freeSceneGraph(engine);
+    freeFramebuffer(&engine->fb);
+    if (engine->canvas != NULL)
+        SDL_DestroyTexture(engine->canvas);
+}
+
 /**
  * Defines the necessary things for the engine to run and enters
- * the main loop
+ * the main loop (see runFrameLoop), then destroys the engine
  *
  *  @param engine Engine that is going to be started
+ *  @param loader Loader whose meshes are added as they finish, can be NULL
+ *  @param capture Capture that gets every frame, can be NULL
+ *  @param frames Frames to render before stopping, 0 to run until the window is closed
+ *  @param recorder Recorder of the camera path, can be NULL
+ *  @param replay Camera path to draw instead of following the input, can be NULL
+ *  @param telemetry Block that gets the counters of every frame, can be NULL
+ *  @param trace Trace that gets the stages of every frame, can be NULL
  *
  *  @return void
  */
-void start(const Engine* engine)
+void start(Engine* engine, MeshLoader* loader, FrameCapture* capture, int frames, PathRecorder* recorder,
+           const Replay* replay, TelemetryBlock* telemetry, TaskTrace* trace)
 {
-    SDL_Event event;
-    int running = 1;
+    runFrameLoop(engine, loader, capture, frames, recorder, replay, telemetry, trace, poseCharacter);
+    destroyEngine(engine);
+}
 
-    // Defining the projection matrix
-    const Matrix4x4 proj_mat =
-    {
-        {
-            {ASPECT_RATIO * FOV_TAN, 0.0f, 0.0f, 0.0f},
-            {0.0f, FOV_TAN, 0.0f, 0.0f},
-            {0.0f, 0.0f, Q, 1.0f},
-            {0.0f, 0.0f, -Z_NEAR * Q, 0.0f}
-        }
-    };
+typedef struct
+{
+    const Engine* engine;
+    const CameraPose* poses;
+    const Matrix4x4* proj;
+    const ShadowMap* shadow;
+    // One per worker
+    Framebuffer* fbs;
+    const char* pattern;
+    SDL_atomic_t failed;
+} BatchJob;
 
-    float theta = 0.0f;
-    // Main Loop
-    while (running)
-    {
-        // TODO: Make this Matrices better and use less space
-        Matrix4x4 rot_mat_x =
-        {
-            {
-                {1.0f, 0.0f, 0.0f, 0.0f},
-                {0.0f, cosf(TO_RAD(theta)), -sinf(TO_RAD(theta)), 0.0f},
-                {0.0f, sinf(TO_RAD(theta)), cosf(TO_RAD(theta)), 0.0f},
-                {0.0f, 0.0f, 0.0f, 1.0f}
-            }
-        };
+/**
+ * Renders one pose of a batch into the framebuffer of the worker and writes it
+ *
+ *  @return void
+ */
+static void renderBatchFrame(void* data, int index, int worker)
+{
+    BatchJob* job = data;
+    Framebuffer* fb = &job->fbs[worker];
+    renderView(job->engine, &job->poses[index], job->proj, job->shadow, NULL, 0, fb);
 
-        Matrix4x4 rot_mat_y =
-        {
-            {
-                {cosf(TO_RAD(theta)), 0.0f, sinf(TO_RAD(theta)), 0.0f},
-                {0.0f, 1.0f, 0.0f, 0.0f},
-                {-sinf(TO_RAD(theta)), 0.0f, cosf(TO_RAD(theta)), 0.0f},
-                {0.0f, 0.0f, 0.0f, 1.0f}
-            }
-        };
+    char name[CAPTURE_PATH_LENGTH + 16];
+    snprintf(name, sizeof(name), job->pattern, index);
+    if (!writeImage(name, fb->color, fb->width, fb->height))
+        SDL_AtomicAdd(&job->failed, 1);
+}
 
-        Matrix4x4 rot_mat_z =
-        {
-            {
-                {cosf(TO_RAD(theta)), -sinf(TO_RAD(theta)), 0.0f, 0.0f},
-                {sinf(TO_RAD(theta)), cosf(TO_RAD(theta)), 0.0f, 0.0f},
-                {0.0f, 0.0f, 1.0f, 0.0f},
-                {0.0f, 0.0f, 0.0f, 1.0f}
-            }
-        };
+/**
+ * Renders the scene once from every camera pose of a list. The scene is
+ * settled first and then only read, so the frames are independent and go
+ * to all the cores at once, every worker drawing into its own framebuffer
+ * and writing each frame as soon as it is done
+ *
+ *  @param engine Engine with the scene
+ *  @param loader Loader whose meshes are waited for, can be NULL
+ *  @param posesPath Camera poses (see loadCameraPoses)
+ *  @param pattern printf pattern for the files of the frames (.png or .ppm), gets the pose number. It has to
+ *                 pass isFramePattern
+ *  @param nWorkers Threads to render with, 0 for one per CPU core
+ *
+ *  @return 1 if every frame was written, 0 otherwise
+ */
+int renderBatch(Engine* engine, MeshLoader* loader, const char* posesPath, const char* pattern, int nWorkers)
+{
+    CameraPose* poses;
+    const int nPoses = loadCameraPoses(posesPath, &poses);
+    if (nPoses < 0)
+    {
+        destroyEngine(engine);
+        return 0;
+    }
 
-        Vector translate_vec = {0.0f, 0.0f, 3.0f};
-        // Check to close the window
-        while (SDL_PollEvent(&event))
-            if (event.type == SDL_QUIT)
-                running = 0;
+    // Every requested mesh is in the scene and every world matrix is final before the workers start
+    while (loader != NULL && !isLoaderIdle(loader))
+    {
+        publishLoadedMeshes(loader, engine);
+        SDL_Delay(1);
+    }
+    if (loader != NULL)
+        publishLoadedMeshes(loader, engine);
+    // The light does not depend on the camera, one shadow map serves every view
+    ShadowMap shadow;
+    createShadowMap(&shadow);
+    settleScene(engine, &shadow);
+    const Matrix4x4 proj = projectionMatrix(ASPECT_RATIO);
 
-        // Renderer settings to draw white on black
-        SDL_SetRenderDrawColor(engine->renderer, 0, 0, 0, 255);
-        SDL_RenderClear(engine->renderer);
-        SDL_SetRenderDrawColor(engine->renderer, 255, 255, 255, 255);
+    WorkerPool pool;
+    const int pooled = createWorkerPool(&pool, nWorkers);
+    const int nThreads = pooled ? pool.nWorkers : 1;
+    BatchJob job = {engine, poses, &proj, shadow.light >= 0 ? &shadow : NULL, NULL, pattern, {0}};
+    ALLOCATE(job.fbs, nThreads * sizeof(Framebuffer));
+    for (int i = 0; i < nThreads; i++)
+        createFramebuffer(&job.fbs[i], WIDTH, HEIGHT, engine->fb.samples);
 
-        for (int i = 0; i < engine->nMeshes; i++)
+    const Uint64 begin = SDL_GetPerformanceCounter();
+    // Streams hold the chunks of one view at a time, so their poses are paged in and drawn one after the other
+    if (pooled && engine->nStreams == 0)
+        runParallel(&pool, renderBatchFrame, &job, nPoses);
+    else
+        for (int i = 0; i < nPoses; i++)
         {
-            const Mesh mesh = engine->meshes[i];
-            for (int j = 0; j < mesh.nTris; j++)
-            {
-                Triangle translated, rotated_x, rotated_z, projection;
-                for (int k = 0; k < 3; k++)
-                {
-                    // Rotate -> Translate -> Project -> Scale
-                    multMatVec(&mesh.tris[j].points[k], &rotated_x.points[k], &rot_mat_x);
-                    multMatVec(&rotated_x.points[k], &rotated_z.points[k], &rot_mat_z);
-                    translate(&rotated_z.points[k], &translated.points[k], &translate_vec);
-                }
-                // Calculate 2 lines of the triangle (l1, l2) and get the normal through crossProduct
-                Vector l1 = {
-                    translated.points[1].x - translated.points[0].x,
-                    translated.points[1].y - translated.points[0].y,
-                    translated.points[1].z - translated.points[0].z
-                };
-
-                Vector l2 = {
-                    translated.points[2].x - translated.points[0].x,
-                    translated.points[2].y - translated.points[0].y,
-                    translated.points[2].z - translated.points[0].z
-                };
-
-                Vector normal = crossProduct(&l1, &l2);
-                normalizeVector(&normal);
-                // Calculate the vector from the camera to one point of the triangle
-                Vector t_camera = {
-                    translated.points[1].x - camera.x,
-                    translated.points[1].y - camera.y,
-                    translated.points[1].z - camera.z
-                };
-                // Culling - Can be much better
-                if (dotProduct(&normal, &t_camera) < 0.0f) {
-                    // Create a normalized light source
-                    Vector light_source = {0.0f, 0.0f, -1.0f};
-                    normalizeVector(&light_source);
-                    for (int k = 0; k < 3; k++) {
-                        // Process Projection and Scaling only for faces we see
-                        multMatVec(&translated.points[k], &projection.points[k], &proj_mat);
-                        scale(&projection.points[k]);
-                    }
-                    // See the alignment between the light source and the normal of the triangle
-                    projection.light = dotProduct(&normal, &light_source);
-                    fillTriangle(&projection, engine->renderer);
-                }
-            }
-            // Present the drawing in the screen
-            SDL_RenderPresent(engine->renderer);
-            theta += 0.1f;
+            settleStreams(engine, &poses[i], &proj, HEIGHT);
+            renderBatchFrame(&job, i, 0);
         }
-    }
-    // Free Meshes array of triangles
-    for (int i = 0; i < engine->nMeshes; i++)
-        if (engine->meshes[i].tris != NULL)
-            free(engine->meshes[i].tris);
+    const double ms = (double)(SDL_GetPerformanceCounter() - begin) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    fprintf(stderr, "[BATCH] %d FRAMES IN %.1f MS ON %d WORKERS\n", nPoses, ms, nThreads);
 
-    // Free the array of Meshes
-    free(engine->meshes);
+    if (pooled)
+        destroyWorkerPool(&pool);
+    for (int i = 0; i < nThreads; i++)
+        freeFramebuffer(&job.fbs[i]);
+    free(job.fbs);
+    free(poses);
+    freeShadowMap(&shadow);
+    destroyEngine(engine);
+    return SDL_AtomicGet(&job.failed) == 0;
 }
 
 /**
  * MAIN
  *
  * @param argc
- * @param argv
+ * @param argv Mesh files (OBJ) to load next to the cube, they reload when they change. Options:
+ *             --capture <path> writes every frame (see createCapture), --frames <n> stops after n frames,
+ *             --headless renders without a window, --msaa <4 or 8> anti-aliases the edges, --wireframe starts in
+ *             the wireframe view (W switches it), --occluders <n> hides what is behind the n meshes covering the
+ *             most of the screen (0 turns culling off), --compact keeps the cube, the floor and the mesh files in
+ *             the compact storage (see compact.h), --batch <poses> renders one frame per camera pose
+ *             (see loadCameraPoses) into the files of --output <pattern> on --workers <n> threads,
+ *             --serve <socket> answers render requests (see protocol.h) until a client stops it,
+ *             --stream <file> pages in the chunks of a chunk file as they are needed (repeatable) keeping at most
+ *             --budget <MB> of each in memory, --build-chunks <obj> <file> splits an OBJ into a chunk file and exits,
+ *             --characters <n> adds n animated characters, --points <file> adds the point cloud of an XYZ file
+ *             (repeatable, see loadPointCloud) drawn as squares of --point-size <pixels>,
+ *             --record <file> writes the camera path of the session (see replay.h), --replay <file> draws a
+ *             recorded path one --timestep <ms> of path time per frame and writes its frame times to --stats <file>,
+ *             --telemetry <name> publishes the counters of every frame in shared memory (see telemetry.h),
+ *             --trace <file> writes how the stages of every frame ran as a Chrome trace (see taskgraph.h)
  * @return
  */
 int main(int argc, char* argv[])
@@ -182,6 +389,114 @@ int main(int argc, char* argv[])
     Engine* engine;
     ALLOCATE(engine, sizeof(Engine));
 
+    // Options first, whatever is left are mesh files
+    const char* capturePath = NULL;
+    const char* batchPath = NULL;
+    const char* socketPath = NULL;
+    const char* outputPattern = "frame%04d.png";
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* statsPath = NULL;
+    const char* telemetryName = NULL;
+    const char* tracePath = NULL;
+    float timestep = REPLAY_DEFAULT_TIMESTEP;
+    int frames = 0, headless = 0, wireframe = 0, samples = 1, nFiles = 0, nWorkers = 0, nStreams = 0;
+    int nCharacters = 0, nClouds = 0, pointSize = 1, nOccluders = OCCLUSION_DEFAULT_OCCLUDERS, compact = 0;
+    size_t budget = STREAM_DEFAULT_BUDGET;
+    const char** files;
+    const char** streams;
+    const char** clouds;
+    ALLOCATE(files, argc * sizeof(char*));
+    ALLOCATE(streams, argc * sizeof(char*));
+    ALLOCATE(clouds, argc * sizeof(char*));
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            capturePath = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--headless") == 0)
+            headless = 1;
+        else if (strcmp(argv[i], "--wireframe") == 0)
+            wireframe = 1;
+        else if (strcmp(argv[i], "--msaa") == 0 && i + 1 < argc)
+            samples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--occluders") == 0 && i + 1 < argc)
+            nOccluders = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--compact") == 0)
+            compact = 1;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batchPath = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputPattern = argv[++i];
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            nWorkers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--characters") == 0 && i + 1 < argc)
+            nCharacters = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+            streams[nStreams++] = argv[++i];
+        else if (strcmp(argv[i], "--points") == 0 && i + 1 < argc)
+            clouds[nClouds++] = argv[++i];
+        else if (strcmp(argv[i], "--point-size") == 0 && i + 1 < argc)
+            pointSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (strcmp(argv[i], "--timestep") == 0 && i + 1 < argc)
+        {
+            const float milliseconds = (float)atof(argv[++i]);
+            timestep = milliseconds > 0.0f ? milliseconds / 1000.0f : REPLAY_DEFAULT_TIMESTEP;
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+            statsPath = argv[++i];
+        else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc)
+            telemetryName = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+        {
+            const int megabytes = atoi(argv[++i]);
+            budget = (size_t)SDL_max(1, megabytes) << 20;
+        }
+        else if (strcmp(argv[i], "--build-chunks") == 0 && i + 2 < argc)
+        {
+            // Offline step, nothing is rendered
+            const int built = buildChunkFile(argv[i + 1], argv[i + 2]);
+            free(files);
+            free(streams);
+            free(clouds);
+            free(engine);
+            return !built;
+        }
+        else
+            files[nFiles++] = argv[i];
+    }
+    // Every worker gives the pattern to snprintf with the number of its pose
+    if (batchPath != NULL && (!isFramePattern(outputPattern) || strlen(outputPattern) >= CAPTURE_PATH_LENGTH))
+    {
+        fprintf(stderr, "[ERROR] --output NEEDS THE POSE NUMBER IN THE PATH, AND NO OTHER %% (like "
+                        "frames/%%04d.png)!\n");
+        free(files);
+        free(streams);
+        free(clouds);
+        free(engine);
+        return 1;
+    }
+    // Started before anything is printed, a capture on stdout moves the messages to stderr
+    FrameCapture capture;
+    const int capturing = capturePath != NULL && createCapture(&capture, capturePath, WIDTH, HEIGHT);
+    if (capturePath != NULL && !capturing)
+    {
+        free(files);
+        free(streams);
+        free(clouds);
+        free(engine);
+        return 1;
+    }
+
     // Coded in place for now until we can actually import some models
     const Triangle tris[12] = {
         // Back
@@ -205,20 +520,168 @@ int main(int argc, char* argv[])
     };
 
     // Allocate space for our meshes triangles
-    Mesh cubeMesh;
+    Mesh cubeMesh = {0};
     cubeMesh.nTris = 12;
-    const int size_to_copy = sizeof(tris) * cubeMesh.nTris;
+    const int size_to_copy = sizeof(tris);
     ALLOCATE(cubeMesh.tris, size_to_copy);
     memcpy(cubeMesh.tris, tris, size_to_copy);
+    // Every face is two triangles going around the same square
+    for (int i = 0; i < cubeMesh.nTris; i++)
+    {
+        const TexCoord first[3] = {{0, 0}, {0, 1}, {1, 1}};
+        const TexCoord second[3] = {{0, 0}, {1, 1}, {1, 0}};
+        memcpy(cubeMesh.tris[i].uv, i % 2 == 0 ? first : second, sizeof(first));
+    }
 
-    if (constructEngine(engine))
+    // Checkerboard until we can actually import some textures
+    Uint32 pixels[64 * 64];
+    for (int y = 0; y < 64; y++)
+        for (int x = 0; x < 64; x++)
+            pixels[y * 64 + x] = (x / 8 + y / 8) % 2 ? 0xFFFFFFFF : 0xFF3050C0;
+    cubeMesh.texture = createTexture(pixels, 64, 64);
+    prepareMesh(&cubeMesh);
+    cubeMesh.shadowCaster = 1;
+
+    // A floor under the cube to catch its shadow
+    const Triangle floorTris[2] = {
+        {{{-3, 2, 1}, {3, 2, 1}, {3, 2, 8}}},
+        {{{-3, 2, 1}, {3, 2, 8}, {-3, 2, 8}}}
+    };
+    Mesh floorMesh = {0};
+    floorMesh.nTris = 2;
+    ALLOCATE(floorMesh.tris, sizeof(floorTris));
+    memcpy(floorMesh.tris, floorTris, sizeof(floorTris));
+    prepareMesh(&floorMesh);
+    if (compact)
     {
-        memcpy(engine->meshes, &cubeMesh, sizeof(cubeMesh));
-        engine->nMeshes = 1;
-        start(engine);
+        compressMesh(&cubeMesh);
+        compressMesh(&floorMesh);
+    }
+
+    // Batches and servers never open a window
+    int status = 0;
+    if (constructEngine(engine, headless || batchPath != NULL || socketPath != NULL, samples))
+    {
+        memcpy(&engine->meshes[0], &cubeMesh, sizeof(cubeMesh));
+        memcpy(&engine->meshes[1], &floorMesh, sizeof(floorMesh));
+        engine->nMeshes = 2;
+        engine->wireframe = wireframe;
+        engine->nOccluders = SDL_max(nOccluders, 0);
+        // The cube spins around its corner, which hangs from a node placing it in front of the camera
+        const Vector cubePosition = {0.0f, 0.0f, 3.0f};
+        const Matrix4x4 cubePlace = translationMatrix(&cubePosition);
+        const Matrix4x4 identity = translationMatrix(&(Vector){0.0f, 0.0f, 0.0f});
+        const int pivot = addNode(engine, -1, &cubePlace, -1);
+        engine->nodes[addNode(engine, pivot, &identity, 0)].spinning = 1;
+        addNode(engine, -1, &identity, 1);
+        if (nCharacters > 0)
+            addCharacters(engine, nCharacters);
+        // White sun from above and behind the camera casting the shadows, plus a warm point light next to the cube
+        const Light ambient = {LIGHT_AMBIENT, {0}, {0}, 0.0f, 0.1f, 0.1f, 0.1f};
+        const Light sun = {LIGHT_DIRECTIONAL, {0.3f, 1.0f, 0.6f}, {0}, 0.0f, 0.8f, 0.8f, 0.8f, 1};
+        const Light lamp = {LIGHT_POINT, {0}, {2.0f, 1.5f, 2.0f}, 4.0f, 0.8f, 0.5f, 0.2f};
+        addLight(engine, &ambient);
+        addLight(engine, &sun);
+        addLight(engine, &lamp);
+
+        // The first frame does not wait for the files, they show up once they are loaded
+        MeshLoader loader;
+        const int loading = createLoader(&loader, compact);
+        for (int i = 0; i < nFiles && loading; i++)
+        {
+            const Vector position = {-2.0f + 2.0f * (i % 3), 0.0f, 5.0f + 2.0f * (i / 3)};
+            requestMesh(&loader, files[i], &position);
+        }
+        // Streams go further away, behind the cube and the meshes. A file that can not be opened is left out
+        ALLOCATE(engine->streams, SDL_max(1, nStreams) * sizeof(MeshStream));
+        for (int i = 0; i < nStreams; i++)
+        {
+            MeshStream* stream = &engine->streams[engine->nStreams];
+            if (!createMeshStream(stream, streams[i], budget))
+                continue;
+            const Vector position = {-3.0f + 3.0f * (i % 3), 0.0f, 9.0f + 3.0f * (i / 3)};
+            const Matrix4x4 place = translationMatrix(&position);
+            stream->node = addNode(engine, -1, &place, -1);
+            engine->nStreams++;
+        }
+        // Clouds are scaled to the size of a mesh and lined up behind the cube
+        engine->pointSize = SDL_min(SDL_max(pointSize, 1), POINT_MAX_SIZE);
+        ALLOCATE(engine->clouds, SDL_max(1, nClouds) * sizeof(PointCloud));
+        for (int i = 0; i < nClouds; i++)
+        {
+            PointCloud* cloud = &engine->clouds[engine->nClouds];
+            if (!loadPointCloud(clouds[i], cloud))
+                continue;
+            const Vector extent = {
+                cloud->boundsMax.x - cloud->boundsMin.x,
+                cloud->boundsMax.y - cloud->boundsMin.y,
+                cloud->boundsMax.z - cloud->boundsMin.z
+            };
+            const float scale = CLOUD_SIZE / fmaxf(fmaxf(extent.x, extent.y), fmaxf(extent.z, 1e-6f));
+            const Vector position = {
+                -(cloud->boundsMin.x + cloud->boundsMax.x) * 0.5f * scale,
+                -(cloud->boundsMin.y + cloud->boundsMax.y) * 0.5f * scale,
+                5.0f + CLOUD_SIZE * i - (cloud->boundsMin.z + cloud->boundsMax.z) * 0.5f * scale
+            };
+            Matrix4x4 place = translationMatrix(&position);
+            place.mat[0][0] = place.mat[1][1] = place.mat[2][2] = scale;
+            cloud->node = addNode(engine, -1, &place, -1);
+            engine->nClouds++;
+        }
+
+        if (batchPath != NULL)
+            status = !renderBatch(engine, loading ? &loader : NULL, batchPath, outputPattern, nWorkers);
+        else if (socketPath != NULL)
+        {
+            status = !runRenderServer(engine, loading ? &loader : NULL, socketPath);
+            destroyEngine(engine);
+        }
+        else
+        {
+            // A replayed path draws what was recorded, the keyboard only stops it
+            PathRecorder recorder;
+            Replay replay = {NULL, 0, timestep, NULL};
+            const int recording = recordPath != NULL && replayPath == NULL &&
+                                  createPathRecorder(&recorder, recordPath);
+            if (replayPath != NULL)
+                replay.nKeys = loadCameraPath(replayPath, &replay.keys);
+            if (replay.nKeys > 0 && statsPath != NULL && (replay.stats = fopen(statsPath, "w")) == NULL)
+                fprintf(stderr, "[ERROR] COULD NOT WRITE THE STATISTICS %s!\n", statsPath);
+            // Rendering goes on without it, nobody depends on it
+            TelemetryBlock* telemetry = telemetryName != NULL ? createTelemetry(telemetryName) : NULL;
+            TaskTrace trace;
+            const int tracing = tracePath != NULL && openTaskTrace(&trace, tracePath);
+
+            if ((recordPath != NULL && replayPath == NULL && !recording) || (replayPath != NULL && replay.nKeys < 0))
+            {
+                status = 1;
+                destroyEngine(engine);
+            }
+            else
+                start(engine, loading ? &loader : NULL, capturing ? &capture : NULL, frames,
+                      recording ? &recorder : NULL, replay.nKeys > 0 ? &replay : NULL, telemetry,
+                      tracing ? &trace : NULL);
+
+            if (recording)
+                destroyPathRecorder(&recorder);
+            if (replay.stats != NULL)
+                fclose(replay.stats);
+            free(replay.keys);
+            destroyTelemetry(telemetry, telemetryName);
+            if (tracing)
+                closeTaskTrace(&trace);
+        }
+        if (loading)
+            destroyLoader(&loader);
     }
+    if (capturing)
+        destroyCapture(&capture);
 
     // Free things
+    freeTexture(cubeMesh.texture);
+    free(files);
+    free(streams);
+    free(clouds);
     free(engine);
-    return 0;
+    return status;
 }
@@ -0,0 +1,270 @@
+//
+// Meshlets: small clusters of triangles culled as a whole
+//
+
+#include "meshlet.h"
+#include "compact.h"
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Computes the bounding sphere and the normal cone of a finished meshlet
+ *
+ *  @param mesh Mesh the meshlet belongs to
+ *  @param meshlet Meshlet with its vertices and triangles filled in
+ *
+ *  @return void
+ */
+static void computeMeshletBounds(const Mesh* mesh, Meshlet* meshlet)
+{
+    const int* verts = &mesh->meshletVerts[meshlet->vertOffset];
+    const Uint8* tris = &mesh->meshletTris[meshlet->triOffset * 3];
+
+    // Sphere around the center of the bounding box of the vertices
+    Vector lo = mesh->verts[verts[0]], hi = lo;
+    for (int v = 1; v < meshlet->nVerts; v++)
+    {
+        const Vector* p = &mesh->verts[verts[v]];
+        lo.x = fminf(lo.x, p->x); lo.y = fminf(lo.y, p->y); lo.z = fminf(lo.z, p->z);
+        hi.x = fmaxf(hi.x, p->x); hi.y = fmaxf(hi.y, p->y); hi.z = fmaxf(hi.z, p->z);
+    }
+    meshlet->center = (Vector){(lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f, (lo.z + hi.z) * 0.5f};
+    meshlet->radius = 0.0f;
+    for (int v = 0; v < meshlet->nVerts; v++)
+    {
+        const Vector* p = &mesh->verts[verts[v]];
+        const Vector d = {p->x - meshlet->center.x, p->y - meshlet->center.y, p->z - meshlet->center.z};
+        meshlet->radius = fmaxf(meshlet->radius, sqrtf(dotProduct(&d, &d)));
+    }
+
+    // Normal of every triangle, the same way the renderer computes it for backface culling
+    Vector normals[MESHLET_MAX_TRIS];
+    Vector axis = {0.0f, 0.0f, 0.0f};
+    int nNormals = 0;
+    for (int j = 0; j < meshlet->nTris; j++)
+    {
+        const Vector* p0 = &mesh->verts[verts[tris[j * 3 + 0]]];
+        const Vector* p1 = &mesh->verts[verts[tris[j * 3 + 1]]];
+        const Vector* p2 = &mesh->verts[verts[tris[j * 3 + 2]]];
+        const Vector l1 = {p1->x - p0->x, p1->y - p0->y, p1->z - p0->z};
+        const Vector l2 = {p2->x - p0->x, p2->y - p0->y, p2->z - p0->z};
+        Vector n = crossProduct(&l1, &l2);
+        // Degenerate triangles are never drawn, they do not widen the cone
+        if (dotProduct(&n, &n) == 0.0f)
+            continue;
+        normalizeVector(&n);
+        normals[nNormals++] = n;
+        axis.x += n.x; axis.y += n.y; axis.z += n.z;
+    }
+
+    // By default the cone can not reject anything
+    meshlet->coneAxis = (Vector){0.0f, 0.0f, 1.0f};
+    meshlet->coneCutoff = 1.0f;
+    if (nNormals == 0 || dotProduct(&axis, &axis) == 0.0f)
+        return;
+
+    normalizeVector(&axis);
+    float minDot = 1.0f;
+    for (int j = 0; j < nNormals; j++)
+        minDot = fminf(minDot, dotProduct(&axis, &normals[j]));
+    // Normals spread over (almost) a half sphere, the cone would never cull
+    if (minDot <= 0.1f)
+        return;
+
+    meshlet->coneAxis = axis;
+    // Sine of the cone half angle
+    meshlet->coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+/**
+ * Splits an indexed mesh into meshlets of at most MESHLET_MAX_VERTS vertices
+ * and MESHLET_MAX_TRIS triangles, following the order of the index buffer.
+ * Every meshlet gets a bounding sphere and a normal cone for culling
+ *
+ *  @param mesh Indexed mesh to split
+ *
+ *  @return void
+ */
+void buildMeshlets(Mesh* mesh)
+{
+    // Worst case is one meshlet for every MESHLET_MAX_VERTS / 3 triangles
+    const int maxMeshlets = mesh->nTris / (MESHLET_MAX_VERTS / 3) + 1;
+    ALLOCATE(mesh->meshlets, maxMeshlets * sizeof(Meshlet));
+    ALLOCATE(mesh->meshletVerts, (mesh->nTris * 3 + 1) * sizeof(int));
+    ALLOCATE(mesh->meshletTris, (mesh->nTris * 3 + 1) * sizeof(Uint8));
+    mesh->nMeshlets = 0;
+
+    // Local index of each mesh vertex in the meshlet being built, -1 if it is not in it
+    int* local;
+    ALLOCATE(local, (mesh->nVerts + 1) * sizeof(int));
+    for (int i = 0; i < mesh->nVerts; i++)
+        local[i] = -1;
+
+    Meshlet current = {0};
+    int nVerts = 0, nTris = 0;
+    for (int j = 0; j <= mesh->nTris; j++)
+    {
+        const int* tri = &mesh->indices[j * 3];
+        int extra = 0;
+        if (j < mesh->nTris)
+            extra = (local[tri[0]] < 0) + (local[tri[1]] < 0 && tri[1] != tri[0]) +
+                    (local[tri[2]] < 0 && tri[2] != tri[0] && tri[2] != tri[1]);
+
+        // Close the current meshlet at the end or when the triangle does not fit
+        if (current.nTris > 0 &&
+            (j == mesh->nTris || current.nVerts + extra > MESHLET_MAX_VERTS || current.nTris == MESHLET_MAX_TRIS))
+        {
+            for (int v = 0; v < current.nVerts; v++)
+                local[mesh->meshletVerts[current.vertOffset + v]] = -1;
+            computeMeshletBounds(mesh, &current);
+            mesh->meshlets[mesh->nMeshlets++] = current;
+            current = (Meshlet){.vertOffset = nVerts, .triOffset = nTris};
+        }
+        if (j == mesh->nTris)
+            break;
+
+        for (int k = 0; k < 3; k++)
+        {
+            if (local[tri[k]] < 0)
+            {
+                local[tri[k]] = current.nVerts++;
+                mesh->meshletVerts[nVerts++] = tri[k];
+            }
+            mesh->meshletTris[nTris * 3 + k] = (Uint8)local[tri[k]];
+        }
+        current.nTris++;
+        nTris++;
+    }
+    free(local);
+}
+
+/**
+ * Tests a whole meshlet against the view frustum and its normal cone. The
+ * camera looks down +z from _camera_ with the projection _proj_
+ *
+ *  @param meshlet Meshlet to test
+ *  @param world Transformation from model to world space
+ *  @param camera Position of the camera
+ *  @param proj Projection matrix (see projectionMatrix)
+ *
+ *  @return 1 if some triangle of the meshlet may be visible, 0 otherwise
+ */
+int isMeshletVisible(const Meshlet* meshlet, const Matrix4x4* world, const Vector* camera, const Matrix4x4* proj)
+{
+    Vector center;
+    multMatVec(&meshlet->center, &center, world);
+    center.x -= camera->x; center.y -= camera->y; center.z -= camera->z;
+
+    // The sphere grows with the biggest scale of the transformation
+    float scale = 0.0f;
+    for (int r = 0; r < 3; r++)
+        scale = fmaxf(scale, sqrtf(world->mat[r][0] * world->mat[r][0] + world->mat[r][1] * world->mat[r][1] +
+                                   world->mat[r][2] * world->mat[r][2]));
+    const float radius = meshlet->radius * scale;
+
+    // Near and far planes
+    if (center.z + radius < Z_NEAR || center.z - radius > Z_FAR)
+        return 0;
+    // Side planes go through the camera, |x| <= z / sx and |y| <= z / sy
+    const float sx = proj->mat[0][0], sy = proj->mat[1][1];
+    const float lx = sqrtf(sx * sx + 1.0f), ly = sqrtf(sy * sy + 1.0f);
+    if ((center.x * sx - center.z) > radius * lx || (-center.x * sx - center.z) > radius * lx ||
+        (center.y * sy - center.z) > radius * ly || (-center.y * sy - center.z) > radius * ly)
+        return 0;
+
+    // Backfacing cluster, the camera is outside of the normal cone widened by the sphere
+    if (meshlet->coneCutoff < 1.0f)
+    {
+        // Meshes are only rotated and uniformly scaled, so the axis can use the world matrix as is
+        Vector axis = {
+            meshlet->coneAxis.x * world->mat[0][0] + meshlet->coneAxis.y * world->mat[1][0] + meshlet->coneAxis.z * world->mat[2][0],
+            meshlet->coneAxis.x * world->mat[0][1] + meshlet->coneAxis.y * world->mat[1][1] + meshlet->coneAxis.z * world->mat[2][1],
+            meshlet->coneAxis.x * world->mat[0][2] + meshlet->coneAxis.y * world->mat[1][2] + meshlet->coneAxis.z * world->mat[2][2]
+        };
+        normalizeVector(&axis);
+        const float distance = sqrtf(dotProduct(&center, &center));
+        if (dotProduct(&center, &axis) >= meshlet->coneCutoff * distance + radius)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Transforms every vertex of a meshlet to world space. World matrices are
+ * affine, so there is no divide by w. Compact meshes are decoded right here:
+ * the vertex list is unpacked as it is read and the 16 bit positions go
+ * through a matrix that also undoes the quantization. Normals are rotated
+ * along, but not normalized
+ *
+ *  @param mesh Mesh the meshlet belongs to
+ *  @param meshlet Meshlet to transform
+ *  @param world Transformation from model to world space
+ *  @param out MESHLET_MAX_VERTS vertices to store the output
+ *  @param normals MESHLET_MAX_VERTS vertices to store the world space normals, can be NULL
+ *  @param ids MESHLET_MAX_VERTS ints to store the mesh vertex of each output, can be NULL
+ *
+ *  @return void
+ */
+void transformMeshlet(const Mesh* mesh, const Meshlet* meshlet, const Matrix4x4* world, Vector* out, Vector* normals,
+                      int* ids)
+{
+    const Matrix4x4 m = mesh->compact ? dequantizeMatrix(mesh, world) : *world;
+    const Uint8* packed = mesh->compact ? &mesh->packedMeshletVerts[meshlet->vertOffset] : NULL;
+    int previous = 0;
+
+#ifdef __SSE2__
+    const __m128 r0 = _mm_loadu_ps(m.mat[0]);
+    const __m128 r1 = _mm_loadu_ps(m.mat[1]);
+    const __m128 r2 = _mm_loadu_ps(m.mat[2]);
+    const __m128 r3 = _mm_loadu_ps(m.mat[3]);
+    const __m128 n0 = _mm_loadu_ps(world->mat[0]);
+    const __m128 n1 = _mm_loadu_ps(world->mat[1]);
+    const __m128 n2 = _mm_loadu_ps(world->mat[2]);
+#endif
+    for (int v = 0; v < meshlet->nVerts; v++)
+    {
+        float x, y, z;
+        const int id = mesh->compact ? readPackedIndex(&packed, &previous)
+                                     : mesh->meshletVerts[meshlet->vertOffset + v];
+        if (ids != NULL)
+            ids[v] = id;
+        if (mesh->compact)
+        {
+            const Uint16* q = &mesh->qverts[id * 3];
+            x = q[0]; y = q[1]; z = q[2];
+        }
+        else
+        {
+            const Vector* p = &mesh->verts[id];
+            x = p->x; y = p->y; z = p->z;
+        }
+#ifdef __SSE2__
+        float o[4];
+        const __m128 xy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(x), r0), _mm_mul_ps(_mm_set1_ps(y), r1));
+        const __m128 zw = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(z), r2), r3);
+        _mm_storeu_ps(o, _mm_add_ps(xy, zw));
+        out[v] = (Vector){o[0], o[1], o[2]};
+#else
+        out[v].x = x * m.mat[0][0] + y * m.mat[1][0] + z * m.mat[2][0] + m.mat[3][0];
+        out[v].y = x * m.mat[0][1] + y * m.mat[1][1] + z * m.mat[2][1] + m.mat[3][1];
+        out[v].z = x * m.mat[0][2] + y * m.mat[1][2] + z * m.mat[2][2] + m.mat[3][2];
+#endif
+        if (normals == NULL)
+            continue;
+
+        // Meshes are only rotated and uniformly scaled, so normals can use the world matrix as is
+        const Vector n = getMeshNormal(mesh, id);
+#ifdef __SSE2__
+        const __m128 nxy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(n.x), n0), _mm_mul_ps(_mm_set1_ps(n.y), n1));
+        _mm_storeu_ps(o, _mm_add_ps(nxy, _mm_mul_ps(_mm_set1_ps(n.z), n2)));
+        normals[v] = (Vector){o[0], o[1], o[2]};
+#else
+        normals[v].x = n.x * world->mat[0][0] + n.y * world->mat[1][0] + n.z * world->mat[2][0];
+        normals[v].y = n.x * world->mat[0][1] + n.y * world->mat[1][1] + n.z * world->mat[2][1];
+        normals[v].z = n.x * world->mat[0][2] + n.y * world->mat[1][2] + n.z * world->mat[2][2];
+#endif
+    }
+}
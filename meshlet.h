@@ -0,0 +1,16 @@
+//
+// Meshlets: small clusters of triangles culled as a whole
+//
+
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "engine.h"
+
+/*Function prototypes*/
+void buildMeshlets(Mesh* mesh);
+int isMeshletVisible(const Meshlet* meshlet, const Matrix4x4* world, const Vector* camera, const Matrix4x4* proj);
+void transformMeshlet(const Mesh* mesh, const Meshlet* meshlet, const Matrix4x4* world, Vector* out, Vector* normals,
+                      int* ids);
+
+#endif //MESHLET_H
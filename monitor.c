@@ -0,0 +1,178 @@
+//
+// Reads the telemetry of a running renderer (--telemetry) and prints it
+//
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+/**
+ * Finds the memory a process has in RAM
+ *
+ *  @param pid The process
+ *
+ *  @return Resident bytes, 0 where /proc can not tell
+ */
+static Uint64 residentBytes(Uint32 pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/statm", pid);
+    FILE* file = fopen(path, "r");
+    unsigned long long size = 0, resident = 0;
+    if (file == NULL)
+        return 0;
+    if (fscanf(file, "%llu %llu", &size, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return (Uint64)resident * (Uint64)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Share of a count, in percent
+ *
+ *  @return 0 when there is nothing to share
+ */
+static double percentOf(double part, double whole)
+{
+    return whole > 0.0 ? part * 100.0 / whole : 0.0;
+}
+
+/**
+ * Prints every counter of a frame
+ *
+ *  @param block Block of the renderer
+ *  @param counters Counters read from it
+ *
+ *  @return void
+ */
+static void printCounters(const TelemetryBlock* block, const TelemetryCounters* counters)
+{
+    const Uint32 visible = counters->meshes - counters->meshesOffscreen;
+    printf("[MONITOR] Renderer %u, frame %llu\n", block->pid, (unsigned long long)counters->frame);
+    printf("  frame time    %.2f ms\n", counters->frameMs);
+    printf("  triangles     %llu rasterized, %llu since the start\n", (unsigned long long)counters->triangles,
+           (unsigned long long)counters->totalTriangles);
+    printf("  points        %llu splatted\n", (unsigned long long)counters->points);
+    printf("  meshes        %u, %u drawn, %.1f%% offscreen, %.1f%% of the rest occluded\n", counters->meshes,
+           counters->meshesDrawn, percentOf(counters->meshesOffscreen, counters->meshes),
+           percentOf(counters->meshesOccluded, visible));
+    printf("  redrawn       %llu pixels in %u rectangles\n", (unsigned long long)counters->dirtyPixels,
+           counters->dirtyRects);
+    printf("  workers       %u, %.1f%% busy\n", counters->nWorkers,
+           percentOf(counters->workerMs, (double)counters->frameMs * counters->nWorkers));
+    printf("  memory        %.1f MB resident, %.1f MB of %.1f MB streamed\n",
+           residentBytes(block->pid) / 1048576.0, counters->streamedBytes / 1048576.0,
+           counters->streamBudget / 1048576.0);
+}
+
+/**
+ * Prints one line of a watch: rates since the last line, the rest from the last frame
+ *
+ *  @param block Block of the renderer
+ *  @param counters Counters read now
+ *  @param last Counters of the last line
+ *
+ *  @return void
+ */
+static void printLine(const TelemetryBlock* block, const TelemetryCounters* counters, const TelemetryCounters* last)
+{
+    // No rates across a restart of the renderer
+    const double seconds = counters->frame >= last->frame && counters->ticks > last->ticks ?
+                           (double)(counters->ticks - last->ticks) / 1000.0 : 0.0;
+    const double fps = seconds > 0.0 ? (double)(counters->frame - last->frame) / seconds : 0.0;
+    const double trianglesPerSecond = seconds > 0.0 ? (double)(counters->totalTriangles - last->totalTriangles) /
+                                                      seconds : 0.0;
+    printf("%10llu %7.1f %9.2f %10llu %9.2f %6.1f%% %6.1f%% %6.1f%% %9.1f %9.1f\n",
+           (unsigned long long)counters->frame, fps, counters->frameMs, (unsigned long long)counters->triangles,
+           trianglesPerSecond / 1e6, percentOf(counters->meshesOffscreen, counters->meshes),
+           percentOf(counters->meshesOccluded, counters->meshes - counters->meshesOffscreen),
+           percentOf(counters->workerMs, (double)counters->frameMs * counters->nWorkers),
+           residentBytes(block->pid) / 1048576.0, counters->streamedBytes / 1048576.0);
+    fflush(stdout);
+}
+
+/**
+ * MAIN
+ *
+ * @param argc
+ * @param argv Name the renderer publishes its telemetry as, then the options: --watch <ms> prints a line every
+ *             ms until the renderer stops, --count <n> stops after n lines
+ * @return
+ */
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <name> [--watch ms] [--count n]\n", argv[0]);
+        return 1;
+    }
+    int interval = 0, count = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+        {
+            const int milliseconds = atoi(argv[++i]);
+            interval = SDL_max(1, milliseconds);
+        }
+        else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            count = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "[ERROR] UNKNOWN OPTION %s!\n", argv[i]);
+            return 1;
+        }
+    }
+
+    const TelemetryBlock* block = attachTelemetry(argv[1]);
+    if (block == NULL)
+        return 1;
+    TelemetryCounters counters, last;
+    if (!readTelemetry(block, &counters))
+    {
+        fprintf(stderr, "[ERROR] COULD NOT READ THE TELEMETRY!\n");
+        detachTelemetry(block);
+        return 1;
+    }
+    if (interval == 0)
+    {
+        printCounters(block, &counters);
+        detachTelemetry(block);
+        return 0;
+    }
+
+    printf("%10s %7s %9s %10s %9s %7s %7s %7s %9s %9s\n", "frame", "fps", "frame_ms", "triangles", "Mtris/s",
+           "offscr", "occl", "busy", "rss_MB", "stream_MB");
+    for (int lines = 0; count <= 0 || lines < count; lines++)
+    {
+        last = counters;
+        SDL_Delay(interval);
+        // Once the renderer is gone the block never changes again
+        if (block->magic != TELEMETRY_MAGIC || (kill((pid_t)block->pid, 0) != 0 && errno == ESRCH))
+        {
+            printf("[MONITOR] The renderer stopped\n");
+            break;
+        }
+        if (readTelemetry(block, &counters))
+            printLine(block, &counters, &last);
+    }
+    detachTelemetry(block);
+    return 0;
+}
+
+#else
+
+int main(int argc, char* argv[])
+{
+    fprintf(stderr, "[ERROR] THE MONITOR NEEDS A UNIX SYSTEM!\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,266 @@
+//
+// Software occlusion culling against a low resolution depth buffer
+//
+
+#include "occlusion.h"
+#include "compact.h"
+#include <float.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Picks the occluders of a frame: the meshes covering the largest screen
+ * areas, as long as they have few triangles. Big, simple meshes close to the
+ * camera hide the most for the least work
+ *
+ *  @param engine Engine with the meshes, their screen areas up to date
+ *  @param count Most occluders to pick, 0 for none
+ *
+ *  @return Number of occluders picked
+ */
+int selectOccluders(Engine* engine, int count)
+{
+    for (int i = 0; i < engine->nMeshes; i++)
+        engine->meshes[i].occluder = 0;
+    int picked = 0;
+    for (; picked < count; picked++)
+    {
+        int best = -1;
+        long bestArea = OCCLUDER_MIN_AREA - 1;
+        for (int i = 0; i < engine->nMeshes; i++)
+        {
+            const Mesh* mesh = &engine->meshes[i];
+            const long area = (long)mesh->rect.w * mesh->rect.h;
+            if (!mesh->occluder && mesh->nTris <= OCCLUDER_MAX_TRIS && area > bestArea)
+            {
+                best = i;
+                bestArea = area;
+            }
+        }
+        if (best < 0)
+            break;
+        engine->meshes[best].occluder = 1;
+    }
+    return picked;
+}
+
+/**
+ * Resets every sample of the occlusion buffer to "nothing in front"
+ *
+ *  @param buffer Occlusion buffer to clear
+ *
+ *  @return void
+ */
+void clearOcclusionBuffer(OcclusionBuffer* buffer)
+{
+    const int size = OCCLUSION_SAMPLES_WIDTH * OCCLUSION_SAMPLES_HEIGHT;
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 far = _mm_set1_ps(FLT_MAX);
+    for (; i + 4 <= size; i += 4)
+        _mm_storeu_ps(&buffer->samples[i], far);
+#endif
+    for (; i < size; i++)
+        buffer->samples[i] = FLT_MAX;
+}
+
+/**
+ * Projects a view space point into occlusion buffer coordinates
+ *
+ *  @param i View space point
+ *  @param o Point in occlusion buffer pixels, z is left untouched as view depth
+ *  @param proj Projection matrix
+ *
+ *  @return void
+ */
+static void toOcclusionSpace(const Vector* i, Vector* o, const Matrix4x4* proj)
+{
+    multMatVec(i, o, proj);
+    scale(o);
+    o->x /= OCCLUSION_SCALE;
+    o->y /= OCCLUSION_SCALE;
+    o->z = i->z;
+}
+
+/**
+ * Rasterizes the triangles of an occluder into the corner samples of the
+ * occlusion buffer. Every covered sample gets the farthest depth of the
+ * triangle, so an occluder never claims to be closer than it really is
+ *
+ *  @param buffer Occlusion buffer to draw into
+ *  @param mesh Mesh that is used as an occluder
+ *  @param world Transformation from model to world space
+ *  @param proj Projection matrix
+ *
+ *  @return void
+ */
+void rasterizeOccluder(OcclusionBuffer* buffer, const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj)
+{
+    // Compact meshes decode their index buffer as they go
+    const Uint8* packed = mesh->packedIndices;
+    int previous = 0;
+
+    for (int j = 0; j < mesh->nTris; j++)
+    {
+        Vector v[3];
+        int clipped = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            const int index = mesh->compact ? readPackedIndex(&packed, &previous) : mesh->indices[j * 3 + k];
+            const Vector p = getMeshVertex(mesh, index);
+            Vector transformed;
+            multMatVec(&p, &transformed, world);
+            // Triangles crossing the near plane are just skipped, that only makes us hide less
+            if (transformed.z < Z_NEAR)
+                clipped = 1;
+            toOcclusionSpace(&transformed, &v[k], proj);
+        }
+        if (clipped)
+            continue;
+
+        // Twice the signed area, the edges are flipped so the inside is always positive
+        const float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+        if (area == 0.0f)
+            continue;
+        const float sign = area > 0.0f ? 1.0f : -1.0f;
+
+        // Edge functions E(x, y) = a * x + b * y + c
+        float a[3], b[3], c[3];
+        for (int e = 0; e < 3; e++)
+        {
+            const Vector* p0 = &v[e];
+            const Vector* p1 = &v[(e + 1) % 3];
+            a[e] = (p0->y - p1->y) * sign;
+            b[e] = (p1->x - p0->x) * sign;
+            c[e] = (p0->x * p1->y - p0->y * p1->x) * sign;
+        }
+        const float depth = fmaxf(v[0].z, fmaxf(v[1].z, v[2].z));
+
+        const int minX = SDL_max(0, (int)ceilf(fminf(v[0].x, fminf(v[1].x, v[2].x))));
+        const int maxX = SDL_min(OCCLUSION_SAMPLES_WIDTH - 1, (int)floorf(fmaxf(v[0].x, fmaxf(v[1].x, v[2].x))));
+        const int minY = SDL_max(0, (int)ceilf(fminf(v[0].y, fminf(v[1].y, v[2].y))));
+        const int maxY = SDL_min(OCCLUSION_SAMPLES_HEIGHT - 1, (int)floorf(fmaxf(v[0].y, fmaxf(v[1].y, v[2].y))));
+
+        for (int y = minY; y <= maxY; y++)
+        {
+            float* row = &buffer->samples[y * OCCLUSION_SAMPLES_WIDTH];
+            int x = minX;
+#ifdef __SSE2__
+            // Four samples at a time
+            const __m128 step = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+            const __m128 d = _mm_set1_ps(depth);
+            const __m128 zero = _mm_setzero_ps();
+            for (; x + 4 <= maxX + 1; x += 4)
+            {
+                const __m128 sx = _mm_add_ps(_mm_set1_ps((float)x), step);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int e = 0; e < 3; e++)
+                {
+                    const __m128 value = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[e]), sx),
+                                                    _mm_set1_ps(b[e] * y + c[e]));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(value, zero));
+                }
+                const __m128 old = _mm_loadu_ps(&row[x]);
+                const __m128 nearer = _mm_min_ps(old, d);
+                _mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+#endif
+            for (; x <= maxX; x++)
+            {
+                if (a[0] * x + b[0] * y + c[0] >= 0.0f &&
+                    a[1] * x + b[1] * y + c[1] >= 0.0f &&
+                    a[2] * x + b[2] * y + c[2] >= 0.0f)
+                    row[x] = fminf(row[x], depth);
+            }
+        }
+    }
+}
+
+/**
+ * Turns the corner samples into pixel depths. A pixel only counts as covered
+ * when all of its 4 corners are, and takes the farthest of them, which keeps
+ * the test conservative along the silhouettes of the occluders
+ *
+ *  @param buffer Occlusion buffer to resolve, after all occluders are drawn
+ *
+ *  @return void
+ */
+void resolveOcclusionBuffer(OcclusionBuffer* buffer)
+{
+    for (int y = 0; y < OCCLUSION_HEIGHT; y++)
+    {
+        const float* top = &buffer->samples[y * OCCLUSION_SAMPLES_WIDTH];
+        const float* bottom = top + OCCLUSION_SAMPLES_WIDTH;
+        float* row = &buffer->depth[y * OCCLUSION_WIDTH];
+        int x = 0;
+#ifdef __SSE2__
+        for (; x + 4 <= OCCLUSION_WIDTH; x += 4)
+        {
+            const __m128 left = _mm_max_ps(_mm_loadu_ps(&top[x]), _mm_loadu_ps(&bottom[x]));
+            const __m128 right = _mm_max_ps(_mm_loadu_ps(&top[x + 1]), _mm_loadu_ps(&bottom[x + 1]));
+            _mm_storeu_ps(&row[x], _mm_max_ps(left, right));
+        }
+#endif
+        for (; x < OCCLUSION_WIDTH; x++)
+            row[x] = fmaxf(fmaxf(top[x], top[x + 1]), fmaxf(bottom[x], bottom[x + 1]));
+    }
+}
+
+/**
+ * Tests the bounding box of a mesh against the occlusion buffer. The box is
+ * rounded outwards and uses its nearest depth, so a mesh is only reported
+ * hidden when every pixel it could touch has an occluder in front of it
+ *
+ *  @param buffer Occlusion buffer with the occluders of this frame
+ *  @param mesh Mesh to test
+ *  @param world Transformation from model to world space
+ *  @param proj Projection matrix
+ *
+ *  @return 1 if the mesh may be visible, 0 if it is hidden or offscreen
+ */
+int isMeshVisible(const OcclusionBuffer* buffer, const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj)
+{
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY, minZ = INFINITY;
+    for (int c = 0; c < 8; c++)
+    {
+        const Vector corner = {
+            c & 1 ? mesh->boundsMax.x : mesh->boundsMin.x,
+            c & 2 ? mesh->boundsMax.y : mesh->boundsMin.y,
+            c & 4 ? mesh->boundsMax.z : mesh->boundsMin.z
+        };
+        Vector transformed, projected;
+        multMatVec(&corner, &transformed, world);
+        // Touching the near plane, too close to be hidden by anything
+        if (transformed.z < Z_NEAR)
+            return 1;
+
+        toOcclusionSpace(&transformed, &projected, proj);
+        minX = fminf(minX, projected.x); maxX = fmaxf(maxX, projected.x);
+        minY = fminf(minY, projected.y); maxY = fmaxf(maxY, projected.y);
+        minZ = fminf(minZ, projected.z);
+    }
+
+    const int x0 = SDL_max(0, (int)floorf(minX));
+    const int x1 = SDL_min(OCCLUSION_WIDTH - 1, (int)ceilf(maxX));
+    const int y0 = SDL_max(0, (int)floorf(minY));
+    const int y1 = SDL_min(OCCLUSION_HEIGHT - 1, (int)ceilf(maxY));
+
+    for (int y = y0; y <= y1; y++)
+    {
+        const float* row = &buffer->depth[y * OCCLUSION_WIDTH];
+        int x = x0;
+#ifdef __SSE2__
+        const __m128 z = _mm_set1_ps(minZ);
+        for (; x + 4 <= x1 + 1; x += 4)
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(&row[x]), z)))
+                return 1;
+#endif
+        for (; x <= x1; x++)
+            if (row[x] >= minZ)
+                return 1;
+    }
+    return 0;
+}
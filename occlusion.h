@@ -0,0 +1,41 @@
+//
+// Software occlusion culling against a low resolution depth buffer
+//
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "engine.h"
+
+// The occlusion buffer is a quarter of the screen in each direction
+#define OCCLUSION_SCALE 4
+#define OCCLUSION_WIDTH (WIDTH / OCCLUSION_SCALE)
+#define OCCLUSION_HEIGHT (HEIGHT / OCCLUSION_SCALE)
+
+// Occluders are sampled at the pixel corners
+#define OCCLUSION_SAMPLES_WIDTH (OCCLUSION_WIDTH + 1)
+#define OCCLUSION_SAMPLES_HEIGHT (OCCLUSION_HEIGHT + 1)
+
+// Meshes picked as occluders every frame unless --occluders says otherwise
+#define OCCLUSION_DEFAULT_OCCLUDERS 4
+// A mesh is only worth drawing into the buffer when its screen area is at least this big (100 x 100 pixels) and it
+// has few enough triangles
+#define OCCLUDER_MIN_AREA (WIDTH * HEIGHT / 64)
+#define OCCLUDER_MAX_TRIS 256
+
+typedef struct
+{
+    // OCCLUSION_SAMPLES_WIDTH * OCCLUSION_SAMPLES_HEIGHT view space depths, farther is bigger
+    float* samples;
+    // OCCLUSION_WIDTH * OCCLUSION_HEIGHT, the farthest of the 4 corners of each pixel
+    float* depth;
+} OcclusionBuffer;
+
+/*Function prototypes*/
+int selectOccluders(Engine* engine, int count);
+void clearOcclusionBuffer(OcclusionBuffer* buffer);
+void rasterizeOccluder(OcclusionBuffer* buffer, const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj);
+void resolveOcclusionBuffer(OcclusionBuffer* buffer);
+int isMeshVisible(const OcclusionBuffer* buffer, const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj);
+
+#endif //OCCLUSION_H
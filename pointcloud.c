@@ -0,0 +1,523 @@
+//
+// Point clouds splatted straight into the framebuffer
+//
+// Scans come as tens of millions of points, far too many to turn into
+// triangles. Points are kept in a structure of arrays, transformed 4 at a time
+// and written to the screen as small squares. Threads splat blocks of points
+// at the same time into a buffer of 64 bit depth + color values with an atomic
+// minimum, so the nearest point of every pixel wins without any lock, and the
+// buffer is then merged into the framebuffer, depth tested against the meshes.
+// Points are sorted by octree level, so a cloud far away draws only the first
+// levels, which still cover it at one point per pixel
+//
+
+#include "pointcloud.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct
+{
+    // Morton code of the cell of the deepest level
+    Uint64 code;
+    int index;
+} PointKey;
+
+typedef struct
+{
+    const PointCloud* cloud;
+    // Model to clip space
+    Matrix4x4 toClip;
+    int count;
+    int size;
+    PointBuffer* points;
+    Framebuffer* fb;
+    const SDL_Rect* clip;
+} SplatJob;
+
+/**
+ * Spreads the bits of a cell coordinate 3 apart, so three of them interleave
+ * into a Morton code
+ *
+ *  @param v Coordinate, at most 21 bits
+ *
+ *  @return The spread bits
+ */
+static Uint64 spreadBits(Uint32 v)
+{
+    Uint64 x = v & 0x1FFFFF;
+    x = (x | x << 32) & 0x1F00000000FFFFull;
+    x = (x | x << 16) & 0x1F0000FF0000FFull;
+    x = (x | x << 8) & 0x100F00F00F00F00Full;
+    x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+/**
+ * Sorts point keys by their code, 8 bits at a time (radix sort). Points in
+ * the same cell keep their order
+ *
+ *  @param keys Keys to sort
+ *  @param scratch Room for as many keys
+ *  @param n Number of keys
+ *
+ *  @return void
+ */
+static void sortPointKeys(PointKey* keys, PointKey* scratch, int n)
+{
+    PointKey* in = keys;
+    PointKey* out = scratch;
+    for (int shift = 0; shift < 3 * (POINT_LEVELS - 1); shift += 8)
+    {
+        int counts[257] = {0};
+        for (int i = 0; i < n; i++)
+            counts[((in[i].code >> shift) & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++)
+            counts[b + 1] += counts[b];
+        for (int i = 0; i < n; i++)
+            out[counts[(in[i].code >> shift) & 0xFF]++] = in[i];
+        PointKey* swap = in;
+        in = out;
+        out = swap;
+    }
+    if (in != keys)
+        memcpy(keys, in, n * sizeof(PointKey));
+}
+
+/**
+ * Builds a cloud from its points. They are sorted along a Morton curve
+ * through the cells of the deepest octree level, then every level takes one
+ * point of each cell it has that no coarser level took, so each level is a
+ * prefix of the arrays and the points of a level are close in memory
+ *
+ *  @param cloud Cloud to build
+ *  @param nPoints Number of points
+ *  @param positions Position of every point
+ *  @param colors ARGB8888 color of every point
+ *
+ *  @return void
+ */
+void createPointCloud(PointCloud* cloud, int nPoints, const Vector* positions, const Uint32* colors)
+{
+    memset(cloud, 0, sizeof(*cloud));
+    cloud->nPoints = nPoints;
+    Vector low = nPoints > 0 ? positions[0] : (Vector){0.0f, 0.0f, 0.0f}, high = low;
+    for (int i = 1; i < nPoints; i++)
+    {
+        low.x = fminf(low.x, positions[i].x); low.y = fminf(low.y, positions[i].y); low.z = fminf(low.z, positions[i].z);
+        high.x = fmaxf(high.x, positions[i].x); high.y = fmaxf(high.y, positions[i].y);
+        high.z = fmaxf(high.z, positions[i].z);
+    }
+    cloud->boundsMin = low;
+    cloud->boundsMax = high;
+
+    // Cubic cells, as many per side as the deepest level has
+    const int cells = 1 << (POINT_LEVELS - 1);
+    const float extent = fmaxf(fmaxf(high.x - low.x, high.y - low.y), fmaxf(high.z - low.z, 1e-6f));
+    const float toCell = (float)cells / extent;
+    PointKey *keys, *scratch;
+    ALLOCATE(keys, SDL_max(1, nPoints) * sizeof(PointKey));
+    ALLOCATE(scratch, SDL_max(1, nPoints) * sizeof(PointKey));
+    for (int i = 0; i < nPoints; i++)
+    {
+        const Uint32 cx = (Uint32)SDL_min((int)((positions[i].x - low.x) * toCell), cells - 1);
+        const Uint32 cy = (Uint32)SDL_min((int)((positions[i].y - low.y) * toCell), cells - 1);
+        const Uint32 cz = (Uint32)SDL_min((int)((positions[i].z - low.z) * toCell), cells - 1);
+        keys[i].code = spreadBits(cx) | spreadBits(cy) << 1 | spreadBits(cz) << 2;
+        keys[i].index = i;
+    }
+    sortPointKeys(keys, scratch, nPoints);
+    free(scratch);
+
+    // Cells of a level are runs of keys that share the top bits of their codes
+    Sint8* levels;
+    ALLOCATE(levels, SDL_max(1, nPoints));
+    memset(levels, POINT_LEVELS - 1, nPoints);
+    Uint8* taken;
+    ALLOCATE(taken, SDL_max(1, nPoints));
+    memset(taken, 0, nPoints);
+    for (int l = 0; l < POINT_LEVELS - 1; l++)
+    {
+        const int shift = 3 * (POINT_LEVELS - 1 - l);
+        for (int i = 0, found = 0; i < nPoints; i++)
+        {
+            if (i > 0 && keys[i].code >> shift != keys[i - 1].code >> shift)
+                found = 0;
+            if (found || taken[i])
+                continue;
+            levels[i] = (Sint8)l;
+            taken[i] = found = 1;
+        }
+    }
+    free(taken);
+
+    // Counting sort by level, the Morton order stays within each level
+    int counts[POINT_LEVELS + 1] = {0};
+    for (int i = 0; i < nPoints; i++)
+        counts[levels[i] + 1]++;
+    for (int l = 0; l < POINT_LEVELS; l++)
+    {
+        counts[l + 1] += counts[l];
+        cloud->levelEnd[l] = counts[l + 1];
+    }
+    const int padded = (nPoints + 3) & ~3;
+    ALLOCATE(cloud->x, SDL_max(4, padded) * sizeof(float));
+    ALLOCATE(cloud->y, SDL_max(4, padded) * sizeof(float));
+    ALLOCATE(cloud->z, SDL_max(4, padded) * sizeof(float));
+    ALLOCATE(cloud->color, SDL_max(4, padded) * sizeof(Uint32));
+    for (int i = nPoints; i < SDL_max(4, padded); i++)
+    {
+        cloud->x[i] = cloud->y[i] = cloud->z[i] = 0.0f;
+        cloud->color[i] = 0;
+    }
+    for (int i = 0; i < nPoints; i++)
+    {
+        const int at = counts[levels[i]]++;
+        const int p = keys[i].index;
+        cloud->x[at] = positions[p].x;
+        cloud->y[at] = positions[p].y;
+        cloud->z[at] = positions[p].z;
+        cloud->color[at] = colors[p];
+    }
+    free(levels);
+    free(keys);
+}
+
+/**
+ * Loads a point cloud from an XYZ file: one point per line, its position and
+ * optionally its color as 3 values from 0 to 255. Lines that do not start
+ * with 3 numbers (headers, comments) are skipped. XYZ is y up while our y
+ * points down, so y is flipped
+ *
+ *  @param path File to load
+ *  @param cloud Cloud to fill
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int loadPointCloud(const char* path, PointCloud* cloud)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT OPEN THE POINT CLOUD %s!\n", path);
+        return 0;
+    }
+
+    Vector* positions = NULL;
+    Uint32* colors = NULL;
+    int nPoints = 0, capacity = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        float values[6];
+        int nValues = 0;
+        char* at = line;
+        for (char* end; nValues < 6; nValues++, at = end)
+        {
+            values[nValues] = strtof(at, &end);
+            if (end == at)
+                break;
+        }
+        if (nValues < 3)
+            continue;
+
+        if (nPoints == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            Vector* grownPositions = realloc(positions, capacity * sizeof(Vector));
+            if (grownPositions != NULL)
+                positions = grownPositions;
+            Uint32* grownColors = realloc(colors, capacity * sizeof(Uint32));
+            if (grownColors != NULL)
+                colors = grownColors;
+            if (grownPositions == NULL || grownColors == NULL)
+            {
+                perror("[ERROR] ALLOCATING MEMORY FAILED!");
+                nPoints = 0;
+                break;
+            }
+        }
+        positions[nPoints] = (Vector){values[0], -values[1], values[2]};
+        colors[nPoints] = 0xFFFFFFFF;
+        if (nValues == 6)
+        {
+            const Uint32 r = (Uint32)fminf(fmaxf(values[3], 0.0f), 255.0f);
+            const Uint32 g = (Uint32)fminf(fmaxf(values[4], 0.0f), 255.0f);
+            const Uint32 b = (Uint32)fminf(fmaxf(values[5], 0.0f), 255.0f);
+            colors[nPoints] = 0xFF000000 | r << 16 | g << 8 | b;
+        }
+        nPoints++;
+    }
+    fclose(file);
+
+    if (nPoints == 0)
+        fprintf(stderr, "[ERROR] THE POINT CLOUD %s HAS NO POINTS!\n", path);
+    else
+    {
+        createPointCloud(cloud, nPoints, positions, colors);
+        printf("[POINTS] %s: %d points\n", path, nPoints);
+    }
+    free(positions);
+    free(colors);
+    return nPoints > 0;
+}
+
+/**
+ * Frees the points of a cloud, the cloud itself is not freed
+ *
+ *  @param cloud Cloud to free
+ *
+ *  @return void
+ */
+void freePointCloud(PointCloud* cloud)
+{
+    free(cloud->x);
+    free(cloud->y);
+    free(cloud->z);
+    free(cloud->color);
+    cloud->x = cloud->y = cloud->z = NULL;
+    cloud->color = NULL;
+    cloud->nPoints = 0;
+}
+
+/**
+ * Creates the buffer points are splatted into, as big as the framebuffers
+ * it is used with
+ *
+ *  @param points Buffer to create
+ *  @param width Width in pixels
+ *  @param height Height in pixels
+ *
+ *  @return void
+ */
+void createPointBuffer(PointBuffer* points, int width, int height)
+{
+    points->width = width;
+    points->height = height;
+    ALLOCATE(points->splats, (size_t)width * height * sizeof(Uint64));
+    for (int i = 0; i < width * height; i++)
+        atomic_init(&points->splats[i], POINT_EMPTY);
+}
+
+/**
+ * Frees the splats of a point buffer
+ *
+ *  @param points Buffer to free
+ *
+ *  @return void
+ */
+void freePointBuffer(PointBuffer* points)
+{
+    free((void*)points->splats);
+    points->splats = NULL;
+}
+
+/**
+ * Picks how many octree levels of a cloud to draw: the first level whose
+ * cells are no bigger than a point on screen where the cloud is the closest
+ *
+ *  @param cloud Cloud to draw
+ *  @param modelView Transformation from model to view space
+ *  @param proj Projection matrix
+ *  @param height Height of the frame in pixels
+ *  @param pointSize Side of the square of every point, in pixels
+ *
+ *  @return The last level to draw
+ */
+int pickPointLevel(const PointCloud* cloud, const Matrix4x4* modelView, const Matrix4x4* proj, int height,
+                   int pointSize)
+{
+    const Vector center = {
+        (cloud->boundsMin.x + cloud->boundsMax.x) * 0.5f,
+        (cloud->boundsMin.y + cloud->boundsMax.y) * 0.5f,
+        (cloud->boundsMin.z + cloud->boundsMax.z) * 0.5f
+    };
+    const Vector half = {cloud->boundsMax.x - center.x, cloud->boundsMax.y - center.y, cloud->boundsMax.z - center.z};
+    Vector view;
+    multMatVec(&center, &view, modelView);
+    // Clouds are only rotated and uniformly scaled
+    const float scale = sqrtf(modelView->mat[0][0] * modelView->mat[0][0] + modelView->mat[0][1] * modelView->mat[0][1] +
+                              modelView->mat[0][2] * modelView->mat[0][2]);
+    const float distance = fmaxf(sqrtf(dotProduct(&view, &view)) - sqrtf(dotProduct(&half, &half)) * scale, Z_NEAR);
+    const float perUnit = proj->mat[1][1] * 0.5f * height * scale / distance;
+
+    float cell = 2.0f * fmaxf(fmaxf(half.x, half.y), half.z);
+    for (int l = 0; l < POINT_LEVELS; l++, cell *= 0.5f)
+        if (cell * perUnit <= (float)pointSize)
+            return l;
+    return POINT_LEVELS - 1;
+}
+
+/**
+ * Splats one point: the square around it keeps the nearest point of every
+ * pixel, racing the other threads with a compare and swap
+ *
+ *  @return void
+ */
+static void splatPoint(const SplatJob* job, float x, float y, float w, Uint32 color)
+{
+    const SDL_Rect* clip = job->clip;
+    const int size = job->size;
+    // Behind the camera, too far, or off the rectangle (which also keeps the float to int conversion safe)
+    if (!(w >= Z_NEAR && w <= Z_FAR) || !(x >= clip->x - size && x < clip->x + clip->w + size) ||
+        !(y >= clip->y - size && y < clip->y + clip->h + size))
+        return;
+
+    Uint32 depth;
+    memcpy(&depth, &w, sizeof(depth));
+    const Uint64 key = (Uint64)depth << 32 | color;
+    const int left = (int)floorf(x + 0.5f - size * 0.5f), top = (int)floorf(y + 0.5f - size * 0.5f);
+    const int x0 = SDL_max(left, clip->x), x1 = SDL_min(left + size, clip->x + clip->w);
+    const int y0 = SDL_max(top, clip->y), y1 = SDL_min(top + size, clip->y + clip->h);
+    for (int py = y0; py < y1; py++)
+        for (int px = x0; px < x1; px++)
+        {
+            _Atomic Uint64* splat = &job->points->splats[py * job->points->width + px];
+            Uint64 old = atomic_load_explicit(splat, memory_order_relaxed);
+            while (key < old &&
+                   !atomic_compare_exchange_weak_explicit(splat, &old, key, memory_order_relaxed, memory_order_relaxed))
+                ;
+        }
+}
+
+/**
+ * Transforms one block of points to the screen, 4 at a time, and splats them
+ *
+ *  @return void
+ */
+static void splatBlock(void* data, int index, int worker)
+{
+    (void)worker;
+    const SplatJob* job = data;
+    const PointCloud* cloud = job->cloud;
+    const float (*m)[4] = job->toClip.mat;
+    const float halfWidth = 0.5f * job->fb->width, halfHeight = 0.5f * job->fb->height;
+    const int first = index * POINT_BLOCK;
+    const int end = SDL_min(first + POINT_BLOCK, job->count);
+    float sx[4], sy[4], sw[4];
+#ifdef __SSE2__
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 hw = _mm_set1_ps(halfWidth), hh = _mm_set1_ps(halfHeight);
+#endif
+    for (int i = first; i < end; i += 4)
+    {
+#ifdef __SSE2__
+        const __m128 x = _mm_loadu_ps(&cloud->x[i]);
+        const __m128 y = _mm_loadu_ps(&cloud->y[i]);
+        const __m128 z = _mm_loadu_ps(&cloud->z[i]);
+        const __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0][0])), _mm_mul_ps(y, _mm_set1_ps(m[1][0]))),
+                                     _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[2][0])), _mm_set1_ps(m[3][0])));
+        const __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0][1])), _mm_mul_ps(y, _mm_set1_ps(m[1][1]))),
+                                     _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[2][1])), _mm_set1_ps(m[3][1])));
+        const __m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0][3])), _mm_mul_ps(y, _mm_set1_ps(m[1][3]))),
+                                     _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[2][3])), _mm_set1_ps(m[3][3])));
+        const __m128 inv = _mm_div_ps(one, cw);
+        _mm_storeu_ps(sx, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cx, inv), one), hw));
+        _mm_storeu_ps(sy, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cy, inv), one), hh));
+        _mm_storeu_ps(sw, cw);
+#else
+        for (int k = 0; k < 4; k++)
+        {
+            const float x = cloud->x[i + k], y = cloud->y[i + k], z = cloud->z[i + k];
+            const float cx = x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0];
+            const float cy = x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1];
+            sw[k] = x * m[0][3] + y * m[1][3] + z * m[2][3] + m[3][3];
+            sx[k] = (cx / sw[k] + 1.0f) * halfWidth;
+            sy[k] = (cy / sw[k] + 1.0f) * halfHeight;
+        }
+#endif
+        for (int k = 0; k < 4 && i + k < end; k++)
+            splatPoint(job, sx[k], sy[k], sw[k], cloud->color[i + k]);
+    }
+}
+
+/**
+ * Merges one row of splats into the framebuffer, where they are nearer than
+ * what is already there, and empties it for the next draw
+ *
+ *  @return void
+ */
+static void mergeRow(void* data, int index, int worker)
+{
+    (void)worker;
+    const SplatJob* job = data;
+    Framebuffer* fb = job->fb;
+    const int y = job->clip->y + index;
+    const int samples = fb->samples;
+    for (int x = job->clip->x; x < job->clip->x + job->clip->w; x++)
+    {
+        _Atomic Uint64* splat = &job->points->splats[y * job->points->width + x];
+        const Uint64 key = atomic_load_explicit(splat, memory_order_relaxed);
+        if (key == POINT_EMPTY)
+            continue;
+        atomic_store_explicit(splat, POINT_EMPTY, memory_order_relaxed);
+
+        const Uint32 depth = (Uint32)(key >> 32);
+        float w;
+        memcpy(&w, &depth, sizeof(w));
+        const float iw = 1.0f / w;
+        const Uint32 color = (Uint32)key | 0xFF000000;
+        const int pixel = y * fb->width + x;
+        for (int k = 0; k < samples; k++)
+        {
+            if (iw <= fb->depth[pixel * samples + k])
+                continue;
+            fb->depth[pixel * samples + k] = iw;
+            if (samples > 1)
+                fb->sampleColor[pixel * samples + k] = color;
+            else
+                fb->color[pixel] = color;
+        }
+    }
+}
+
+/**
+ * Draws a point cloud: the points of the octree levels the distance asks for
+ * are splatted as squares of pointSize pixels, in blocks spread over the
+ * workers of a pool, and merged into the framebuffer with a depth test
+ *
+ *  @param cloud Cloud to draw
+ *  @param modelView Transformation from model to view space
+ *  @param proj Projection matrix
+ *  @param pointSize Side of the square of every point, in pixels
+ *  @param points Buffer as big as the framebuffer, empty
+ *  @param fb Framebuffer to draw into
+ *  @param clip Only pixels inside this rectangle are touched
+ *  @param pool Pool to splat on, NULL to splat on this thread
+ *
+ *  @return Number of points splatted, the same whatever the clip
+ */
+int drawPointCloud(const PointCloud* cloud, const Matrix4x4* modelView, const Matrix4x4* proj, int pointSize,
+                   PointBuffer* points, Framebuffer* fb, const SDL_Rect* clip, WorkerPool* pool)
+{
+    SplatJob job;
+    job.cloud = cloud;
+    job.toClip = multMatMat(modelView, proj);
+    job.size = SDL_min(SDL_max(pointSize, 1), POINT_MAX_SIZE);
+    job.count = cloud->levelEnd[pickPointLevel(cloud, modelView, proj, fb->height, job.size)];
+    job.points = points;
+    job.fb = fb;
+    job.clip = clip;
+    if (cloud->nPoints == 0 || clip->w <= 0 || clip->h <= 0)
+        return 0;
+
+    const int nBlocks = (job.count + POINT_BLOCK - 1) / POINT_BLOCK;
+    if (pool != NULL && nBlocks > 1)
+        runParallel(pool, splatBlock, &job, nBlocks);
+    else
+        for (int b = 0; b < nBlocks; b++)
+            splatBlock(&job, b, 0);
+
+    if (pool != NULL)
+        runParallel(pool, mergeRow, &job, clip->h);
+    else
+        for (int y = 0; y < clip->h; y++)
+            mergeRow(&job, y, 0);
+    return job.count;
+}
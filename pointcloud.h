@@ -0,0 +1,59 @@
+//
+// Point clouds splatted straight into the framebuffer
+//
+
+#ifndef POINTCLOUD_H
+#define POINTCLOUD_H
+
+#include "engine.h"
+#include "pool.h"
+#include <stdatomic.h>
+
+// Depth of the octree the points are sorted by, every level is a coarser copy of the cloud
+#define POINT_LEVELS 16
+// Points splatted by one item of a parallel loop
+#define POINT_BLOCK 65536
+// Largest side of the square a point covers, in pixels
+#define POINT_MAX_SIZE 8
+// Splat of a pixel no point reached
+#define POINT_EMPTY 0xFFFFFFFFFFFFFFFFull
+
+struct PointCloud
+{
+    int nPoints;
+    // Structure of arrays padded to a multiple of 4, so 4 points are transformed at once
+    float* x;
+    float* y;
+    float* z;
+    Uint32* color;
+    // Points are sorted by octree level: the first levelEnd[l] points have one point in every
+    // occupied cell of depth l, and the last level has all of them
+    int levelEnd[POINT_LEVELS];
+    Vector boundsMin, boundsMax;
+    // Scene graph node that places the cloud in the world, its transform and screen area of the last frame
+    int node;
+    Matrix4x4 world;
+    SDL_Rect rect;
+};
+
+typedef struct
+{
+    int width, height;
+    // View depth (high 32 bits) and color (low 32 bits) of the nearest point of every pixel. Positive
+    // floats sort like their bits, so the smallest value is the nearest point and threads splat with
+    // an atomic minimum, no locks. POINT_EMPTY between two draws
+    _Atomic Uint64* splats;
+} PointBuffer;
+
+/*Function prototypes*/
+void createPointCloud(PointCloud* cloud, int nPoints, const Vector* positions, const Uint32* colors);
+int loadPointCloud(const char* path, PointCloud* cloud);
+void freePointCloud(PointCloud* cloud);
+void createPointBuffer(PointBuffer* points, int width, int height);
+void freePointBuffer(PointBuffer* points);
+int pickPointLevel(const PointCloud* cloud, const Matrix4x4* modelView, const Matrix4x4* proj, int height,
+                   int pointSize);
+int drawPointCloud(const PointCloud* cloud, const Matrix4x4* modelView, const Matrix4x4* proj, int pointSize,
+                   PointBuffer* points, Framebuffer* fb, const SDL_Rect* clip, WorkerPool* pool);
+
+#endif //POINTCLOUD_H
@@ -0,0 +1,156 @@
+//
+// Pool of worker threads running parallel loops
+//
+// The threads are started once and sleep between loops. Items are handed out
+// one at a time with an atomic counter, so uneven items balance themselves
+//
+
+#include "pool.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Takes items of the current loop until there are none left
+ *
+ *  @return void
+ */
+static void workOn(WorkerPool* pool, int worker)
+{
+    const Uint64 begin = SDL_GetPerformanceCounter();
+    int index;
+    while ((index = SDL_AtomicAdd(&pool->next, 1)) < pool->count)
+        pool->work(pool->data, index, worker);
+    pool->busy[worker] += SDL_GetPerformanceCounter() - begin;
+}
+
+/**
+ * Worker thread: waits for a loop, helps with it and reports back
+ *
+ *  @param data The WorkerPool
+ *
+ *  @return 0
+ */
+static int workerThread(void* data)
+{
+    WorkerPool* pool = data;
+    SDL_LockMutex(pool->mutex);
+    const int worker = ++pool->started;
+    // Starting from 0 a thread that comes up late still joins a loop already running
+    int seen = 0;
+    while (1)
+    {
+        while (pool->generation == seen && pool->running)
+            SDL_CondWait(pool->start, pool->mutex);
+        if (!pool->running)
+            break;
+        seen = pool->generation;
+        SDL_UnlockMutex(pool->mutex);
+
+        workOn(pool, worker);
+
+        SDL_LockMutex(pool->mutex);
+        if (++pool->finished == pool->nWorkers - 1)
+            SDL_CondSignal(pool->done);
+    }
+    SDL_UnlockMutex(pool->mutex);
+    return 0;
+}
+
+/**
+ * Starts the threads of a pool
+ *
+ *  @param pool Pool to start
+ *  @param nWorkers Threads to use counting the caller, 0 for one per CPU core
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int createWorkerPool(WorkerPool* pool, int nWorkers)
+{
+    memset(pool, 0, sizeof(*pool));
+    if (nWorkers <= 0)
+        nWorkers = SDL_GetCPUCount();
+    pool->nWorkers = SDL_max(1, SDL_min(nWorkers, MAX_WORKERS));
+    pool->running = 1;
+    pool->mutex = SDL_CreateMutex();
+    pool->start = SDL_CreateCond();
+    pool->done = SDL_CreateCond();
+    if (pool->mutex == NULL || pool->start == NULL || pool->done == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CREATE THE WORKER POOL LOCKS!\n[SDL] %s\n", SDL_GetError());
+        destroyWorkerPool(pool);
+        return 0;
+    }
+    for (int i = 1; i < pool->nWorkers; i++)
+    {
+        pool->threads[i] = SDL_CreateThread(workerThread, "worker", pool);
+        if (pool->threads[i] == NULL)
+        {
+            fprintf(stderr, "[ERROR] COULD NOT START A WORKER THREAD!\n[SDL] %s\n", SDL_GetError());
+            // Keep the ones that started
+            pool->nWorkers = i;
+            break;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Runs work(data, index, worker) for every index from 0 to count - 1 on all
+ * the workers of the pool, the caller included, and returns when all of
+ * them are done
+ *
+ *  @param pool Pool to run on
+ *  @param work Function to run for every item
+ *  @param data Passed along to work
+ *  @param count Number of items
+ *
+ *  @return void
+ */
+void runParallel(WorkerPool* pool, WorkFunction work, void* data, int count)
+{
+    SDL_LockMutex(pool->mutex);
+    pool->work = work;
+    pool->data = data;
+    pool->count = count;
+    pool->finished = 0;
+    SDL_AtomicSet(&pool->next, 0);
+    pool->generation++;
+    SDL_CondBroadcast(pool->start);
+    SDL_UnlockMutex(pool->mutex);
+
+    workOn(pool, 0);
+
+    SDL_LockMutex(pool->mutex);
+    while (pool->finished < pool->nWorkers - 1)
+        SDL_CondWait(pool->done, pool->mutex);
+    SDL_UnlockMutex(pool->mutex);
+}
+
+/**
+ * Stops and joins the threads of a pool
+ *
+ *  @param pool Pool to stop
+ *
+ *  @return void
+ */
+void destroyWorkerPool(WorkerPool* pool)
+{
+    if (pool->mutex != NULL)
+    {
+        SDL_LockMutex(pool->mutex);
+        pool->running = 0;
+        SDL_CondBroadcast(pool->start);
+        SDL_UnlockMutex(pool->mutex);
+    }
+    for (int i = 1; i < MAX_WORKERS; i++)
+    {
+        if (pool->threads[i] != NULL)
+            SDL_WaitThread(pool->threads[i], NULL);
+        pool->threads[i] = NULL;
+    }
+    SDL_DestroyCond(pool->start);
+    SDL_DestroyCond(pool->done);
+    SDL_DestroyMutex(pool->mutex);
+    pool->start = pool->done = NULL;
+    pool->mutex = NULL;
+}
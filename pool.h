@@ -0,0 +1,47 @@
+//
+// Pool of worker threads running parallel loops
+//
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "engine.h"
+
+// Most threads a pool can have, the calling thread included
+#define MAX_WORKERS 64
+
+// One item of a parallel loop, worker is the index of the thread running it (0 is the caller)
+typedef void (*WorkFunction)(void* data, int index, int worker);
+
+typedef struct
+{
+    // Threads working on a loop, the calling thread counts as worker 0
+    int nWorkers;
+    SDL_Thread* threads[MAX_WORKERS];
+    // Guards everything below except next, start wakes the workers and done wakes the caller
+    SDL_mutex* mutex;
+    SDL_cond* start;
+    SDL_cond* done;
+    int running;
+    // Increases with every loop so the workers know a new one started
+    int generation;
+    // Workers that started, and workers done with the current loop
+    int started;
+    int finished;
+    // Current loop
+    WorkFunction work;
+    void* data;
+    int count;
+    // Next item to take
+    SDL_atomic_t next;
+    // Performance counter ticks every worker spent on items since the pool started, only written by
+    // that worker and read between loops
+    Uint64 busy[MAX_WORKERS];
+} WorkerPool;
+
+/*Function prototypes*/
+int createWorkerPool(WorkerPool* pool, int nWorkers);
+void runParallel(WorkerPool* pool, WorkFunction work, void* data, int count);
+void destroyWorkerPool(WorkerPool* pool);
+
+#endif //POOL_H
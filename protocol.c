@@ -0,0 +1,147 @@
+//
+// Messages between the render server and its clients
+//
+
+#include "protocol.h"
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// A client that went away must not kill the server with SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * Sends a whole message, however many writes it takes
+ *
+ *  @param socket Connected socket
+ *  @param message Bytes to send
+ *  @param size Number of bytes
+ *
+ *  @return 1 on success, 0 if the connection failed
+ */
+int sendMessage(int socket, const void* message, size_t size)
+{
+    const char* at = message;
+    while (size > 0)
+    {
+        const ssize_t sent = send(socket, at, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return 0;
+        at += sent;
+        size -= sent;
+    }
+    return 1;
+}
+
+/**
+ * Receives a whole message, however many reads it takes
+ *
+ *  @param socket Connected socket
+ *  @param message Output, the bytes received
+ *  @param size Number of bytes
+ *
+ *  @return 1 on success, 0 if the other side closed the connection, -1 on failure
+ */
+int receiveMessage(int socket, void* message, size_t size)
+{
+    char* at = message;
+    const size_t total = size;
+    while (size > 0)
+    {
+        const ssize_t received = recv(socket, at, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received == 0 && size == total)
+            return 0;
+        if (received <= 0)
+            return -1;
+        at += received;
+        size -= received;
+    }
+    return 1;
+}
+
+/**
+ * Maps a frame in shared memory. The server creates it and the clients map
+ * the one named in the response
+ *
+ *  @param name Name of the shared memory, starting with /
+ *  @param size Bytes of the frame
+ *  @param create 1 to create it (it must not exist), 0 to open an existing one
+ *
+ *  @return The pixels, NULL on failure
+ */
+Uint32* mapSharedFrame(const char* name, size_t size, int create)
+{
+    const int fd = create ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT OPEN THE SHARED FRAME %s!\n", name);
+        return NULL;
+    }
+    if (create && ftruncate(fd, size) != 0)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT RESIZE THE SHARED FRAME %s!\n", name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    void* pixels = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the memory alive on its own
+    close(fd);
+    if (pixels == MAP_FAILED)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT MAP THE SHARED FRAME %s!\n", name);
+        if (create)
+            shm_unlink(name);
+        return NULL;
+    }
+    return pixels;
+}
+
+/**
+ * Unmaps a frame mapped by mapSharedFrame
+ *
+ *  @param pixels The mapped pixels, can be NULL
+ *  @param size Bytes of the frame
+ *
+ *  @return void
+ */
+void unmapSharedFrame(Uint32* pixels, size_t size)
+{
+    if (pixels != NULL)
+        munmap(pixels, size);
+}
+
+#else
+
+int sendMessage(int socket, const void* message, size_t size)
+{
+    return 0;
+}
+
+int receiveMessage(int socket, void* message, size_t size)
+{
+    return -1;
+}
+
+Uint32* mapSharedFrame(const char* name, size_t size, int create)
+{
+    fprintf(stderr, "[ERROR] SHARED FRAMES NEED A UNIX SYSTEM!\n");
+    return NULL;
+}
+
+void unmapSharedFrame(Uint32* pixels, size_t size)
+{
+}
+
+#endif
@@ -0,0 +1,72 @@
+//
+// Messages between the render server and its clients
+//
+// A client connects to the Unix socket of the server and sends RenderRequests,
+// one at a time. Every request is answered with a RenderResponse naming the
+// shared memory where the server drew the frame, so pixels never go through
+// the socket. The frame stays untouched until the client sends its next
+// request, the memory is only renamed when the resolution changes
+//
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "camera.h"
+#include <stddef.h>
+
+// First field of every request, anything else on the socket is not a client
+#define RENDER_MAGIC 0x524E4452u
+// Biggest width and height a client can ask for
+#define RENDER_MAX_SIZE 8192
+// Meshes a request can pick, more than that draws the whole scene
+#define RENDER_MAX_MESHES 64
+#define RENDER_SHM_NAME_LENGTH 64
+
+typedef enum
+{
+    RENDER_FRAME,
+    // Stops the server once the answer is sent
+    RENDER_SHUTDOWN
+} RenderCommand;
+
+typedef enum
+{
+    RENDER_OK,
+    RENDER_BAD_REQUEST,
+    RENDER_NO_MEMORY
+} RenderStatus;
+
+typedef struct
+{
+    Uint32 magic;
+    Sint32 command;
+    CameraPose pose;
+    Sint32 width, height;
+    // Samples per pixel, 4 or 8 for anti-aliasing, anything else for none
+    Sint32 samples;
+    // Indices of the meshes to draw, 0 meshes draws all of them
+    Sint32 nMeshes;
+    Sint32 meshes[RENDER_MAX_MESHES];
+} RenderRequest;
+
+typedef struct
+{
+    Sint32 status;
+    Sint32 width, height;
+    // Meshes in the scene, so clients know what they can pick
+    Sint32 nMeshes;
+    // Frames the server has drawn since it started
+    Uint32 frame;
+    // Time the server spent drawing this frame
+    float milliseconds;
+    // Shared memory with width * height ARGB8888 pixels
+    char shm[RENDER_SHM_NAME_LENGTH];
+} RenderResponse;
+
+/*Function prototypes*/
+int sendMessage(int socket, const void* message, size_t size);
+int receiveMessage(int socket, void* message, size_t size);
+Uint32* mapSharedFrame(const char* name, size_t size, int create);
+void unmapSharedFrame(Uint32* pixels, size_t size);
+
+#endif //PROTOCOL_H
@@ -0,0 +1,603 @@
+//
+// CPU rasterizer drawing into a Framebuffer
+//
+
+#include "raster.h"
+#include "texture.h"
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Allocates the color and depth buffers of a framebuffer
+ *
+ *  @param fb Framebuffer to create
+ *  @param width Width in pixels
+ *  @param height Height in pixels
+ *  @param samples Samples per pixel, 1 for none or 4 or 8 for multisample anti-aliasing
+ *
+ *  @return void
+ */
+void createFramebuffer(Framebuffer* fb, int width, int height, int samples)
+{
+    fb->width = width;
+    fb->height = height;
+    fb->samples = samples == 4 || samples == 8 ? samples : 1;
+    fb->sampleColor = NULL;
+    ALLOCATE(fb->color, width * height * sizeof(Uint32));
+    if (fb->samples > 1)
+        ALLOCATE(fb->sampleColor, width * height * fb->samples * sizeof(Uint32));
+    ALLOCATE(fb->depth, width * height * fb->samples * sizeof(float));
+}
+
+/**
+ * Frees the buffers of a framebuffer
+ *
+ *  @param fb Framebuffer to free
+ *
+ *  @return void
+ */
+void freeFramebuffer(Framebuffer* fb)
+{
+    free(fb->color);
+    free(fb->sampleColor);
+    free(fb->depth);
+    fb->color = NULL;
+    fb->sampleColor = NULL;
+    fb->depth = NULL;
+}
+
+/**
+ * Clears part of a framebuffer to black and infinitely far away, every
+ * sample of it. Depth only framebuffers have no color buffer
+ *
+ *  @param fb Framebuffer to clear
+ *  @param rect Area to clear, NULL for all of it
+ *
+ *  @return void
+ */
+void clearFramebuffer(Framebuffer* fb, const SDL_Rect* rect)
+{
+    const SDL_Rect all = {0, 0, fb->width, fb->height};
+    if (rect == NULL)
+        rect = &all;
+
+    const int samples = fb->samples;
+    for (int y = rect->y; y < rect->y + rect->h; y++)
+    {
+        float* depth = &fb->depth[(y * fb->width + rect->x) * samples];
+        for (int x = 0; x < rect->w * samples; x++)
+            depth[x] = 0.0f;
+        if (fb->color == NULL)
+            continue;
+        Uint32* color = &fb->color[y * fb->width + rect->x];
+        for (int x = 0; x < rect->w; x++)
+            color[x] = 0xFF000000;
+        if (fb->sampleColor == NULL)
+            continue;
+        color = &fb->sampleColor[(y * fb->width + rect->x) * samples];
+        for (int x = 0; x < rect->w * samples; x++)
+            color[x] = 0xFF000000;
+    }
+}
+
+/**
+ * Point where the edge a -> b crosses the near plane
+ *
+ *  @param a Vertex in front of the plane
+ *  @param b Vertex behind the plane
+ *
+ *  @return Interpolated vertex on the plane
+ */
+static RasterVertex intersectNear(const RasterVertex* a, const RasterVertex* b)
+{
+    const float t = (Z_NEAR - a->w) / (b->w - a->w);
+    RasterVertex o;
+    o.x = a->x + (b->x - a->x) * t;
+    o.y = a->y + (b->y - a->y) * t;
+    o.w = Z_NEAR;
+    o.uv.u = a->uv.u + (b->uv.u - a->uv.u) * t;
+    o.uv.v = a->uv.v + (b->uv.v - a->uv.v) * t;
+    o.r = a->r + (b->r - a->r) * t;
+    o.g = a->g + (b->g - a->g) * t;
+    o.b = a->b + (b->b - a->b) * t;
+    o.sr = a->sr + (b->sr - a->sr) * t;
+    o.sg = a->sg + (b->sg - a->sg) * t;
+    o.sb = a->sb + (b->sb - a->sb) * t;
+    o.shadowPos.x = a->shadowPos.x + (b->shadowPos.x - a->shadowPos.x) * t;
+    o.shadowPos.y = a->shadowPos.y + (b->shadowPos.y - a->shadowPos.y) * t;
+    o.shadowPos.z = a->shadowPos.z + (b->shadowPos.z - a->shadowPos.z) * t;
+    return o;
+}
+
+/**
+ * Clips a view space triangle (x, y and w = z) against the near plane, so
+ * nothing behind the camera reaches the projection
+ *
+ *  @param in The 3 vertices of the triangle
+ *  @param out Room for 2 triangles (6 vertices)
+ *
+ *  @return Number of triangles written to _out_, 0 to 2
+ */
+int clipTriangleNear(const RasterVertex* in, RasterVertex* out)
+{
+    RasterVertex polygon[4];
+    int n = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const RasterVertex* a = &in[i];
+        const RasterVertex* b = &in[(i + 1) % 3];
+        const int aIn = a->w >= Z_NEAR, bIn = b->w >= Z_NEAR;
+        if (aIn)
+            polygon[n++] = *a;
+        if (aIn != bIn)
+            polygon[n++] = aIn ? intersectNear(a, b) : intersectNear(b, a);
+    }
+    if (n < 3)
+        return 0;
+
+    // Fan out of the first vertex
+    for (int i = 0; i + 2 < n; i++)
+    {
+        out[i * 3 + 0] = polygon[0];
+        out[i * 3 + 1] = polygon[i + 1];
+        out[i * 3 + 2] = polygon[i + 2];
+    }
+    return n - 2;
+}
+
+/**
+ * Projects a clipped view space vertex to the screen, keeping its view depth
+ *
+ *  @param v Vertex to project
+ *  @param proj Projection matrix
+ *  @param fb Framebuffer the vertex is drawn into, its size is the size of the screen
+ *
+ *  @return void
+ */
+void projectVertex(RasterVertex* v, const Matrix4x4* proj, const Framebuffer* fb)
+{
+    const Vector view = {v->x, v->y, v->w};
+    Vector projected;
+    multMatVec(&view, &projected, proj);
+    v->x = (projected.x + 1.0f) * 0.5f * fb->width;
+    v->y = (projected.y + 1.0f) * 0.5f * fb->height;
+}
+
+/**
+ * Gradient of a value that varies linearly over the screen inside a triangle
+ *
+ *  @param v Triangle vertices
+ *  @param a The value at every vertex
+ *  @param area Twice the signed area of the triangle
+ *  @param dx Output, change per pixel to the right
+ *  @param dy Output, change per pixel down
+ *
+ *  @return void
+ */
+static void gradient(const RasterVertex* v, const float* a, float area, float* dx, float* dy)
+{
+    *dx = ((a[1] - a[0]) * (v[2].y - v[0].y) - (a[2] - a[0]) * (v[1].y - v[0].y)) / area;
+    *dy = ((a[2] - a[0]) * (v[1].x - v[0].x) - (a[1] - a[0]) * (v[2].x - v[0].x)) / area;
+}
+
+// Features a raster loop is specialized for
+#define RASTER_TEXTURED 1
+#define RASTER_SHADOWED 2
+#define RASTER_DEPTH_ONLY 4
+// Sample counts, one of them at most
+#define RASTER_MSAA4 8
+#define RASTER_MSAA8 16
+
+// Sample positions inside a pixel, from its center. Rotated grid for 4x and the usual 8x pattern,
+// so near horizontal and near vertical edges get as many coverage steps as there are samples
+static const float msaa4[2][4] = {
+    {-0.125f, 0.375f, -0.375f, 0.125f},
+    {-0.375f, -0.125f, 0.125f, 0.375f}
+};
+static const float msaa8[2][8] = {
+    {0.0625f, -0.0625f, 0.3125f, -0.1875f, -0.3125f, -0.4375f, 0.1875f, 0.4375f},
+    {-0.1875f, 0.1875f, 0.0625f, -0.3125f, 0.3125f, -0.0625f, 0.4375f, -0.4375f}
+};
+
+/**
+ * Rasterizes a projected triangle with depth testing. Texture coordinates are
+ * interpolated with perspective correction and the mip level comes from how
+ * many texels one pixel covers. Untextured triangles get the color of their
+ * light. With a shadow map, the light of the shadow casting light is scaled
+ * per pixel by how lit the shadow map says the pixel is.
+ *
+ * With multisampling, coverage and depth are tested at every sample but the
+ * pixel is shaded once, at its center, and the color written to the samples
+ * that passed.
+ *
+ * Always inlined with a constant _features_, so every specialization keeps
+ * only the setup and the per pixel work its features need
+ *
+ *  @param v The 3 projected vertices
+ *  @param texture Texture to sample when RASTER_TEXTURED
+ *  @param shadow Shadow map to look up when RASTER_SHADOWED
+ *  @param fb Framebuffer to draw into, with RASTER_DEPTH_ONLY only the depth is written
+ *  @param clip Only pixels inside this rectangle are touched
+ *  @param features RASTER_* flags, the sample count has to be the one of fb
+ *
+ *  @return void
+ */
+SDL_FORCE_INLINE void rasterizeTriangle(const RasterVertex* v, const Texture* texture, const ShadowMap* shadow,
+                                        Framebuffer* fb, const SDL_Rect* clip, const int features)
+{
+    const int textured = features & RASTER_TEXTURED;
+    const int shadowed = features & RASTER_SHADOWED;
+    const int colored = !(features & RASTER_DEPTH_ONLY);
+    const int samples = features & RASTER_MSAA8 ? 8 : features & RASTER_MSAA4 ? 4 : 1;
+    const float* sampleX = samples == 8 ? msaa8[0] : msaa4[0];
+    const float* sampleY = samples == 8 ? msaa8[1] : msaa4[1];
+
+    const float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+    if (area == 0.0f)
+        return;
+
+    // Edge functions, flipped so the inside is positive whatever the winding
+    const float sign = area > 0.0f ? 1.0f : -1.0f;
+    float ea[3], eb[3], ec[3];
+    int bias[3];
+    for (int e = 0; e < 3; e++)
+    {
+        const RasterVertex* p0 = &v[e];
+        const RasterVertex* p1 = &v[(e + 1) % 3];
+        ea[e] = (p0->y - p1->y) * sign;
+        eb[e] = (p1->x - p0->x) * sign;
+        ec[e] = (p0->x * p1->y - p0->y * p1->x) * sign;
+        // Top-left rule: pixels exactly on an edge belong to the top and left edges only
+        bias[e] = (ea[e] > 0.0f || (ea[e] == 0.0f && eb[e] < 0.0f)) ? 0 : 1;
+    }
+
+    // Values that interpolate linearly on the screen: 1 / w and everything else divided by w
+    const float iw[3] = {1.0f / v[0].w, 1.0f / v[1].w, 1.0f / v[2].w};
+    float iwDx, iwDy;
+    gradient(v, iw, area, &iwDx, &iwDy);
+    // Light, texture coordinates, then shadowed light and shadow map position
+    float aw[11][3], awDx[11] = {0}, awDy[11] = {0};
+    if (colored)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            aw[0][k] = v[k].r * iw[k];
+            aw[1][k] = v[k].g * iw[k];
+            aw[2][k] = v[k].b * iw[k];
+            aw[3][k] = v[k].uv.u * iw[k];
+            aw[4][k] = v[k].uv.v * iw[k];
+            aw[5][k] = v[k].sr * iw[k];
+            aw[6][k] = v[k].sg * iw[k];
+            aw[7][k] = v[k].sb * iw[k];
+            aw[8][k] = v[k].shadowPos.x * iw[k];
+            aw[9][k] = v[k].shadowPos.y * iw[k];
+            aw[10][k] = v[k].shadowPos.z * iw[k];
+        }
+        for (int a = 0; a < 3; a++)
+            gradient(v, aw[a], area, &awDx[a], &awDy[a]);
+        for (int a = 3; a < 5 && textured; a++)
+            gradient(v, aw[a], area, &awDx[a], &awDy[a]);
+        for (int a = 5; a < 11 && shadowed; a++)
+            gradient(v, aw[a], area, &awDx[a], &awDy[a]);
+    }
+
+    // Edge functions and depth at every sample, relative to the pixel center
+    float sampleEdge[3][8], sampleIw[8];
+    for (int k = 0; k < samples && samples > 1; k++)
+    {
+        for (int e = 0; e < 3; e++)
+            sampleEdge[e][k] = ea[e] * sampleX[k] + eb[e] * sampleY[k];
+        sampleIw[k] = iwDx * sampleX[k] + iwDy * sampleY[k];
+    }
+
+    const int minX = SDL_max(clip->x, (int)floorf(fminf(v[0].x, fminf(v[1].x, v[2].x))));
+    const int maxX = SDL_min(clip->x + clip->w - 1, (int)ceilf(fmaxf(v[0].x, fmaxf(v[1].x, v[2].x))));
+    const int minY = SDL_max(clip->y, (int)floorf(fminf(v[0].y, fminf(v[1].y, v[2].y))));
+    const int maxY = SDL_min(clip->y + clip->h - 1, (int)ceilf(fmaxf(v[0].y, fmaxf(v[1].y, v[2].y))));
+
+    const float texW = textured ? (float)texture->width : 0.0f;
+    const float texH = textured ? (float)texture->height : 0.0f;
+
+    for (int y = minY; y <= maxY; y++)
+    {
+        const float py = y + 0.5f, px = minX + 0.5f;
+        float e0 = ea[0] * px + eb[0] * py + ec[0];
+        float e1 = ea[1] * px + eb[1] * py + ec[1];
+        float e2 = ea[2] * px + eb[2] * py + ec[2];
+        const float dx = px - v[0].x, dy = py - v[0].y;
+        float pIw = iw[0] + iwDx * dx + iwDy * dy;
+        float pAw[11];
+        for (int a = 0; a < 11 && colored; a++)
+            pAw[a] = aw[a][0] + awDx[a] * dx + awDy[a] * dy;
+
+        Uint32* color = !colored ? NULL : samples > 1 ? &fb->sampleColor[y * fb->width * samples]
+                                                      : &fb->color[y * fb->width];
+        float* depth = &fb->depth[y * fb->width * samples];
+        for (int x = minX; x <= maxX; x++)
+        {
+            // Samples that are inside the triangle and closer than what is there (bigger 1 / w is closer)
+            int covered = 0;
+            if (samples == 1)
+            {
+                const int inside = (e0 > 0.0f || (e0 == 0.0f && !bias[0])) &&
+                                   (e1 > 0.0f || (e1 == 0.0f && !bias[1])) &&
+                                   (e2 > 0.0f || (e2 == 0.0f && !bias[2]));
+                covered = inside && pIw > depth[x];
+            }
+            else
+            {
+                for (int k = 0; k < samples; k++)
+                {
+                    const float s0 = e0 + sampleEdge[0][k], s1 = e1 + sampleEdge[1][k], s2 = e2 + sampleEdge[2][k];
+                    const int inside = (s0 > 0.0f || (s0 == 0.0f && !bias[0])) &&
+                                       (s1 > 0.0f || (s1 == 0.0f && !bias[1])) &&
+                                       (s2 > 0.0f || (s2 == 0.0f && !bias[2]));
+                    covered |= (inside && pIw + sampleIw[k] > depth[x * samples + k]) << k;
+                }
+            }
+
+            if (covered)
+            {
+                if (samples == 1)
+                    depth[x] = pIw;
+                else
+                    for (int k = 0; k < samples; k++)
+                        if (covered & (1 << k))
+                            depth[x * samples + k] = pIw + sampleIw[k];
+
+                if (colored)
+                {
+                    // Shaded once for all the samples, at the center unless it is only partly covered. Then the
+                    // center may be outside of the triangle, so the first covered sample is shaded instead
+                    float cIw = pIw;
+                    const float* at = pAw;
+                    float moved[11];
+                    if (samples > 1 && covered != (1 << samples) - 1)
+                    {
+                        int k = 0;
+                        while (!(covered & (1 << k)))
+                            k++;
+                        cIw += sampleIw[k];
+                        for (int a = 0; a < 11; a++)
+                            moved[a] = pAw[a] + awDx[a] * sampleX[k] + awDy[a] * sampleY[k];
+                        at = moved;
+                    }
+                    const float w = 1.0f / cIw;
+                    float lr = at[0] * w, lg = at[1] * w, lb = at[2] * w;
+                    if (shadowed)
+                    {
+                        const float lit = sampleShadow(shadow, at[8] * w, at[9] * w, at[10] * w);
+                        lr += at[5] * w * lit;
+                        lg += at[6] * w * lit;
+                        lb += at[7] * w * lit;
+                    }
+                    const Uint32 r = (Uint32)(SDL_max(0.0f, SDL_min(1.0f, lr)) * 255.0f);
+                    const Uint32 g = (Uint32)(SDL_max(0.0f, SDL_min(1.0f, lg)) * 255.0f);
+                    const Uint32 b = (Uint32)(SDL_max(0.0f, SDL_min(1.0f, lb)) * 255.0f);
+                    Uint32 pixel;
+                    if (textured)
+                    {
+                        const float u = at[3] * w, tv = at[4] * w;
+                        // How fast the texture coordinates change from one pixel to the next, in texels
+                        const float dudx = (awDx[3] - u * iwDx) * w * texW, dvdx = (awDx[4] - tv * iwDx) * w * texH;
+                        const float dudy = (awDy[3] - u * iwDy) * w * texW, dvdy = (awDy[4] - tv * iwDy) * w * texH;
+                        const float rho2 = fmaxf(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+                        const float lod = rho2 > 1.0f ? 0.5f * log2f(rho2) : 0.0f;
+
+                        const Uint32 texel = sampleTexture(texture, u, tv, lod);
+                        pixel = 0xFF000000 | ((((texel >> 16) & 0xFF) * r / 255) << 16) |
+                                ((((texel >> 8) & 0xFF) * g / 255) << 8) | ((texel & 0xFF) * b / 255);
+                    }
+                    else
+                        pixel = 0xFF000000 | r << 16 | g << 8 | b;
+
+                    if (samples == 1)
+                        color[x] = pixel;
+                    else
+                        for (int k = 0; k < samples; k++)
+                            if (covered & (1 << k))
+                                color[x * samples + k] = pixel;
+                }
+            }
+            e0 += ea[0]; e1 += ea[1]; e2 += ea[2];
+            pIw += iwDx;
+            for (int a = 0; a < 3 && colored; a++)
+                pAw[a] += awDx[a];
+            for (int a = 3; a < 5 && colored && textured; a++)
+                pAw[a] += awDx[a];
+            for (int a = 5; a < 11 && colored && shadowed; a++)
+                pAw[a] += awDx[a];
+        }
+    }
+}
+
+// One raster loop per combination of features
+#define RASTER_LOOP(name, features)                                                                             \
+    static void name(const RasterVertex* v, const Texture* texture, const ShadowMap* shadow, Framebuffer* fb,   \
+                     const SDL_Rect* clip)                                                                      \
+    {                                                                                                           \
+        rasterizeTriangle(v, texture, shadow, fb, clip, features);                                              \
+    }
+
+// Every shading combination for one sample count
+#define RASTER_LOOPS(suffix, msaa)                                                                              \
+    RASTER_LOOP(fillLit##suffix, msaa)                                                                          \
+    RASTER_LOOP(fillTextured##suffix, RASTER_TEXTURED | msaa)                                                   \
+    RASTER_LOOP(fillShadowed##suffix, RASTER_SHADOWED | msaa)                                                   \
+    RASTER_LOOP(fillTexturedShadowed##suffix, RASTER_TEXTURED | RASTER_SHADOWED | msaa)                         \
+    RASTER_LOOP(fillDepth##suffix, RASTER_DEPTH_ONLY | msaa)
+
+RASTER_LOOPS(, 0)
+RASTER_LOOPS(Msaa4, RASTER_MSAA4)
+RASTER_LOOPS(Msaa8, RASTER_MSAA8)
+
+// Indexed by sample count (1, 4, 8) and then RASTER_* shading flags, depth only loops ignore the
+// texture and the shadows
+static const RasterFunction rasterFunctions[3][8] = {
+    {fillLit, fillTextured, fillShadowed, fillTexturedShadowed, fillDepth, fillDepth, fillDepth, fillDepth},
+    {
+        fillLitMsaa4, fillTexturedMsaa4, fillShadowedMsaa4, fillTexturedShadowedMsaa4,
+        fillDepthMsaa4, fillDepthMsaa4, fillDepthMsaa4, fillDepthMsaa4
+    },
+    {
+        fillLitMsaa8, fillTexturedMsaa8, fillShadowedMsaa8, fillTexturedShadowedMsaa8,
+        fillDepthMsaa8, fillDepthMsaa8, fillDepthMsaa8, fillDepthMsaa8
+    }
+};
+
+/**
+ * Picks the raster loop specialized for what the triangles of a batch use,
+ * so the loop does not have to check it for every pixel
+ *
+ *  @param texture Texture of the triangles, NULL for none
+ *  @param shadow Shadow map to look up, NULL for none
+ *  @param fb Framebuffer drawn into, depth only when it has no color buffer
+ *
+ *  @return The raster function, called with the same texture, shadow and fb
+ */
+RasterFunction selectRasterFunction(const Texture* texture, const ShadowMap* shadow, const Framebuffer* fb)
+{
+    return rasterFunctions[fb->samples == 8 ? 2 : fb->samples == 4 ? 1 : 0]
+                          [(texture != NULL ? RASTER_TEXTURED : 0) | (shadow != NULL ? RASTER_SHADOWED : 0) |
+                           (fb->color == NULL ? RASTER_DEPTH_ONLY : 0)];
+}
+
+/**
+ * Rasterizes a projected triangle with depth testing (see rasterizeTriangle).
+ * Batches of triangles should pick their loop once with selectRasterFunction
+ *
+ *  @param v The 3 projected vertices
+ *  @param texture Texture to sample, NULL for none
+ *  @param shadow Shadow map to look up, NULL for none
+ *  @param fb Framebuffer to draw into, without a color buffer only the depth is written
+ *  @param clip Only pixels inside this rectangle are touched
+ *
+ *  @return void
+ */
+void fillTriangle(const RasterVertex* v, const Texture* texture, const ShadowMap* shadow, Framebuffer* fb,
+                  const SDL_Rect* clip)
+{
+    selectRasterFunction(texture, shadow, fb)(v, texture, shadow, fb, clip);
+}
+
+/**
+ * Draws a projected line with depth testing, one pixel per step along its
+ * longer axis. The line is clipped to the rectangle before stepping, so
+ * long lines mostly off the screen cost nothing
+ *
+ *  @param a First projected end
+ *  @param b Second projected end
+ *  @param color ARGB color of the line
+ *  @param fb Framebuffer to draw into
+ *  @param clip Only pixels inside this rectangle are touched
+ *
+ *  @return void
+ */
+void drawLine(const RasterVertex* a, const RasterVertex* b, Uint32 color, Framebuffer* fb, const SDL_Rect* clip)
+{
+    // Liang-Barsky: the part of the line inside the rectangle is t0 <= t <= t1
+    const float dx = b->x - a->x, dy = b->y - a->y;
+    const float p[4] = {-dx, dx, -dy, dy};
+    const float q[4] = {a->x - clip->x, clip->x + clip->w - a->x, a->y - clip->y, clip->y + clip->h - a->y};
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int k = 0; k < 4; k++)
+    {
+        if (p[k] == 0.0f)
+        {
+            if (q[k] < 0.0f)
+                return;
+            continue;
+        }
+        const float r = q[k] / p[k];
+        if (p[k] < 0.0f)
+            t0 = fmaxf(t0, r);
+        else
+            t1 = fminf(t1, r);
+    }
+    if (t0 > t1)
+        return;
+
+    // 1 / w varies linearly along the projected line
+    const float iwA = 1.0f / a->w, iwB = 1.0f / b->w;
+    const float x0 = a->x + dx * t0, y0 = a->y + dy * t0, iw0 = iwA + (iwB - iwA) * t0;
+    const float x1 = a->x + dx * t1, y1 = a->y + dy * t1, iw1 = iwA + (iwB - iwA) * t1;
+    const int steps = SDL_max(1, (int)ceilf(fmaxf(fabsf(x1 - x0), fabsf(y1 - y0))));
+    const float sx = (x1 - x0) / steps, sy = (y1 - y0) / steps, siw = (iw1 - iw0) / steps;
+
+    float x = x0, y = y0, iw = iw0;
+    for (int i = 0; i <= steps; i++, x += sx, y += sy, iw += siw)
+    {
+        const int px = (int)floorf(x), py = (int)floorf(y);
+        // The ends can round just outside of the rectangle
+        if (px < clip->x || px >= clip->x + clip->w || py < clip->y || py >= clip->y + clip->h)
+            continue;
+        // Lines cover every sample of their pixels
+        const int at = (py * fb->width + px) * fb->samples;
+        for (int k = 0; k < fb->samples; k++)
+        {
+            if (iw < fb->depth[at + k])
+                continue;
+            fb->depth[at + k] = iw;
+            if (fb->sampleColor != NULL)
+                fb->sampleColor[at + k] = color;
+            else if (fb->color != NULL)
+                fb->color[at] = color;
+        }
+    }
+}
+
+/**
+ * Averages the samples of every pixel of a multisampled framebuffer into
+ * its color buffer. With SSE2 the channels of 4 samples are added at once
+ *
+ *  @param fb Framebuffer to resolve, nothing happens with one sample per pixel
+ *  @param rect Area to resolve, NULL for all of it
+ *
+ *  @return void
+ */
+void resolveFramebuffer(Framebuffer* fb, const SDL_Rect* rect)
+{
+    const SDL_Rect all = {0, 0, fb->width, fb->height};
+    if (rect == NULL)
+        rect = &all;
+    if (fb->sampleColor == NULL)
+        return;
+
+    const int samples = fb->samples;
+    for (int y = rect->y; y < rect->y + rect->h; y++)
+    {
+        const Uint32* in = &fb->sampleColor[(y * fb->width + rect->x) * samples];
+        Uint32* out = &fb->color[y * fb->width + rect->x];
+        for (int x = 0; x < rect->w; x++, in += samples)
+        {
+#ifdef __SSE2__
+            // 16 bits per channel leave room for the sum of 8 samples
+            const __m128i zero = _mm_setzero_si128();
+            __m128i sum = zero;
+            for (int k = 0; k < samples; k += 4)
+            {
+                const __m128i four = _mm_loadu_si128((const __m128i*)&in[k]);
+                sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(four, zero));
+                sum = _mm_add_epi16(sum, _mm_unpackhi_epi8(four, zero));
+            }
+            sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+            // Rounded average, 4 samples shift by 2 and 8 by 3
+            sum = _mm_add_epi16(sum, _mm_set1_epi16((short)(samples / 2)));
+            sum = _mm_srl_epi16(sum, _mm_cvtsi32_si128(samples == 8 ? 3 : 2));
+            out[x] = (Uint32)_mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+#else
+            Uint32 r = samples / 2, g = samples / 2, b = samples / 2;
+            for (int k = 0; k < samples; k++)
+            {
+                r += (in[k] >> 16) & 0xFF;
+                g += (in[k] >> 8) & 0xFF;
+                b += in[k] & 0xFF;
+            }
+            out[x] = 0xFF000000 | (r / samples) << 16 | (g / samples) << 8 | (b / samples);
+#endif
+        }
+    }
+}
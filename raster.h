@@ -0,0 +1,27 @@
+//
+// CPU rasterizer drawing into a Framebuffer
+//
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "engine.h"
+#include "shadow.h"
+
+// Draws one projected triangle, see selectRasterFunction
+typedef void (*RasterFunction)(const RasterVertex* v, const Texture* texture, const ShadowMap* shadow, Framebuffer* fb,
+                               const SDL_Rect* clip);
+
+/*Function prototypes*/
+void createFramebuffer(Framebuffer* fb, int width, int height, int samples);
+void resolveFramebuffer(Framebuffer* fb, const SDL_Rect* rect);
+void freeFramebuffer(Framebuffer* fb);
+void clearFramebuffer(Framebuffer* fb, const SDL_Rect* rect);
+int clipTriangleNear(const RasterVertex* in, RasterVertex* out);
+void projectVertex(RasterVertex* v, const Matrix4x4* proj, const Framebuffer* fb);
+RasterFunction selectRasterFunction(const Texture* texture, const ShadowMap* shadow, const Framebuffer* fb);
+void fillTriangle(const RasterVertex* v, const Texture* texture, const ShadowMap* shadow, Framebuffer* fb,
+                  const SDL_Rect* clip);
+void drawLine(const RasterVertex* a, const RasterVertex* b, Uint32 color, Framebuffer* fb, const SDL_Rect* clip);
+
+#endif //RASTER_H
@@ -0,0 +1,240 @@
+//
+// Drawing meshes and whole views with the CPU rasterizer
+//
+
+#include "render.h"
+#include "camera.h"
+#include "light.h"
+#include "meshlet.h"
+#include "pointcloud.h"
+#include "raster.h"
+#include "scene.h"
+#include "skin.h"
+#include "stream.h"
+#include "wireframe.h"
+
+// Everything is drawn in view space, where the camera sits at the origin
+Vector camera = {0.0f, 0.0f, 0.0f};
+
+/**
+ * Transforms, culls, lights and fills every triangle of a mesh. Whole meshlets
+ * outside of the view or facing away are skipped before touching their vertices,
+ * the rest are lit once per vertex and the colors blended across the faces
+ *
+ *  @param mesh Mesh to draw
+ *  @param world Transformation from model to world space
+ *  @param proj_mat Projection matrix
+ *  @param lights Lights of the scene
+ *  @param nLights Number of lights
+ *  @param shadow Shadow map of the shadow casting light, NULL for no shadows
+ *  @param fb Framebuffer to draw into
+ *  @param clip Only pixels inside this rectangle are touched
+ *
+ *  @return Number of mesh triangles that went to the rasterizer, the same whatever the clip. A triangle cut in
+ *          two by the near plane counts once, one entirely behind it does not count
+ */
+int drawMesh(const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj_mat, const Light* lights, int nLights,
+             const ShadowMap* shadow, Framebuffer* fb, const SDL_Rect* clip)
+{
+    Vector transformed[MESHLET_MAX_VERTS];
+    Vector normals[MESHLET_MAX_VERTS];
+    Vector shadowPos[MESHLET_MAX_VERTS];
+    float rgb[MESHLET_MAX_VERTS * 3];
+    float shadowRgb[MESHLET_MAX_VERTS * 3];
+    int ids[MESHLET_MAX_VERTS];
+    const int shadowed = shadow != NULL ? shadow->light : -1;
+    // The raster loop only does what this mesh needs
+    const ShadowMap* shadowMap = shadowed >= 0 ? shadow : NULL;
+    const RasterFunction raster = selectRasterFunction(mesh->texture, shadowMap, fb);
+    int submitted = 0;
+
+    for (int m = 0; m < mesh->nMeshlets; m++)
+    {
+        const Meshlet* meshlet = &mesh->meshlets[m];
+        if (!isMeshletVisible(meshlet, world, &camera, proj_mat))
+            continue;
+
+        // Rotate -> Translate (both in the world matrix), once for every vertex of the meshlet
+        transformMeshlet(mesh, meshlet, world, transformed, normals, ids);
+        // Light every vertex once, no matter how many faces share it
+        shadeVertices(transformed, normals, meshlet->nVerts, lights, nLights, shadowed, rgb, shadowRgb);
+        for (int v = 0; v < meshlet->nVerts && shadowed >= 0; v++)
+            shadowPos[v] = toShadowMap(shadow, &transformed[v]);
+
+        for (int j = 0; j < meshlet->nTris; j++)
+        {
+            const Uint8* tri = &mesh->meshletTris[(meshlet->triOffset + j) * 3];
+            Triangle translated;
+            for (int k = 0; k < 3; k++)
+                translated.points[k] = transformed[tri[k]];
+
+            // Calculate 2 lines of the triangle (l1, l2) and get the normal through crossProduct
+            Vector l1 = {
+                translated.points[1].x - translated.points[0].x,
+                translated.points[1].y - translated.points[0].y,
+                translated.points[1].z - translated.points[0].z
+            };
+
+            Vector l2 = {
+                translated.points[2].x - translated.points[0].x,
+                translated.points[2].y - translated.points[0].y,
+                translated.points[2].z - translated.points[0].z
+            };
+
+            Vector normal = crossProduct(&l1, &l2);
+            normalizeVector(&normal);
+            // Calculate the vector from the camera to one point of the triangle
+            Vector t_camera = {
+                translated.points[1].x - camera.x,
+                translated.points[1].y - camera.y,
+                translated.points[1].z - camera.z
+            };
+            // Culling - Can be much better
+            if (dotProduct(&normal, &t_camera) < 0.0f) {
+                RasterVertex view[3], clipped[6];
+                for (int k = 0; k < 3; k++)
+                {
+                    view[k].x = translated.points[k].x;
+                    view[k].y = translated.points[k].y;
+                    view[k].w = translated.points[k].z;
+                    view[k].uv = mesh->uvs != NULL ? mesh->uvs[ids[tri[k]]] : (TexCoord){0.0f, 0.0f};
+                    view[k].r = rgb[tri[k] * 3 + 0];
+                    view[k].g = rgb[tri[k] * 3 + 1];
+                    view[k].b = rgb[tri[k] * 3 + 2];
+                    view[k].sr = shadowed >= 0 ? shadowRgb[tri[k] * 3 + 0] : 0.0f;
+                    view[k].sg = shadowed >= 0 ? shadowRgb[tri[k] * 3 + 1] : 0.0f;
+                    view[k].sb = shadowed >= 0 ? shadowRgb[tri[k] * 3 + 2] : 0.0f;
+                    view[k].shadowPos = shadowed >= 0 ? shadowPos[tri[k]] : (Vector){0.0f, 0.0f, 0.0f};
+                }
+                // Process Projection and Scaling only for faces we see, after cutting what is behind us
+                const int nClipped = clipTriangleNear(view, clipped);
+                for (int k = 0; k < nClipped * 3; k++)
+                    projectVertex(&clipped[k], proj_mat, fb);
+                for (int c = 0; c < nClipped; c++)
+                    raster(&clipped[c * 3], mesh->texture, shadowMap, fb, clip);
+                submitted += nClipped > 0;
+            }
+        }
+    }
+    return submitted;
+}
+
+/**
+ * Draws every mesh of the engine from a camera pose into a framebuffer of
+ * its own. Nothing in the engine is written, so many views can be drawn at
+ * the same time from different threads
+ *
+ *  @param engine Engine with the meshes (world matrices up to date) and lights
+ *  @param pose Where the camera is
+ *  @param proj Projection matrix
+ *  @param shadow Shadow map of the shadow casting light, NULL for no shadows
+ *  @param meshes Indices of the meshes to draw, NULL for all of them, the streams and the point clouds
+ *  @param nMeshes Number of indices in meshes
+ *  @param fb Framebuffer to draw into, cleared first and resolved at the end
+ *
+ *  @return void
+ */
+void renderView(const Engine* engine, const CameraPose* pose, const Matrix4x4* proj, const ShadowMap* shadow,
+                const int* meshes, int nMeshes, Framebuffer* fb)
+{
+    // Everything is moved to view space, where the camera is at the origin looking down +z
+    const Matrix4x4 view = viewMatrix(pose);
+    Light lights[MAX_LIGHTS];
+    transformLights(engine->lights, engine->nLights, &view, lights);
+    ShadowMap viewShadow;
+    if (shadow != NULL)
+    {
+        const Matrix4x4 toWorld = cameraToWorld(pose);
+        viewShadow = *shadow;
+        viewShadow.toMap = multMatMat(&toWorld, &shadow->toMap);
+    }
+
+    const SDL_Rect all = {0, 0, fb->width, fb->height};
+    clearFramebuffer(fb, NULL);
+    if (meshes == NULL)
+        nMeshes = engine->nMeshes;
+    for (int i = 0; i < nMeshes; i++)
+    {
+        const Mesh* mesh = &engine->meshes[meshes != NULL ? meshes[i] : i];
+        const Matrix4x4 modelView = multMatMat(&mesh->world, &view);
+        if (engine->wireframe)
+            drawMeshEdges(mesh, &modelView, proj, fb, &all);
+        else
+            drawMesh(mesh, &modelView, proj, lights, engine->nLights, shadow != NULL ? &viewShadow : NULL, fb,
+                     &all);
+    }
+    for (int i = 0; i < engine->nStreams && meshes == NULL; i++)
+    {
+        const MeshStream* stream = &engine->streams[i];
+        const Matrix4x4 modelView = multMatMat(&stream->world, &view);
+        drawMeshStream(stream, &modelView, proj, lights, engine->nLights, shadow != NULL ? &viewShadow : NULL,
+                       engine->wireframe, fb, &all);
+    }
+    if (meshes == NULL && engine->nClouds > 0)
+    {
+        // Every view splats into a buffer of its own
+        PointBuffer points;
+        createPointBuffer(&points, fb->width, fb->height);
+        for (int i = 0; i < engine->nClouds; i++)
+        {
+            const PointCloud* cloud = &engine->clouds[i];
+            const Matrix4x4 modelView = multMatMat(&cloud->world, &view);
+            drawPointCloud(cloud, &modelView, proj, engine->pointSize, &points, fb, &all, NULL);
+        }
+        freePointBuffer(&points);
+    }
+    resolveFramebuffer(fb, NULL);
+}
+
+/**
+ * Brings the animated meshes and the world matrices of the meshes up to date
+ * with the scene graph, and the shadow map with them, before views are drawn
+ * from the scene
+ *
+ *  @param engine Engine with the scene
+ *  @param shadow Shadow map of the scene
+ *
+ *  @return void
+ */
+void settleScene(Engine* engine, ShadowMap* shadow)
+{
+    skinMeshes(engine, NULL);
+    updateSceneGraph(engine);
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        Mesh* mesh = &engine->meshes[i];
+        const Node* node = &engine->nodes[mesh->node];
+        if (node->changed)
+        {
+            mesh->world = node->world;
+            if (mesh->shadowCaster)
+                shadow->dirty = 1;
+        }
+    }
+    for (int i = 0; i < engine->nStreams; i++)
+        engine->streams[i].world = engine->nodes[engine->streams[i].node].world;
+    for (int i = 0; i < engine->nClouds; i++)
+        engine->clouds[i].world = engine->nodes[engine->clouds[i].node].world;
+    updateShadowMap(shadow, engine);
+}
+
+/**
+ * Pages in every chunk of the streams a view needs, waiting for the disk.
+ * The scene has to be settled first
+ *
+ *  @param engine Engine with the streams
+ *  @param pose Where the camera is
+ *  @param proj Projection matrix
+ *  @param height Height of the view in pixels
+ *
+ *  @return void
+ */
+void settleStreams(Engine* engine, const CameraPose* pose, const Matrix4x4* proj, int height)
+{
+    const Matrix4x4 view = viewMatrix(pose);
+    for (int i = 0; i < engine->nStreams; i++)
+    {
+        const Matrix4x4 modelView = multMatMat(&engine->streams[i].world, &view);
+        settleMeshStream(&engine->streams[i], &modelView, proj, height);
+    }
+}
@@ -0,0 +1,20 @@
+//
+// Drawing meshes and whole views with the CPU rasterizer
+//
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "engine.h"
+#include "camera.h"
+#include "shadow.h"
+
+/*Function prototypes*/
+int drawMesh(const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj_mat, const Light* lights, int nLights,
+             const ShadowMap* shadow, Framebuffer* fb, const SDL_Rect* clip);
+void renderView(const Engine* engine, const CameraPose* pose, const Matrix4x4* proj, const ShadowMap* shadow,
+                const int* meshes, int nMeshes, Framebuffer* fb);
+void settleScene(Engine* engine, ShadowMap* shadow);
+void settleStreams(Engine* engine, const CameraPose* pose, const Matrix4x4* proj, int height);
+
+#endif //RENDER_H
@@ -0,0 +1,159 @@
+//
+// Camera paths recorded during interactive sessions and replayed with a fixed timestep
+//
+// While recording, every frame appends the camera pose and the animation time
+// to a file, 32 bytes per frame, with the time it was shown at. Replaying
+// walks that path in fixed steps of path time, whatever the frames cost, so
+// the same file draws the same frames on every machine and a slow flight
+// through a scene becomes something that can be timed again and again
+//
+
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Starts recording a camera path
+ *
+ *  @param recorder Recorder to start
+ *  @param path File to write, replaced if it exists
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int createPathRecorder(PathRecorder* recorder, const char* path)
+{
+    recorder->nKeys = 0;
+    recorder->file = fopen(path, "wb");
+    const PathFileHeader header = {PATH_FILE_MAGIC, PATH_FILE_VERSION};
+    if (recorder->file == NULL || fwrite(&header, sizeof(header), 1, recorder->file) != 1)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT WRITE THE CAMERA PATH %s!\n", path);
+        if (recorder->file != NULL)
+            fclose(recorder->file);
+        recorder->file = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Appends the key of one frame. Keys have to come in the order of their time
+ *
+ *  @param recorder Recorder
+ *  @param key What the frame showed
+ *
+ *  @return void
+ */
+void recordPathKey(PathRecorder* recorder, const PathKey* key)
+{
+    if (recorder->file != NULL && fwrite(key, sizeof(PathKey), 1, recorder->file) == 1)
+        recorder->nKeys++;
+}
+
+/**
+ * Finishes the file of a recording
+ *
+ *  @param recorder Recorder to stop
+ *
+ *  @return void
+ */
+void destroyPathRecorder(PathRecorder* recorder)
+{
+    if (recorder->file == NULL)
+        return;
+    fclose(recorder->file);
+    recorder->file = NULL;
+    printf("[REPLAY] %d frames recorded\n", recorder->nKeys);
+}
+
+/**
+ * Reads a recorded camera path. Keys that go back in time are dropped, so
+ * the path can always be sampled
+ *
+ *  @param path File written by a PathRecorder
+ *  @param keys Output, array with the keys that has to be freed
+ *
+ *  @return Number of keys, -1 on failure
+ */
+int loadCameraPath(const char* path, PathKey** keys)
+{
+    FILE* file = fopen(path, "rb");
+    PathFileHeader header;
+    if (file == NULL || fread(&header, sizeof(header), 1, file) != 1 || header.magic != PATH_FILE_MAGIC ||
+        header.version != PATH_FILE_VERSION)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT READ THE CAMERA PATH %s!\n", path);
+        if (file != NULL)
+            fclose(file);
+        return -1;
+    }
+
+    int count = 0, capacity = 256;
+    ALLOCATE(*keys, capacity * sizeof(PathKey));
+    PathKey key;
+    while (fread(&key, sizeof(key), 1, file) == 1)
+    {
+        if (count > 0 && !(key.time >= (*keys)[count - 1].time))
+            continue;
+        if (count == capacity)
+        {
+            capacity *= 2;
+            PathKey* grown = realloc(*keys, capacity * sizeof(PathKey));
+            if (grown == NULL)
+            {
+                perror("[ERROR] ALLOCATING MEMORY FAILED!");
+                break;
+            }
+            *keys = grown;
+        }
+        (*keys)[count++] = key;
+    }
+    fclose(file);
+    if (count == 0)
+        fprintf(stderr, "[ERROR] THE CAMERA PATH %s IS EMPTY!\n", path);
+    return count > 0 ? count : -1;
+}
+
+/**
+ * Finds where a path is at a time, between the two keys around it. Times
+ * before the first key or after the last one get that key
+ *
+ *  @param keys Keys of the path, in the order of their time
+ *  @param nKeys Number of keys, at least 1
+ *  @param time Seconds since the path started
+ *  @param key Output, the interpolated key
+ *
+ *  @return void
+ */
+void samplePath(const PathKey* keys, int nKeys, float time, PathKey* key)
+{
+    // Last key at or before the time
+    int low = 0, high = nKeys - 1;
+    while (low < high)
+    {
+        const int middle = (low + high + 1) / 2;
+        if (keys[middle].time <= time)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    const PathKey* a = &keys[low];
+    if (low == nKeys - 1 || time <= a->time)
+    {
+        *key = *a;
+        key->time = time;
+        return;
+    }
+
+    const PathKey* b = &keys[low + 1];
+    const float t = b->time > a->time ? (time - a->time) / (b->time - a->time) : 1.0f;
+    key->time = time;
+    key->pose.position.x = a->pose.position.x + (b->pose.position.x - a->pose.position.x) * t;
+    key->pose.position.y = a->pose.position.y + (b->pose.position.y - a->pose.position.y) * t;
+    key->pose.position.z = a->pose.position.z + (b->pose.position.z - a->pose.position.z) * t;
+    key->pose.yaw = a->pose.yaw + (b->pose.yaw - a->pose.yaw) * t;
+    key->pose.pitch = a->pose.pitch + (b->pose.pitch - a->pose.pitch) * t;
+    key->theta = a->theta + (b->theta - a->theta) * t;
+    // Switches happen at the key that recorded them
+    key->wireframe = a->wireframe;
+}
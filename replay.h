@@ -0,0 +1,57 @@
+//
+// Camera paths recorded during interactive sessions and replayed with a fixed timestep
+//
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "camera.h"
+#include "engine.h"
+#include <stdio.h>
+
+#define PATH_FILE_MAGIC 0x48544150u
+#define PATH_FILE_VERSION 1
+// Replayed frames are this far apart in path time when no timestep is given (60 frames per second)
+#define REPLAY_DEFAULT_TIMESTEP (1.0f / 60.0f)
+
+// Start of a path file, the keys follow until the end of the file
+typedef struct
+{
+    Uint32 magic;
+    Uint32 version;
+} PathFileHeader;
+
+// Everything that moves in one frame: the camera, and the animation time every object is posed from
+typedef struct
+{
+    // Seconds since the recording started
+    float time;
+    CameraPose pose;
+    float theta;
+    Uint32 wireframe;
+} PathKey;
+
+typedef struct
+{
+    FILE* file;
+    int nKeys;
+} PathRecorder;
+
+typedef struct
+{
+    PathKey* keys;
+    int nKeys;
+    // Path time between two frames, in seconds
+    float timestep;
+    // Numbers of every frame as CSV lines, NULL for none
+    FILE* stats;
+} Replay;
+
+/*Function prototypes*/
+int createPathRecorder(PathRecorder* recorder, const char* path);
+void recordPathKey(PathRecorder* recorder, const PathKey* key);
+void destroyPathRecorder(PathRecorder* recorder);
+int loadCameraPath(const char* path, PathKey** keys);
+void samplePath(const PathKey* keys, int nKeys, float time, PathKey* key);
+
+#endif //REPLAY_H
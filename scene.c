@@ -0,0 +1,127 @@
+//
+// Scene graph with hierarchical transforms
+//
+// Nodes are kept in a flat array in depth first order: a node is followed by
+// its whole subtree. Updating the world matrices is then a single pass over
+// the array where every parent is already done before its children
+//
+
+#include "scene.h"
+#include "pointcloud.h"
+#include "stream.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Adds a node at the end of the subtree of its parent. Nodes after that
+ * point move one place up, the links of the parents, meshes, streams and
+ * point clouds are fixed along
+ *
+ *  @param engine Engine with the scene graph
+ *  @param parent Parent node, -1 for a root
+ *  @param local Transformation relative to the parent
+ *  @param mesh Mesh drawn at the node, -1 for none
+ *
+ *  @return Index of the new node, -1 if there is no memory left
+ */
+int addNode(Engine* engine, int parent, const Matrix4x4* local, int mesh)
+{
+    if (engine->nNodes == engine->nodesCapacity)
+    {
+        const int capacity = engine->nodesCapacity ? engine->nodesCapacity * 2 : 64;
+        Node* nodes = realloc(engine->nodes, capacity * sizeof(Node));
+        if (nodes == NULL)
+        {
+            perror("[ERROR] ALLOCATING MEMORY FAILED!");
+            return -1;
+        }
+        engine->nodes = nodes;
+        engine->nodesCapacity = capacity;
+    }
+
+    const int at = parent >= 0 ? parent + engine->nodes[parent].subtreeSize : engine->nNodes;
+    memmove(&engine->nodes[at + 1], &engine->nodes[at], (engine->nNodes - at) * sizeof(Node));
+    engine->nNodes++;
+    for (int i = at + 1; i < engine->nNodes; i++)
+    {
+        if (engine->nodes[i].parent >= at)
+            engine->nodes[i].parent++;
+        if (engine->nodes[i].mesh >= 0)
+            engine->meshes[engine->nodes[i].mesh].node = i;
+    }
+    for (int i = 0; i < engine->nStreams; i++)
+        if (engine->streams[i].node >= at)
+            engine->streams[i].node++;
+    for (int i = 0; i < engine->nClouds; i++)
+        if (engine->clouds[i].node >= at)
+            engine->clouds[i].node++;
+    // Every ancestor gets one more node in its subtree
+    for (int p = parent; p >= 0; p = engine->nodes[p].parent)
+        engine->nodes[p].subtreeSize++;
+
+    Node* node = &engine->nodes[at];
+    memset(node, 0, sizeof(*node));
+    node->parent = parent;
+    node->subtreeSize = 1;
+    node->mesh = mesh;
+    node->local = *local;
+    node->dirty = 1;
+    if (mesh >= 0)
+        engine->meshes[mesh].node = at;
+    return at;
+}
+
+/**
+ * Changes the transformation of a node relative to its parent. The world
+ * matrices of it and its subtree are updated by the next updateSceneGraph
+ *
+ *  @param engine Engine with the scene graph
+ *  @param node Node to move
+ *  @param local New transformation relative to the parent
+ *
+ *  @return void
+ */
+void setNodeLocal(Engine* engine, int node, const Matrix4x4* local)
+{
+    engine->nodes[node].local = *local;
+    engine->nodes[node].dirty = 1;
+}
+
+/**
+ * Recomputes the world matrices of the dirty nodes and everything below
+ * them, in one pass. Nodes that did not move are only looked at, and their
+ * changed flag tells the rest of the frame what has to be redrawn
+ *
+ *  @param engine Engine with the scene graph
+ *
+ *  @return void
+ */
+void updateSceneGraph(Engine* engine)
+{
+    Node* nodes = engine->nodes;
+    for (int i = 0; i < engine->nNodes; i++)
+    {
+        Node* node = &nodes[i];
+        const Node* parent = node->parent >= 0 ? &nodes[node->parent] : NULL;
+        node->changed = node->dirty || (parent != NULL && parent->changed);
+        if (!node->changed)
+            continue;
+        node->world = parent != NULL ? multMatMat(&node->local, &parent->world) : node->local;
+        node->dirty = 0;
+    }
+}
+
+/**
+ * Frees the nodes of the scene graph
+ *
+ *  @param engine Engine with the scene graph
+ *
+ *  @return void
+ */
+void freeSceneGraph(Engine* engine)
+{
+    free(engine->nodes);
+    engine->nodes = NULL;
+    engine->nNodes = 0;
+    engine->nodesCapacity = 0;
+}
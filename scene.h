@@ -0,0 +1,16 @@
+//
+// Scene graph with hierarchical transforms
+//
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "engine.h"
+
+/*Function prototypes*/
+int addNode(Engine* engine, int parent, const Matrix4x4* local, int mesh);
+void setNodeLocal(Engine* engine, int node, const Matrix4x4* local);
+void updateSceneGraph(Engine* engine);
+void freeSceneGraph(Engine* engine);
+
+#endif //SCENE_H
@@ -0,0 +1,274 @@
+//
+// Render server answering RenderRequests over a Unix socket
+//
+// The scene is loaded once and shared by every request, which is the point of
+// the server: tools ask for frames instead of loading the meshes themselves.
+// Every client gets a frame in shared memory that the server draws into
+// directly, and only the small response goes back through the socket
+//
+
+#include "server.h"
+#include "protocol.h"
+#include "render.h"
+#include "shadow.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct
+{
+    int socket;
+    // Its color buffer is the shared memory named shm, NULL until the first frame
+    Framebuffer fb;
+    char shm[RENDER_SHM_NAME_LENGTH];
+} ServerClient;
+
+typedef struct
+{
+    Engine* engine;
+    ShadowMap shadow;
+    int nClients;
+    ServerClient clients[SERVER_MAX_CLIENTS];
+    // Frames drawn, and shared frames created so far (their names have to be unique)
+    Uint32 frame;
+    Uint32 nShared;
+    int running;
+} RenderServer;
+
+/**
+ * Unmaps and removes the shared frame of a client
+ *
+ *  @return void
+ */
+static void releaseFrame(ServerClient* client)
+{
+    if (client->fb.color != NULL)
+    {
+        unmapSharedFrame(client->fb.color, (size_t)client->fb.width * client->fb.height * sizeof(Uint32));
+        shm_unlink(client->shm);
+    }
+    free(client->fb.sampleColor);
+    free(client->fb.depth);
+    client->fb.color = NULL;
+    client->fb.sampleColor = NULL;
+    client->fb.depth = NULL;
+    client->fb.width = client->fb.height = 0;
+    client->shm[0] = '\0';
+}
+
+/**
+ * Gives a client a frame of the requested size and samples per pixel. A
+ * different frame gets a new name, so the client knows it has to map it again
+ *
+ *  @return RENDER_OK, or RENDER_NO_MEMORY if the frame could not be created
+ */
+static RenderStatus resizeFrame(RenderServer* server, ServerClient* client, int width, int height, int samples)
+{
+    samples = samples == 4 || samples == 8 ? samples : 1;
+    if (client->fb.color != NULL && client->fb.width == width && client->fb.height == height &&
+        client->fb.samples == samples)
+        return RENDER_OK;
+    releaseFrame(client);
+
+    // Only the resolved frame is shared, the samples stay in the server
+    const size_t pixels = (size_t)width * height;
+    snprintf(client->shm, sizeof(client->shm), "/renderer-%d-%u", (int)getpid(), server->nShared++);
+    client->fb.color = mapSharedFrame(client->shm, pixels * sizeof(Uint32), 1);
+    client->fb.sampleColor = samples > 1 ? malloc(pixels * samples * sizeof(Uint32)) : NULL;
+    client->fb.depth = malloc(pixels * samples * sizeof(float));
+    client->fb.width = width;
+    client->fb.height = height;
+    client->fb.samples = samples;
+    if (client->fb.color == NULL || client->fb.depth == NULL || (samples > 1 && client->fb.sampleColor == NULL))
+    {
+        releaseFrame(client);
+        return RENDER_NO_MEMORY;
+    }
+    return RENDER_OK;
+}
+
+/**
+ * Reads one request of a client, draws it and answers
+ *
+ *  @return 1 to keep the client, 0 if it left, broke the protocol or stalled for SERVER_CLIENT_TIMEOUT_MS
+ */
+static int serveClient(RenderServer* server, ServerClient* client)
+{
+    RenderRequest request;
+    if (receiveMessage(client->socket, &request, sizeof(request)) <= 0 || request.magic != RENDER_MAGIC)
+        return 0;
+
+    Engine* engine = server->engine;
+    RenderResponse response = {0};
+    response.status = RENDER_OK;
+    response.nMeshes = engine->nMeshes;
+    int meshes[RENDER_MAX_MESHES];
+    if (request.width <= 0 || request.width > RENDER_MAX_SIZE || request.height <= 0 ||
+        request.height > RENDER_MAX_SIZE || request.nMeshes < 0 || request.nMeshes > RENDER_MAX_MESHES)
+        response.status = RENDER_BAD_REQUEST;
+    for (int i = 0; i < request.nMeshes && response.status == RENDER_OK; i++)
+    {
+        if (request.meshes[i] < 0 || request.meshes[i] >= engine->nMeshes)
+            response.status = RENDER_BAD_REQUEST;
+        meshes[i] = request.meshes[i];
+    }
+
+    if (request.command == RENDER_SHUTDOWN)
+        server->running = 0;
+    else if (response.status == RENDER_OK)
+        response.status = resizeFrame(server, client, request.width, request.height, request.samples);
+
+    if (request.command == RENDER_FRAME && response.status == RENDER_OK)
+    {
+        const Uint64 begin = SDL_GetPerformanceCounter();
+        const Matrix4x4 proj = projectionMatrix((float)request.height / request.width);
+        // Requests come one at a time, so the streams page in what this one needs and may evict the last one
+        if (request.nMeshes == 0)
+            settleStreams(engine, &request.pose, &proj, request.height);
+        renderView(engine, &request.pose, &proj, server->shadow.light >= 0 ? &server->shadow : NULL,
+                   request.nMeshes > 0 ? meshes : NULL, request.nMeshes, &client->fb);
+        response.milliseconds = (float)((double)(SDL_GetPerformanceCounter() - begin) * 1000.0 /
+                                        (double)SDL_GetPerformanceFrequency());
+        response.width = client->fb.width;
+        response.height = client->fb.height;
+        response.frame = ++server->frame;
+        memcpy(response.shm, client->shm, sizeof(response.shm));
+    }
+    return sendMessage(client->socket, &response, sizeof(response));
+}
+
+/**
+ * Loads the scene and answers render requests on a Unix socket until a
+ * client asks the server to stop. Meshes that change on disk are reloaded
+ * between two requests
+ *
+ *  @param engine Engine with the scene, destroyed by the caller
+ *  @param loader Loader with the requested meshes, can be NULL
+ *  @param path Path of the socket
+ *
+ *  @return 1 after a shutdown request, 0 if the server could not start
+ */
+int runRenderServer(Engine* engine, MeshLoader* loader, const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "[ERROR] THE SOCKET PATH %s IS TOO LONG!\n", path);
+        return 0;
+    }
+    strcpy(address.sun_path, path);
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    // A server that did not stop cleanly leaves its socket behind
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, SERVER_MAX_CLIENTS) != 0)
+    {
+        perror("[ERROR] COULD NOT OPEN THE SERVER SOCKET");
+        if (listener >= 0)
+            close(listener);
+        return 0;
+    }
+
+    // Clients never see a scene that is still loading
+    while (loader != NULL && !isLoaderIdle(loader))
+    {
+        publishLoadedMeshes(loader, engine);
+        SDL_Delay(1);
+    }
+
+    RenderServer server;
+    memset(&server, 0, sizeof(server));
+    server.engine = engine;
+    server.running = 1;
+    createShadowMap(&server.shadow);
+    printf("[SERVER] Listening on %s\n", path);
+
+    while (server.running)
+    {
+        if (loader != NULL)
+            publishLoadedMeshes(loader, engine);
+        settleScene(engine, &server.shadow);
+
+        // Waking up every LOADER_POLL_MS keeps picking up reloaded meshes with no clients around
+        struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < server.nClients; i++)
+        {
+            fds[i + 1].fd = server.clients[i].socket;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, server.nClients + 1, LOADER_POLL_MS) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("[ERROR] THE SERVER COULD NOT WAIT FOR CLIENTS");
+            break;
+        }
+
+        // Backwards, a client that leaves is replaced by the last one
+        for (int i = server.nClients - 1; i >= 0 && server.running; i--)
+        {
+            ServerClient* client = &server.clients[i];
+            if (fds[i + 1].revents == 0 || serveClient(&server, client))
+                continue;
+            close(client->socket);
+            releaseFrame(client);
+            *client = server.clients[--server.nClients];
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            const int connection = accept(listener, NULL, NULL);
+            if (connection >= 0 && server.nClients == SERVER_MAX_CLIENTS)
+            {
+                fprintf(stderr, "[ERROR] TOO MANY CLIENTS, CLOSING THE NEW ONE!\n");
+                close(connection);
+            }
+            else if (connection >= 0)
+            {
+                // Requests are read and answered in one go, a peer that stalls halfway times out instead of
+                // blocking the server (serveClient then drops it)
+                const struct timeval timeout = {SERVER_CLIENT_TIMEOUT_MS / 1000,
+                                                SERVER_CLIENT_TIMEOUT_MS % 1000 * 1000};
+                setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                ServerClient* client = &server.clients[server.nClients++];
+                memset(client, 0, sizeof(ServerClient));
+                client->socket = connection;
+            }
+        }
+    }
+
+    printf("[SERVER] Stopped after %u frames\n", server.frame);
+    for (int i = 0; i < server.nClients; i++)
+    {
+        close(server.clients[i].socket);
+        releaseFrame(&server.clients[i]);
+    }
+    close(listener);
+    unlink(path);
+    freeShadowMap(&server.shadow);
+    return 1;
+}
+
+#else
+
+int runRenderServer(Engine* engine, MeshLoader* loader, const char* path)
+{
+    fprintf(stderr, "[ERROR] THE RENDER SERVER NEEDS A UNIX SYSTEM!\n");
+    return 0;
+}
+
+#endif
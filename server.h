@@ -0,0 +1,19 @@
+//
+// Render server answering RenderRequests over a Unix socket (see protocol.h)
+//
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "engine.h"
+#include "loader.h"
+
+// Clients connected at the same time, the rest wait in the listen queue
+#define SERVER_MAX_CLIENTS 16
+// A client that stops in the middle of a message is dropped after this long, so it cannot stall the others
+#define SERVER_CLIENT_TIMEOUT_MS 1000
+
+/*Function prototypes*/
+int runRenderServer(Engine* engine, MeshLoader* loader, const char* path);
+
+#endif //SERVER_H
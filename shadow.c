@@ -0,0 +1,226 @@
+//
+// Shadow maps for directional lights, drawn by the CPU rasterizer
+//
+
+#include "shadow.h"
+#include "meshlet.h"
+#include "raster.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * Allocates the depth buffer of a shadow map. It starts dirty so the first
+ * frame draws it
+ *
+ *  @param shadow Shadow map to create
+ *
+ *  @return void
+ */
+void createShadowMap(ShadowMap* shadow)
+{
+    shadow->light = -1;
+    shadow->dirty = 1;
+    shadow->map.width = SHADOW_MAP_SIZE;
+    shadow->map.height = SHADOW_MAP_SIZE;
+    shadow->map.samples = 1;
+    shadow->map.color = NULL;
+    shadow->map.sampleColor = NULL;
+    ALLOCATE(shadow->map.depth, SHADOW_MAP_SIZE * SHADOW_MAP_SIZE * sizeof(float));
+}
+
+/**
+ * Frees the depth buffer of a shadow map
+ *
+ *  @param shadow Shadow map to free
+ *
+ *  @return void
+ */
+void freeShadowMap(ShadowMap* shadow)
+{
+    freeFramebuffer(&shadow->map);
+}
+
+/**
+ * Fits an orthographic projection along the light direction around the
+ * bounding boxes of every shadow caster
+ *
+ *  @param shadow Shadow map to fit, direction has to be set
+ *  @param engine Engine with the meshes
+ *
+ *  @return void
+ */
+static void fitShadowMap(ShadowMap* shadow, const Engine* engine)
+{
+    // Light space axes, forward is where the light travels
+    Vector forward = shadow->direction;
+    normalizeVector(&forward);
+    Vector up = fabsf(forward.y) < 0.9f ? (Vector){0.0f, 1.0f, 0.0f} : (Vector){1.0f, 0.0f, 0.0f};
+    Vector right = crossProduct(&up, &forward);
+    normalizeVector(&right);
+    up = crossProduct(&forward, &right);
+
+    float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        const Mesh* mesh = &engine->meshes[i];
+        if (!mesh->shadowCaster)
+            continue;
+        for (int c = 0; c < 8; c++)
+        {
+            const Vector corner = {
+                c & 1 ? mesh->boundsMax.x : mesh->boundsMin.x,
+                c & 2 ? mesh->boundsMax.y : mesh->boundsMin.y,
+                c & 4 ? mesh->boundsMax.z : mesh->boundsMin.z
+            };
+            Vector p;
+            multMatVec(&corner, &p, &mesh->world);
+            const float l[3] = {dotProduct(&p, &right), dotProduct(&p, &up), dotProduct(&p, &forward)};
+            for (int a = 0; a < 3; a++)
+            {
+                min[a] = fminf(min[a], l[a]);
+                max[a] = fmaxf(max[a], l[a]);
+            }
+        }
+    }
+    // Nothing casts shadows, any projection works since the map stays empty
+    if (min[0] > max[0])
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            min[a] = 0.0f;
+            max[a] = 1.0f;
+        }
+    }
+
+    // Keep a texel free around the casters so the PCF lookups at the border see nothing
+    const float padX = (max[0] - min[0]) / (SHADOW_MAP_SIZE - 2) + 1e-4f;
+    const float padY = (max[1] - min[1]) / (SHADOW_MAP_SIZE - 2) + 1e-4f;
+    min[0] -= padX; max[0] += padX;
+    min[1] -= padY; max[1] += padY;
+    const float kx = SHADOW_MAP_SIZE / (max[0] - min[0]);
+    const float ky = SHADOW_MAP_SIZE / (max[1] - min[1]);
+    // Casters end up with a closeness between 0.5 (farthest) and 1 (nearest)
+    const float kz = 0.5f / fmaxf(max[2] - min[2], 1e-4f);
+
+    const Matrix4x4 toMap =
+    {
+        {
+            {right.x * kx, up.x * ky, -forward.x * kz, 0.0f},
+            {right.y * kx, up.y * ky, -forward.y * kz, 0.0f},
+            {right.z * kx, up.z * ky, -forward.z * kz, 0.0f},
+            {-min[0] * kx, -min[1] * ky, 1.0f + min[2] * kz, 1.0f}
+        }
+    };
+    shadow->toMap = toMap;
+}
+
+/**
+ * Draws the shadow map again, but only when something it depends on changed:
+ * a shadow caster moved (dirty is set by whoever moves it) or the shadow
+ * casting light changed. Most frames just keep the cached map
+ *
+ *  @param shadow Shadow map to update
+ *  @param engine Engine with the lights and meshes
+ *
+ *  @return 1 if the map changed and the shadows on screen have to be redrawn, 0 otherwise
+ */
+int updateShadowMap(ShadowMap* shadow, const Engine* engine)
+{
+    // Only the first directional light that asks for it gets shadows
+    int light = -1;
+    for (int l = 0; l < engine->nLights && light < 0; l++)
+        if (engine->lights[l].type == LIGHT_DIRECTIONAL && engine->lights[l].castsShadows)
+            light = l;
+
+    if (light != shadow->light ||
+        (light >= 0 && memcmp(&engine->lights[light].direction, &shadow->direction, sizeof(Vector)) != 0))
+        shadow->dirty = 1;
+    if (!shadow->dirty)
+        return 0;
+
+    shadow->dirty = 0;
+    shadow->light = light;
+    clearFramebuffer(&shadow->map, NULL);
+    if (light < 0)
+        return 1;
+
+    shadow->direction = engine->lights[light].direction;
+    fitShadowMap(shadow, engine);
+
+    // Depth only pass over every caster, both sides of the triangles
+    const SDL_Rect all = {0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE};
+    const RasterFunction fillDepth = selectRasterFunction(NULL, NULL, &shadow->map);
+    Vector transformed[MESHLET_MAX_VERTS];
+    RasterVertex mapped[MESHLET_MAX_VERTS];
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        const Mesh* mesh = &engine->meshes[i];
+        if (!mesh->shadowCaster)
+            continue;
+        for (int m = 0; m < mesh->nMeshlets; m++)
+        {
+            const Meshlet* meshlet = &mesh->meshlets[m];
+            transformMeshlet(mesh, meshlet, &mesh->world, transformed, NULL, NULL);
+            for (int v = 0; v < meshlet->nVerts; v++)
+            {
+                const Vector p = toShadowMap(shadow, &transformed[v]);
+                // The rasterizer keeps the biggest 1 / w, so w is 1 / closeness
+                mapped[v] = (RasterVertex){p.x, p.y, 1.0f / p.z};
+            }
+            for (int j = 0; j < meshlet->nTris; j++)
+            {
+                const Uint8* tri = &mesh->meshletTris[(meshlet->triOffset + j) * 3];
+                const RasterVertex v[3] = {mapped[tri[0]], mapped[tri[1]], mapped[tri[2]]};
+                fillDepth(v, NULL, NULL, &shadow->map, &all);
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * Moves a world space point into the shadow map
+ *
+ *  @param shadow Shadow map
+ *  @param p World space point
+ *
+ *  @return Texel coordinates in x and y, closeness to the light in z
+ */
+Vector toShadowMap(const ShadowMap* shadow, const Vector* p)
+{
+    Vector o;
+    multMatVec(p, &o, &shadow->toMap);
+    return o;
+}
+
+/**
+ * Percentage closer filtering: compares the point against the 3x3 texels
+ * around it and returns how many of them do not block the light
+ *
+ *  @param shadow Shadow map
+ *  @param x Texel x coordinate
+ *  @param y Texel y coordinate
+ *  @param closeness Closeness of the point to the light
+ *
+ *  @return 0 for fully in shadow up to 1 for fully lit
+ */
+float sampleShadow(const ShadowMap* shadow, float x, float y, float closeness)
+{
+    const int cx = (int)floorf(x), cy = (int)floorf(y);
+    // Points farther away than every caster go below 0, empty texels (0) still have to light them
+    const float limit = fmaxf(closeness, 0.0f) + SHADOW_BIAS;
+    int lit = 0;
+    for (int ty = cy - 1; ty <= cy + 1; ty++)
+    {
+        for (int tx = cx - 1; tx <= cx + 1; tx++)
+        {
+            // Outside of the map there are no casters
+            if (tx < 0 || ty < 0 || tx >= SHADOW_MAP_SIZE || ty >= SHADOW_MAP_SIZE ||
+                shadow->map.depth[ty * SHADOW_MAP_SIZE + tx] <= limit)
+                lit++;
+        }
+    }
+    return lit / 9.0f;
+}
@@ -0,0 +1,35 @@
+//
+// Shadow maps for directional lights, drawn by the CPU rasterizer
+//
+
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "engine.h"
+
+// Width and height of the shadow map in texels
+#define SHADOW_MAP_SIZE 1024
+// How much closer to the light a point may be stored before it shadows itself
+#define SHADOW_BIAS 0.003f
+
+typedef struct
+{
+    // Light the map was drawn for, -1 when no light casts shadows
+    int light;
+    Vector direction;
+    // World space to map texels (x, y) and closeness to the light (z, bigger is closer)
+    Matrix4x4 toMap;
+    // Depth only framebuffer (color is NULL)
+    Framebuffer map;
+    // Set when a shadow caster moved, the map is drawn again before it is used
+    int dirty;
+} ShadowMap;
+
+/*Function prototypes*/
+void createShadowMap(ShadowMap* shadow);
+void freeShadowMap(ShadowMap* shadow);
+int updateShadowMap(ShadowMap* shadow, const Engine* engine);
+Vector toShadowMap(const ShadowMap* shadow, const Vector* p);
+float sampleShadow(const ShadowMap* shadow, float x, float y, float closeness);
+
+#endif //SHADOW_H
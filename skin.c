@@ -0,0 +1,229 @@
+//
+// Skeletal skinning: vertices posed by a weighted blend of bone transformations
+//
+// Animated meshes keep their vertices at rest and a palette of bone matrices
+// the animation sets every frame. Before anything is drawn every vertex is
+// moved by the blend of the matrices of its bones (linear blend skinning),
+// straight into the vertices and normals of the mesh, so drawing, shadows
+// and the wireframe view work on posed meshes as they do on rigid ones. The
+// meshes are posed in parallel, one per worker at a time
+//
+
+#include "skin.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Makes a prepared mesh animated. Every vertex gets up to SKIN_INFLUENCES
+ * bones, sorted so the heaviest come first and the zero weights last, and
+ * the weights are scaled to add up to 1. Every bone starts at rest
+ *
+ *  @param mesh Prepared mesh, not compact, the skin is freed along with it
+ *  @param nBones Number of bones, at most MAX_BONES
+ *  @param bones SKIN_INFLUENCES bones per vertex of the mesh
+ *  @param weights SKIN_INFLUENCES weights per vertex of the mesh
+ *
+ *  @return void
+ */
+void createSkin(Mesh* mesh, int nBones, const Uint8* bones, const float* weights)
+{
+    Skin* skin;
+    ALLOCATE(skin, sizeof(Skin));
+    skin->nBones = SDL_min(nBones, MAX_BONES);
+    skin->dirty = 1;
+    ALLOCATE(skin->bones, mesh->nVerts * SKIN_INFLUENCES * sizeof(Uint8));
+    ALLOCATE(skin->weights, mesh->nVerts * SKIN_INFLUENCES * sizeof(float));
+    ALLOCATE(skin->restVerts, mesh->nVerts * sizeof(Vector));
+    ALLOCATE(skin->restNormals, mesh->nVerts * sizeof(Vector));
+    ALLOCATE(skin->palette, skin->nBones * sizeof(Matrix4x4));
+    memcpy(skin->restVerts, mesh->verts, mesh->nVerts * sizeof(Vector));
+    memcpy(skin->restNormals, mesh->normals, mesh->nVerts * sizeof(Vector));
+    const Vector origin = {0.0f, 0.0f, 0.0f};
+    for (int b = 0; b < skin->nBones; b++)
+        skin->palette[b] = translationMatrix(&origin);
+
+    for (int v = 0; v < mesh->nVerts; v++)
+    {
+        Uint8* vb = &skin->bones[v * SKIN_INFLUENCES];
+        float* vw = &skin->weights[v * SKIN_INFLUENCES];
+        float total = 0.0f;
+        for (int i = 0; i < SKIN_INFLUENCES; i++)
+        {
+            // Bones out of range do not move the vertex
+            vb[i] = bones[v * SKIN_INFLUENCES + i] < skin->nBones ? bones[v * SKIN_INFLUENCES + i] : 0;
+            vw[i] = bones[v * SKIN_INFLUENCES + i] < skin->nBones ? fmaxf(weights[v * SKIN_INFLUENCES + i], 0.0f) : 0.0f;
+            total += vw[i];
+        }
+        // Insertion sort, heaviest first, so the kernel stops at the first zero
+        for (int i = 1; i < SKIN_INFLUENCES; i++)
+            for (int j = i; j > 0 && vw[j] > vw[j - 1]; j--)
+            {
+                const float w = vw[j]; vw[j] = vw[j - 1]; vw[j - 1] = w;
+                const Uint8 b = vb[j]; vb[j] = vb[j - 1]; vb[j - 1] = b;
+            }
+        // A vertex with no weight follows the first bone
+        if (total <= 0.0f)
+        {
+            vw[0] = total = 1.0f;
+            vb[0] = 0;
+        }
+        for (int i = 0; i < SKIN_INFLUENCES; i++)
+            vw[i] /= total;
+    }
+
+    // Posed meshlets can face anywhere, so their normal cones never cull
+    for (int m = 0; m < mesh->nMeshlets; m++)
+        mesh->meshlets[m].coneCutoff = 2.0f;
+    mesh->skin = skin;
+}
+
+/**
+ * Poses the vertices and normals of an animated mesh from its rest pose and
+ * its palette, in one pass over the vertices that also finds the new bounds.
+ * The blended matrix of every vertex is built a row at a time, 4 floats per
+ * SSE2 operation. The meshlets are culled as a whole mesh afterwards, their
+ * bounding spheres are not valid once the vertices moved
+ *
+ *  @param mesh Animated mesh
+ *
+ *  @return void
+ */
+void skinMesh(Mesh* mesh)
+{
+    Skin* skin = mesh->skin;
+    const Uint8* bones = skin->bones;
+    const float* weights = skin->weights;
+#ifdef __SSE2__
+    __m128 low = _mm_set1_ps(INFINITY), high = _mm_set1_ps(-INFINITY);
+    for (int v = 0; v < mesh->nVerts; v++, bones += SKIN_INFLUENCES, weights += SKIN_INFLUENCES)
+    {
+        const Matrix4x4* m = &skin->palette[bones[0]];
+        __m128 w = _mm_set1_ps(weights[0]);
+        __m128 r0 = _mm_mul_ps(w, _mm_loadu_ps(m->mat[0]));
+        __m128 r1 = _mm_mul_ps(w, _mm_loadu_ps(m->mat[1]));
+        __m128 r2 = _mm_mul_ps(w, _mm_loadu_ps(m->mat[2]));
+        __m128 r3 = _mm_mul_ps(w, _mm_loadu_ps(m->mat[3]));
+        for (int i = 1; i < SKIN_INFLUENCES && weights[i] > 0.0f; i++)
+        {
+            m = &skin->palette[bones[i]];
+            w = _mm_set1_ps(weights[i]);
+            r0 = _mm_add_ps(r0, _mm_mul_ps(w, _mm_loadu_ps(m->mat[0])));
+            r1 = _mm_add_ps(r1, _mm_mul_ps(w, _mm_loadu_ps(m->mat[1])));
+            r2 = _mm_add_ps(r2, _mm_mul_ps(w, _mm_loadu_ps(m->mat[2])));
+            r3 = _mm_add_ps(r3, _mm_mul_ps(w, _mm_loadu_ps(m->mat[3])));
+        }
+
+        const Vector* p = &skin->restVerts[v];
+        const Vector* n = &skin->restNormals[v];
+        float o[4];
+        const __m128 xy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p->x), r0), _mm_mul_ps(_mm_set1_ps(p->y), r1));
+        const __m128 position = _mm_add_ps(xy, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p->z), r2), r3));
+        _mm_storeu_ps(o, position);
+        mesh->verts[v] = (Vector){o[0], o[1], o[2]};
+        low = _mm_min_ps(low, position);
+        high = _mm_max_ps(high, position);
+        // Normals are blended with the same matrix and normalized when they are lit
+        const __m128 nxy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(n->x), r0), _mm_mul_ps(_mm_set1_ps(n->y), r1));
+        _mm_storeu_ps(o, _mm_add_ps(nxy, _mm_mul_ps(_mm_set1_ps(n->z), r2)));
+        mesh->normals[v] = (Vector){o[0], o[1], o[2]};
+    }
+    float bounds[4];
+    _mm_storeu_ps(bounds, low);
+    mesh->boundsMin = (Vector){bounds[0], bounds[1], bounds[2]};
+    _mm_storeu_ps(bounds, high);
+    mesh->boundsMax = (Vector){bounds[0], bounds[1], bounds[2]};
+#else
+    Vector low = {INFINITY, INFINITY, INFINITY}, high = {-INFINITY, -INFINITY, -INFINITY};
+    for (int v = 0; v < mesh->nVerts; v++, bones += SKIN_INFLUENCES, weights += SKIN_INFLUENCES)
+    {
+        float r[4][3] = {{0.0f}};
+        for (int i = 0; i < SKIN_INFLUENCES && (i == 0 || weights[i] > 0.0f); i++)
+        {
+            const Matrix4x4* m = &skin->palette[bones[i]];
+            for (int row = 0; row < 4; row++)
+                for (int col = 0; col < 3; col++)
+                    r[row][col] += weights[i] * m->mat[row][col];
+        }
+
+        const Vector* p = &skin->restVerts[v];
+        const Vector* n = &skin->restNormals[v];
+        Vector* out = &mesh->verts[v];
+        out->x = p->x * r[0][0] + p->y * r[1][0] + p->z * r[2][0] + r[3][0];
+        out->y = p->x * r[0][1] + p->y * r[1][1] + p->z * r[2][1] + r[3][1];
+        out->z = p->x * r[0][2] + p->y * r[1][2] + p->z * r[2][2] + r[3][2];
+        low.x = fminf(low.x, out->x); low.y = fminf(low.y, out->y); low.z = fminf(low.z, out->z);
+        high.x = fmaxf(high.x, out->x); high.y = fmaxf(high.y, out->y); high.z = fmaxf(high.z, out->z);
+        mesh->normals[v].x = n->x * r[0][0] + n->y * r[1][0] + n->z * r[2][0];
+        mesh->normals[v].y = n->x * r[0][1] + n->y * r[1][1] + n->z * r[2][1];
+        mesh->normals[v].z = n->x * r[0][2] + n->y * r[1][2] + n->z * r[2][2];
+    }
+    mesh->boundsMin = low;
+    mesh->boundsMax = high;
+#endif
+
+    // Every meshlet gets the sphere around the posed mesh
+    const Vector center = {
+        (mesh->boundsMin.x + mesh->boundsMax.x) * 0.5f,
+        (mesh->boundsMin.y + mesh->boundsMax.y) * 0.5f,
+        (mesh->boundsMin.z + mesh->boundsMax.z) * 0.5f
+    };
+    const Vector half = {mesh->boundsMax.x - center.x, mesh->boundsMax.y - center.y, mesh->boundsMax.z - center.z};
+    const float radius = sqrtf(dotProduct(&half, &half));
+    for (int m = 0; m < mesh->nMeshlets; m++)
+    {
+        mesh->meshlets[m].center = center;
+        mesh->meshlets[m].radius = radius;
+    }
+    skin->dirty = 0;
+}
+
+/**
+ * Poses one mesh of the engine, if its palette changed
+ *
+ *  @return void
+ */
+static void skinWork(void* data, int index, int worker)
+{
+    (void)worker;
+    Engine* engine = data;
+    Mesh* mesh = &engine->meshes[index];
+    if (mesh->skin != NULL && mesh->skin->dirty)
+        skinMesh(mesh);
+}
+
+/**
+ * Poses every animated mesh whose palette changed, spread over the workers
+ * of a pool. Their nodes are marked dirty, so the next updateSceneGraph
+ * reports them as changed and their old and new screen areas are redrawn
+ *
+ *  @param engine Engine with the meshes and the scene graph
+ *  @param pool Pool to pose on, NULL to pose on this thread
+ *
+ *  @return Number of meshes posed
+ */
+int skinMeshes(Engine* engine, WorkerPool* pool)
+{
+    int posed = 0;
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        const Mesh* mesh = &engine->meshes[i];
+        if (mesh->skin == NULL || !mesh->skin->dirty)
+            continue;
+        engine->nodes[mesh->node].dirty = 1;
+        posed++;
+    }
+    if (posed == 0)
+        return 0;
+
+    if (pool != NULL && posed > 1)
+        runParallel(pool, skinWork, engine, engine->nMeshes);
+    else
+        for (int i = 0; i < engine->nMeshes; i++)
+            skinWork(engine, i, 0);
+    return posed;
+}
@@ -0,0 +1,21 @@
+//
+// Skeletal skinning: vertices posed by a weighted blend of bone transformations
+//
+
+#ifndef SKIN_H
+#define SKIN_H
+
+#include "engine.h"
+#include "pool.h"
+
+// Bones that can move one vertex
+#define SKIN_INFLUENCES 4
+// Bones of one skin, they are indexed with a byte
+#define MAX_BONES 256
+
+/*Function prototypes*/
+void createSkin(Mesh* mesh, int nBones, const Uint8* bones, const float* weights);
+void skinMesh(Mesh* mesh);
+int skinMeshes(Engine* engine, WorkerPool* pool);
+
+#endif //SKIN_H
@@ -0,0 +1,951 @@
+//
+// Out-of-core meshes: chunks of a mesh file paged in as the camera needs them
+//
+// A mesh too big for memory is split offline (buildChunkFile) into spatial
+// chunks, each stored at a few levels of detail as a compact mesh ready to be
+// drawn. At runtime only the chunk table stays in memory. Every frame the
+// renderer works out the level it wants of every chunk it sees, and of the
+// chunks the camera is heading to, and the thread of the stream reads them
+// most urgent first. Chunks that are not there yet are drawn from another
+// level, so frames never wait for the disk, and the levels that went unused
+// for the longest are evicted to stay under the memory budget
+//
+
+#include "stream.h"
+#include "compact.h"
+#include "loader.h"
+#include "meshlet.h"
+#include "render.h"
+#include "wireframe.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define seekFile(file, offset) fseeko(file, (off_t)(offset), SEEK_SET)
+#else
+#define seekFile(file, offset) _fseeki64(file, (__int64)(offset), SEEK_SET)
+#endif
+
+// Requests are grouped by urgency: levels being drawn, then something to draw for every
+// visible chunk, then the level it should have, then what the camera is heading to
+#define PRIORITY_DRAWN 4e6f
+#define PRIORITY_COARSE 3e6f
+#define PRIORITY_DETAIL 2e6f
+#define PRIORITY_PREFETCH 1e6f
+
+typedef struct
+{
+    int start, count;
+} ChunkRange;
+
+// Vertices of a whole mesh gathered in the cells of a grid, in a hash table with open addressing
+typedef struct
+{
+    Vector origin;
+    float cell;
+    int capacity;
+    // 3 coordinates of the cell in every slot, empty slots have no vertices
+    Sint32* keys;
+    int* counts;
+    Vector* sums;
+} CellGrid;
+
+/**
+ * Coordinate of a vector along an axis (0 is x, 1 is y, 2 is z)
+ *
+ *  @return The coordinate
+ */
+static float axisOf(const Vector* v, int axis)
+{
+    return axis == 0 ? v->x : axis == 1 ? v->y : v->z;
+}
+
+/**
+ * Partially sorts triangles by their centroid along an axis, so the one at
+ * position k has the smaller ones before it and the bigger ones after it
+ *
+ *  @param order Triangle indices to reorder
+ *  @param centroids Centroid of every triangle
+ *  @param count Number of indices
+ *  @param k Position that has to be right
+ *  @param axis Axis to sort along
+ *
+ *  @return void
+ */
+static void selectTriangle(int* order, const Vector* centroids, int count, int k, int axis)
+{
+    int low = 0, high = count - 1;
+    while (low < high)
+    {
+        const float pivot = axisOf(&centroids[order[(low + high) / 2]], axis);
+        int i = low, j = high;
+        while (i <= j)
+        {
+            while (axisOf(&centroids[order[i]], axis) < pivot)
+                i++;
+            while (axisOf(&centroids[order[j]], axis) > pivot)
+                j--;
+            if (i <= j)
+            {
+                const int swap = order[i];
+                order[i++] = order[j];
+                order[j--] = swap;
+            }
+        }
+        if (k <= j)
+            high = j;
+        else if (k >= i)
+            low = i;
+        else
+            break;
+    }
+}
+
+/**
+ * Splits triangles in half across the longest side of their centroids until
+ * every part fits in a chunk
+ *
+ *  @param order Triangle indices, reordered so every chunk is a range of them
+ *  @param centroids Centroid of every triangle
+ *  @param start First index of the part to split
+ *  @param count Number of triangles in the part
+ *  @param ranges Chunks found so far, room for all of them
+ *  @param nRanges Number of chunks found so far
+ *
+ *  @return void
+ */
+static void splitChunks(int* order, const Vector* centroids, int start, int count, ChunkRange* ranges, int* nRanges)
+{
+    if (count <= STREAM_CHUNK_TRIS)
+    {
+        ranges[(*nRanges)++] = (ChunkRange){start, count};
+        return;
+    }
+
+    Vector low = centroids[order[start]], high = low;
+    for (int i = start + 1; i < start + count; i++)
+    {
+        const Vector* c = &centroids[order[i]];
+        low.x = fminf(low.x, c->x); low.y = fminf(low.y, c->y); low.z = fminf(low.z, c->z);
+        high.x = fmaxf(high.x, c->x); high.y = fmaxf(high.y, c->y); high.z = fmaxf(high.z, c->z);
+    }
+    const Vector extent = {high.x - low.x, high.y - low.y, high.z - low.z};
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+
+    const int half = count / 2;
+    selectTriangle(&order[start], centroids, count, half, axis);
+    splitChunks(order, centroids, start, half, ranges, nRanges);
+    splitChunks(order, centroids, start + half, count - half, ranges, nRanges);
+}
+
+/**
+ * Cell of a grid a point falls in
+ *
+ *  @return void
+ */
+static void cellOf(const CellGrid* grid, const Vector* p, Sint32 key[3])
+{
+    key[0] = (Sint32)floorf((p->x - grid->origin.x) / grid->cell);
+    key[1] = (Sint32)floorf((p->y - grid->origin.y) / grid->cell);
+    key[2] = (Sint32)floorf((p->z - grid->origin.z) / grid->cell);
+}
+
+/**
+ * Finds the slot of a cell in the hash table of a grid, taking an empty
+ * one if the cell is not there yet. The table never fills up
+ *
+ *  @return Index of the slot
+ */
+static int findCell(CellGrid* grid, const Sint32 key[3])
+{
+    Uint32 hash = (Uint32)key[0] * 73856093u ^ (Uint32)key[1] * 19349663u ^ (Uint32)key[2] * 83492791u;
+    for (;; hash++)
+    {
+        const int slot = (int)(hash & (Uint32)(grid->capacity - 1));
+        if (grid->counts[slot] == 0)
+        {
+            memcpy(&grid->keys[slot * 3], key, 3 * sizeof(Sint32));
+            return slot;
+        }
+        if (memcmp(&grid->keys[slot * 3], key, 3 * sizeof(Sint32)) == 0)
+            return slot;
+    }
+}
+
+/**
+ * Gathers every vertex of a mesh in the cells of a grid anchored at the
+ * corner of the mesh, so each cell knows the average of its vertices
+ *
+ *  @param grid Grid to fill
+ *  @param tris Triangles of the whole mesh
+ *  @param nTris Number of triangles
+ *  @param origin Corner of the grid
+ *  @param cell Size of the grid cells
+ *
+ *  @return void
+ */
+static void buildCellGrid(CellGrid* grid, const Triangle* tris, int nTris, const Vector* origin, float cell)
+{
+    grid->origin = *origin;
+    grid->cell = cell;
+    // More slots than corners, there is always an empty one
+    grid->capacity = 1;
+    while (grid->capacity <= nTris * 4)
+        grid->capacity *= 2;
+    ALLOCATE(grid->keys, grid->capacity * 3 * sizeof(Sint32));
+    ALLOCATE(grid->counts, grid->capacity * sizeof(int));
+    ALLOCATE(grid->sums, grid->capacity * sizeof(Vector));
+    memset(grid->counts, 0, grid->capacity * sizeof(int));
+    memset(grid->sums, 0, grid->capacity * sizeof(Vector));
+    for (int t = 0; t < nTris; t++)
+        for (int k = 0; k < 3; k++)
+        {
+            const Vector* p = &tris[t].points[k];
+            Sint32 key[3];
+            cellOf(grid, p, key);
+            const int slot = findCell(grid, key);
+            grid->counts[slot]++;
+            grid->sums[slot].x += p->x;
+            grid->sums[slot].y += p->y;
+            grid->sums[slot].z += p->z;
+        }
+}
+
+/**
+ * Frees the hash table of a grid
+ *
+ *  @return void
+ */
+static void freeCellGrid(CellGrid* grid)
+{
+    free(grid->keys);
+    free(grid->counts);
+    free(grid->sums);
+}
+
+/**
+ * Simplifies the triangles of a chunk by moving every vertex to the average
+ * of the vertices in its cell of a grid, and dropping the triangles that
+ * collapse. The averages come from the whole mesh, so neighbouring chunks
+ * move their shared edges the same way and two chunks at the same level
+ * never open a crack
+ *
+ *  @param tris Triangles at full detail
+ *  @param nTris Number of triangles
+ *  @param grid Grid of the level, built from the whole mesh
+ *  @param out Room for nTris triangles
+ *
+ *  @return Number of triangles left
+ */
+static int simplifyChunk(const Triangle* tris, int nTris, CellGrid* grid, Triangle* out)
+{
+    int n = 0;
+    for (int t = 0; t < nTris; t++)
+    {
+        Triangle snapped = tris[t];
+        int slots[3];
+        for (int k = 0; k < 3; k++)
+        {
+            Vector* p = &snapped.points[k];
+            Sint32 key[3];
+            cellOf(grid, p, key);
+            slots[k] = findCell(grid, key);
+            const float weight = 1.0f / (float)grid->counts[slots[k]];
+            p->x = grid->sums[slots[k]].x * weight;
+            p->y = grid->sums[slots[k]].y * weight;
+            p->z = grid->sums[slots[k]].z * weight;
+        }
+        if (slots[0] == slots[1] || slots[1] == slots[2] || slots[0] == slots[2])
+            continue;
+        out[n++] = snapped;
+    }
+    return n;
+}
+
+/**
+ * Writes an array to a chunk file, counting its bytes
+ *
+ *  @return 1 on success, 0 on failure
+ */
+static int writeArray(FILE* file, const void* data, size_t size, Uint32* written)
+{
+    *written += (Uint32)size;
+    return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+/**
+ * Writes a compact mesh as the data of a chunk level
+ *
+ *  @param file File to write to, at the end of the data written so far
+ *  @param mesh Compact mesh
+ *  @param size Set to the bytes written
+ *
+ *  @return 1 on success, 0 on failure
+ */
+static int writeChunkLevel(FILE* file, const Mesh* mesh, Uint32* size)
+{
+    ChunkLevelHeader header;
+    memset(&header, 0, sizeof(header));
+    header.nVerts = mesh->nVerts;
+    header.nTris = mesh->nTris;
+    header.nMeshlets = mesh->nMeshlets;
+    header.nEdges = mesh->nEdges;
+    header.packedIndicesSize = mesh->packedIndicesSize;
+    header.packedMeshletVertsSize = mesh->packedMeshletVertsSize;
+    header.boundsMin = mesh->boundsMin;
+    header.boundsMax = mesh->boundsMax;
+
+    *size = 0;
+    return writeArray(file, &header, sizeof(header), size) &&
+           writeArray(file, mesh->qverts, (size_t)mesh->nVerts * 3 * sizeof(Uint16), size) &&
+           writeArray(file, mesh->octNormals, (size_t)mesh->nVerts * sizeof(Uint16), size) &&
+           writeArray(file, mesh->packedIndices, mesh->packedIndicesSize, size) &&
+           writeArray(file, mesh->meshlets, (size_t)mesh->nMeshlets * sizeof(Meshlet), size) &&
+           writeArray(file, mesh->meshletTris, (size_t)mesh->nTris * 3, size) &&
+           writeArray(file, mesh->packedMeshletVerts, mesh->packedMeshletVertsSize, size) &&
+           writeArray(file, mesh->edges, (size_t)mesh->nEdges * 2 * sizeof(int), size);
+}
+
+/**
+ * Splits an OBJ file into a chunk file a MeshStream can page in. The whole
+ * mesh is read into memory, so this runs once on a machine that can hold it
+ *
+ *  @param objPath OBJ file to split
+ *  @param path Chunk file to write
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int buildChunkFile(const char* objPath, const char* path)
+{
+    Triangle* tris;
+    const int nTris = loadObjTriangles(objPath, &tris);
+    if (nTris == 0)
+        return 0;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CREATE THE CHUNK FILE %s!\n", path);
+        free(tris);
+        return 0;
+    }
+
+    // Centroids to split by, and the average edge that sizes the simplification grids
+    Vector* centroids;
+    int* order;
+    ALLOCATE(centroids, nTris * sizeof(Vector));
+    ALLOCATE(order, nTris * sizeof(int));
+    Vector boundsMin = tris[0].points[0], boundsMax = boundsMin;
+    double edges = 0.0;
+    for (int t = 0; t < nTris; t++)
+    {
+        const Vector* p = tris[t].points;
+        centroids[t] = (Vector){(p[0].x + p[1].x + p[2].x) / 3.0f, (p[0].y + p[1].y + p[2].y) / 3.0f,
+                                (p[0].z + p[1].z + p[2].z) / 3.0f};
+        order[t] = t;
+        for (int k = 0; k < 3; k++)
+        {
+            boundsMin.x = fminf(boundsMin.x, p[k].x); boundsMin.y = fminf(boundsMin.y, p[k].y);
+            boundsMin.z = fminf(boundsMin.z, p[k].z);
+            boundsMax.x = fmaxf(boundsMax.x, p[k].x); boundsMax.y = fmaxf(boundsMax.y, p[k].y);
+            boundsMax.z = fmaxf(boundsMax.z, p[k].z);
+            const Vector* q = &p[(k + 1) % 3];
+            edges += sqrt((p[k].x - q->x) * (p[k].x - q->x) + (p[k].y - q->y) * (p[k].y - q->y) +
+                          (p[k].z - q->z) * (p[k].z - q->z));
+        }
+    }
+    const float edge = (float)(edges / (nTris * 3.0));
+
+    // Every chunk but a lone one has more than half of STREAM_CHUNK_TRIS triangles
+    ChunkRange* ranges;
+    int nRanges = 0;
+    ALLOCATE(ranges, (nTris / (STREAM_CHUNK_TRIS / 2) + 2) * sizeof(ChunkRange));
+    splitChunks(order, centroids, 0, nTris, ranges, &nRanges);
+    free(centroids);
+
+    // The table is written again at the end, once the offsets are known
+    ChunkFileHeader header = {CHUNK_FILE_MAGIC, CHUNK_FILE_VERSION, nRanges, STREAM_LEVELS, boundsMin, boundsMax};
+    ChunkEntry* entries;
+    ALLOCATE(entries, nRanges * sizeof(ChunkEntry));
+    memset(entries, 0, nRanges * sizeof(ChunkEntry));
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(entries, sizeof(ChunkEntry), nRanges, file) == (size_t)nRanges;
+    Uint64 offset = sizeof(header) + (Uint64)nRanges * sizeof(ChunkEntry);
+
+    // One grid per simplified level, the cells double in size every level
+    CellGrid grids[STREAM_LEVELS];
+    for (int l = 1; l < STREAM_LEVELS; l++)
+        buildCellGrid(&grids[l], tris, nTris, &boundsMin, edge * (float)(1 << l));
+
+    Triangle *chunkTris, *levelTris;
+    ALLOCATE(chunkTris, STREAM_CHUNK_TRIS * sizeof(Triangle));
+    ALLOCATE(levelTris, STREAM_CHUNK_TRIS * sizeof(Triangle));
+    for (int c = 0; c < nRanges && ok; c++)
+    {
+        ChunkEntry* entry = &entries[c];
+        const int count = ranges[c].count;
+        Vector low = tris[order[ranges[c].start]].points[0], high = low;
+        for (int i = 0; i < count; i++)
+        {
+            chunkTris[i] = tris[order[ranges[c].start + i]];
+            for (int k = 0; k < 3; k++)
+            {
+                const Vector* p = &chunkTris[i].points[k];
+                low.x = fminf(low.x, p->x); low.y = fminf(low.y, p->y); low.z = fminf(low.z, p->z);
+                high.x = fmaxf(high.x, p->x); high.y = fmaxf(high.y, p->y); high.z = fmaxf(high.z, p->z);
+            }
+        }
+        // Grown below by the error of the coarsest level, so the sphere holds every level
+        entry->center = (Vector){(low.x + high.x) * 0.5f, (low.y + high.y) * 0.5f, (low.z + high.z) * 0.5f};
+        const Vector half = {high.x - entry->center.x, high.y - entry->center.y, high.z - entry->center.z};
+        entry->radius = sqrtf(dotProduct(&half, &half));
+
+        memcpy(levelTris, chunkTris, count * sizeof(Triangle));
+        int nLevelTris = count;
+        for (int l = 0; l < STREAM_LEVELS && ok; l++)
+        {
+            // Every level is simplified from the full one, a chunk too small for a level keeps the previous one
+            if (l > 0)
+            {
+                // A vertex and the average of its cell are both inside the cell
+                const int n = simplifyChunk(chunkTris, count, &grids[l], levelTris);
+                entry->error[l] = n > 0 ? grids[l].cell * 1.7320508f : entry->error[l - 1];
+                if (n > 0)
+                    nLevelTris = n;
+            }
+
+            Mesh mesh = {0};
+            mesh.nTris = nLevelTris;
+            ALLOCATE(mesh.tris, nLevelTris * sizeof(Triangle));
+            memcpy(mesh.tris, levelTris, nLevelTris * sizeof(Triangle));
+            prepareMesh(&mesh);
+            compressMesh(&mesh);
+            ok = writeChunkLevel(file, &mesh, &entry->size[l]);
+            entry->offset[l] = offset;
+            entry->nTris[l] = mesh.nTris;
+            offset += entry->size[l];
+            freeMesh(&mesh);
+        }
+        // Coarser levels only move vertices further
+        entry->radius += entry->error[STREAM_LEVELS - 1];
+    }
+    for (int l = 1; l < STREAM_LEVELS; l++)
+        freeCellGrid(&grids[l]);
+    free(chunkTris);
+    free(levelTris);
+    free(ranges);
+    free(order);
+    free(tris);
+
+    ok = ok && fseek(file, sizeof(header), SEEK_SET) == 0 &&
+         fwrite(entries, sizeof(ChunkEntry), nRanges, file) == (size_t)nRanges;
+    free(entries);
+    if (fclose(file) != 0 || !ok)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT WRITE THE CHUNK FILE %s!\n", path);
+        remove(path);
+        return 0;
+    }
+    printf("[CHUNKS] %d triangles split into %d chunks of %d levels, %llu bytes\n", nTris, nRanges, STREAM_LEVELS,
+           (unsigned long long)offset);
+    return 1;
+}
+
+/**
+ * Copies the next array out of the data of a chunk level
+ *
+ *  @return The array, NULL for an empty one
+ */
+static void* readArray(const Uint8** at, size_t size)
+{
+    if (size == 0)
+        return NULL;
+    void* array;
+    ALLOCATE(array, size);
+    memcpy(array, *at, size);
+    *at += size;
+    return array;
+}
+
+/**
+ * Reads a level of a chunk into a compact mesh. Only the stream thread
+ * reads the file
+ *
+ *  @param file Chunk file
+ *  @param entry Chunk to read
+ *  @param level Level to read
+ *  @param mesh Mesh to fill, ready to draw on success
+ *
+ *  @return 1 on success, 0 on failure
+ */
+static int readChunkLevel(FILE* file, const ChunkEntry* entry, int level, Mesh* mesh)
+{
+    const size_t size = entry->size[level];
+    Uint8* data = malloc(size);
+    if (data == NULL || size < sizeof(ChunkLevelHeader) || seekFile(file, entry->offset[level]) != 0 ||
+        fread(data, size, 1, file) != 1)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT READ A CHUNK OF %u BYTES!\n", (unsigned)size);
+        free(data);
+        return 0;
+    }
+
+    ChunkLevelHeader header;
+    memcpy(&header, data, sizeof(header));
+    const size_t expected = sizeof(header) + (size_t)header.nVerts * 4 * sizeof(Uint16) + header.packedIndicesSize +
+                            (size_t)header.nMeshlets * sizeof(Meshlet) + (size_t)header.nTris * 3 +
+                            header.packedMeshletVertsSize + (size_t)header.nEdges * 2 * sizeof(int);
+    if (expected != size)
+    {
+        fprintf(stderr, "[ERROR] A CHUNK OF THE STREAM IS DAMAGED!\n");
+        free(data);
+        return 0;
+    }
+
+    const Uint8* at = data + sizeof(header);
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->compact = 1;
+    mesh->nVerts = header.nVerts;
+    mesh->nTris = header.nTris;
+    mesh->nMeshlets = header.nMeshlets;
+    mesh->nEdges = header.nEdges;
+    mesh->packedIndicesSize = header.packedIndicesSize;
+    mesh->packedMeshletVertsSize = header.packedMeshletVertsSize;
+    mesh->boundsMin = header.boundsMin;
+    mesh->boundsMax = header.boundsMax;
+    mesh->qverts = readArray(&at, (size_t)header.nVerts * 3 * sizeof(Uint16));
+    mesh->octNormals = readArray(&at, (size_t)header.nVerts * sizeof(Uint16));
+    mesh->packedIndices = readArray(&at, header.packedIndicesSize);
+    mesh->meshlets = readArray(&at, (size_t)header.nMeshlets * sizeof(Meshlet));
+    mesh->meshletTris = readArray(&at, (size_t)header.nTris * 3);
+    mesh->packedMeshletVerts = readArray(&at, header.packedMeshletVertsSize);
+    mesh->edges = readArray(&at, (size_t)header.nEdges * 2 * sizeof(int));
+    free(data);
+    return 1;
+}
+
+/**
+ * Stream thread: reads the most urgent level the renderer wants and does
+ * not have, one at a time without holding the mutex
+ *
+ *  @param data The MeshStream
+ *
+ *  @return 0
+ */
+static int streamThread(void* data)
+{
+    MeshStream* stream = data;
+    SDL_LockMutex(stream->mutex);
+    while (stream->running)
+    {
+        int chunk = -1, level = -1;
+        float best = -1.0f;
+        for (int c = 0; c < stream->nChunks; c++)
+            for (int l = 0; l < STREAM_LEVELS; l++)
+            {
+                const StreamChunk* candidate = &stream->chunks[c];
+                if (candidate->wanted[l] && !candidate->resident[l] && !candidate->ready[l] &&
+                    candidate->priority[l] > best)
+                {
+                    chunk = c;
+                    level = l;
+                    best = candidate->priority[l];
+                }
+            }
+        if (chunk < 0)
+        {
+            SDL_CondWait(stream->wake, stream->mutex);
+            continue;
+        }
+
+        stream->loadingChunk = chunk;
+        stream->loadingLevel = level;
+        const ChunkEntry entry = stream->chunks[chunk].entry;
+        SDL_UnlockMutex(stream->mutex);
+
+        Mesh mesh;
+        const int loaded = readChunkLevel(stream->file, &entry, level, &mesh);
+
+        SDL_LockMutex(stream->mutex);
+        stream->loadingChunk = stream->loadingLevel = -1;
+        if (loaded)
+        {
+            stream->chunks[chunk].loaded[level] = mesh;
+            stream->chunks[chunk].ready[level] = 1;
+        }
+        // A level that can not be read is not asked for again
+        else
+            stream->chunks[chunk].entry.size[level] = 0;
+    }
+    SDL_UnlockMutex(stream->mutex);
+    return 0;
+}
+
+/**
+ * Opens a chunk file (see buildChunkFile) and starts the thread that pages
+ * its chunks in. Nothing is read until the renderer asks for it
+ *
+ *  @param stream Stream to open
+ *  @param path Chunk file
+ *  @param budget Most bytes of chunk data to keep in memory
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int createMeshStream(MeshStream* stream, const char* path, size_t budget)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->loadingChunk = stream->loadingLevel = -1;
+    stream->budget = budget;
+    stream->file = fopen(path, "rb");
+    ChunkFileHeader header;
+    if (stream->file == NULL || fread(&header, sizeof(header), 1, stream->file) != 1 ||
+        header.magic != CHUNK_FILE_MAGIC || header.version != CHUNK_FILE_VERSION ||
+        header.nLevels != STREAM_LEVELS || header.nChunks <= 0)
+    {
+        fprintf(stderr, "[ERROR] %s IS NOT A CHUNK FILE!\n", path);
+        destroyMeshStream(stream);
+        return 0;
+    }
+
+    stream->nChunks = header.nChunks;
+    stream->boundsMin = header.boundsMin;
+    stream->boundsMax = header.boundsMax;
+    ALLOCATE(stream->chunks, stream->nChunks * sizeof(StreamChunk));
+    memset(stream->chunks, 0, stream->nChunks * sizeof(StreamChunk));
+    // Every chunk can ask for two levels now and two more for where the camera goes, and a drawn one
+    ALLOCATE(stream->requests, stream->nChunks * 5 * sizeof(StreamRequest));
+    int ok = 1;
+    for (int c = 0; c < stream->nChunks && ok; c++)
+    {
+        StreamChunk* chunk = &stream->chunks[c];
+        ok = fread(&chunk->entry, sizeof(ChunkEntry), 1, stream->file) == 1;
+        chunk->bounds.center = chunk->entry.center;
+        chunk->bounds.radius = chunk->entry.radius;
+        chunk->bounds.coneCutoff = 2.0f;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "[ERROR] THE CHUNK TABLE OF %s IS CUT SHORT!\n", path);
+        destroyMeshStream(stream);
+        return 0;
+    }
+
+    stream->running = 1;
+    stream->mutex = SDL_CreateMutex();
+    stream->wake = SDL_CreateCond();
+    if (stream->mutex == NULL || stream->wake == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CREATE THE STREAM LOCKS!\n[SDL] %s\n", SDL_GetError());
+        destroyMeshStream(stream);
+        return 0;
+    }
+    stream->thread = SDL_CreateThread(streamThread, "stream", stream);
+    if (stream->thread == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT START THE STREAM THREAD!\n[SDL] %s\n", SDL_GetError());
+        destroyMeshStream(stream);
+        return 0;
+    }
+    printf("[STREAM] %s: %d chunks, %zu MB budget\n", path, stream->nChunks, budget >> 20);
+    return 1;
+}
+
+/**
+ * Stops the stream thread, frees every level and closes the file
+ *
+ *  @param stream Stream to destroy
+ *
+ *  @return void
+ */
+void destroyMeshStream(MeshStream* stream)
+{
+    if (stream->thread != NULL)
+    {
+        SDL_LockMutex(stream->mutex);
+        stream->running = 0;
+        SDL_CondSignal(stream->wake);
+        SDL_UnlockMutex(stream->mutex);
+        SDL_WaitThread(stream->thread, NULL);
+        stream->thread = NULL;
+    }
+    for (int c = 0; c < stream->nChunks && stream->chunks != NULL; c++)
+        for (int l = 0; l < STREAM_LEVELS; l++)
+        {
+            if (stream->chunks[c].resident[l])
+                freeMesh(&stream->chunks[c].levels[l]);
+            if (stream->chunks[c].ready[l])
+                freeMesh(&stream->chunks[c].loaded[l]);
+        }
+    free(stream->chunks);
+    free(stream->requests);
+    stream->chunks = NULL;
+    stream->requests = NULL;
+    if (stream->file != NULL)
+        fclose(stream->file);
+    stream->file = NULL;
+    if (stream->wake != NULL)
+        SDL_DestroyCond(stream->wake);
+    if (stream->mutex != NULL)
+        SDL_DestroyMutex(stream->mutex);
+    stream->wake = NULL;
+    stream->mutex = NULL;
+}
+
+/**
+ * Picks the level of a chunk whose simplification stays under
+ * STREAM_PIXEL_ERROR on screen
+ *
+ *  @param chunk Chunk to pick the level of
+ *  @param modelView Transformation from model to view space
+ *  @param proj Projection matrix
+ *  @param height Height of the frame in pixels
+ *  @param pixels Set to the radius of the chunk on screen, can be NULL
+ *
+ *  @return The coarsest level that is detailed enough
+ */
+static int pickLevel(const StreamChunk* chunk, const Matrix4x4* modelView, const Matrix4x4* proj, int height,
+                     float* pixels)
+{
+    Vector center;
+    multMatVec(&chunk->entry.center, &center, modelView);
+    // Meshes are only rotated and uniformly scaled
+    const float scale = sqrtf(modelView->mat[0][0] * modelView->mat[0][0] + modelView->mat[0][1] * modelView->mat[0][1] +
+                              modelView->mat[0][2] * modelView->mat[0][2]);
+    const float distance = fmaxf(sqrtf(dotProduct(&center, &center)) - chunk->entry.radius * scale, Z_NEAR);
+    const float perUnit = proj->mat[1][1] * 0.5f * height * scale / distance;
+    if (pixels != NULL)
+        *pixels = chunk->entry.radius * perUnit;
+
+    int level = 0;
+    while (level + 1 < STREAM_LEVELS && chunk->entry.error[level + 1] * perUnit <= STREAM_PIXEL_ERROR)
+        level++;
+    return level;
+}
+
+/**
+ * Finds the resident level to draw in place of a level: the level itself,
+ * else the closest coarser one, else the closest finer one
+ *
+ *  @return The level, -1 if nothing of the chunk is resident
+ */
+static int pickResidentLevel(const StreamChunk* chunk, int level)
+{
+    for (int l = level; l < STREAM_LEVELS; l++)
+        if (chunk->resident[l])
+            return l;
+    for (int l = level - 1; l >= 0; l--)
+        if (chunk->resident[l])
+            return l;
+    return -1;
+}
+
+/**
+ * Orders requests from the most urgent to the least
+ *
+ *  @return Comparison result for qsort
+ */
+static int compareRequests(const void* a, const void* b)
+{
+    const float pa = ((const StreamRequest*)a)->priority, pb = ((const StreamRequest*)b)->priority;
+    return (pa < pb) - (pa > pb);
+}
+
+/**
+ * Orders chunk levels from the one unused for the longest
+ *
+ *  @return Comparison result for qsort
+ */
+static int compareLastUsed(const void* a, const void* b)
+{
+    const StreamRequest* ra = a;
+    const StreamRequest* rb = b;
+    return (ra->priority > rb->priority) - (ra->priority < rb->priority);
+}
+
+/**
+ * Brings a stream up to date for the next frame. Called once per frame
+ * before anything is drawn, it never waits for the stream thread:
+ *  - levels the thread finished are handed to the renderer
+ *  - the levels the view needs are requested, most urgent first, as long
+ *    as they fit in the budget together. That is something to draw for
+ *    every visible chunk, then its right level of detail, then the same for
+ *    where the camera will be in STREAM_PREFETCH_FRAMES frames if it keeps
+ *    moving like in the last one
+ *  - levels that were not requested are evicted, least recently used first,
+ *    until the requested ones fit
+ *
+ *  @param stream Stream to update
+ *  @param modelView Transformation from model to view space of the frame
+ *  @param proj Projection matrix
+ *  @param height Height of the frame in pixels
+ *
+ *  @return 1 if what the stream draws changed, 0 otherwise
+ */
+int updateMeshStream(MeshStream* stream, const Matrix4x4* modelView, const Matrix4x4* proj, int height)
+{
+    if (SDL_TryLockMutex(stream->mutex) != 0)
+        return 0;
+    stream->frame++;
+
+    int changed = 0;
+    for (int c = 0; c < stream->nChunks; c++)
+        for (int l = 0; l < STREAM_LEVELS; l++)
+        {
+            StreamChunk* chunk = &stream->chunks[c];
+            if (!chunk->ready[l])
+                continue;
+            chunk->levels[l] = chunk->loaded[l];
+            chunk->resident[l] = 1;
+            chunk->ready[l] = 0;
+            stream->resident += chunk->entry.size[l];
+            changed = 1;
+        }
+
+    // The camera motion of the last frame, carried on
+    Matrix4x4 ahead = *modelView;
+    for (int r = 0; r < 4 && stream->hasLast; r++)
+        for (int k = 0; k < 4; k++)
+            ahead.mat[r][k] += (modelView->mat[r][k] - stream->lastModelView.mat[r][k]) * STREAM_PREFETCH_FRAMES;
+    const Vector origin = {0.0f, 0.0f, 0.0f};
+
+    int nRequests = 0;
+    StreamRequest* requests = stream->requests;
+    for (int c = 0; c < stream->nChunks; c++)
+    {
+        StreamChunk* chunk = &stream->chunks[c];
+        float pixels;
+        if (isMeshletVisible(&chunk->bounds, modelView, &origin, proj))
+        {
+            const int level = pickLevel(chunk, modelView, proj, height, &pixels);
+            const int drawn = pickResidentLevel(chunk, level);
+            if (drawn >= 0)
+            {
+                chunk->lastUsed[drawn] = stream->frame;
+                requests[nRequests++] = (StreamRequest){c, drawn, PRIORITY_DRAWN + pixels};
+            }
+            requests[nRequests++] = (StreamRequest){c, STREAM_LEVELS - 1, PRIORITY_COARSE + pixels};
+            requests[nRequests++] = (StreamRequest){c, level, PRIORITY_DETAIL + pixels};
+        }
+        if (stream->hasLast && isMeshletVisible(&chunk->bounds, &ahead, &origin, proj))
+        {
+            const int level = pickLevel(chunk, &ahead, proj, height, &pixels);
+            requests[nRequests++] = (StreamRequest){c, STREAM_LEVELS - 1, PRIORITY_PREFETCH + pixels};
+            requests[nRequests++] = (StreamRequest){c, level, PRIORITY_PREFETCH + pixels};
+        }
+    }
+    qsort(requests, nRequests, sizeof(StreamRequest), compareRequests);
+
+    // Whatever does not fit in the budget is drawn from the levels that did
+    for (int c = 0; c < stream->nChunks; c++)
+        memset(stream->chunks[c].wanted, 0, sizeof(stream->chunks[c].wanted));
+    size_t wanted = 0, missing = 0;
+    for (int r = 0; r < nRequests; r++)
+    {
+        StreamChunk* chunk = &stream->chunks[requests[r].chunk];
+        const int l = requests[r].level;
+        const size_t size = chunk->entry.size[l];
+        if (chunk->wanted[l] || size == 0 || wanted + size > stream->budget)
+            continue;
+        chunk->wanted[l] = 1;
+        chunk->priority[l] = requests[r].priority;
+        wanted += size;
+        if (!chunk->resident[l])
+            missing += size;
+    }
+
+    // Make room for what is still to come
+    if (stream->resident + missing > stream->budget)
+    {
+        int nEvictable = 0;
+        for (int c = 0; c < stream->nChunks; c++)
+            for (int l = 0; l < STREAM_LEVELS; l++)
+                if (stream->chunks[c].resident[l] && !stream->chunks[c].wanted[l])
+                    requests[nEvictable++] = (StreamRequest){c, l, (float)stream->chunks[c].lastUsed[l]};
+        qsort(requests, nEvictable, sizeof(StreamRequest), compareLastUsed);
+        for (int e = 0; e < nEvictable && stream->resident + missing > stream->budget; e++)
+        {
+            StreamChunk* chunk = &stream->chunks[requests[e].chunk];
+            const int l = requests[e].level;
+            freeMesh(&chunk->levels[l]);
+            chunk->resident[l] = 0;
+            stream->resident -= chunk->entry.size[l];
+        }
+    }
+
+    stream->lastModelView = *modelView;
+    stream->hasLast = 1;
+    SDL_CondSignal(stream->wake);
+    SDL_UnlockMutex(stream->mutex);
+    return changed;
+}
+
+/**
+ * Updates a stream until every level the view asks for is resident. For
+ * captures and batches, which want the frame as good as it gets rather
+ * than on time
+ *
+ *  @param stream Stream to settle
+ *  @param modelView Transformation from model to view space of the frame
+ *  @param proj Projection matrix
+ *  @param height Height of the frame in pixels
+ *
+ *  @return 1 if what the stream draws changed, 0 otherwise
+ */
+int settleMeshStream(MeshStream* stream, const Matrix4x4* modelView, const Matrix4x4* proj, int height)
+{
+    // A still camera, nothing to prefetch
+    stream->hasLast = 0;
+    int settled = 0, changed = 0;
+    while (!settled)
+    {
+        changed |= updateMeshStream(stream, modelView, proj, height);
+        SDL_LockMutex(stream->mutex);
+        settled = 1;
+        for (int c = 0; c < stream->nChunks && settled; c++)
+            for (int l = 0; l < STREAM_LEVELS && settled; l++)
+                settled = !stream->chunks[c].wanted[l] || stream->chunks[c].resident[l];
+        SDL_UnlockMutex(stream->mutex);
+        if (!settled)
+            SDL_Delay(1);
+        stream->hasLast = 0;
+    }
+    return changed;
+}
+
+/**
+ * Draws every visible chunk of a stream at the level its distance asks for,
+ * or the closest level that is resident. Nothing in the stream is written,
+ * so many views can be drawn at the same time between two updates
+ *
+ *  @param stream Stream to draw
+ *  @param modelView Transformation from model to view space
+ *  @param proj Projection matrix
+ *  @param lights Lights of the scene, in view space
+ *  @param nLights Number of lights
+ *  @param shadow Shadow map of the shadow casting light, NULL for no shadows
+ *  @param wireframe Draws the edges instead of filling the triangles
+ *  @param fb Framebuffer to draw into
+ *  @param clip Only pixels inside this rectangle are touched
+ *
+ *  @return Number of triangles that went to the rasterizer (see drawMesh), 0 for wireframes
+ */
+int drawMeshStream(const MeshStream* stream, const Matrix4x4* modelView, const Matrix4x4* proj, const Light* lights,
+                   int nLights, const ShadowMap* shadow, int wireframe, Framebuffer* fb, const SDL_Rect* clip)
+{
+    const Vector origin = {0.0f, 0.0f, 0.0f};
+    int submitted = 0;
+    for (int c = 0; c < stream->nChunks; c++)
+    {
+        const StreamChunk* chunk = &stream->chunks[c];
+        if (!isMeshletVisible(&chunk->bounds, modelView, &origin, proj))
+            continue;
+        const int level = pickResidentLevel(chunk, pickLevel(chunk, modelView, proj, fb->height, NULL));
+        if (level < 0)
+            continue;
+        if (wireframe)
+            drawMeshEdges(&chunk->levels[level], modelView, proj, fb, clip);
+        else
+            submitted += drawMesh(&chunk->levels[level], modelView, proj, lights, nLights, shadow, fb, clip);
+    }
+    return submitted;
+}
@@ -0,0 +1,117 @@
+//
+// Out-of-core meshes: chunks of a mesh file paged in as the camera needs them
+//
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "engine.h"
+#include "shadow.h"
+#include <stdio.h>
+
+#define CHUNK_FILE_MAGIC 0x4B4E4843u
+#define CHUNK_FILE_VERSION 1
+// Levels of detail of every chunk, 0 is the full mesh and each one after has about a quarter of the triangles
+#define STREAM_LEVELS 3
+// Most triangles in a chunk at full detail
+#define STREAM_CHUNK_TRIS 16384
+// Levels are picked so their simplification moves nothing by more than this on screen
+#define STREAM_PIXEL_ERROR 1.0f
+// How far ahead the camera motion is followed to load chunks before they are needed
+#define STREAM_PREFETCH_FRAMES 8
+// Memory for the chunks of one stream when no budget is given
+#define STREAM_DEFAULT_BUDGET (256u << 20)
+
+// Start of a chunk file, the chunk table follows and then the data of every level
+typedef struct
+{
+    Uint32 magic;
+    Uint32 version;
+    Sint32 nChunks;
+    Sint32 nLevels;
+    Vector boundsMin, boundsMax;
+} ChunkFileHeader;
+
+typedef struct
+{
+    Vector center;
+    float radius;
+    // Where the levels are in the file
+    Uint64 offset[STREAM_LEVELS];
+    Uint32 size[STREAM_LEVELS];
+    Sint32 nTris[STREAM_LEVELS];
+    // Farthest a vertex was moved by the simplification, in model units
+    float error[STREAM_LEVELS];
+} ChunkEntry;
+
+// Start of the data of a level, the arrays of a compact mesh follow in order (see readChunkLevel)
+typedef struct
+{
+    Sint32 nVerts, nTris, nMeshlets, nEdges;
+    Sint32 packedIndicesSize, packedMeshletVertsSize;
+    Vector boundsMin, boundsMax;
+} ChunkLevelHeader;
+
+typedef struct
+{
+    ChunkEntry entry;
+    // Bounding sphere as a meshlet with no normal cone, culled like any other one
+    Meshlet bounds;
+    // Levels the renderer can draw, only touched by the render thread
+    Mesh levels[STREAM_LEVELS];
+    Uint32 lastUsed[STREAM_LEVELS];
+    // Everything below is guarded by the stream mutex
+    int resident[STREAM_LEVELS];
+    // Requested by the renderer this frame, and how soon it needs them
+    int wanted[STREAM_LEVELS];
+    float priority[STREAM_LEVELS];
+    // Read by the stream thread and waiting for the next frame
+    int ready[STREAM_LEVELS];
+    Mesh loaded[STREAM_LEVELS];
+} StreamChunk;
+
+// A level the renderer would like to have, see updateMeshStream
+typedef struct
+{
+    int chunk, level;
+    float priority;
+} StreamRequest;
+
+struct MeshStream
+{
+    FILE* file;
+    int nChunks;
+    StreamChunk* chunks;
+    Vector boundsMin, boundsMax;
+    // Scene graph node that places the stream in the world, its transform and screen area of the last frame
+    int node;
+    Matrix4x4 world;
+    SDL_Rect rect;
+    // Bytes of resident levels, never more than the budget once the renderer has evicted
+    size_t budget;
+    size_t resident;
+    Uint32 frame;
+    // View of the last update, the camera motion comes from it
+    Matrix4x4 lastModelView;
+    int hasLast;
+    // Scratch space of the update, one entry per request
+    StreamRequest* requests;
+    SDL_Thread* thread;
+    // Guards the chunk fields marked above, the condition wakes the thread up for new requests
+    SDL_mutex* mutex;
+    SDL_cond* wake;
+    int running;
+    // Chunk and level the thread is reading, -1 when it is not
+    int loadingChunk, loadingLevel;
+};
+
+/*Function prototypes*/
+int buildChunkFile(const char* objPath, const char* path);
+int createMeshStream(MeshStream* stream, const char* path, size_t budget);
+void destroyMeshStream(MeshStream* stream);
+int updateMeshStream(MeshStream* stream, const Matrix4x4* modelView, const Matrix4x4* proj, int height);
+int settleMeshStream(MeshStream* stream, const Matrix4x4* modelView, const Matrix4x4* proj, int height);
+int drawMeshStream(const MeshStream* stream, const Matrix4x4* modelView, const Matrix4x4* proj, const Light* lights,
+                   int nLights, const ShadowMap* shadow, int wireframe, Framebuffer* fb, const SDL_Rect* clip);
+
+#endif //STREAM_H
@@ -0,0 +1,439 @@
+//
+// Graph of the tasks of a frame, run on a work stealing scheduler
+//
+// Every worker has a queue of ready tasks. A task that finishes pushes the
+// tasks it was the last dependency of onto the queue of its own worker, so
+// chains stay on one thread with their data in its cache, and workers with an
+// empty queue steal the oldest task of another one. Workers with nothing to
+// steal sleep until a task is pushed, they never spin through a long task
+//
+
+#include "taskgraph.h"
+#include <string.h>
+
+/**
+ * Empties a graph
+ *
+ *  @param graph Graph to empty
+ *
+ *  @return void
+ */
+void createTaskGraph(TaskGraph* graph)
+{
+    memset(graph, 0, sizeof(*graph));
+}
+
+/**
+ * Adds a task after all the tasks already in a graph, waiting for the ones
+ * it conflicts with
+ *
+ *  @param graph Graph to add to
+ *  @param name Name in the traces, kept as is
+ *  @param run Function of the task
+ *  @param data Passed along to run
+ *  @param reads Resources the task reads
+ *  @param writes Resources the task writes
+ *
+ *  @return Index of the task, -1 if the graph is full
+ */
+int addTask(TaskGraph* graph, const char* name, TaskFunction run, void* data, Uint32 reads, Uint32 writes)
+{
+    if (graph->nTasks == MAX_TASKS)
+    {
+        fprintf(stderr, "[ERROR] THE TASK GRAPH IS FULL!\n");
+        return -1;
+    }
+    const int index = graph->nTasks++;
+    Task* task = &graph->tasks[index];
+    memset(task, 0, sizeof(*task));
+    task->name = name;
+    task->run = run;
+    task->data = data;
+    task->reads = reads;
+    task->writes = writes;
+    for (int i = 0; i < index; i++)
+    {
+        Task* earlier = &graph->tasks[i];
+        if ((earlier->writes & (reads | writes)) == 0 && (earlier->reads & writes) == 0)
+            continue;
+        task->dependencies[task->nDependencies++] = i;
+        earlier->dependents[earlier->nDependents++] = index;
+    }
+    return index;
+}
+
+/**
+ * Makes a task ready on the queue of a worker, and wakes a sleeping worker
+ * to steal it
+ *
+ *  @return void
+ */
+static void pushTask(TaskScheduler* scheduler, int worker, int task)
+{
+    TaskQueue* queue = &scheduler->queues[worker];
+    SDL_AtomicLock(&queue->lock);
+    queue->tasks[queue->tail++] = task;
+    SDL_AtomicUnlock(&queue->lock);
+    SDL_AtomicAdd(&scheduler->queued, 1);
+    // A worker going to sleep counts itself before it looks at the queues one last time
+    if (SDL_AtomicGet(&scheduler->sleeping) > 0)
+    {
+        SDL_LockMutex(scheduler->mutex);
+        SDL_CondSignal(scheduler->wake);
+        SDL_UnlockMutex(scheduler->mutex);
+    }
+}
+
+/**
+ * Takes the newest task of the queue of a worker, or steals the oldest one
+ * of another queue
+ *
+ *  @return The task, -1 if every queue is empty
+ */
+static int takeTask(TaskScheduler* scheduler, int worker)
+{
+    for (int i = 0; i < scheduler->nWorkers; i++)
+    {
+        const int victim = (worker + i) % scheduler->nWorkers;
+        TaskQueue* queue = &scheduler->queues[victim];
+        int task = -1;
+        SDL_AtomicLock(&queue->lock);
+        if (queue->head < queue->tail)
+            task = victim == worker ? queue->tasks[--queue->tail] : queue->tasks[queue->head++];
+        SDL_AtomicUnlock(&queue->lock);
+        if (task >= 0)
+        {
+            SDL_AtomicAdd(&scheduler->queued, -1);
+            return task;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Runs a task on a worker and keeps the times of the run
+ *
+ *  @return void
+ */
+static void timeTask(Task* task, int worker)
+{
+    task->worker = worker;
+    task->begin = SDL_GetPerformanceCounter();
+    task->run(task->data);
+    task->end = SDL_GetPerformanceCounter();
+}
+
+/**
+ * Runs a task and makes ready the tasks that were only waiting for it
+ *
+ *  @return void
+ */
+static void runTask(TaskScheduler* scheduler, int index, int worker)
+{
+    TaskGraph* graph = scheduler->graph;
+    Task* task = &graph->tasks[index];
+    timeTask(task, worker);
+    for (int i = 0; i < task->nDependents; i++)
+    {
+        const int dependent = task->dependents[i];
+        if (SDL_AtomicAdd(&graph->tasks[dependent].waiting, -1) == 1)
+            pushTask(scheduler, worker, dependent);
+    }
+    // The last task wakes everyone, the run is over
+    if (SDL_AtomicAdd(&scheduler->remaining, -1) == 1)
+    {
+        SDL_LockMutex(scheduler->mutex);
+        SDL_CondBroadcast(scheduler->wake);
+        SDL_UnlockMutex(scheduler->mutex);
+    }
+}
+
+/**
+ * Runs and steals tasks until every task of the current run is done
+ *
+ *  @return void
+ */
+static void workOnGraph(TaskScheduler* scheduler, int worker)
+{
+    while (SDL_AtomicGet(&scheduler->remaining) > 0)
+    {
+        const int task = takeTask(scheduler, worker);
+        if (task >= 0)
+        {
+            runTask(scheduler, task, worker);
+            continue;
+        }
+        // Nothing ready, sleep until a task is pushed or the run is over
+        SDL_LockMutex(scheduler->mutex);
+        SDL_AtomicAdd(&scheduler->sleeping, 1);
+        while (SDL_AtomicGet(&scheduler->queued) == 0 && SDL_AtomicGet(&scheduler->remaining) > 0)
+            SDL_CondWait(scheduler->wake, scheduler->mutex);
+        SDL_AtomicAdd(&scheduler->sleeping, -1);
+        SDL_UnlockMutex(scheduler->mutex);
+    }
+}
+
+/**
+ * Worker thread: waits for a run, helps with it and reports back
+ *
+ *  @param data The TaskScheduler
+ *
+ *  @return 0
+ */
+static int schedulerThread(void* data)
+{
+    TaskScheduler* scheduler = data;
+    SDL_LockMutex(scheduler->mutex);
+    const int worker = ++scheduler->started;
+    // Starting from 0 a thread that comes up late still joins a run already going
+    int seen = 0;
+    while (1)
+    {
+        while (scheduler->generation == seen && scheduler->running)
+            SDL_CondWait(scheduler->wake, scheduler->mutex);
+        if (!scheduler->running)
+            break;
+        seen = scheduler->generation;
+        SDL_UnlockMutex(scheduler->mutex);
+
+        workOnGraph(scheduler, worker);
+
+        SDL_LockMutex(scheduler->mutex);
+        if (++scheduler->finished == scheduler->nWorkers - 1)
+            SDL_CondSignal(scheduler->done);
+    }
+    SDL_UnlockMutex(scheduler->mutex);
+    return 0;
+}
+
+/**
+ * Starts the threads of a scheduler
+ *
+ *  @param scheduler Scheduler to start
+ *  @param nWorkers Threads to use counting the caller, 0 for one per CPU core
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int createTaskScheduler(TaskScheduler* scheduler, int nWorkers)
+{
+    memset(scheduler, 0, sizeof(*scheduler));
+    if (nWorkers <= 0)
+        nWorkers = SDL_GetCPUCount();
+    scheduler->nWorkers = SDL_max(1, SDL_min(nWorkers, MAX_WORKERS));
+    scheduler->running = 1;
+    scheduler->mutex = SDL_CreateMutex();
+    scheduler->wake = SDL_CreateCond();
+    scheduler->done = SDL_CreateCond();
+    if (scheduler->mutex == NULL || scheduler->wake == NULL || scheduler->done == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CREATE THE TASK SCHEDULER LOCKS!\n[SDL] %s\n", SDL_GetError());
+        destroyTaskScheduler(scheduler);
+        return 0;
+    }
+    for (int i = 1; i < scheduler->nWorkers; i++)
+    {
+        scheduler->threads[i] = SDL_CreateThread(schedulerThread, "scheduler", scheduler);
+        if (scheduler->threads[i] == NULL)
+        {
+            fprintf(stderr, "[ERROR] COULD NOT START A SCHEDULER THREAD!\n[SDL] %s\n", SDL_GetError());
+            // Keep the ones that started
+            scheduler->nWorkers = i;
+            break;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Marks the critical path of the last run of a graph: from the task that
+ * ended last, back through the dependencies that ended last
+ *
+ *  @return void
+ */
+static void markCriticalPath(TaskGraph* graph)
+{
+    int last = 0;
+    for (int i = 1; i < graph->nTasks; i++)
+        if (graph->tasks[i].end > graph->tasks[last].end)
+            last = i;
+    while (last >= 0)
+    {
+        Task* task = &graph->tasks[last];
+        task->critical = 1;
+        last = -1;
+        for (int d = 0; d < task->nDependencies; d++)
+            if (last < 0 || graph->tasks[task->dependencies[d]].end > graph->tasks[last].end)
+                last = task->dependencies[d];
+    }
+}
+
+/**
+ * Runs every task of a graph on all the workers of a scheduler, the caller
+ * included, and returns when all of them are done
+ *
+ *  @param scheduler Scheduler to run on
+ *  @param graph Graph to run, its tasks get the times of this run
+ *
+ *  @return void
+ */
+void runTaskGraph(TaskScheduler* scheduler, TaskGraph* graph)
+{
+    if (graph->nTasks == 0)
+        return;
+    for (int i = 0; i < graph->nTasks; i++)
+        graph->tasks[i].critical = 0;
+    // Alone, the order the tasks were added in already has every dependency first
+    if (scheduler->nWorkers == 1 || scheduler->mutex == NULL)
+    {
+        for (int i = 0; i < graph->nTasks; i++)
+            timeTask(&graph->tasks[i], 0);
+        markCriticalPath(graph);
+        return;
+    }
+
+    for (int i = 0; i < scheduler->nWorkers; i++)
+        scheduler->queues[i].head = scheduler->queues[i].tail = 0;
+    SDL_AtomicSet(&scheduler->remaining, graph->nTasks);
+    SDL_AtomicSet(&scheduler->queued, 0);
+    for (int i = 0; i < graph->nTasks; i++)
+        SDL_AtomicSet(&graph->tasks[i].waiting, graph->tasks[i].nDependencies);
+
+    SDL_LockMutex(scheduler->mutex);
+    scheduler->graph = graph;
+    scheduler->finished = 0;
+    scheduler->generation++;
+    SDL_UnlockMutex(scheduler->mutex);
+    // The first tasks go on the queue of the caller, the workers steal them from there
+    for (int i = 0; i < graph->nTasks; i++)
+        if (graph->tasks[i].nDependencies == 0)
+            pushTask(scheduler, 0, i);
+    SDL_LockMutex(scheduler->mutex);
+    SDL_CondBroadcast(scheduler->wake);
+    SDL_UnlockMutex(scheduler->mutex);
+
+    workOnGraph(scheduler, 0);
+
+    SDL_LockMutex(scheduler->mutex);
+    while (scheduler->finished < scheduler->nWorkers - 1)
+        SDL_CondWait(scheduler->done, scheduler->mutex);
+    SDL_UnlockMutex(scheduler->mutex);
+    markCriticalPath(graph);
+}
+
+/**
+ * Stops and joins the threads of a scheduler
+ *
+ *  @param scheduler Scheduler to stop
+ *
+ *  @return void
+ */
+void destroyTaskScheduler(TaskScheduler* scheduler)
+{
+    if (scheduler->mutex != NULL)
+    {
+        SDL_LockMutex(scheduler->mutex);
+        scheduler->running = 0;
+        SDL_CondBroadcast(scheduler->wake);
+        SDL_UnlockMutex(scheduler->mutex);
+    }
+    for (int i = 1; i < MAX_WORKERS; i++)
+    {
+        if (scheduler->threads[i] != NULL)
+            SDL_WaitThread(scheduler->threads[i], NULL);
+        scheduler->threads[i] = NULL;
+    }
+    SDL_DestroyCond(scheduler->wake);
+    SDL_DestroyCond(scheduler->done);
+    SDL_DestroyMutex(scheduler->mutex);
+    scheduler->wake = scheduler->done = NULL;
+    scheduler->mutex = NULL;
+}
+
+/**
+ * Starts a trace file, in the JSON array format of the Chrome trace viewer
+ *
+ *  @param trace Trace to start
+ *  @param path File to write, replaced if it exists
+ *
+ *  @return 1 on success, 0 on failure
+ */
+int openTaskTrace(TaskTrace* trace, const char* path)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->file = fopen(path, "w");
+    if (trace->file == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT WRITE THE TRACE %s!\n", path);
+        return 0;
+    }
+    trace->origin = SDL_GetPerformanceCounter();
+    // Frames get a row of their own under the workers
+    fprintf(trace->file, "[\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"frames\"}}",
+            MAX_WORKERS);
+    trace->nEvents = 1;
+    return 1;
+}
+
+/**
+ * Adds the last run of a graph to a trace: one event per task on the row of
+ * its worker, the tasks of the critical path in their own category, and
+ * one event for the whole run
+ *
+ *  @param trace Trace to write to
+ *  @param graph Graph that just ran
+ *  @param frame Number of the frame, in the names of the events
+ *
+ *  @return void
+ */
+void traceTaskGraph(TaskTrace* trace, const TaskGraph* graph, int frame)
+{
+    if (trace->file == NULL || graph->nTasks == 0)
+        return;
+    const double toMicroseconds = 1e6 / (double)SDL_GetPerformanceFrequency();
+    Uint64 begin = graph->tasks[0].begin, end = graph->tasks[0].end;
+    double critical = 0.0, busy = 0.0;
+    for (int i = 0; i < graph->nTasks; i++)
+    {
+        const Task* task = &graph->tasks[i];
+        const double duration = (double)(task->end - task->begin) * toMicroseconds;
+        if (!(trace->named & (1ull << task->worker)))
+        {
+            trace->named |= 1ull << task->worker;
+            fprintf(trace->file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                                 "\"args\":{\"name\":\"%s %d\"}}",
+                    task->worker, task->worker == 0 ? "render" : "worker", task->worker);
+            trace->nEvents++;
+        }
+        fprintf(trace->file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                             "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+                task->name, task->critical ? "critical" : "task", task->worker,
+                (double)(task->begin - trace->origin) * toMicroseconds, duration, frame);
+        begin = SDL_min(begin, task->begin);
+        end = SDL_max(end, task->end);
+        busy += duration;
+        if (task->critical)
+            critical += duration;
+    }
+    fprintf(trace->file, ",\n{\"name\":\"frame %d\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                         "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"critical_us\":%.3f,\"busy_us\":%.3f}}",
+            frame, MAX_WORKERS, (double)(begin - trace->origin) * toMicroseconds,
+            (double)(end - begin) * toMicroseconds, critical, busy);
+    trace->nEvents += graph->nTasks + 1;
+}
+
+/**
+ * Finishes a trace file
+ *
+ *  @param trace Trace to finish
+ *
+ *  @return void
+ */
+void closeTaskTrace(TaskTrace* trace)
+{
+    if (trace->file == NULL)
+        return;
+    fprintf(trace->file, "\n]\n");
+    fclose(trace->file);
+    trace->file = NULL;
+    printf("[TRACE] %d events written\n", trace->nEvents);
+}
@@ -0,0 +1,99 @@
+//
+// Graph of the tasks of a frame, run on a work stealing scheduler
+//
+// Tasks are added in the order a single thread would run them, each with the
+// resources it reads and writes (one bit each, the caller decides what they
+// mean). A task waits for every earlier task that writes something it reads
+// or writes, or that reads something it writes, so the graph gives the same
+// results as running the tasks in order, and everything else runs at once
+//
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include "engine.h"
+#include "pool.h"
+#include <stdio.h>
+
+// Most tasks a graph can have
+#define MAX_TASKS 32
+
+typedef void (*TaskFunction)(void* data);
+
+typedef struct
+{
+    const char* name;
+    TaskFunction run;
+    void* data;
+    Uint32 reads, writes;
+    // Earlier tasks this one waits for, and later tasks waiting for it
+    int nDependencies;
+    int dependencies[MAX_TASKS];
+    int nDependents;
+    int dependents[MAX_TASKS];
+    // Dependencies not done yet in the current run
+    SDL_atomic_t waiting;
+    // Last run: performance counter at the start and the end, the worker that ran it, and whether
+    // it was on the chain of tasks that decided when the run ended
+    Uint64 begin, end;
+    int worker;
+    int critical;
+} Task;
+
+typedef struct
+{
+    int nTasks;
+    Task tasks[MAX_TASKS];
+} TaskGraph;
+
+// Ready tasks of one worker. The worker takes the newest, the others steal the oldest
+typedef struct
+{
+    SDL_SpinLock lock;
+    int head, tail;
+    int tasks[MAX_TASKS];
+} TaskQueue;
+
+typedef struct
+{
+    // Threads running a graph, the calling thread counts as worker 0
+    int nWorkers;
+    SDL_Thread* threads[MAX_WORKERS];
+    TaskQueue queues[MAX_WORKERS];
+    // Guards everything below but the atomics, wake starts a run or a sleeping worker, done wakes the caller
+    SDL_mutex* mutex;
+    SDL_cond* wake;
+    SDL_cond* done;
+    int running;
+    // Increases with every run so the workers know a new one started
+    int generation;
+    int started;
+    int finished;
+    TaskGraph* graph;
+    // Tasks of the current run not done yet, ready ones not taken yet, and workers waiting for some
+    SDL_atomic_t remaining;
+    SDL_atomic_t queued;
+    SDL_atomic_t sleeping;
+} TaskScheduler;
+
+// Chrome trace (chrome://tracing, Perfetto) of the graph runs, one event per task
+typedef struct
+{
+    FILE* file;
+    int nEvents;
+    // Performance counter of time 0, and the workers already given a name (one bit each)
+    Uint64 origin;
+    Uint64 named;
+} TaskTrace;
+
+/*Function prototypes*/
+void createTaskGraph(TaskGraph* graph);
+int addTask(TaskGraph* graph, const char* name, TaskFunction run, void* data, Uint32 reads, Uint32 writes);
+int createTaskScheduler(TaskScheduler* scheduler, int nWorkers);
+void runTaskGraph(TaskScheduler* scheduler, TaskGraph* graph);
+void destroyTaskScheduler(TaskScheduler* scheduler);
+int openTaskTrace(TaskTrace* trace, const char* path);
+void traceTaskGraph(TaskTrace* trace, const TaskGraph* graph, int frame);
+void closeTaskTrace(TaskTrace* trace);
+
+#endif //TASKGRAPH_H
@@ -0,0 +1,186 @@
+//
+// Counters of a running renderer in shared memory, for tools to read live
+//
+// Publishing is a few stores into memory nobody else writes: no system call,
+// no lock and no wait for the readers, however many there are
+//
+
+#include "telemetry.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Creates the shared memory of a renderer. What a renderer that died left
+ * under the same name is unlinked, readers still attached to it keep it
+ *
+ *  @param name Name of the shared memory, starting with /
+ *
+ *  @return The block with every counter at 0, NULL on failure
+ */
+TelemetryBlock* createTelemetry(const char* name)
+{
+    // Readable by monitoring tools of other users, only the renderer writes
+    shm_unlink(name);
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(TelemetryBlock)) != 0)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CREATE THE TELEMETRY %s!\n", name);
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(name);
+        }
+        return NULL;
+    }
+    TelemetryBlock* block = mmap(NULL, sizeof(TelemetryBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT MAP THE TELEMETRY %s!\n", name);
+        shm_unlink(name);
+        return NULL;
+    }
+    // The magic goes last, a reader attaching before that refuses the block
+    block->version = TELEMETRY_VERSION;
+    block->pid = (Uint32)getpid();
+    atomic_store_explicit(&block->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    block->magic = TELEMETRY_MAGIC;
+    return block;
+}
+
+/**
+ * Stops and removes the shared memory of a renderer. Readers keep their
+ * mapping, it loses its magic and stops changing
+ *
+ *  @param block Block made by createTelemetry, can be NULL
+ *  @param name Name it was created with
+ *
+ *  @return void
+ */
+void destroyTelemetry(TelemetryBlock* block, const char* name)
+{
+    if (block == NULL)
+        return;
+    block->magic = 0;
+    munmap(block, sizeof(TelemetryBlock));
+    shm_unlink(name);
+}
+
+/**
+ * Maps the shared memory of a running renderer, read only
+ *
+ *  @param name Name the renderer was given
+ *
+ *  @return The block, NULL on failure
+ */
+const TelemetryBlock* attachTelemetry(const char* name)
+{
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[ERROR] NO RENDERER PUBLISHES TELEMETRY AS %s!\n", name);
+        return NULL;
+    }
+    const TelemetryBlock* block = mmap(NULL, sizeof(TelemetryBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT MAP THE TELEMETRY %s!\n", name);
+        return NULL;
+    }
+    if (block->magic != TELEMETRY_MAGIC || block->version != TELEMETRY_VERSION)
+    {
+        fprintf(stderr, "[ERROR] %s IS NOT THE TELEMETRY OF THIS RENDERER VERSION!\n", name);
+        munmap((void*)block, sizeof(TelemetryBlock));
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * Unmaps a block mapped by attachTelemetry
+ *
+ *  @param block The block, can be NULL
+ *
+ *  @return void
+ */
+void detachTelemetry(const TelemetryBlock* block)
+{
+    if (block != NULL)
+        munmap((void*)block, sizeof(TelemetryBlock));
+}
+
+#else
+
+TelemetryBlock* createTelemetry(const char* name)
+{
+    fprintf(stderr, "[ERROR] TELEMETRY NEEDS A UNIX SYSTEM!\n");
+    return NULL;
+}
+
+void destroyTelemetry(TelemetryBlock* block, const char* name)
+{
+}
+
+const TelemetryBlock* attachTelemetry(const char* name)
+{
+    fprintf(stderr, "[ERROR] TELEMETRY NEEDS A UNIX SYSTEM!\n");
+    return NULL;
+}
+
+void detachTelemetry(const TelemetryBlock* block)
+{
+}
+
+#endif
+
+/**
+ * Replaces the counters of a block, once per frame. Only one thread may
+ * publish to a block
+ *
+ *  @param block Block made by createTelemetry
+ *  @param counters What the frame did
+ *
+ *  @return void
+ */
+void publishTelemetry(TelemetryBlock* block, const TelemetryCounters* counters)
+{
+    const Uint32 sequence = atomic_load_explicit(&block->sequence, memory_order_relaxed);
+    atomic_store_explicit(&block->sequence, sequence + 1, memory_order_relaxed);
+    // The odd sequence is seen before any of the new counters
+    atomic_thread_fence(memory_order_release);
+    block->counters = *counters;
+    atomic_store_explicit(&block->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Copies the counters of a block, all from the same frame
+ *
+ *  @param block Block of a renderer
+ *  @param counters Output, the counters
+ *
+ *  @return 1 on success, 0 if the renderer kept writing through every attempt
+ */
+int readTelemetry(const TelemetryBlock* block, TelemetryCounters* counters)
+{
+    // C11 atomic loads take no const pointer
+    _Atomic Uint32* sequence = (_Atomic Uint32*)&block->sequence;
+    for (int attempt = 0; attempt < TELEMETRY_READ_ATTEMPTS; attempt++)
+    {
+        const Uint32 before = atomic_load_explicit(sequence, memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(counters, &block->counters, sizeof(*counters));
+        // The copy is done before the sequence is checked again
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(sequence, memory_order_relaxed) == before)
+            return 1;
+    }
+    return 0;
+}
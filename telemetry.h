@@ -0,0 +1,71 @@
+//
+// Counters of a running renderer in shared memory, for tools to read live
+//
+// The renderer owns a named shared memory block and rewrites its counters at
+// the end of every frame. Readers map it read only and never stop the
+// renderer: the block is a seqlock, the sequence is odd while the counters
+// are written and readers retry when it changed under them. The layout only
+// uses fixed size fields, a reader built on its own reads it as is
+//
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "engine.h"
+#include <stdatomic.h>
+
+// First field of the block, anything else in the shared memory is not a renderer
+#define TELEMETRY_MAGIC 0x4D4C4554u
+#define TELEMETRY_VERSION 2
+// Times a reader tries before it gives up on a renderer that writes all the time
+#define TELEMETRY_READ_ATTEMPTS 64
+
+// What the last frame did, and totals since the renderer started
+typedef struct
+{
+    Uint64 frame;
+    // SDL_GetTicks of the renderer when the frame was done
+    Uint64 ticks;
+    float frameMs;
+    // Time the worker pool spent on items during the frame, summed over its threads
+    float workerMs;
+    Uint32 nWorkers;
+    Uint32 dirtyRects;
+    Uint32 meshes;
+    // Meshes outside the screen, and meshes on it hidden behind the occluders
+    Uint32 meshesOffscreen;
+    Uint32 meshesOccluded;
+    // Meshes drawn in the frame, once however many dirty rectangles they are drawn in
+    Uint32 meshesDrawn;
+    Uint32 padding;
+    Uint64 dirtyPixels;
+    // Triangles of the meshes and streams that passed culling and went to the rasterizer, and points splatted.
+    // Per frame, counted once like the meshes
+    Uint64 triangles;
+    Uint64 points;
+    // Chunks of streamed meshes in memory, and what they are allowed
+    Uint64 streamedBytes;
+    Uint64 streamBudget;
+    // Sum of the triangles of every frame since the start
+    Uint64 totalTriangles;
+} TelemetryCounters;
+
+typedef struct
+{
+    Uint32 magic;
+    Uint32 version;
+    Uint32 pid;
+    // Odd while the counters are being written
+    _Atomic Uint32 sequence;
+    TelemetryCounters counters;
+} TelemetryBlock;
+
+/*Function prototypes*/
+TelemetryBlock* createTelemetry(const char* name);
+void publishTelemetry(TelemetryBlock* block, const TelemetryCounters* counters);
+void destroyTelemetry(TelemetryBlock* block, const char* name);
+const TelemetryBlock* attachTelemetry(const char* name);
+int readTelemetry(const TelemetryBlock* block, TelemetryCounters* counters);
+void detachTelemetry(const TelemetryBlock* block);
+
+#endif //TELEMETRY_H
@@ -0,0 +1,1185 @@
+//
+// Regression tests: fixed scenes rendered headless, compared against golden
+// images, and timed against a baseline
+//
+// Every scene is built in code, so the test does not depend on any asset. The
+// golden test draws it into a small framebuffer and compares the pixels with
+// tests/golden/<scene>.ppm, allowing a few pixels to differ slightly (other
+// compilers round differently along the edges). Some scenes are compared with
+// the golden image of another one instead, the compact meshes have to look
+// like the full size ones. The frame scene is drawn for several frames by the
+// frame loop of the renderer into a hidden window, so the golden image also
+// covers the task graph, the dirty rectangles and the canvas. The performance
+// test draws every scene at the size of the window many times and compares the
+// fastest frame time (the least disturbed by the rest of the machine) and the
+// triangles (and points) per second with the line of tests/baseline.txt for
+// the same scene and build configuration, failing if either got worse by more
+// than a threshold. A configuration without a baseline is skipped, numbers of
+// a debug build say nothing about a release build. "regress update" renders
+// every scene and rewrites the goldens and the baselines of one configuration.
+// The unit checks test one function each on cases the scenes do not reach
+//
+// Usage: regress golden <scene> <tests dir>
+//        regress perf <scene> <tests dir> <configuration> <threshold, 0.25 fails 25% slower>
+//        regress update <tests dir> <configuration>
+//        regress unit <check>
+//
+
+#include "camera.h"
+#include "capture.h"
+#include "compact.h"
+#include "engine.h"
+#include "frame.h"
+#include "light.h"
+#include "occlusion.h"
+#include "pointcloud.h"
+#include "protocol.h"
+#include "raster.h"
+#include "render.h"
+#include "scene.h"
+#include "server.h"
+#include "shadow.h"
+#include "skin.h"
+#include "texture.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Size of the golden images
+#define GOLDEN_WIDTH 160
+#define GOLDEN_HEIGHT 160
+// A pixel differs when one of its channels is further than this from the golden image
+#define GOLDEN_CHANNEL_TOLERANCE 8
+// Fraction of the pixels that may differ
+#define GOLDEN_PIXEL_TOLERANCE 0.005
+// Frames timed by a performance test, after the warm up ones
+#define PERF_FRAMES 15
+#define PERF_WARMUP 2
+// Returned when a test can not run, CTest reports it as skipped (SKIP_RETURN_CODE)
+#define SKIP 77
+#define PATH_LENGTH 512
+
+typedef struct
+{
+    const char* name;
+    // Samples per pixel of the framebuffer
+    int samples;
+    void (*build)(Engine* engine);
+    // Only the meshes that pass the occlusion test are drawn, which has to hide some of them without changing a pixel
+    int occlusion;
+    // Scene whose golden image this one is compared with, NULL for its own
+    const char* reference;
+    // Drawn through the frame loop of the renderer for this many frames instead of once with renderView
+    int frames;
+} Scene;
+
+typedef struct
+{
+    double ms;
+    double perSecond;
+} Timing;
+
+typedef struct
+{
+    const char* name;
+    // Returns 0 when the check passes
+    int (*run)(void);
+} UnitCheck;
+
+// Checkerboard of the cube, shared by every scene
+static Texture* checker = NULL;
+// Every scene is seen from here
+static const CameraPose defaultPose = {{0.0f, 0.0f, 0.0f}, 0.0f, 0.0f};
+// Unit cube, the boxes of the scenes are scaled from it
+static const Triangle unitCube[12] = {
+    {{{0, 0, 0}, {0, 1, 0}, {1, 1, 0}}}, {{{0, 0, 0}, {1, 1, 0}, {1, 0, 0}}},
+    {{{0, 0, 0}, {1, 0, 0}, {1, 0, 1}}}, {{{0, 0, 0}, {1, 0, 1}, {0, 0, 1}}},
+    {{{1, 0, 0}, {1, 1, 0}, {1, 1, 1}}}, {{{1, 0, 0}, {1, 1, 1}, {1, 0, 1}}},
+    {{{0, 0, 0}, {0, 0, 1}, {0, 1, 1}}}, {{{0, 0, 0}, {0, 1, 1}, {0, 1, 0}}},
+    {{{0, 1, 0}, {0, 1, 1}, {1, 1, 1}}}, {{{0, 1, 0}, {1, 1, 1}, {1, 1, 0}}},
+    {{{0, 0, 1}, {1, 0, 1}, {1, 1, 1}}}, {{{0, 0, 1}, {1, 1, 1}, {0, 1, 1}}}
+};
+
+/**
+ * Adds a prepared mesh to the engine, hanging from a node at a position
+ *
+ *  @param engine Engine to add it to
+ *  @param mesh Mesh, the engine owns it from now on
+ *  @param position Where it goes
+ *
+ *  @return Index of the mesh
+ */
+static int addSceneMesh(Engine* engine, const Mesh* mesh, const Vector* position)
+{
+    Mesh* meshes = realloc(engine->meshes, (engine->nMeshes + 1) * sizeof(Mesh));
+    if (meshes == NULL)
+    {
+        perror("[ERROR] ALLOCATING MEMORY FAILED!");
+        exit(1);
+    }
+    engine->meshes = meshes;
+    engine->meshes[engine->nMeshes] = *mesh;
+    const Matrix4x4 place = translationMatrix(position);
+    addNode(engine, -1, &place, engine->nMeshes);
+    return engine->nMeshes++;
+}
+
+/**
+ * Builds a mesh out of triangles
+ *
+ *  @param tris Triangles to copy
+ *  @param nTris Number of triangles
+ *  @param mesh Mesh to fill, prepared for drawing
+ *
+ *  @return void
+ */
+static void buildMesh(const Triangle* tris, int nTris, Mesh* mesh)
+{
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->nTris = nTris;
+    ALLOCATE(mesh->tris, nTris * sizeof(Triangle));
+    memcpy(mesh->tris, tris, nTris * sizeof(Triangle));
+    prepareMesh(mesh);
+}
+
+/**
+ * The scene of the renderer: a textured cube turned on its corner over a
+ * floor, lit by the same lights, casting its shadow
+ *
+ *  @return void
+ */
+static void buildCubeScene(Engine* engine)
+{
+    Mesh cube = {0};
+    cube.nTris = 12;
+    ALLOCATE(cube.tris, sizeof(unitCube));
+    memcpy(cube.tris, unitCube, sizeof(unitCube));
+    for (int i = 0; i < cube.nTris; i++)
+    {
+        const TexCoord first[3] = {{0, 0}, {0, 1}, {1, 1}};
+        const TexCoord second[3] = {{0, 0}, {1, 1}, {1, 0}};
+        memcpy(cube.tris[i].uv, i % 2 == 0 ? first : second, sizeof(first));
+    }
+    cube.texture = checker;
+    prepareMesh(&cube);
+    cube.shadowCaster = 1;
+    const Vector cubePosition = {0.0f, 0.0f, 3.0f};
+    const int index = addSceneMesh(engine, &cube, &cubePosition);
+    // Turned like the spinning cube a few frames in
+    const float a = 0.6f;
+    const Matrix4x4 turnX = {{{1, 0, 0, 0}, {0, cosf(a), -sinf(a), 0}, {0, sinf(a), cosf(a), 0}, {0, 0, 0, 1}}};
+    const Matrix4x4 turnZ = {{{cosf(a), -sinf(a), 0, 0}, {sinf(a), cosf(a), 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}}};
+    const Matrix4x4 turn = multMatMat(&turnX, &turnZ);
+    const Matrix4x4 turned = multMatMat(&turn, &engine->nodes[engine->meshes[index].node].local);
+    setNodeLocal(engine, engine->meshes[index].node, &turned);
+
+    const Triangle floorTris[2] = {
+        {{{-3, 2, 1}, {3, 2, 1}, {3, 2, 8}}},
+        {{{-3, 2, 1}, {3, 2, 8}, {-3, 2, 8}}}
+    };
+    Mesh floorMesh;
+    buildMesh(floorTris, 2, &floorMesh);
+    addSceneMesh(engine, &floorMesh, &(Vector){0.0f, 0.0f, 0.0f});
+
+    const Light ambient = {LIGHT_AMBIENT, {0}, {0}, 0.0f, 0.1f, 0.1f, 0.1f};
+    const Light sun = {LIGHT_DIRECTIONAL, {0.3f, 1.0f, 0.6f}, {0}, 0.0f, 0.8f, 0.8f, 0.8f, 1};
+    const Light lamp = {LIGHT_POINT, {0}, {2.0f, 1.5f, 2.0f}, 4.0f, 0.8f, 0.5f, 0.2f};
+    addLight(engine, &ambient);
+    addLight(engine, &sun);
+    addLight(engine, &lamp);
+}
+
+/**
+ * The cube scene in the wireframe view
+ *
+ *  @return void
+ */
+static void buildWireframeScene(Engine* engine)
+{
+    buildCubeScene(engine);
+    engine->wireframe = 1;
+}
+
+/**
+ * The cube scene behind a finely tessellated sphere, the scene the triangle
+ * throughput is measured on
+ *
+ *  @return void
+ */
+static void buildSphereScene(Engine* engine)
+{
+    buildCubeScene(engine);
+    const int rings = 64, sides = 128;
+    const float radius = 1.2f;
+    Triangle* tris;
+    ALLOCATE(tris, rings * sides * 2 * sizeof(Triangle));
+    int nTris = 0;
+    for (int r = 0; r < rings; r++)
+        for (int s = 0; s < sides; s++)
+        {
+            Vector p[2][2];
+            for (int i = 0; i < 2; i++)
+                for (int j = 0; j < 2; j++)
+                {
+                    const float polar = (float)M_PI * (r + i) / rings;
+                    const float around = 2.0f * (float)M_PI * (s + j) / sides;
+                    p[i][j] = (Vector){radius * sinf(polar) * cosf(around), -radius * cosf(polar),
+                                       radius * sinf(polar) * sinf(around)};
+                }
+            if (r > 0)
+                tris[nTris++] = (Triangle){{p[0][0], p[1][1], p[0][1]}};
+            if (r < rings - 1)
+                tris[nTris++] = (Triangle){{p[0][0], p[1][0], p[1][1]}};
+        }
+    Mesh sphere;
+    buildMesh(tris, nTris, &sphere);
+    sphere.shadowCaster = 1;
+    free(tris);
+    addSceneMesh(engine, &sphere, &(Vector){-1.2f, 0.3f, 5.0f});
+}
+
+/**
+ * The cube scene with a wall across the floor and boxes standing behind it,
+ * where nothing of them can be seen
+ *
+ *  @return void
+ */
+static void buildOcclusionScene(Engine* engine)
+{
+    buildCubeScene(engine);
+    Triangle tris[12];
+    const Vector wallSize = {6.0f, 3.5f, 0.2f};
+    for (int i = 0; i < 12; i++)
+        for (int k = 0; k < 3; k++)
+        {
+            const Vector* p = &unitCube[i].points[k];
+            tris[i].points[k] = (Vector){p->x * wallSize.x, p->y * wallSize.y, p->z * wallSize.z};
+        }
+    Mesh wall;
+    buildMesh(tris, 12, &wall);
+    wall.shadowCaster = 1;
+    addSceneMesh(engine, &wall, &(Vector){-3.0f, -1.5f, 5.5f});
+    for (int i = 0; i < 3; i++)
+    {
+        Mesh box;
+        buildMesh(unitCube, 12, &box);
+        addSceneMesh(engine, &box, &(Vector){-2.0f + 1.5f * i, 1.0f, 7.0f});
+    }
+}
+
+/**
+ * The sphere scene with every mesh in the compact storage, drawn like the
+ * full size one within the tolerance of the golden images
+ *
+ *  @return void
+ */
+static void buildCompactScene(Engine* engine)
+{
+    buildSphereScene(engine);
+    for (int i = 0; i < engine->nMeshes; i++)
+        compressMesh(&engine->meshes[i]);
+}
+
+/**
+ * Bends a skinned tube of addCharacters (a PoseFunction, see frame.h)
+ *
+ *  @param mesh Skinned mesh
+ *  @param time Animation time
+ *  @param phase Offset of the animation of this mesh
+ *
+ *  @return void
+ */
+static void bendCharacter(Mesh* mesh, float time, float phase)
+{
+    const float angle = 0.4f * sinf(time + phase);
+    const float c = cosf(angle), s = sinf(angle);
+    // The top bone turns around the middle of the tube
+    const Matrix4x4 bend = {{{c, -s, 0, 0}, {s, c, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}}};
+    const Matrix4x4 toJoint = translationMatrix(&(Vector){0.0f, 0.5f, 0.0f});
+    const Matrix4x4 fromJoint = translationMatrix(&(Vector){0.0f, -0.5f, 0.0f});
+    const Matrix4x4 turned = multMatMat(&toJoint, &bend);
+    mesh->skin->palette[1] = multMatMat(&turned, &fromJoint);
+    mesh->skin->dirty = 1;
+}
+
+/**
+ * Bends every skinned mesh of the engine, each a bit differently
+ *
+ *  @param engine Engine with the skinned meshes
+ *  @param time Animation time
+ *
+ *  @return void
+ */
+static void bendCharacters(Engine* engine, float time)
+{
+    for (int i = 0; i < engine->nMeshes; i++)
+        if (engine->meshes[i].skin != NULL)
+            bendCharacter(&engine->meshes[i], time, (float)i);
+}
+
+/**
+ * Adds rows of skinned tubes bent by two bones on the floor of the cube scene
+ *
+ *  @param engine Engine with the cube scene
+ *  @param count Number of tubes, 4 per row
+ *
+ *  @return void
+ */
+static void addCharacters(Engine* engine, int count)
+{
+    const int sides = 10, rings = 8;
+    Triangle* tris;
+    ALLOCATE(tris, rings * sides * 2 * sizeof(Triangle));
+    int nTris = 0;
+    for (int r = 0; r < rings; r++)
+        for (int s = 0; s < sides; s++)
+        {
+            const float a0 = 2.0f * (float)M_PI * s / sides, a1 = 2.0f * (float)M_PI * (s + 1) / sides;
+            const float y0 = -(float)r / rings, y1 = -(float)(r + 1) / rings;
+            const Vector p00 = {0.1f * cosf(a0), y0, 0.1f * sinf(a0)};
+            const Vector p01 = {0.1f * cosf(a1), y0, 0.1f * sinf(a1)};
+            const Vector p10 = {0.1f * cosf(a0), y1, 0.1f * sinf(a0)};
+            const Vector p11 = {0.1f * cosf(a1), y1, 0.1f * sinf(a1)};
+            tris[nTris++] = (Triangle){{p00, p11, p10}};
+            tris[nTris++] = (Triangle){{p00, p01, p11}};
+        }
+    Mesh tube;
+    buildMesh(tris, nTris, &tube);
+    free(tris);
+
+    // The bottom half follows the first bone, the top half the second, blended in between
+    Uint8* bones;
+    float* weights;
+    ALLOCATE(bones, tube.nVerts * SKIN_INFLUENCES * sizeof(Uint8));
+    ALLOCATE(weights, tube.nVerts * SKIN_INFLUENCES * sizeof(float));
+    memset(bones, 0, tube.nVerts * SKIN_INFLUENCES * sizeof(Uint8));
+    memset(weights, 0, tube.nVerts * SKIN_INFLUENCES * sizeof(float));
+    for (int v = 0; v < tube.nVerts; v++)
+    {
+        const float up = SDL_min(SDL_max((-tube.verts[v].y - 0.25f) * 2.0f, 0.0f), 1.0f);
+        bones[v * SKIN_INFLUENCES + 1] = 1;
+        weights[v * SKIN_INFLUENCES] = 1.0f - up;
+        weights[v * SKIN_INFLUENCES + 1] = up;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        Mesh mesh;
+        copyMesh(&tube, &mesh);
+        createSkin(&mesh, 2, bones, weights);
+        addSceneMesh(engine, &mesh, &(Vector){-2.0f + 4.0f * (i % 4) / 3.0f, 2.0f, 4.0f + (float)(i / 4)});
+    }
+    bendCharacters(engine, 0.0f);
+    free(bones);
+    free(weights);
+    freeMesh(&tube);
+}
+
+/**
+ * The floor of the cube scene with rows of skinned tubes bent by two bones
+ *
+ *  @return void
+ */
+static void buildCharacterScene(Engine* engine)
+{
+    buildCubeScene(engine);
+    addCharacters(engine, 16);
+}
+
+/**
+ * The cube scene set up like the renderer: the cube spins on a node of its
+ * own, which the frame loop turns every frame, a row of tubes bends (see
+ * bendCharacter) and the occluders are on
+ *
+ *  @return void
+ */
+static void buildFrameScene(Engine* engine)
+{
+    buildCubeScene(engine);
+    Mesh* cube = &engine->meshes[0];
+    const int pivot = cube->node;
+    const Matrix4x4 identity = translationMatrix(&(Vector){0.0f, 0.0f, 0.0f});
+    engine->nodes[pivot].mesh = -1;
+    cube->node = addNode(engine, pivot, &identity, 0);
+    engine->nodes[cube->node].spinning = 1;
+    addCharacters(engine, 4);
+    engine->nOccluders = OCCLUSION_DEFAULT_OCCLUDERS;
+}
+
+/**
+ * The cube scene behind a colored shell of points
+ *
+ *  @return void
+ */
+static void buildPointScene(Engine* engine)
+{
+    buildCubeScene(engine);
+    const int nPoints = 400000;
+    Vector* positions;
+    Uint32* colors;
+    ALLOCATE(positions, nPoints * sizeof(Vector));
+    ALLOCATE(colors, nPoints * sizeof(Uint32));
+    // Spiral over the sphere, the same points on every machine
+    for (int i = 0; i < nPoints; i++)
+    {
+        const float y = 1.0f - 2.0f * (i + 0.5f) / nPoints;
+        const float r = sqrtf(1.0f - y * y), around = 2.39996323f * i;
+        positions[i] = (Vector){r * cosf(around), y, r * sinf(around)};
+        colors[i] = 0xFF000000 | (Uint32)((positions[i].x + 1.0f) * 127.0f) << 16 |
+                    (Uint32)((y + 1.0f) * 127.0f) << 8 | (Uint32)((positions[i].z + 1.0f) * 127.0f);
+    }
+    ALLOCATE(engine->clouds, sizeof(PointCloud));
+    createPointCloud(&engine->clouds[0], nPoints, positions, colors);
+    free(positions);
+    free(colors);
+    const Matrix4x4 place = translationMatrix(&(Vector){0.5f, 0.0f, 5.0f});
+    engine->clouds[0].node = addNode(engine, -1, &place, -1);
+    engine->nClouds = 1;
+    engine->pointSize = 2;
+}
+
+static const Scene scenes[] = {
+    {"cube", 1, buildCubeScene},
+    {"msaa", 4, buildCubeScene},
+    {"wireframe", 1, buildWireframeScene},
+    {"sphere", 1, buildSphereScene},
+    {"characters", 1, buildCharacterScene},
+    {"points", 1, buildPointScene},
+    {"occlusion", 1, buildOcclusionScene, 1},
+    {"compact", 1, buildCompactScene, 0, "sphere"},
+    {"frame", 1, buildFrameScene, 0, NULL, 30}
+};
+
+/**
+ * Builds a scene into an empty engine, without a window, and settles it
+ *
+ *  @param scene Scene to build
+ *  @param engine Engine to build it into
+ *  @param shadow Shadow map to create and draw
+ *
+ *  @return void
+ */
+static void createScene(const Scene* scene, Engine* engine, ShadowMap* shadow)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->pointSize = 1;
+    scene->build(engine);
+    createShadowMap(shadow);
+    settleScene(engine, shadow);
+}
+
+/**
+ * Frees everything createScene made
+ *
+ *  @return void
+ */
+static void destroyScene(Engine* engine, ShadowMap* shadow)
+{
+    for (int i = 0; i < engine->nMeshes; i++)
+        freeMesh(&engine->meshes[i]);
+    free(engine->meshes);
+    for (int i = 0; i < engine->nClouds; i++)
+        freePointCloud(&engine->clouds[i]);
+    free(engine->clouds);
+    freeSceneGraph(engine);
+    freeShadowMap(shadow);
+}
+
+/**
+ * Picks the occluders of a scene and tests every mesh against them, the way
+ * the frames of the renderer do
+ *
+ *  @param engine Engine with the settled scene
+ *  @param visible Filled with the indices of the meshes that may be seen
+ *
+ *  @return Number of indices in visible
+ */
+static int cullScene(Engine* engine, int* visible)
+{
+    // The occlusion buffer follows the window
+    const Matrix4x4 view = viewMatrix(&defaultPose);
+    const Matrix4x4 proj = projectionMatrix(ASPECT_RATIO);
+    OcclusionBuffer buffer;
+    ALLOCATE(buffer.samples, OCCLUSION_SAMPLES_WIDTH * OCCLUSION_SAMPLES_HEIGHT * sizeof(float));
+    ALLOCATE(buffer.depth, OCCLUSION_WIDTH * OCCLUSION_HEIGHT * sizeof(float));
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        const Matrix4x4 modelView = multMatMat(&engine->meshes[i].world, &view);
+        engine->meshes[i].rect = meshScreenRect(&engine->meshes[i], &modelView, &proj);
+    }
+    selectOccluders(engine, OCCLUSION_DEFAULT_OCCLUDERS);
+    clearOcclusionBuffer(&buffer);
+    for (int i = 0; i < engine->nMeshes; i++)
+        if (engine->meshes[i].occluder)
+        {
+            const Matrix4x4 modelView = multMatMat(&engine->meshes[i].world, &view);
+            rasterizeOccluder(&buffer, &engine->meshes[i], &modelView, &proj);
+        }
+    resolveOcclusionBuffer(&buffer);
+    int count = 0;
+    for (int i = 0; i < engine->nMeshes; i++)
+    {
+        const Matrix4x4 modelView = multMatMat(&engine->meshes[i].world, &view);
+        if (engine->meshes[i].occluder || isMeshVisible(&buffer, &engine->meshes[i], &modelView, &proj))
+            visible[count++] = i;
+    }
+    free(buffer.samples);
+    free(buffer.depth);
+    return count;
+}
+
+/**
+ * Draws a scene from the default camera, only what passes the occlusion
+ * test for scenes that use it
+ *
+ *  @param scene Scene that was built
+ *  @param engine Engine with the scene
+ *  @param shadow Its shadow map
+ *  @param fb Framebuffer to draw into, the projection follows its size
+ *
+ *  @return void
+ */
+static void drawScene(const Scene* scene, Engine* engine, const ShadowMap* shadow, Framebuffer* fb)
+{
+    const Matrix4x4 proj = projectionMatrix((float)fb->height / fb->width);
+    int* visible = NULL;
+    int nVisible = 0;
+    if (scene->occlusion)
+    {
+        ALLOCATE(visible, SDL_max(1, engine->nMeshes) * sizeof(int));
+        nVisible = cullScene(engine, visible);
+    }
+    renderView(engine, &defaultPose, &proj, shadow->light >= 0 ? shadow : NULL, visible, nVisible, fb);
+    free(visible);
+}
+
+/**
+ * Reads a binary PPM (P6) image, as writeImage writes them
+ *
+ *  @param path File to read
+ *  @param width Width of the image, set on success
+ *  @param height Height of the image, set on success
+ *
+ *  @return ARGB8888 pixels to free, NULL if the file can not be read
+ */
+static Uint32* readPpm(const char* path, int* width, int* height)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    int maxValue = 0;
+    Uint32* pixels = NULL;
+    if (fscanf(file, "P6 %d %d %d", width, height, &maxValue) == 3 && maxValue == 255 && fgetc(file) != EOF &&
+        *width > 0 && *height > 0)
+    {
+        const int n = *width * *height;
+        Uint8* rgb;
+        ALLOCATE(rgb, n * 3);
+        if (fread(rgb, 3, n, file) == (size_t)n)
+        {
+            ALLOCATE(pixels, n * sizeof(Uint32));
+            for (int i = 0; i < n; i++)
+                pixels[i] = 0xFF000000 | (Uint32)rgb[i * 3] << 16 | (Uint32)rgb[i * 3 + 1] << 8 | rgb[i * 3 + 2];
+        }
+        free(rgb);
+    }
+    fclose(file);
+    return pixels;
+}
+
+/**
+ * Draws a scene through the frame loop of the renderer (see frame.h) into a
+ * hidden window: the task graph runs the stages, and every frame after the
+ * first only redraws its dirty rectangles straight into the canvas
+ *
+ *  @param scene Scene to draw, with its number of frames
+ *  @param engine Engine with the scene, without a window
+ *  @param pixels Output, WIDTH x HEIGHT ARGB8888 pixels the canvas shows after the last frame
+ *
+ *  @return 1 if the frames were drawn, 0 if there was no window to draw them in
+ */
+static int drawFrames(const Scene* scene, Engine* engine, Uint32* pixels)
+{
+    // No display is needed, the dummy driver keeps the window in memory
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+    if (SDL_Init(SDL_INIT_VIDEO) == 0)
+        engine->window = SDL_CreateWindow("regress", 0, 0, WIDTH, HEIGHT, SDL_WINDOW_HIDDEN);
+    if (engine->window != NULL)
+        engine->renderer = SDL_CreateRenderer(engine->window, -1, SDL_RENDERER_SOFTWARE);
+    if (engine->renderer != NULL)
+        engine->canvas = SDL_CreateTexture(engine->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                           WIDTH, HEIGHT);
+    int shown = 0;
+    if (engine->canvas != NULL)
+    {
+        createFramebuffer(&engine->fb, WIDTH, HEIGHT, scene->samples);
+        runFrameLoop(engine, NULL, NULL, scene->frames, NULL, NULL, NULL, NULL, bendCharacter);
+        shown = SDL_RenderCopy(engine->renderer, engine->canvas, NULL, NULL) == 0 &&
+                SDL_RenderReadPixels(engine->renderer, NULL, SDL_PIXELFORMAT_ARGB8888, pixels,
+                                     WIDTH * sizeof(Uint32)) == 0;
+        freeFramebuffer(&engine->fb);
+    }
+    if (!shown)
+        fprintf(stderr, "[ERROR] COULD NOT DRAW %s IN A WINDOW!\n[SDL] %s\n", scene->name, SDL_GetError());
+
+    if (engine->canvas != NULL)
+        SDL_DestroyTexture(engine->canvas);
+    if (engine->renderer != NULL)
+        SDL_DestroyRenderer(engine->renderer);
+    if (engine->window != NULL)
+        SDL_DestroyWindow(engine->window);
+    engine->canvas = NULL;
+    engine->renderer = NULL;
+    engine->window = NULL;
+    SDL_Quit();
+    return shown;
+}
+
+/**
+ * Scales the frames of a scene down to the size of the golden images (see
+ * drawFrames), every pixel the average of a block of the window
+ *
+ *  @param scene Scene to draw
+ *  @param engine Engine with the scene, without a window
+ *  @param fb Framebuffer to draw into
+ *
+ *  @return void
+ */
+static void shrinkFrames(const Scene* scene, Engine* engine, Framebuffer* fb)
+{
+    Uint32* pixels;
+    ALLOCATE(pixels, WIDTH * HEIGHT * sizeof(Uint32));
+    const int shown = drawFrames(scene, engine, pixels);
+    const int blockWidth = WIDTH / fb->width, blockHeight = HEIGHT / fb->height;
+    const Uint32 n = blockWidth * blockHeight;
+    for (int y = 0; y < fb->height; y++)
+        for (int x = 0; x < fb->width; x++)
+        {
+            Uint32 sum[3] = {0, 0, 0};
+            for (int by = 0; by < blockHeight && shown; by++)
+                for (int bx = 0; bx < blockWidth; bx++)
+                {
+                    const Uint32 pixel = pixels[(y * blockHeight + by) * WIDTH + x * blockWidth + bx];
+                    sum[0] += pixel >> 16 & 0xFF;
+                    sum[1] += pixel >> 8 & 0xFF;
+                    sum[2] += pixel & 0xFF;
+                }
+            fb->color[y * fb->width + x] = 0xFF000000 | (sum[0] + n / 2) / n << 16 | (sum[1] + n / 2) / n << 8 |
+                                           (sum[2] + n / 2) / n;
+        }
+    free(pixels);
+}
+
+/**
+ * Renders a scene at the size of the golden images
+ *
+ *  @param scene Scene to render
+ *  @param fb Framebuffer to create and draw into
+ *
+ *  @return void
+ */
+static void renderGolden(const Scene* scene, Framebuffer* fb)
+{
+    Engine engine;
+    ShadowMap shadow;
+    createScene(scene, &engine, &shadow);
+    createFramebuffer(fb, GOLDEN_WIDTH, GOLDEN_HEIGHT, scene->samples);
+    if (scene->frames > 0)
+        shrinkFrames(scene, &engine, fb);
+    else
+        drawScene(scene, &engine, &shadow, fb);
+    destroyScene(&engine, &shadow);
+}
+
+/**
+ * Checks that the occlusion test of a scene hides meshes that can not be
+ * seen anyway: the frame drawn with every mesh has to be the same
+ *
+ *  @param scene Scene to check
+ *
+ *  @return 0 if some meshes are hidden and no pixel changed, 1 otherwise
+ */
+static int checkOcclusion(const Scene* scene)
+{
+    Engine engine;
+    ShadowMap shadow;
+    createScene(scene, &engine, &shadow);
+    int* visible;
+    ALLOCATE(visible, SDL_max(1, engine.nMeshes) * sizeof(int));
+    const int hidden = engine.nMeshes - cullScene(&engine, visible);
+    free(visible);
+
+    Framebuffer culled, full;
+    createFramebuffer(&culled, GOLDEN_WIDTH, GOLDEN_HEIGHT, scene->samples);
+    createFramebuffer(&full, GOLDEN_WIDTH, GOLDEN_HEIGHT, scene->samples);
+    drawScene(scene, &engine, &shadow, &culled);
+    const Matrix4x4 proj = projectionMatrix((float)full.height / full.width);
+    renderView(&engine, &defaultPose, &proj, shadow.light >= 0 ? &shadow : NULL, NULL, 0, &full);
+    int changed = 0;
+    for (int i = 0; i < full.width * full.height; i++)
+        changed += culled.color[i] != full.color[i];
+    printf("[OCCLUSION] %s: %d of %d meshes hidden, %d pixels changed\n", scene->name, hidden, engine.nMeshes,
+           changed);
+    if (hidden == 0 || changed > 0)
+        fprintf(stderr, "[ERROR] THE OCCLUSION TEST OF %s %s!\n", scene->name,
+                hidden == 0 ? "HIDES NOTHING" : "HIDES MESHES THAT CAN BE SEEN");
+    freeFramebuffer(&culled);
+    freeFramebuffer(&full);
+    destroyScene(&engine, &shadow);
+    return hidden == 0 || changed > 0;
+}
+
+/**
+ * Checks that the frame loop leaves nothing behind: what the canvas shows
+ * after the frames, most of them only redrawing their dirty rectangles, has
+ * to be exactly what renderView draws from scratch for the scene as the last
+ * frame left it
+ *
+ *  @param scene Scene to check, with its number of frames
+ *
+ *  @return 0 if no pixel differs, 1 otherwise
+ */
+static int checkFrames(const Scene* scene)
+{
+    Engine engine;
+    ShadowMap shadow;
+    createScene(scene, &engine, &shadow);
+    Uint32* pixels;
+    ALLOCATE(pixels, WIDTH * HEIGHT * sizeof(Uint32));
+    const int shown = drawFrames(scene, &engine, pixels);
+
+    // The frames moved the casters since the shadow map was drawn
+    shadow.dirty = 1;
+    settleScene(&engine, &shadow);
+    Framebuffer full;
+    createFramebuffer(&full, WIDTH, HEIGHT, scene->samples);
+    drawScene(scene, &engine, &shadow, &full);
+    int changed = 0;
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+        changed += ((pixels[i] ^ full.color[i]) & 0xFFFFFF) != 0;
+    printf("[FRAMES] %s: %d pixels differ from the frame drawn from scratch\n", scene->name, changed);
+    if (shown && changed > 0)
+        fprintf(stderr, "[ERROR] THE FRAMES OF %s LEFT PIXELS BEHIND!\n", scene->name);
+    free(pixels);
+    freeFramebuffer(&full);
+    destroyScene(&engine, &shadow);
+    return !shown || changed > 0;
+}
+
+/**
+ * Renders a scene and compares it with its golden image, or the one of its
+ * reference scene. When they differ the frame is written next to the test
+ * as <scene>.actual.ppm
+ *
+ *  @param scene Scene to check
+ *  @param dir Directory of the tests
+ *
+ *  @return 0 if the images match, 1 if they do not
+ */
+static int checkGolden(const Scene* scene, const char* dir)
+{
+    char path[PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/golden/%s.ppm", dir, scene->reference != NULL ? scene->reference : scene->name);
+    int width, height;
+    Uint32* golden = readPpm(path, &width, &height);
+    if (golden == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT READ THE GOLDEN IMAGE %s, \"regress update\" writes it\n", path);
+        return 1;
+    }
+
+    Framebuffer fb;
+    renderGolden(scene, &fb);
+    int differ = 0, worst = 0;
+    // An image of another size differs everywhere
+    if (width != fb.width || height != fb.height)
+        differ = fb.width * fb.height;
+    for (int i = 0; i < fb.width * fb.height && width == fb.width && height == fb.height; i++)
+    {
+        int far = 0;
+        for (int shift = 0; shift < 24; shift += 8)
+            far = SDL_max(far, abs((int)(golden[i] >> shift & 0xFF) - (int)(fb.color[i] >> shift & 0xFF)));
+        worst = SDL_max(worst, far);
+        differ += far > GOLDEN_CHANNEL_TOLERANCE;
+    }
+    int failed = differ > (int)(GOLDEN_PIXEL_TOLERANCE * fb.width * fb.height);
+    printf("[GOLDEN] %s: %d of %d pixels differ, largest difference %d\n", scene->name, differ,
+           fb.width * fb.height, worst);
+    if (failed)
+    {
+        snprintf(path, sizeof(path), "%s.actual.ppm", scene->name);
+        if (writeImage(path, fb.color, fb.width, fb.height))
+            fprintf(stderr, "[ERROR] %s DOES NOT MATCH ITS GOLDEN IMAGE, THE FRAME IS IN %s\n", scene->name, path);
+    }
+    free(golden);
+    freeFramebuffer(&fb);
+    if (scene->occlusion)
+        failed = checkOcclusion(scene) || failed;
+    if (scene->frames > 0)
+        failed = checkFrames(scene) || failed;
+    return failed;
+}
+
+/**
+ * Times a scene at the size of the window. Every frame settles the scene
+ * (the characters are bent again, so skinning is timed too) and draws it
+ *
+ *  @param scene Scene to time
+ *
+ *  @return Fastest frame time and triangles plus points drawn per second
+ */
+static Timing timeScene(const Scene* scene)
+{
+    Engine engine;
+    ShadowMap shadow;
+    createScene(scene, &engine, &shadow);
+    Framebuffer fb;
+    createFramebuffer(&fb, WIDTH, HEIGHT, scene->samples);
+    double primitives = 0.0;
+    for (int i = 0; i < engine.nMeshes; i++)
+        primitives += engine.meshes[i].nTris;
+    for (int i = 0; i < engine.nClouds; i++)
+        primitives += engine.clouds[i].nPoints;
+
+    double fastest = INFINITY;
+    for (int f = -PERF_WARMUP; f < PERF_FRAMES; f++)
+    {
+        const Uint64 begin = SDL_GetPerformanceCounter();
+        bendCharacters(&engine, 0.1f * f);
+        settleScene(&engine, &shadow);
+        drawScene(scene, &engine, &shadow, &fb);
+        if (f >= 0)
+            fastest = fmin(fastest, (double)(SDL_GetPerformanceCounter() - begin) * 1000.0 /
+                                    (double)SDL_GetPerformanceFrequency());
+    }
+    const Timing timing = {fastest, primitives * 1000.0 / fmax(fastest, 1e-6)};
+    freeFramebuffer(&fb);
+    destroyScene(&engine, &shadow);
+    return timing;
+}
+
+/**
+ * Reads the baseline of a scene in a configuration. Every line of the file
+ * is "<scene> <configuration> <ms per frame> <per second>", # comments
+ *
+ *  @param path Baseline file
+ *  @param scene Name of the scene
+ *  @param config Build configuration
+ *  @param timing Set to the baseline when it is found
+ *
+ *  @return 1 if the baseline was found, 0 otherwise
+ */
+static int readBaseline(const char* path, const char* scene, const char* config, Timing* timing)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+    char line[PATH_LENGTH], name[64], configuration[64];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), file) != NULL)
+        found = line[0] != '#' &&
+                sscanf(line, "%63s %63s %lf %lf", name, configuration, &timing->ms, &timing->perSecond) == 4 &&
+                strcmp(name, scene) == 0 && strcmp(configuration, config) == 0;
+    fclose(file);
+    return found;
+}
+
+/**
+ * Times a scene and compares it with its baseline
+ *
+ *  @param scene Scene to time
+ *  @param dir Directory of the tests
+ *  @param config Build configuration
+ *  @param threshold Fraction the frame time may grow by (and the throughput shrink by)
+ *
+ *  @return 0 if it is not slower, 1 if it is, SKIP without a baseline for the configuration
+ */
+static int checkPerformance(const Scene* scene, const char* dir, const char* config, double threshold)
+{
+    char path[PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/baseline.txt", dir);
+    Timing baseline;
+    if (!readBaseline(path, scene->name, config, &baseline))
+    {
+        printf("[PERF] %s: no baseline for the %s configuration, \"regress update\" records one\n", scene->name,
+               config);
+        return SKIP;
+    }
+
+    const Timing timing = timeScene(scene);
+    const int slower = timing.ms > baseline.ms * (1.0 + threshold);
+    const int fewer = timing.perSecond < baseline.perSecond / (1.0 + threshold);
+    printf("[PERF] %s: %.2f ms per frame (baseline %.2f), %.0f primitives per second (baseline %.0f)\n",
+           scene->name, timing.ms, baseline.ms, timing.perSecond, baseline.perSecond);
+    if (slower || fewer)
+        fprintf(stderr, "[ERROR] %s IS MORE THAN %.0f%% SLOWER THAN ITS BASELINE\n", scene->name, threshold * 100.0);
+    return slower || fewer;
+}
+
+/**
+ * Renders every golden image again and times every scene, replacing the
+ * baselines of one configuration and keeping the others
+ *
+ *  @param dir Directory of the tests
+ *  @param config Build configuration
+ *
+ *  @return 0 on success, 1 on failure
+ */
+static int update(const char* dir, const char* config)
+{
+    const int nScenes = sizeof(scenes) / sizeof(scenes[0]);
+    char path[PATH_LENGTH];
+    for (int s = 0; s < nScenes; s++)
+    {
+        if (scenes[s].reference != NULL)
+            continue;
+        Framebuffer fb;
+        renderGolden(&scenes[s], &fb);
+        snprintf(path, sizeof(path), "%s/golden/%s.ppm", dir, scenes[s].name);
+        const int written = writeImage(path, fb.color, fb.width, fb.height);
+        freeFramebuffer(&fb);
+        if (!written)
+            return 1;
+        printf("[GOLDEN] %s written\n", path);
+    }
+
+    // Lines of the other configurations stay as they are
+    snprintf(path, sizeof(path), "%s/baseline.txt", dir);
+    char* kept = NULL;
+    size_t length = 0;
+    FILE* file = fopen(path, "r");
+    char line[PATH_LENGTH], name[64], configuration[64];
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] != '#' && sscanf(line, "%63s %63s", name, configuration) == 2 &&
+            strcmp(configuration, config) == 0)
+            continue;
+        char* grown = realloc(kept, length + strlen(line) + 1);
+        if (grown == NULL)
+            break;
+        kept = grown;
+        strcpy(kept + length, line);
+        length += strlen(line);
+    }
+    if (file != NULL)
+        fclose(file);
+
+    file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT WRITE %s!\n", path);
+        free(kept);
+        return 1;
+    }
+    if (kept != NULL)
+        fputs(kept, file);
+    else
+        fputs("# scene configuration ms-per-frame primitives-per-second\n", file);
+    for (int s = 0; s < nScenes; s++)
+    {
+        const Timing timing = timeScene(&scenes[s]);
+        fprintf(file, "%s %s %.3f %.0f\n", scenes[s].name, config, timing.ms, timing.perSecond);
+        printf("[PERF] %s: %.2f ms per frame, %.0f primitives per second\n", scenes[s].name, timing.ms,
+               timing.perSecond);
+    }
+    fclose(file);
+    free(kept);
+    return 0;
+}
+
+/**
+ * Lights vertices whose normals have no length, as faces without an area
+ * leave them. Every count from 1 to 8 vertices is lit, so they go through
+ * both the batches of 4 and the scalar tail: only the ambient light may reach
+ * them, and nothing may turn into NaN
+ *
+ *  @return 0 if the light is right, 1 otherwise
+ */
+static int checkZeroNormals(void)
+{
+    const Light lights[3] = {
+        {LIGHT_AMBIENT, {0}, {0}, 0.0f, 0.1f, 0.2f, 0.3f},
+        {LIGHT_DIRECTIONAL, {0.0f, 0.0f, 1.0f}, {0}, 0.0f, 0.8f, 0.8f, 0.8f, 1},
+        {LIGHT_POINT, {0}, {0.0f, 0.0f, 1.0f}, 4.0f, 0.8f, 0.5f, 0.2f}
+    };
+    const Vector positions[8] = {{0}}, normals[8] = {{0}};
+    float rgb[8 * 3], shadowRgb[8 * 3];
+    int wrong = 0;
+    for (int n = 1; n <= 8; n++)
+    {
+        shadeVertices(positions, normals, n, lights, 3, 1, rgb, shadowRgb);
+        // Written so that NaN counts as wrong
+        for (int v = 0; v < n; v++)
+            wrong += !(fabsf(rgb[v * 3] - lights[0].r) < 1e-6f && fabsf(rgb[v * 3 + 1] - lights[0].g) < 1e-6f &&
+                       fabsf(rgb[v * 3 + 2] - lights[0].b) < 1e-6f && fabsf(shadowRgb[v * 3]) < 1e-6f &&
+                       fabsf(shadowRgb[v * 3 + 1]) < 1e-6f && fabsf(shadowRgb[v * 3 + 2]) < 1e-6f);
+    }
+    printf("[UNIT] normals: %d of 36 vertices with a zero normal lit wrong\n", wrong);
+    if (wrong > 0)
+        fprintf(stderr, "[ERROR] VERTICES WITH A ZERO NORMAL GET MORE THAN THE AMBIENT LIGHT!\n");
+    return wrong > 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+typedef struct
+{
+    Engine* engine;
+    const char* path;
+} ServerThread;
+
+/**
+ * Runs the render server of checkStalledClient
+ *
+ *  @return 1 after a shutdown request, 0 if the server could not start
+ */
+static int runServerThread(void* data)
+{
+    const ServerThread* thread = data;
+    return runRenderServer(thread->engine, NULL, thread->path);
+}
+
+/**
+ * Connects to the render server of checkStalledClient, waiting for it to
+ * listen. Reads give up after 5 seconds, so a stalled server fails the check
+ * instead of hanging it
+ *
+ *  @return The socket, -1 on failure
+ */
+static int connectServer(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    const struct timeval timeout = {5, 0};
+    for (int attempt = 0; attempt < 500; attempt++)
+    {
+        const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection >= 0 && connect(connection, (struct sockaddr*)&address, sizeof(address)) == 0)
+        {
+            setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return connection;
+        }
+        if (connection >= 0)
+            close(connection);
+        SDL_Delay(10);
+    }
+    return -1;
+}
+
+/**
+ * Serves the cube scene, has one client send half a request and stop, then
+ * asks for a frame with a second one. The server has to drop the stalled
+ * client and answer the second one, which finally stops it
+ *
+ *  @return 0 if the second client got its frame, 1 otherwise
+ */
+static int checkStalledClient(void)
+{
+    Engine engine;
+    ShadowMap shadow;
+    createScene(&scenes[0], &engine, &shadow);
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/regress-%d.sock", (int)getpid());
+    ServerThread data = {&engine, path};
+    SDL_Thread* thread = SDL_CreateThread(runServerThread, "server", &data);
+
+    RenderRequest request;
+    memset(&request, 0, sizeof(request));
+    request.magic = RENDER_MAGIC;
+    request.command = RENDER_FRAME;
+    request.pose = defaultPose;
+    request.width = request.height = 64;
+    RenderResponse response;
+    memset(&response, 0, sizeof(response));
+
+    // The server is already reading the stalled request when the second client connects
+    const int stalled = connectServer(path);
+    const int waiting = stalled >= 0 ? connectServer(path) : -1;
+    int served = 0;
+    if (waiting >= 0 && sendMessage(stalled, &request, sizeof(request) / 2))
+    {
+        SDL_Delay(SERVER_CLIENT_TIMEOUT_MS / 4);
+        served = sendMessage(waiting, &request, sizeof(request)) &&
+                 receiveMessage(waiting, &response, sizeof(response)) > 0 && response.status == RENDER_OK &&
+                 response.width == 64 && response.height == 64;
+    }
+    request.command = RENDER_SHUTDOWN;
+    const int stopped = served && sendMessage(waiting, &request, sizeof(request)) &&
+                        receiveMessage(waiting, &response, sizeof(response)) > 0;
+    if (stalled >= 0)
+        close(stalled);
+    if (waiting >= 0)
+        close(waiting);
+    printf("[UNIT] server: the second client %s\n", served ? "got its frame" : "was not served");
+    if (!stopped)
+    {
+        // The server thread is stuck, the process exits with it
+        fprintf(stderr, "[ERROR] A CLIENT THAT STALLED BLOCKED THE RENDER SERVER!\n");
+        return 1;
+    }
+    SDL_WaitThread(thread, NULL);
+    destroyScene(&engine, &shadow);
+    return 0;
+}
+
+#else
+
+static int checkStalledClient(void)
+{
+    printf("[UNIT] server: skipped, the render server needs a Unix system\n");
+    return 0;
+}
+
+#endif
+
+static const UnitCheck unitChecks[] = {
+    {"normals", checkZeroNormals},
+    {"server", checkStalledClient}
+};
+
+int main(int argc, char* argv[])
+{
+    Uint32 pixels[64 * 64];
+    for (int y = 0; y < 64; y++)
+        for (int x = 0; x < 64; x++)
+            pixels[y * 64 + x] = (x / 8 + y / 8) % 2 ? 0xFFFFFFFF : 0xFF3050C0;
+    checker = createTexture(pixels, 64, 64);
+
+    const Scene* scene = NULL;
+    for (int s = 0; argc > 2 && s < (int)(sizeof(scenes) / sizeof(scenes[0])); s++)
+        if (strcmp(argv[2], scenes[s].name) == 0)
+            scene = &scenes[s];
+    const UnitCheck* check = NULL;
+    for (int c = 0; argc > 2 && c < (int)(sizeof(unitChecks) / sizeof(unitChecks[0])); c++)
+        if (strcmp(argv[2], unitChecks[c].name) == 0)
+            check = &unitChecks[c];
+    // An empty configuration is a build without CMAKE_BUILD_TYPE
+    const char* config = argc > 4 && argv[4][0] != '\0' ? argv[4] : "None";
+
+    int status = 2;
+    if (argc == 4 && strcmp(argv[1], "update") == 0)
+        status = update(argv[2], argv[3][0] != '\0' ? argv[3] : "None");
+    else if (argc == 4 && strcmp(argv[1], "golden") == 0 && scene != NULL)
+        status = checkGolden(scene, argv[3]);
+    else if (argc == 6 && strcmp(argv[1], "perf") == 0 && scene != NULL)
+        status = checkPerformance(scene, argv[3], config, atof(argv[5]));
+    else if (argc == 3 && strcmp(argv[1], "unit") == 0 && check != NULL)
+        status = check->run();
+    else
+        fprintf(stderr, "Usage: %s golden <scene> <tests dir>\n"
+                        "       %s perf <scene> <tests dir> <configuration> <threshold>\n"
+                        "       %s update <tests dir> <configuration>\n"
+                        "       %s unit <check>\n", argv[0], argv[0], argv[0], argv[0]);
+    freeTexture(checker);
+    return status;
+}
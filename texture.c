@@ -0,0 +1,194 @@
+//
+// Mipmapped textures stored in cache friendly tiles
+//
+
+#include "texture.h"
+#include <math.h>
+#include <stdio.h>
+
+/**
+ * Position of a texel inside a tiled mip level. Tiles of 4x4 texels are
+ * stored one after the other, row by row, so texels that are close on the
+ * texture are also close in memory
+ *
+ *  @param x Column of the texel
+ *  @param y Row of the texel
+ *  @param width Width of the mip level
+ *
+ *  @return Index of the texel in the level
+ */
+static int tiledIndex(int x, int y, int width)
+{
+    const int tilesX = (width + TEXTURE_TILE - 1) / TEXTURE_TILE;
+    return ((y / TEXTURE_TILE * tilesX + x / TEXTURE_TILE) * TEXTURE_TILE + y % TEXTURE_TILE) * TEXTURE_TILE +
+           x % TEXTURE_TILE;
+}
+
+/**
+ * Number of texels a tiled mip level takes, including the padding of the
+ * tiles on the right and bottom borders
+ *
+ *  @param width Width of the mip level
+ *  @param height Height of the mip level
+ *
+ *  @return Number of texels
+ */
+static int tiledSize(int width, int height)
+{
+    return ((width + TEXTURE_TILE - 1) / TEXTURE_TILE) * ((height + TEXTURE_TILE - 1) / TEXTURE_TILE) *
+           TEXTURE_TILE * TEXTURE_TILE;
+}
+
+/**
+ * Creates a texture out of ARGB8888 pixels and generates its whole mip chain
+ * with a box filter
+ *
+ *  @param pixels width * height pixels, row by row
+ *  @param width Width of the texture, a power of two
+ *  @param height Height of the texture, a power of two
+ *
+ *  @return The texture, NULL if the size is not supported
+ */
+Texture* createTexture(const Uint32* pixels, int width, int height)
+{
+    if (width <= 0 || height <= 0 || (width & (width - 1)) || (height & (height - 1)) ||
+        width > (1 << (TEXTURE_MAX_LEVELS - 1)) || height > (1 << (TEXTURE_MAX_LEVELS - 1)))
+    {
+        fprintf(stderr, "[ERROR] TEXTURES NEED POWER OF TWO SIZES (GOT %dx%d)!\n", width, height);
+        return NULL;
+    }
+
+    Texture* texture;
+    ALLOCATE(texture, sizeof(Texture));
+    texture->width = width;
+    texture->height = height;
+    texture->nLevels = 0;
+
+    // Level 0 is a tiled copy of the pixels
+    ALLOCATE(texture->levels[0], tiledSize(width, height) * sizeof(Uint32));
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            texture->levels[0][tiledIndex(x, y, width)] = pixels[y * width + x];
+    texture->nLevels = 1;
+
+    // Every other level averages 2x2 texels of the one before it
+    int w = width, h = height;
+    while (w > 1 || h > 1)
+    {
+        const Uint32* src = texture->levels[texture->nLevels - 1];
+        const int sw = w, sh = h;
+        w = SDL_max(1, w / 2);
+        h = SDL_max(1, h / 2);
+        Uint32* dst;
+        ALLOCATE(dst, tiledSize(w, h) * sizeof(Uint32));
+
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+            {
+                const int x0 = SDL_min(x * 2, sw - 1), x1 = SDL_min(x * 2 + 1, sw - 1);
+                const int y0 = SDL_min(y * 2, sh - 1), y1 = SDL_min(y * 2 + 1, sh - 1);
+                const Uint32 t[4] = {
+                    src[tiledIndex(x0, y0, sw)], src[tiledIndex(x1, y0, sw)],
+                    src[tiledIndex(x0, y1, sw)], src[tiledIndex(x1, y1, sw)]
+                };
+                Uint32 texel = 0;
+                for (int shift = 0; shift < 32; shift += 8)
+                {
+                    const Uint32 sum = ((t[0] >> shift) & 0xFF) + ((t[1] >> shift) & 0xFF) +
+                                       ((t[2] >> shift) & 0xFF) + ((t[3] >> shift) & 0xFF);
+                    texel |= ((sum + 2) / 4) << shift;
+                }
+                dst[tiledIndex(x, y, w)] = texel;
+            }
+        texture->levels[texture->nLevels++] = dst;
+    }
+    return texture;
+}
+
+/**
+ * Loads a BMP file into a texture
+ *
+ *  @param path Path of the image
+ *
+ *  @return The texture, NULL if it could not be loaded
+ */
+Texture* loadTexture(const char* path)
+{
+    SDL_Surface* loaded = SDL_LoadBMP(path);
+    if (loaded == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT LOAD TEXTURE %s! \n[SDL] %s\n", path, SDL_GetError());
+        return NULL;
+    }
+    SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+    if (surface == NULL)
+    {
+        fprintf(stderr, "[ERROR] COULD NOT CONVERT TEXTURE %s! \n[SDL] %s\n", path, SDL_GetError());
+        return NULL;
+    }
+
+    // Rows of a surface can be padded, copy them into a tight array first
+    Uint32* pixels;
+    ALLOCATE(pixels, surface->w * surface->h * sizeof(Uint32));
+    for (int y = 0; y < surface->h; y++)
+        memcpy(&pixels[y * surface->w], (const Uint8*)surface->pixels + y * surface->pitch, surface->w * sizeof(Uint32));
+
+    Texture* texture = createTexture(pixels, surface->w, surface->h);
+    free(pixels);
+    SDL_FreeSurface(surface);
+    return texture;
+}
+
+/**
+ * Frees a texture and its mip chain
+ *
+ *  @param texture Texture to free, can be NULL
+ *
+ *  @return void
+ */
+void freeTexture(Texture* texture)
+{
+    if (texture == NULL)
+        return;
+    for (int i = 0; i < texture->nLevels; i++)
+        free(texture->levels[i]);
+    free(texture);
+}
+
+/**
+ * Samples a texture with bilinear filtering on the mip level picked by _lod_.
+ * Coordinates wrap around, so the texture repeats
+ *
+ *  @param texture Texture to sample
+ *  @param u Horizontal coordinate, 0 to 1 covers the texture once
+ *  @param v Vertical coordinate, 0 to 1 covers the texture once
+ *  @param lod log2 of the texels covered by a pixel, 0 or less is level 0
+ *
+ *  @return Filtered ARGB8888 color
+ */
+Uint32 sampleTexture(const Texture* texture, float u, float v, float lod)
+{
+    const int level = SDL_min(texture->nLevels - 1, SDL_max(0, (int)lod));
+    const int w = SDL_max(1, texture->width >> level), h = SDL_max(1, texture->height >> level);
+    const Uint32* texels = texture->levels[level];
+
+    // Texel centers are at half coordinates
+    const float fx = u * w - 0.5f, fy = v * h - 0.5f;
+    const float flx = floorf(fx), fly = floorf(fy);
+    const int x0 = (int)flx & (w - 1), y0 = (int)fly & (h - 1);
+    const int x1 = (x0 + 1) & (w - 1), y1 = (y0 + 1) & (h - 1);
+    // Weights in 1/256ths so the blend stays in integers
+    const Uint32 ax = (Uint32)((fx - flx) * 256.0f), ay = (Uint32)((fy - fly) * 256.0f);
+
+    const Uint32 t00 = texels[tiledIndex(x0, y0, w)], t10 = texels[tiledIndex(x1, y0, w)];
+    const Uint32 t01 = texels[tiledIndex(x0, y1, w)], t11 = texels[tiledIndex(x1, y1, w)];
+    Uint32 color = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        const Uint32 top = ((t00 >> shift) & 0xFF) * (256 - ax) + ((t10 >> shift) & 0xFF) * ax;
+        const Uint32 bottom = ((t01 >> shift) & 0xFF) * (256 - ax) + ((t11 >> shift) & 0xFF) * ax;
+        color |= ((top * (256 - ay) + bottom * ay) >> 16) << shift;
+    }
+    return color;
+}
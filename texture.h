@@ -0,0 +1,19 @@
+//
+// Mipmapped textures stored in cache friendly tiles
+//
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "engine.h"
+
+// Texels are grouped in 4x4 tiles, 64 bytes each
+#define TEXTURE_TILE 4
+
+/*Function prototypes*/
+Texture* createTexture(const Uint32* pixels, int width, int height);
+Texture* loadTexture(const char* path);
+void freeTexture(Texture* texture);
+Uint32 sampleTexture(const Texture* texture, float u, float v, float lod);
+
+#endif //TEXTURE_H
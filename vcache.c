@@ -0,0 +1,219 @@
+//
+// Load time reordering of indexed meshes for vertex reuse
+//
+
+#include "vcache.h"
+
+/**
+ * Average cache miss ratio: how many vertices have to be transformed per
+ * triangle when the index buffer goes through a FIFO cache of _cacheSize_.
+ * 0.5 is the best a big regular mesh can get, 3 means no reuse at all
+ *
+ *  @param indices 3 indices per triangle
+ *  @param nTris Number of triangles
+ *  @param nVerts Number of vertices the indices point to
+ *  @param cacheSize Number of entries of the simulated cache
+ *
+ *  @return Misses per triangle
+ */
+float computeACMR(const int* indices, int nTris, int nVerts, int cacheSize)
+{
+    if (nTris == 0)
+        return 0.0f;
+
+    // A vertex is in the cache if it was inserted less than cacheSize misses ago
+    int* insertedAt;
+    ALLOCATE(insertedAt, (nVerts + 1) * sizeof(int));
+    for (int i = 0; i < nVerts; i++)
+        insertedAt[i] = -cacheSize - 1;
+
+    int misses = 0;
+    for (int i = 0; i < nTris * 3; i++)
+    {
+        if (misses - insertedAt[indices[i]] > cacheSize)
+            insertedAt[indices[i]] = misses++;
+    }
+    free(insertedAt);
+    return (float)misses / nTris;
+}
+
+/**
+ * Picks the next fanning vertex for Tipsify: the vertex of the last triangles
+ * that is still in the cache and will stay there after its remaining
+ * triangles are emitted, preferring the oldest one. Falls back to the recently
+ * used vertices, then to any vertex with triangles left
+ *
+ *  @return Next vertex or -1 when every triangle has been emitted
+ */
+static int nextFanVertex(const int* candidates, int nCandidates, const int* live, const int* cacheTime, int time,
+                         const int* deadEnd, int* nDeadEnd, int* cursor, int nVerts)
+{
+    int best = -1, bestPriority = -1;
+    for (int i = 0; i < nCandidates; i++)
+    {
+        const int v = candidates[i];
+        if (live[v] == 0)
+            continue;
+        int priority = 0;
+        if (time - cacheTime[v] + 2 * live[v] <= VERTEX_CACHE_SIZE)
+            priority = time - cacheTime[v];
+        if (priority > bestPriority)
+        {
+            best = v;
+            bestPriority = priority;
+        }
+    }
+    if (best != -1)
+        return best;
+
+    // Dead end, go back to a recently used vertex
+    while (*nDeadEnd > 0)
+    {
+        const int v = deadEnd[--(*nDeadEnd)];
+        if (live[v] > 0)
+            return v;
+    }
+    // Nothing recent, take the next vertex in input order
+    while (*cursor < nVerts)
+    {
+        const int v = (*cursor)++;
+        if (live[v] > 0)
+            return v;
+    }
+    return -1;
+}
+
+/**
+ * Reorders the triangles of an indexed mesh so vertices get reused while they
+ * are still hot, using Tipsify (Sander, Nehab and Barczak, 2007): triangles are
+ * emitted in fans around vertices that are chosen to stay in the cache
+ *
+ *  @param mesh Indexed mesh to reorder
+ *
+ *  @return void
+ */
+void optimizeVertexCache(Mesh* mesh)
+{
+    const int nVerts = mesh->nVerts, nTris = mesh->nTris;
+    if (nTris == 0)
+        return;
+
+    // Triangles using each vertex, as offsets into one flat array
+    int *offsets, *adjacency, *live, *cacheTime, *deadEnd, *candidates, *result;
+    Uint8* emitted;
+    ALLOCATE(offsets, (nVerts + 1) * sizeof(int));
+    ALLOCATE(adjacency, nTris * 3 * sizeof(int));
+    ALLOCATE(live, (nVerts + 1) * sizeof(int));
+    ALLOCATE(cacheTime, (nVerts + 1) * sizeof(int));
+    ALLOCATE(deadEnd, nTris * 3 * sizeof(int));
+    ALLOCATE(result, nTris * 3 * sizeof(int));
+    ALLOCATE(emitted, nTris);
+    memset(live, 0, nVerts * sizeof(int));
+    memset(cacheTime, 0, nVerts * sizeof(int));
+    memset(emitted, 0, nTris);
+
+    for (int i = 0; i < nTris * 3; i++)
+        live[mesh->indices[i]]++;
+    offsets[0] = 0;
+    for (int v = 0; v < nVerts; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+    // Fill the adjacency using cacheTime as a temporary fill counter
+    for (int i = 0; i < nTris * 3; i++)
+    {
+        const int v = mesh->indices[i];
+        adjacency[offsets[v] + cacheTime[v]++] = i / 3;
+    }
+    memset(cacheTime, 0, nVerts * sizeof(int));
+
+    // The vertices of the triangles emitted around one fan vertex, at most 3 per triangle
+    int maxFan = 0;
+    for (int v = 0; v < nVerts; v++)
+        maxFan = SDL_max(maxFan, live[v]);
+    ALLOCATE(candidates, (maxFan * 3 + 1) * sizeof(int));
+
+    int time = VERTEX_CACHE_SIZE + 1, cursor = 1, nDeadEnd = 0, nResult = 0;
+    int fan = 0;
+    while (fan >= 0)
+    {
+        int nCandidates = 0;
+        for (int a = offsets[fan]; a < offsets[fan + 1]; a++)
+        {
+            const int t = adjacency[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            for (int k = 0; k < 3; k++)
+            {
+                const int v = mesh->indices[t * 3 + k];
+                result[nResult++] = v;
+                deadEnd[nDeadEnd++] = v;
+                candidates[nCandidates++] = v;
+                live[v]--;
+                // Only a miss puts the vertex (back) in the cache
+                if (time - cacheTime[v] > VERTEX_CACHE_SIZE)
+                    cacheTime[v] = time++;
+            }
+        }
+        fan = nextFanVertex(candidates, nCandidates, live, cacheTime, time, deadEnd, &nDeadEnd, &cursor, nVerts);
+    }
+
+    memcpy(mesh->indices, result, nTris * 3 * sizeof(int));
+    free(offsets);
+    free(adjacency);
+    free(live);
+    free(cacheTime);
+    free(deadEnd);
+    free(candidates);
+    free(result);
+    free(emitted);
+}
+
+/**
+ * Reorders the vertex array so vertices are stored in the order the index
+ * buffer first uses them, which makes fetching them close to sequential.
+ * Vertices no triangle uses are dropped
+ *
+ *  @param mesh Indexed mesh to reorder, after optimizeVertexCache
+ *
+ *  @return void
+ */
+void optimizeVertexFetch(Mesh* mesh)
+{
+    int* remap;
+    Vector* verts;
+    TexCoord* uvs = NULL;
+    Vector* normals = NULL;
+    ALLOCATE(remap, (mesh->nVerts + 1) * sizeof(int));
+    ALLOCATE(verts, (mesh->nVerts + 1) * sizeof(Vector));
+    if (mesh->normals != NULL)
+        ALLOCATE(normals, (mesh->nVerts + 1) * sizeof(Vector));
+    if (mesh->uvs != NULL)
+        ALLOCATE(uvs, (mesh->nVerts + 1) * sizeof(TexCoord));
+    for (int v = 0; v < mesh->nVerts; v++)
+        remap[v] = -1;
+
+    int nVerts = 0;
+    for (int i = 0; i < mesh->nTris * 3; i++)
+    {
+        const int v = mesh->indices[i];
+        if (remap[v] < 0)
+        {
+            remap[v] = nVerts;
+            if (uvs != NULL)
+                uvs[nVerts] = mesh->uvs[v];
+            if (normals != NULL)
+                normals[nVerts] = mesh->normals[v];
+            verts[nVerts++] = mesh->verts[v];
+        }
+        mesh->indices[i] = remap[v];
+    }
+
+    free(mesh->verts);
+    free(mesh->uvs);
+    free(mesh->normals);
+    free(remap);
+    mesh->verts = verts;
+    mesh->uvs = uvs;
+    mesh->normals = normals;
+    mesh->nVerts = nVerts;
+}
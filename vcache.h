@@ -0,0 +1,18 @@
+//
+// Load time reordering of indexed meshes for vertex reuse
+//
+
+#ifndef VCACHE_H
+#define VCACHE_H
+
+#include "engine.h"
+
+// Size of the FIFO cache the triangle order is tuned for and the ACMR is measured with
+#define VERTEX_CACHE_SIZE 16
+
+/*Function prototypes*/
+float computeACMR(const int* indices, int nTris, int nVerts, int cacheSize);
+void optimizeVertexCache(Mesh* mesh);
+void optimizeVertexFetch(Mesh* mesh);
+
+#endif //VCACHE_H
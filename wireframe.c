@@ -0,0 +1,152 @@
+//
+// Wireframe view drawn from the unique edges of every mesh
+//
+// Drawing the outline of every triangle draws each shared edge twice. The
+// edges are instead collected once when the mesh is prepared, and every
+// frame each vertex is projected once and each edge drawn once by the CPU
+// line rasterizer
+//
+
+#include "wireframe.h"
+#include "compact.h"
+#include "raster.h"
+#include <string.h>
+
+/**
+ * Hashes an edge key
+ *
+ *  @return Hash of the key
+ */
+static Uint32 hashEdge(Uint64 key)
+{
+    return (Uint32)((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/**
+ * Collects the unique edges of a mesh. Vertices that were split for their
+ * normals or texture coordinates still share their edges, so vertices are
+ * welded by position first and every edge is kept once however many
+ * triangles use it
+ *
+ *  @param mesh Indexed mesh, before compressMesh
+ *
+ *  @return void
+ */
+void buildMeshEdges(Mesh* mesh)
+{
+    const int nVerts = mesh->nVerts, nCorners = mesh->nTris * 3;
+
+    // First vertex with the same position of every vertex
+    int capacity = 1;
+    while (capacity < nVerts * 2)
+        capacity <<= 1;
+    int *welded, *table;
+    ALLOCATE(welded, (nVerts + 1) * sizeof(int));
+    ALLOCATE(table, capacity * sizeof(int));
+    memset(table, 0xFF, capacity * sizeof(int));
+    for (int v = 0; v < nVerts; v++)
+    {
+        const Vector* p = &mesh->verts[v];
+        Uint32 slot = hashVector(p) & (capacity - 1);
+        while (table[slot] != -1 && memcmp(&mesh->verts[table[slot]], p, sizeof(Vector)) != 0)
+            slot = (slot + 1) & (capacity - 1);
+        if (table[slot] == -1)
+            table[slot] = v;
+        welded[v] = table[slot];
+    }
+    free(table);
+
+    // Edges keyed by their two welded vertices, the smallest first
+    capacity = 1;
+    while (capacity < nCorners * 2)
+        capacity <<= 1;
+    Uint64* keys;
+    ALLOCATE(keys, capacity * sizeof(Uint64));
+    memset(keys, 0xFF, capacity * sizeof(Uint64));
+    ALLOCATE(mesh->edges, (nCorners * 2 + 1) * sizeof(int));
+    mesh->nEdges = 0;
+    for (int i = 0; i < nCorners; i++)
+    {
+        const int a = welded[mesh->indices[i]];
+        const int b = welded[mesh->indices[i - i % 3 + (i + 1) % 3]];
+        if (a == b)
+            continue;
+        const Uint64 key = (Uint64)SDL_min(a, b) << 32 | (Uint32)SDL_max(a, b);
+        Uint32 slot = hashEdge(key) & (capacity - 1);
+        while (keys[slot] != ~0ull && keys[slot] != key)
+            slot = (slot + 1) & (capacity - 1);
+        if (keys[slot] == key)
+            continue;
+        keys[slot] = key;
+        mesh->edges[mesh->nEdges * 2 + 0] = SDL_min(a, b);
+        mesh->edges[mesh->nEdges * 2 + 1] = SDL_max(a, b);
+        mesh->nEdges++;
+    }
+    free(keys);
+    free(welded);
+
+    int* shrunk = realloc(mesh->edges, (mesh->nEdges * 2 + 1) * sizeof(int));
+    if (shrunk != NULL)
+        mesh->edges = shrunk;
+}
+
+/**
+ * Draws the unique edges of a mesh as lines, depth tested against what is
+ * already in the framebuffer
+ *
+ *  @param mesh Mesh to draw
+ *  @param world Transformation from model to view space
+ *  @param proj_mat Projection matrix
+ *  @param fb Framebuffer to draw into
+ *  @param clip Only pixels inside this rectangle are touched
+ *
+ *  @return void
+ */
+void drawMeshEdges(const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj_mat, Framebuffer* fb,
+                   const SDL_Rect* clip)
+{
+    // Every vertex is transformed and projected once, however many edges share it
+    Vector* view;
+    RasterVertex* screen;
+    ALLOCATE(view, (mesh->nVerts + 1) * sizeof(Vector));
+    ALLOCATE(screen, (mesh->nVerts + 1) * sizeof(RasterVertex));
+    for (int v = 0; v < mesh->nVerts; v++)
+    {
+        const Vector p = getMeshVertex(mesh, v);
+        multMatVec(&p, &view[v], world);
+        if (view[v].z < Z_NEAR)
+            continue;
+        screen[v] = (RasterVertex){.x = view[v].x, .y = view[v].y, .w = view[v].z};
+        projectVertex(&screen[v], proj_mat, fb);
+    }
+
+    for (int e = 0; e < mesh->nEdges; e++)
+    {
+        int a = mesh->edges[e * 2], b = mesh->edges[e * 2 + 1];
+        if (view[a].z < Z_NEAR && view[b].z < Z_NEAR)
+            continue;
+        if (view[a].z >= Z_NEAR && view[b].z >= Z_NEAR)
+        {
+            drawLine(&screen[a], &screen[b], WIREFRAME_COLOR, fb, clip);
+            continue;
+        }
+
+        // Cut the part behind the near plane
+        if (view[a].z < Z_NEAR)
+        {
+            const int swap = a;
+            a = b;
+            b = swap;
+        }
+        const float t = (Z_NEAR - view[a].z) / (view[b].z - view[a].z);
+        RasterVertex cut = {
+            .x = view[a].x + (view[b].x - view[a].x) * t,
+            .y = view[a].y + (view[b].y - view[a].y) * t,
+            .w = Z_NEAR
+        };
+        projectVertex(&cut, proj_mat, fb);
+        drawLine(&screen[a], &cut, WIREFRAME_COLOR, fb, clip);
+    }
+    free(view);
+    free(screen);
+}
@@ -0,0 +1,18 @@
+//
+// Wireframe view drawn from the unique edges of every mesh
+//
+
+#ifndef WIREFRAME_H
+#define WIREFRAME_H
+
+#include "engine.h"
+
+// Color of the wireframe lines
+#define WIREFRAME_COLOR 0xFFFFFFFF
+
+/*Function prototypes*/
+void buildMeshEdges(Mesh* mesh);
+void drawMeshEdges(const Mesh* mesh, const Matrix4x4* world, const Matrix4x4* proj_mat, Framebuffer* fb,
+                   const SDL_Rect* clip);
+
+#endif //WIREFRAME_H